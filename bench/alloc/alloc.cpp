@@ -0,0 +1,752 @@
+#include "bench/alloc/machine.h"
+#include "bench/alloc/traces.h"
+#include "bench/bench.h"
+#include "sys/kheap.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Runs the kernel's own BuddyAllocator and KHeap on a simulated machine (see
+// machine.h), both to time them on allocation traces and to fuzz them
+// against a model of what they should hand out.
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+namespace {
+using namespace Bench;
+
+// Mirrors kheap.cpp: each chunk has a 32-byte header and is a multiple of 32
+// bytes, and chunks from PMM_THRESHOLD up come straight from the PMM.
+const size_t CHUNK_HEADER_SIZE = 32;
+const size_t PMM_THRESHOLD = 0x4000;
+const size_t PAGE_SIZE = 0x1000;
+
+const size_t MAX_TRACES = 64;
+const size_t MAX_REPETITIONS = 32;
+// How often replay samples the heap's fragmentation, in calls.
+const size_t FRAGMENTATION_INTERVAL = 1024;
+
+uint64_t NowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t NowCycles()
+{
+    return __builtin_ia32_rdtsc();
+}
+
+size_t ChunkSize(size_t size)
+{
+    return (size + CHUNK_HEADER_SIZE + 31) / 32 * 32;
+}
+
+/**
+ * @return The size of the PMM block that an allocation of size bytes takes.
+ */
+size_t BlockSize(size_t size)
+{
+    size_t block = PAGE_SIZE;
+    while(block < size) {
+        block *= 2;
+    }
+    return block;
+}
+
+bool InHeap(uintptr_t addr)
+{
+    return addr >= Machine::HeapBase() &&
+           addr < Machine::HeapBase() + KHeap::GetStats().heap_size_;
+}
+
+int CompareU64(const void *lhs, const void *rhs)
+{
+    uint64_t l = *(const uint64_t*) lhs, r = *(const uint64_t*) rhs;
+    return (l > r) - (l < r);
+}
+
+// --- Replay ---------------------------------------------------------------
+
+const Machine::Config REPLAY_MACHINE = {
+    .phys_size_ = 256 << 20,
+    .num_ranges_ = 2,
+    .layout_seed_ = 0,
+    // As the kernel boots.
+    .heap_initial_size_ = 1024,
+    .heap_max_size_ = 64 << 20,
+};
+
+struct ReplayResult {
+    // Time spent in the allocators only.
+    uint64_t elapsed_ns_;
+    uint64_t elapsed_cycles_;
+    uint64_t latency_p50_ns_, latency_p99_ns_, latency_max_ns_;
+    // Memory taken from the PMM, by the heap and by large allocations.
+    size_t footprint_peak_;
+    // Bytes requested and not yet freed.
+    size_t live_peak_;
+    // Mean over samples of the share of the heap's free memory not in its
+    // largest free chunk.
+    double fragmentation_;
+    size_t failed_ops_;
+};
+
+/**
+ * Replay a trace on a freshly booted machine, timing each call.
+ * @return Whether the heap was consistent afterwards.
+ */
+bool Replay(const Trace &trace, ReplayResult &result)
+{
+    if(! Machine::Boot(REPLAY_MACHINE)) {
+        fprintf(stderr, "alloc: unable to boot\n");
+        return false;
+    }
+
+    auto *slots = (void**) calloc(trace.num_slots_, sizeof(void*));
+    auto *sizes = (uint64_t*) calloc(trace.num_slots_, sizeof(uint64_t));
+    auto *latencies = (uint64_t*) malloc(trace.num_ops_ * sizeof(uint64_t));
+    result = {};
+    size_t live = 0, num_samples = 0;
+    double fragmentation_sum = 0;
+
+    uint64_t start_ns = NowNs(), start_cycles = NowCycles();
+    for(size_t i = 0; i < trace.num_ops_; ++i) {
+        const TraceOp &op = trace.ops_[i];
+        void *&slot = slots[op.slot_];
+
+        uint64_t before = NowCycles();
+        switch(op.kind_) {
+        case TraceOp::ALLOCATE:
+            slot = KHeap::Allocate(op.size_);
+            break;
+        case TraceOp::REALLOCATE: {
+            void *allocation = KHeap::Reallocate(slot, op.size_);
+            slot = allocation ? allocation : slot;
+            break;
+        }
+        case TraceOp::FREE:
+            KHeap::Free(slot);
+            slot = nullptr;
+            break;
+        }
+        latencies[i] = NowCycles() - before;
+        result.elapsed_cycles_ += latencies[i];
+
+        // A failed call leaves the slot as it was, so that later calls on it
+        // are still valid.
+        if(op.kind_ != TraceOp::FREE && ! slot) {
+            ++result.failed_ops_;
+        } else if(op.kind_ == TraceOp::FREE || slot) {
+            live = live - sizes[op.slot_] +
+                   (op.kind_ == TraceOp::FREE ? 0 : op.size_);
+            sizes[op.slot_] = op.kind_ == TraceOp::FREE ? 0 : op.size_;
+        }
+
+        size_t footprint = BuddyAllocator::MemInUse();
+        result.footprint_peak_ = footprint > result.footprint_peak_ ?
+                                 footprint : result.footprint_peak_;
+        result.live_peak_ = live > result.live_peak_ ? live : result.live_peak_;
+        if(i % FRAGMENTATION_INTERVAL == FRAGMENTATION_INTERVAL - 1) {
+            KHeap::Stats stats = KHeap::GetStats();
+            fragmentation_sum += 1.0 - (double) stats.largest_free_ /
+                                       stats.free_;
+            ++num_samples;
+        }
+    }
+
+    // Convert cycles to time by the rate over the whole replay, rather than
+    // reading the clock around every call.
+    double ns_per_cycle = (double) (NowNs() - start_ns) /
+                          (NowCycles() - start_cycles);
+    result.elapsed_ns_ = result.elapsed_cycles_ * ns_per_cycle;
+    qsort(latencies, trace.num_ops_, sizeof(uint64_t), CompareU64);
+    if(trace.num_ops_) {
+        result.latency_p50_ns_ = latencies[trace.num_ops_ / 2] * ns_per_cycle;
+        result.latency_p99_ns_ = latencies[trace.num_ops_ * 99 / 100] *
+                                 ns_per_cycle;
+        result.latency_max_ns_ = latencies[trace.num_ops_ - 1] * ns_per_cycle;
+    }
+    result.fragmentation_ = num_samples ? fragmentation_sum / num_samples : 0;
+
+    for(uint32_t i = 0; i < trace.num_slots_; ++i) {
+        KHeap::Free(slots[i]);
+    }
+    free(slots);
+    free(sizes);
+    free(latencies);
+    return KHeap::Verify() && BuddyAllocator::Verify();
+}
+
+/**
+ * Replay each trace a number of times, and write out the run with the median
+ * time in the same form as the main benchmarks, so that compare.py can diff
+ * runs of either.
+ */
+int RunReplays(const char **trace_names, size_t num_traces, FILE *out,
+               size_t repetitions)
+{
+    time_t now = time(nullptr);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(out, "{\n  \"context\": {\"commit\": \"%s\", \"date\": \"%s\", "
+            "\"repetitions\": %zu},\n  \"benchmarks\": [",
+            BENCH_COMMIT, date, repetitions);
+
+    for(size_t t = 0; t < num_traces; ++t) {
+        Trace trace;
+        if(! MakeSyntheticTrace(trace_names[t], trace) &&
+           ! LoadTrace(trace_names[t], trace))
+        {
+            fprintf(stderr, "alloc: no trace named %s\n", trace_names[t]);
+            return 1;
+        }
+
+        ReplayResult results[MAX_REPETITIONS];
+        for(size_t rep = 0; rep < repetitions; ++rep) {
+            if(! Replay(trace, results[rep])) {
+                fprintf(stderr, "alloc: heap inconsistent after %s\n",
+                        trace.name_);
+                return 1;
+            }
+        }
+
+        // Insertion sort by time; there are only a few.
+        for(size_t i = 1; i < repetitions; ++i) {
+            for(size_t j = i; j > 0 && results[j].elapsed_ns_ <
+                                       results[j - 1].elapsed_ns_; --j)
+            {
+                ReplayResult tmp = results[j];
+                results[j] = results[j - 1];
+                results[j - 1] = tmp;
+            }
+        }
+        const ReplayResult &med = results[repetitions / 2];
+        size_t ops = trace.num_ops_ ? trace.num_ops_ : 1;
+        double ns_per_op = (double) med.elapsed_ns_ / ops;
+
+        fprintf(out, "%s\n    {\"name\": \"kheap/replay/%s\", \"arg\": 0, "
+                "\"iterations\": %zu, \"ns_per_iter\": %.3f, "
+                "\"ns_per_iter_min\": %.3f, \"cycles_per_iter\": %.1f, "
+                "\"items_per_sec\": %.0f, \"latency_p50_ns\": %llu, "
+                "\"latency_p99_ns\": %llu, \"latency_max_ns\": %llu, "
+                "\"footprint_peak_bytes\": %zu, \"live_peak_bytes\": %zu, "
+                "\"fragmentation\": %.4f, \"failed_ops\": %zu}",
+                t ? "," : "", trace.name_, trace.num_ops_, ns_per_op,
+                (double) results[0].elapsed_ns_ / ops,
+                (double) med.elapsed_cycles_ / ops, 1e9 / ns_per_op,
+                (unsigned long long) med.latency_p50_ns_,
+                (unsigned long long) med.latency_p99_ns_,
+                (unsigned long long) med.latency_max_ns_, med.footprint_peak_,
+                med.live_peak_, med.fragmentation_, med.failed_ops_);
+        fflush(out);
+
+        fprintf(stderr, "%-24s %9zu ops %10.0f ops/s  p99 %6llu ns  "
+                "peak %6zu KiB for %6zu KiB live  frag %.3f\n", trace.name_,
+                trace.num_ops_, 1e9 / ns_per_op,
+                (unsigned long long) med.latency_p99_ns_,
+                med.footprint_peak_ >> 10, med.live_peak_ >> 10,
+                med.fragmentation_);
+        FreeTrace(trace);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    return 0;
+}
+
+// --- Fuzzing --------------------------------------------------------------
+
+const size_t MAX_LIVE = 4096;
+// Limits on what's live at once, well within the machine, so that every
+// allocation should succeed and a failure is a bug.
+const size_t HEAP_BUDGET = 1 << 20;
+const size_t LARGE_BUDGET = 4 << 20;
+const size_t PAGE_BUDGET = 4 << 20;
+
+/**
+ * What the fuzzer expects of one allocation.
+ */
+struct Block {
+    uintptr_t addr_;
+    // Bytes requested.
+    size_t size_;
+    // Seeds the bytes written to the allocation.
+    uint64_t pattern_;
+    // For allocations from the PMM, the size of their block; 0 for those
+    // within the heap.
+    size_t pmm_bytes_;
+    // Was this allocated from BuddyAllocator directly, rather than KHeap?
+    bool pages_;
+};
+
+struct Interval {
+    uintptr_t base_, bound_;
+};
+
+struct FuzzState {
+    uint64_t seed_;
+    size_t op_;
+    Block blocks_[MAX_LIVE];
+    size_t num_blocks_;
+    // Live allocations, sorted by address, to catch any overlap.
+    Interval intervals_[MAX_LIVE];
+    size_t num_intervals_;
+    size_t heap_bytes_, large_bytes_, page_bytes_;
+};
+
+[[noreturn]] void Fail(const FuzzState &state, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "fuzz: seed %llu, op %zu: ",
+            (unsigned long long) state.seed_, state.op_);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+/**
+ * Call fn(offset) for each byte of an allocation that the fuzzer writes:
+ * all of a small one, and for a large one its ends and the start of each
+ * page, so that large allocations stay cheap to check.
+ */
+template <typename fn_t>
+void ForEachTestedByte(size_t size, fn_t fn)
+{
+    if(size <= PAGE_SIZE) {
+        for(size_t i = 0; i < size; ++i) {
+            fn(i);
+        }
+        return;
+    }
+    for(size_t i = 0; i < 256; ++i) {
+        fn(i);
+        fn(size - 256 + i);
+    }
+    for(size_t page = PAGE_SIZE; page < size - 256; page += PAGE_SIZE) {
+        for(size_t i = 0; i < 64 && page + i < size - 256; ++i) {
+            fn(page + i);
+        }
+    }
+}
+
+uint8_t PatternByte(uint64_t pattern, size_t offset)
+{
+    return (uint8_t) ((pattern >> (offset % 8 * 8)) + offset / 8);
+}
+
+void Fill(const Block &block)
+{
+    auto *bytes = (uint8_t*) block.addr_;
+    ForEachTestedByte(block.size_, [&](size_t i) {
+        bytes[i] = PatternByte(block.pattern_, i);
+    });
+}
+
+/**
+ * Check the bytes last written to a block, up to limit, e.g. what a
+ * reallocation should have preserved.
+ */
+void Check(const FuzzState &state, const Block &block, uintptr_t addr,
+           size_t limit)
+{
+    auto *bytes = (const uint8_t*) addr;
+    ForEachTestedByte(block.size_, [&](size_t i) {
+        if(i < limit && bytes[i] != PatternByte(block.pattern_, i)) {
+            Fail(state, "byte %zu of the %zu-byte allocation at 0x%lx was "
+                 "overwritten", i, block.size_, block.addr_);
+        }
+    });
+}
+
+size_t FindInterval(const FuzzState &state, uintptr_t base)
+{
+    size_t lo = 0, hi = state.num_intervals_;
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(state.intervals_[mid].base_ < base) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void AddInterval(FuzzState &state, uintptr_t base, size_t size)
+{
+    size_t ind = FindInterval(state, base);
+    if((ind < state.num_intervals_ &&
+        state.intervals_[ind].base_ < base + size) ||
+       (ind > 0 && state.intervals_[ind - 1].bound_ > base))
+    {
+        Fail(state, "0x%lx-0x%lx overlaps a live allocation", base,
+             base + size);
+    }
+    for(size_t i = state.num_intervals_; i > ind; --i) {
+        state.intervals_[i] = state.intervals_[i - 1];
+    }
+    state.intervals_[ind] = {base, base + size};
+    ++state.num_intervals_;
+}
+
+void RemoveInterval(FuzzState &state, uintptr_t base)
+{
+    size_t ind = FindInterval(state, base);
+    for(size_t i = ind; i + 1 < state.num_intervals_; ++i) {
+        state.intervals_[i] = state.intervals_[i + 1];
+    }
+    --state.num_intervals_;
+}
+
+void Account(FuzzState &state, const Block &block, int sign)
+{
+    size_t &budget = block.pages_ ? state.page_bytes_ :
+                     block.pmm_bytes_ ? state.large_bytes_ : state.heap_bytes_;
+    budget += sign * (block.pmm_bytes_ ? block.pmm_bytes_ : block.size_);
+}
+
+/**
+ * Check a new or moved allocation against the model, then write to it.
+ */
+void Track(FuzzState &state, Block &block)
+{
+    if(block.addr_ % 16) {
+        Fail(state, "0x%lx is misaligned", block.addr_);
+    }
+
+    bool from_pmm = block.pages_ || ChunkSize(block.size_) >= PMM_THRESHOLD;
+    if(! block.pages_ && from_pmm == InHeap(block.addr_)) {
+        // Shrinking a large allocation keeps it where it is.
+        if(! block.pmm_bytes_ || InHeap(block.addr_)) {
+            Fail(state, "the %zu-byte allocation at 0x%lx is %s the heap",
+                 block.size_, block.addr_, from_pmm ? "in" : "outside");
+        }
+    }
+    if(block.pages_) {
+        block.pmm_bytes_ = BlockSize(block.size_);
+    } else if(! InHeap(block.addr_)) {
+        size_t needed = BlockSize(ChunkSize(block.size_));
+        block.pmm_bytes_ = block.pmm_bytes_ >= needed ? block.pmm_bytes_
+                                                      : needed;
+    } else {
+        block.pmm_bytes_ = 0;
+    }
+
+    AddInterval(state, block.addr_, block.size_);
+    Account(state, block, 1);
+    Fill(block);
+}
+
+void Untrack(FuzzState &state, const Block &block)
+{
+    RemoveInterval(state, block.addr_);
+    Account(state, block, -1);
+}
+
+/**
+ * Check the allocators' own invariants, and that their accounting matches
+ * the model's.
+ */
+void CheckInvariants(const FuzzState &state)
+{
+    if(! KHeap::Verify()) {
+        Fail(state, "KHeap::Verify failed");
+    }
+    if(! BuddyAllocator::Verify()) {
+        Fail(state, "BuddyAllocator::Verify failed");
+    }
+
+    KHeap::Stats stats = KHeap::GetStats();
+    size_t expected_pmm = BlockSize(stats.heap_size_);
+    size_t min_in_use = 0, num_in_heap = 0;
+    for(size_t i = 0; i < state.num_blocks_; ++i) {
+        const Block &block = state.blocks_[i];
+        Check(state, block, block.addr_, block.size_);
+        expected_pmm += block.pmm_bytes_;
+        if(! block.pmm_bytes_) {
+            min_in_use += ChunkSize(block.size_);
+            ++num_in_heap;
+        }
+    }
+
+    if(BuddyAllocator::MemInUse() != expected_pmm) {
+        Fail(state, "the PMM has %zu bytes in use, expected %zu",
+             BuddyAllocator::MemInUse(), expected_pmm);
+    }
+    // Chunks may keep up to 32 bytes of slack rather than split it off.
+    if(stats.in_use_ < min_in_use ||
+       stats.in_use_ > min_in_use + 32 * num_in_heap)
+    {
+        Fail(state, "the heap has %zu bytes in use, expected %zu-%zu",
+             stats.in_use_, min_in_use, min_in_use + 32 * num_in_heap);
+    }
+}
+
+size_t RandomSize(Rng &rng, size_t lo, size_t hi)
+{
+    unsigned lo_log = 63 - __builtin_clzll(lo);
+    unsigned hi_log = 63 - __builtin_clzll(hi);
+    size_t base = (size_t) 1 << (lo_log + rng.Below(hi_log - lo_log + 1));
+    size_t size = base + rng.Below(base);
+    return size < lo ? lo : size > hi ? hi : size;
+}
+
+size_t RandomHeapSize(Rng &rng)
+{
+    uint64_t kind = rng.Below(100);
+    return kind < 75 ? RandomSize(rng, 1, 1024) :
+           kind < 95 ? RandomSize(rng, 1024, PMM_THRESHOLD) :
+                       RandomSize(rng, PMM_THRESHOLD, 512 << 10);
+}
+
+void FuzzAllocate(FuzzState &state, Rng &rng)
+{
+    Block block = {0, RandomHeapSize(rng), rng.Next(), 0, false};
+    bool large = ChunkSize(block.size_) >= PMM_THRESHOLD;
+    if((large && state.large_bytes_ + BlockSize(block.size_) > LARGE_BUDGET) ||
+       (! large && state.heap_bytes_ + block.size_ > HEAP_BUDGET))
+    {
+        return;
+    }
+
+    block.addr_ = (uintptr_t) KHeap::Allocate(block.size_);
+    if(! block.addr_) {
+        Fail(state, "allocating %zu bytes failed", block.size_);
+    }
+    Track(state, block);
+    state.blocks_[state.num_blocks_++] = block;
+}
+
+void FuzzAllocatePages(FuzzState &state, Rng &rng)
+{
+    Block block = {0, RandomSize(rng, PAGE_SIZE, 64 << 10), rng.Next(), 0,
+                   true};
+    if(state.page_bytes_ + BlockSize(block.size_) > PAGE_BUDGET) {
+        return;
+    }
+
+    block.addr_ = (uintptr_t) BuddyAllocator::Allocate(block.size_);
+    if(! block.addr_) {
+        Fail(state, "allocating %zu bytes of pages failed", block.size_);
+    }
+    Track(state, block);
+    state.blocks_[state.num_blocks_++] = block;
+}
+
+void FuzzReallocate(FuzzState &state, Block &block, Rng &rng)
+{
+    size_t size = rng.Below(2) ? RandomHeapSize(rng)
+                               : 1 + rng.Below(block.size_);
+    bool large = ChunkSize(size) >= PMM_THRESHOLD;
+    if((large && state.large_bytes_ + BlockSize(size) > LARGE_BUDGET) ||
+       (! large && state.heap_bytes_ + size > HEAP_BUDGET))
+    {
+        return;
+    }
+
+    void *allocation = KHeap::Reallocate((void*) block.addr_, size);
+    if(! allocation) {
+        Fail(state, "reallocating %zu bytes to %zu failed", block.size_, size);
+    }
+    Check(state, block, (uintptr_t) allocation,
+          size < block.size_ ? size : block.size_);
+
+    Untrack(state, block);
+    block.addr_ = (uintptr_t) allocation;
+    block.size_ = size;
+    block.pattern_ = rng.Next();
+    Track(state, block);
+}
+
+void FuzzFree(FuzzState &state, size_t ind)
+{
+    Block &block = state.blocks_[ind];
+    Check(state, block, block.addr_, block.size_);
+    Untrack(state, block);
+    if(block.pages_) {
+        BuddyAllocator::Free((void*) block.addr_);
+    } else {
+        KHeap::Free((void*) block.addr_);
+    }
+    block = state.blocks_[--state.num_blocks_];
+}
+
+/**
+ * Boot a machine laid out by the seed, run random calls against it, then
+ * free everything and check that the heap and PMM are back to how they
+ * started.
+ */
+void FuzzSeed(FuzzState &state, uint64_t seed, size_t num_ops,
+              size_t check_every)
+{
+    static const size_t INITIAL_SIZES[] = {1024, 4096, 65536};
+    Rng rng(seed);
+    Machine::Config config = {
+        .phys_size_ = 128 << 20,
+        .num_ranges_ = 1 + rng.Below(6),
+        .layout_seed_ = seed,
+        .heap_initial_size_ = INITIAL_SIZES[rng.Below(3)],
+        .heap_max_size_ = 4 << 20,
+    };
+
+    state = {};
+    state.seed_ = seed;
+    if(! Machine::Boot(config)) {
+        Fail(state, "unable to boot");
+    }
+
+    for(state.op_ = 0; state.op_ < num_ops; ++state.op_) {
+        uint64_t kind = rng.Below(100);
+        if(state.num_blocks_ == 0 ||
+           (kind < 45 && state.num_blocks_ < MAX_LIVE))
+        {
+            FuzzAllocate(state, rng);
+        } else if(kind < 50 && state.num_blocks_ < MAX_LIVE) {
+            FuzzAllocatePages(state, rng);
+        } else if(kind < 65) {
+            Block &block = state.blocks_[rng.Below(state.num_blocks_)];
+            if(! block.pages_) {
+                FuzzReallocate(state, block, rng);
+            }
+        } else {
+            FuzzFree(state, rng.Below(state.num_blocks_));
+        }
+
+        if(state.op_ % check_every == check_every - 1) {
+            CheckInvariants(state);
+        }
+    }
+
+    CheckInvariants(state);
+    while(state.num_blocks_) {
+        FuzzFree(state, rng.Below(state.num_blocks_));
+    }
+    CheckInvariants(state);
+
+    // With everything freed, the heap should have merged back into a single
+    // chunk.
+    KHeap::Stats stats = KHeap::GetStats();
+    if(stats.largest_free_ != stats.heap_size_) {
+        Fail(state, "the heap's largest free chunk is %zu of %zu bytes after "
+             "freeing everything", stats.largest_free_, stats.heap_size_);
+    }
+}
+
+int RunFuzzer(uint64_t first_seed, size_t num_seeds, size_t num_ops,
+              size_t check_every)
+{
+    static FuzzState state;
+    for(uint64_t seed = first_seed; seed < first_seed + num_seeds; ++seed) {
+        FuzzSeed(state, seed, num_ops, check_every);
+        fprintf(stderr, "fuzz: seed %llu passed %zu ops\n",
+                (unsigned long long) seed, num_ops);
+    }
+    return 0;
+}
+
+int Usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s replay [--trace name-or-file]... [--out file.json] "
+            "[--repetitions n]\n"
+            "       %s fuzz [--seed n] [--seeds n] [--ops n] "
+            "[--check-every n]\n"
+            "       %s dump trace-name\n"
+            "Synthetic traces:", argv0, argv0, argv0);
+    for(const char *const *name = SyntheticTraceNames(); *name; ++name) {
+        fprintf(stderr, " %s", *name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+}
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2) {
+        return Usage(argv[0]);
+    }
+
+    if(! strcmp(argv[1], "replay")) {
+        const char *traces[MAX_TRACES];
+        size_t num_traces = 0;
+        const char *out_path = nullptr;
+        size_t repetitions = 5;
+        for(int i = 2; i < argc; ++i) {
+            if(! strcmp(argv[i], "--trace") && i + 1 < argc &&
+               num_traces < MAX_TRACES)
+            {
+                traces[num_traces++] = argv[++i];
+            } else if(! strcmp(argv[i], "--out") && i + 1 < argc) {
+                out_path = argv[++i];
+            } else if(! strcmp(argv[i], "--repetitions") && i + 1 < argc) {
+                repetitions = strtoull(argv[++i], nullptr, 10);
+            } else {
+                return Usage(argv[0]);
+            }
+        }
+        if(repetitions < 1 || repetitions > MAX_REPETITIONS) {
+            fprintf(stderr, "alloc: repetitions must be from 1 to %zu\n",
+                    MAX_REPETITIONS);
+            return 1;
+        }
+        if(! num_traces) {
+            for(const char *const *name = SyntheticTraceNames(); *name;
+                ++name)
+            {
+                traces[num_traces++] = *name;
+            }
+        }
+
+        FILE *out = out_path ? fopen(out_path, "w") : stdout;
+        if(! out) {
+            perror(out_path);
+            return 1;
+        }
+        int status = RunReplays(traces, num_traces, out, repetitions);
+        if(out != stdout) {
+            fclose(out);
+        }
+        return status;
+    }
+
+    if(! strcmp(argv[1], "fuzz")) {
+        uint64_t seed = 1;
+        size_t num_seeds = 8, num_ops = 200000, check_every = 1000;
+        for(int i = 2; i < argc; ++i) {
+            if(i + 1 == argc) {
+                return Usage(argv[0]);
+            } else if(! strcmp(argv[i], "--seed")) {
+                seed = strtoull(argv[++i], nullptr, 10);
+            } else if(! strcmp(argv[i], "--seeds")) {
+                num_seeds = strtoull(argv[++i], nullptr, 10);
+            } else if(! strcmp(argv[i], "--ops")) {
+                num_ops = strtoull(argv[++i], nullptr, 10);
+            } else if(! strcmp(argv[i], "--check-every")) {
+                check_every = strtoull(argv[++i], nullptr, 10);
+            } else {
+                return Usage(argv[0]);
+            }
+        }
+        return RunFuzzer(seed, num_seeds, num_ops,
+                         check_every ? check_every : 1);
+    }
+
+    if(! strcmp(argv[1], "dump") && argc == 3) {
+        Trace trace;
+        if(! MakeSyntheticTrace(argv[2], trace)) {
+            return Usage(argv[0]);
+        }
+        DumpTrace(trace, stdout);
+        FreeTrace(trace);
+        return 0;
+    }
+
+    return Usage(argv[0]);
+}
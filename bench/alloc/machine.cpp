@@ -0,0 +1,259 @@
+#include "bench/alloc/machine.h"
+#include "bench/bench.h"
+#include "sys/kheap.h"
+#include "sys/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Bench {
+namespace Machine {
+namespace {
+const size_t PAGE_SIZE = 0x1000;
+// Reserved gaps between usable ranges are at most this many pages.
+const size_t MAX_GAP_PAGES = 16;
+const size_t MAX_RANGES = 16;
+
+// Physical memory persists across boots, and is only replaced when a larger
+// machine is booted.
+int phys_fd = -1;
+uintptr_t phys_base;
+size_t phys_size;
+
+// The window of address space set aside for the heap.
+uintptr_t heap_base;
+size_t heap_window_size;
+
+bool logging = true;
+
+size_t RoundUpToPage(size_t size)
+{
+    return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+bool InPhysMem(uintptr_t base, uintptr_t bound)
+{
+    return base >= phys_base && base <= bound && bound <= phys_base + phys_size;
+}
+
+bool InHeapWindow(uintptr_t base, uintptr_t bound)
+{
+    return base >= heap_base && base <= bound &&
+           bound <= heap_base + heap_window_size;
+}
+
+bool AllocatePhysMem(size_t size)
+{
+    if(phys_fd != -1) {
+        munmap((void*) phys_base, phys_size);
+        close(phys_fd);
+    }
+
+    phys_fd = memfd_create("phys_mem", 0);
+    if(phys_fd == -1 || ftruncate(phys_fd, size) == -1) {
+        perror("memfd_create");
+        return false;
+    }
+
+    // Populate up front, so that page faults on first touch aren't timed.
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, phys_fd, 0);
+    if(mem == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    phys_base = (uintptr_t) mem;
+    phys_size = size;
+    return true;
+}
+
+bool ReserveHeapWindow(size_t size)
+{
+    if(heap_base) {
+        munmap((void*) heap_base, heap_window_size);
+    }
+
+    void *window = mmap(nullptr, size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(window == MAP_FAILED) {
+        perror("mmap");
+        heap_base = 0;
+        return false;
+    }
+    heap_base = (uintptr_t) window;
+    heap_window_size = size;
+    return true;
+}
+
+/**
+ * Lay out a memory map over physical memory: usable ranges, each preceded by
+ * a reserved gap. With a seed, gaps and ranges vary in size, and a usable
+ * range too small to hold more than its own metadata comes first.
+ * @return The memory map, to be freed with free().
+ */
+stivale2_struct_tag_memmap *MakeMemoryMap(const Config &config)
+{
+    size_t num_ranges = config.num_ranges_ < 1 ? 1 :
+                        config.num_ranges_ > MAX_RANGES ? MAX_RANGES :
+                        config.num_ranges_;
+    size_t max_entries = 2 * num_ranges + 1;
+    auto *memmap = (stivale2_struct_tag_memmap*) calloc(
+            1, sizeof(stivale2_struct_tag_memmap) +
+               max_entries * sizeof(stivale2_mmap_entry));
+    memmap->tag.identifier = STIVALE2_STRUCT_TAG_MEMMAP_ID;
+
+    Rng rng(config.layout_seed_);
+    size_t num_pages = phys_size / PAGE_SIZE;
+    size_t gap_pages[MAX_RANGES], weights[MAX_RANGES];
+    size_t total_gap_pages = 0, total_weight = 0;
+    for(size_t i = 0; i < num_ranges; ++i) {
+        gap_pages[i] = config.layout_seed_ ? 1 + rng.Below(MAX_GAP_PAGES)
+                                           : MAX_GAP_PAGES;
+        weights[i] = config.layout_seed_ ? 1 + rng.Below(8) : 1;
+        total_gap_pages += gap_pages[i];
+        total_weight += weights[i];
+    }
+
+    uintptr_t addr = phys_base;
+    auto add_entry = [&](size_t pages, uint32_t type) {
+        memmap->memmap[memmap->entries++] = {addr, pages * PAGE_SIZE, type, 0};
+        addr += pages * PAGE_SIZE;
+    };
+
+    size_t tiny_pages = 0;
+    if(config.layout_seed_) {
+        tiny_pages = 1 + rng.Below(2);
+        add_entry(tiny_pages, STIVALE2_MMAP_USABLE);
+    }
+
+    size_t usable_pages = num_pages - total_gap_pages - tiny_pages;
+    size_t remaining_pages = usable_pages;
+    for(size_t i = 0; i < num_ranges; ++i) {
+        size_t pages = i + 1 == num_ranges ?
+                       remaining_pages : usable_pages * weights[i] / total_weight;
+        add_entry(gap_pages[i], STIVALE2_MMAP_RESERVED);
+        add_entry(pages, STIVALE2_MMAP_USABLE);
+        remaining_pages -= pages;
+    }
+    return memmap;
+}
+}
+
+bool Boot(const Config &config)
+{
+    size_t size = RoundUpToPage(config.phys_size_);
+    if(size > phys_size && ! AllocatePhysMem(size)) {
+        return false;
+    }
+    if(! ReserveHeapWindow(RoundUpToPage(config.heap_max_size_))) {
+        return false;
+    }
+
+    // The kernel's page map lives as long as the kernel; so does this one.
+    static PageMap page_map;
+    stivale2_struct_tag_memmap *memmap = MakeMemoryMap(config);
+    bool was_logging = logging;
+    SetLogging(false);
+    BuddyAllocator::InitBuddyAllocator(*memmap);
+    KHeap::Init(config.heap_initial_size_, &page_map, config.heap_max_size_,
+                heap_base);
+    SetLogging(was_logging);
+    free(memmap);
+
+    // Once up, the heap is the only thing allocated.
+    return BuddyAllocator::MemInUse() > 0;
+}
+
+uintptr_t HeapBase()
+{
+    return heap_base;
+}
+
+void SetLogging(bool enabled)
+{
+    logging = enabled;
+}
+}
+}
+
+using namespace Bench::Machine;
+
+// The direct map is the identity: physical memory is mapped at its own
+// addresses.
+uint64_t ToHighMem(uint64_t paddr)
+{
+    return paddr;
+}
+
+void *ToHighMem(void *mem)
+{
+    return mem;
+}
+
+uint64_t FromHighMem(uint64_t vaddr)
+{
+    return vaddr;
+}
+
+void *FromHighMem(void *mem)
+{
+    return mem;
+}
+
+// KHeap only ever maps and unmaps the heap, so these map physical memory into
+// the heap's window, and refuse anything else rather than map over the host
+// process.
+PageMap::PageMap()
+    : root_(nullptr)
+    , vmem_direct_mapping_base_(0)
+{}
+
+PageMap::~PageMap()
+{}
+
+bool PageMap::MapRange(const AddrRange &phys_range, size_t virt_offset,
+                       uint16_t)
+{
+    uintptr_t vaddr = phys_range.base_ + virt_offset;
+    size_t size = phys_range.bound_ - phys_range.base_;
+    if(! InPhysMem(phys_range.base_, phys_range.bound_) ||
+       ! InHeapWindow(vaddr, vaddr + size))
+    {
+        fprintf(stderr, "machine: can't map 0x%lx-0x%lx to 0x%lx\n",
+                phys_range.base_, phys_range.bound_, vaddr);
+        abort();
+    }
+
+    void *mem = mmap((void*) vaddr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED | MAP_POPULATE, phys_fd,
+                     phys_range.base_ - phys_base);
+    return mem != MAP_FAILED;
+}
+
+bool PageMap::UnmapRange(const AddrRange &vaddr_range)
+{
+    if(! InHeapWindow(vaddr_range.base_, vaddr_range.bound_)) {
+        fprintf(stderr, "machine: can't unmap 0x%lx-0x%lx\n",
+                vaddr_range.base_, vaddr_range.bound_);
+        abort();
+    }
+
+    // Leave the window reserved, but inaccessible.
+    void *mem = mmap((void*) vaddr_range.base_,
+                     vaddr_range.bound_ - vaddr_range.base_, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                     -1, 0);
+    return mem != MAP_FAILED;
+}
+
+void PageMap::Load()
+{}
+
+// Log writes to the serial port; send it to stderr instead.
+void outportb(uint16_t port, uint8_t val)
+{
+    if(port == COM1_PORT && logging) {
+        fputc(val, stderr);
+    }
+}
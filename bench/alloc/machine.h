@@ -0,0 +1,52 @@
+#ifndef BENCH_ALLOC_MACHINE_H
+#define BENCH_ALLOC_MACHINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Bench {
+
+// The hardware under BuddyAllocator and KHeap, simulated within a host
+// process so that the real allocators can run unmodified. Physical memory is
+// a shared memory file, mapped at its own "physical" addresses, so that the
+// direct map is the identity. The heap is mapped from the same file into a
+// separate window of address space by a stand-in for PageMap, so that, as in
+// the kernel, writes through either mapping are seen by the other. Like the
+// allocators it hosts, there's only one machine.
+namespace Machine
+{
+struct Config {
+    // Bytes of physical memory, a multiple of the page size.
+    size_t phys_size_;
+    // Number of usable ranges to carve physical memory into. Reserved gaps
+    // separate them, as in a real memory map.
+    size_t num_ranges_;
+    // Seeds the layout of the memory map; with 0, usable ranges are of equal
+    // size.
+    uint64_t layout_seed_;
+    size_t heap_initial_size_;
+    size_t heap_max_size_;
+};
+
+/**
+ * (Re)initialize BuddyAllocator and KHeap from scratch over a fresh memory
+ * map. Memory isn't cleared between boots, any more than it would be on
+ * real hardware.
+ * @return Whether both allocators came up.
+ */
+bool Boot(const Config &config);
+
+/**
+ * @return The virtual address at which KHeap maps the heap.
+ */
+uintptr_t HeapBase();
+
+/**
+ * Silence the kernel's log, e.g. while booting, which logs every usable
+ * range. Warnings and verification failures are logged otherwise.
+ */
+void SetLogging(bool enabled);
+}
+}
+
+#endif
@@ -0,0 +1,462 @@
+#include "bench/alloc/traces.h"
+#include "bench/bench.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace Bench {
+namespace {
+/**
+ * Appends calls to a trace, handing out slots and keeping track of which are
+ * live so that generators can pick one to free.
+ */
+class TraceBuilder
+{
+public:
+    TraceBuilder(Trace &trace, const char *name)
+        : trace_(trace)
+        , live_(nullptr)
+        , live_pos_(nullptr)
+        , free_slots_(nullptr)
+        , num_live_(0)
+        , num_free_slots_(0)
+        , slot_capacity_(0)
+    {
+        trace_ = {name, nullptr, 0, 0, 0};
+    }
+
+    ~TraceBuilder()
+    {
+        free(live_);
+        free(live_pos_);
+        free(free_slots_);
+    }
+
+    TraceBuilder(const TraceBuilder&) = delete;
+    TraceBuilder &operator=(const TraceBuilder&) = delete;
+
+    uint32_t Allocate(uint64_t size)
+    {
+        uint32_t slot;
+        if(num_free_slots_) {
+            slot = free_slots_[--num_free_slots_];
+        } else {
+            slot = trace_.num_slots_++;
+            if(slot == slot_capacity_) {
+                GrowSlots();
+            }
+        }
+
+        live_pos_[slot] = num_live_;
+        live_[num_live_++] = slot;
+        Push({TraceOp::ALLOCATE, slot, size});
+        return slot;
+    }
+
+    void Reallocate(uint32_t slot, uint64_t size)
+    {
+        Push({TraceOp::REALLOCATE, slot, size});
+    }
+
+    void Free(uint32_t slot)
+    {
+        uint32_t last = live_[--num_live_];
+        live_[live_pos_[slot]] = last;
+        live_pos_[last] = live_pos_[slot];
+        free_slots_[num_free_slots_++] = slot;
+        Push({TraceOp::FREE, slot, 0});
+    }
+
+    uint32_t NumLive() const
+    {
+        return num_live_;
+    }
+
+    uint32_t RandomLive(Rng &rng) const
+    {
+        return live_[rng.Below(num_live_)];
+    }
+
+private:
+    Trace &trace_;
+    uint32_t *live_;
+    uint32_t *live_pos_;
+    uint32_t *free_slots_;
+    uint32_t num_live_;
+    uint32_t num_free_slots_;
+    uint32_t slot_capacity_;
+
+    void GrowSlots()
+    {
+        slot_capacity_ = slot_capacity_ ? 2 * slot_capacity_ : 1024;
+        size_t bytes = slot_capacity_ * sizeof(uint32_t);
+        live_ = (uint32_t*) realloc(live_, bytes);
+        live_pos_ = (uint32_t*) realloc(live_pos_, bytes);
+        free_slots_ = (uint32_t*) realloc(free_slots_, bytes);
+    }
+
+    void Push(const TraceOp &op)
+    {
+        if(trace_.num_ops_ == trace_.capacity_) {
+            trace_.capacity_ = trace_.capacity_ ? 2 * trace_.capacity_ : 4096;
+            trace_.ops_ = (TraceOp*) realloc(trace_.ops_,
+                                             trace_.capacity_ * sizeof(TraceOp));
+        }
+        trace_.ops_[trace_.num_ops_++] = op;
+    }
+};
+
+/**
+ * @return A size in [lo, hi], with each power of two equally likely to be
+ *         the leading one, as allocation sizes tend to be.
+ */
+uint64_t LogUniform(Rng &rng, uint64_t lo, uint64_t hi)
+{
+    unsigned lo_log = 63 - __builtin_clzll(lo);
+    unsigned hi_log = 63 - __builtin_clzll(hi);
+    uint64_t base = 1ULL << (lo_log + rng.Below(hi_log - lo_log + 1));
+    uint64_t size = base + rng.Below(base);
+    return size < lo ? lo : size > hi ? hi : size;
+}
+
+/**
+ * Allocate with probability 1 - live / max_live, and otherwise free a random
+ * allocation, so that the number live hovers around max_live / 2.
+ * @return Whether to allocate.
+ */
+bool ChurnAllocates(Rng &rng, const TraceBuilder &builder, uint32_t max_live)
+{
+    return rng.Below(max_live) >= builder.NumLive();
+}
+
+// Many small, short-lived objects, as from the ds containers' nodes and
+// strings.
+void SmallChurn(TraceBuilder &builder, Rng &rng)
+{
+    for(size_t i = 0; i < (1 << 20); ++i) {
+        if(ChurnAllocates(rng, builder, 8192)) {
+            builder.Allocate(LogUniform(rng, 16, 512));
+        } else {
+            builder.Free(builder.RandomLive(rng));
+        }
+    }
+}
+
+// Mostly small objects, with some buffers, and a few large enough to go
+// straight to the PMM.
+void SizeMix(TraceBuilder &builder, Rng &rng)
+{
+    for(size_t i = 0; i < (1 << 19); ++i) {
+        if(ChurnAllocates(rng, builder, 2048)) {
+            uint64_t kind = rng.Below(100);
+            builder.Allocate(kind < 70 ? LogUniform(rng, 16, 1024) :
+                             kind < 95 ? LogUniform(rng, 1024, 16384) :
+                                         LogUniform(rng, 16384, 262144));
+        } else {
+            builder.Free(builder.RandomLive(rng));
+        }
+    }
+}
+
+// Bursts of allocation, most of which is soon freed, leaving survivors
+// scattered through the heap, as when a directory is walked and a few of its
+// entries are kept.
+void Bursty(TraceBuilder &builder, Rng &rng)
+{
+    for(size_t phase = 0; phase < 48; ++phase) {
+        for(size_t i = 0; i < 8192; ++i) {
+            builder.Allocate(LogUniform(rng, 32, 2048));
+        }
+
+        uint32_t survivors = builder.NumLive() / 8 < 16384 ?
+                             builder.NumLive() / 8 : 16384;
+        while(builder.NumLive() > survivors) {
+            builder.Free(builder.RandomLive(rng));
+        }
+    }
+}
+
+bool IsArray(const uint32_t *array_slots, size_t num_arrays, uint32_t slot)
+{
+    for(size_t i = 0; i < num_arrays; ++i) {
+        if(array_slots[i] == slot) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Arrays growing by half again at a time, as a DynArray or String does,
+// among small churn.
+void ReallocGrowth(TraceBuilder &builder, Rng &rng)
+{
+    const size_t NUM_ARRAYS = 64;
+    const uint64_t MAX_ARRAY_SIZE = 65536;
+    uint32_t array_slots[NUM_ARRAYS];
+    uint64_t array_sizes[NUM_ARRAYS];
+    for(size_t i = 0; i < NUM_ARRAYS; ++i) {
+        array_sizes[i] = 16;
+        array_slots[i] = builder.Allocate(array_sizes[i]);
+    }
+
+    for(size_t i = 0; i < (1 << 19); ++i) {
+        if(rng.Below(2)) {
+            size_t ind = rng.Below(NUM_ARRAYS);
+            if(array_sizes[ind] >= MAX_ARRAY_SIZE) {
+                builder.Free(array_slots[ind]);
+                array_sizes[ind] = 16;
+                array_slots[ind] = builder.Allocate(array_sizes[ind]);
+            } else {
+                array_sizes[ind] += array_sizes[ind] / 2;
+                builder.Reallocate(array_slots[ind], array_sizes[ind]);
+            }
+            continue;
+        }
+
+        if(ChurnAllocates(rng, builder, NUM_ARRAYS + 4096) ||
+           builder.NumLive() == NUM_ARRAYS)
+        {
+            builder.Allocate(LogUniform(rng, 16, 256));
+            continue;
+        }
+
+        // Leave the arrays alone when picking something to free.
+        uint32_t slot = builder.RandomLive(rng);
+        while(IsArray(array_slots, NUM_ARRAYS, slot)) {
+            slot = builder.RandomLive(rng);
+        }
+        builder.Free(slot);
+    }
+}
+
+// Buffers freed in the order they were allocated, as by a queue of I/O
+// requests.
+void Fifo(TraceBuilder &builder, Rng &rng)
+{
+    const size_t QUEUE_LEN = 4096;
+    uint32_t queue[QUEUE_LEN];
+    for(size_t i = 0; i < (1 << 19); ++i) {
+        if(i >= QUEUE_LEN) {
+            builder.Free(queue[i % QUEUE_LEN]);
+        }
+        queue[i % QUEUE_LEN] = builder.Allocate(LogUniform(rng, 512, 8192));
+    }
+}
+
+struct SyntheticTrace {
+    const char *name_;
+    void (*generate_)(TraceBuilder&, Rng&);
+};
+
+const SyntheticTrace SYNTHETIC_TRACES[] = {
+    {"small_churn", SmallChurn},
+    {"size_mix", SizeMix},
+    {"bursty", Bursty},
+    {"realloc_growth", ReallocGrowth},
+    {"fifo", Fifo},
+};
+const size_t NUM_SYNTHETIC_TRACES = sizeof(SYNTHETIC_TRACES) /
+                                    sizeof(SYNTHETIC_TRACES[0]);
+
+/**
+ * A map from the addresses in a recorded trace to slots, by linear probing.
+ * Address 0 marks an empty entry; KHeap never hands it out.
+ */
+class AddrMap
+{
+public:
+    AddrMap()
+        : entries_((Entry*) calloc(1024, sizeof(Entry)))
+        , capacity_(1024)
+        , size_(0)
+    {}
+
+    ~AddrMap()
+    {
+        free(entries_);
+    }
+
+    AddrMap(const AddrMap&) = delete;
+    AddrMap &operator=(const AddrMap&) = delete;
+
+    void Insert(uint64_t addr, uint32_t slot)
+    {
+        if(2 * (size_ + 1) > capacity_) {
+            Grow();
+        }
+        size_t ind = Find(addr);
+        size_ += entries_[ind].addr_ != addr;
+        entries_[ind] = {addr, slot};
+    }
+
+    /**
+     * Remove an address, putting its slot in slot.
+     * @return Whether the address was present.
+     */
+    bool Remove(uint64_t addr, uint32_t &slot)
+    {
+        size_t ind = Find(addr);
+        if(entries_[ind].addr_ != addr) {
+            return false;
+        }
+        slot = entries_[ind].slot_;
+        --size_;
+
+        // Shift back any entry that probed past the one removed.
+        size_t hole = ind;
+        for(size_t next = (ind + 1) & (capacity_ - 1); entries_[next].addr_;
+            next = (next + 1) & (capacity_ - 1))
+        {
+            size_t home = Home(entries_[next].addr_);
+            if(((next - home) & (capacity_ - 1)) >=
+               ((next - hole) & (capacity_ - 1)))
+            {
+                entries_[hole] = entries_[next];
+                hole = next;
+            }
+        }
+        entries_[hole].addr_ = 0;
+        return true;
+    }
+
+private:
+    struct Entry {
+        uint64_t addr_;
+        uint32_t slot_;
+    };
+
+    Entry *entries_;
+    size_t capacity_;
+    size_t size_;
+
+    size_t Home(uint64_t addr) const
+    {
+        return (addr * 0x9E3779B97F4A7C15ULL >> 32) & (capacity_ - 1);
+    }
+
+    size_t Find(uint64_t addr) const
+    {
+        size_t ind = Home(addr);
+        while(entries_[ind].addr_ && entries_[ind].addr_ != addr) {
+            ind = (ind + 1) & (capacity_ - 1);
+        }
+        return ind;
+    }
+
+    void Grow()
+    {
+        Entry *old = entries_;
+        size_t old_capacity = capacity_;
+        capacity_ *= 2;
+        entries_ = (Entry*) calloc(capacity_, sizeof(Entry));
+        for(size_t i = 0; i < old_capacity; ++i) {
+            if(old[i].addr_) {
+                entries_[Find(old[i].addr_)] = old[i];
+            }
+        }
+        free(old);
+    }
+};
+}
+
+const char *const *SyntheticTraceNames()
+{
+    static const char *names[NUM_SYNTHETIC_TRACES + 1];
+    for(size_t i = 0; i < NUM_SYNTHETIC_TRACES; ++i) {
+        names[i] = SYNTHETIC_TRACES[i].name_;
+    }
+    return names;
+}
+
+bool MakeSyntheticTrace(const char *name, Trace &trace)
+{
+    for(const SyntheticTrace &synthetic : SYNTHETIC_TRACES) {
+        if(! strcmp(synthetic.name_, name)) {
+            TraceBuilder builder(trace, synthetic.name_);
+            Rng rng;
+            synthetic.generate_(builder, rng);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LoadTrace(const char *path, Trace &trace)
+{
+    FILE *in = fopen(path, "r");
+    if(! in) {
+        return false;
+    }
+
+    const char *name = strrchr(path, '/');
+    TraceBuilder builder(trace, name ? name + 1 : path);
+    AddrMap slots;
+    char line[256];
+    while(fgets(line, sizeof(line), in)) {
+        const char *call = strstr(line, "[KHEAP] ");
+        if(! call) {
+            continue;
+        }
+
+        unsigned long long addr, new_addr, size;
+        uint32_t slot;
+        call += strlen("[KHEAP] ");
+        switch(*call) {
+        case 'a':
+            if(sscanf(call + 1, "%llx %llu", &addr, &size) == 2 && addr) {
+                slots.Insert(addr, builder.Allocate(size));
+            }
+            break;
+        case 'r':
+            if(sscanf(call + 1, "%llx %llx %llu", &addr, &new_addr,
+                      &size) != 3 || ! new_addr)
+            {
+                break;
+            }
+            if(slots.Remove(addr, slot)) {
+                builder.Reallocate(slot, size);
+            } else {
+                slot = builder.Allocate(size);
+            }
+            slots.Insert(new_addr, slot);
+            break;
+        case 'f':
+            if(sscanf(call + 1, "%llx", &addr) == 1 &&
+               slots.Remove(addr, slot))
+            {
+                builder.Free(slot);
+            }
+            break;
+        }
+    }
+
+    fclose(in);
+    return true;
+}
+
+void DumpTrace(const Trace &trace, FILE *out)
+{
+    for(size_t i = 0; i < trace.num_ops_; ++i) {
+        const TraceOp &op = trace.ops_[i];
+        unsigned long long addr = (op.slot_ + 1ULL) * 0x1000;
+        switch(op.kind_) {
+        case TraceOp::ALLOCATE:
+            fprintf(out, "[KHEAP] a %llX %llu\n", addr,
+                    (unsigned long long) op.size_);
+            break;
+        case TraceOp::REALLOCATE:
+            fprintf(out, "[KHEAP] r %llX %llX %llu\n", addr, addr,
+                    (unsigned long long) op.size_);
+            break;
+        case TraceOp::FREE:
+            fprintf(out, "[KHEAP] f %llX\n", addr);
+            break;
+        }
+    }
+}
+
+void FreeTrace(Trace &trace)
+{
+    free(trace.ops_);
+    trace = {nullptr, nullptr, 0, 0, 0};
+}
+}
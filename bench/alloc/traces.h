@@ -0,0 +1,64 @@
+#ifndef BENCH_ALLOC_TRACES_H
+#define BENCH_ALLOC_TRACES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace Bench {
+
+/**
+ * One call to the heap. Allocations are named by slot rather than address,
+ * so that a trace replays the same whatever addresses the heap hands out. A
+ * slot is reused once its allocation has been freed.
+ */
+struct TraceOp {
+    enum kind_t : uint8_t {
+        ALLOCATE,
+        REALLOCATE,
+        FREE
+    };
+
+    kind_t kind_;
+    uint32_t slot_;
+    // Requested size in bytes, for ALLOCATE and REALLOCATE.
+    uint64_t size_;
+};
+
+struct Trace {
+    const char *name_;
+    TraceOp *ops_;
+    size_t num_ops_;
+    size_t capacity_;
+    uint32_t num_slots_;
+};
+
+/**
+ * @return The names of the synthetic traces, terminated by nullptr.
+ */
+const char *const *SyntheticTraceNames();
+
+/**
+ * Generate a synthetic trace, the same every time for a given name.
+ * @return Whether a trace of that name exists.
+ */
+bool MakeSyntheticTrace(const char *name, Trace &trace);
+
+/**
+ * Read a trace recorded by a kernel built with KHEAP_TRACE=1. Lines not
+ * logged by KHeap are skipped, so a whole serial log may be given. Calls on
+ * allocations made before recording began, and calls that failed, are
+ * dropped.
+ * @return Whether the file could be read.
+ */
+bool LoadTrace(const char *path, Trace &trace);
+
+/**
+ * Write a trace out in the format LoadTrace reads, with made-up addresses.
+ */
+void DumpTrace(const Trace &trace, FILE *out);
+
+void FreeTrace(Trace &trace);
+}
+
+#endif
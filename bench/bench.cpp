@@ -0,0 +1,289 @@
+#include "bench/bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+namespace Bench {
+namespace {
+const size_t MAX_CASES = 512;
+
+struct Case {
+    const char *name_;
+    case_fn_t fn_;
+    uint64_t arg_;
+    size_t iterations_;
+};
+
+Case cases[MAX_CASES];
+size_t num_cases;
+// The case being run, named by Check's failures.
+const Case *current_case;
+
+uint64_t NowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t NowCycles()
+{
+    return __builtin_ia32_rdtsc();
+}
+
+int CompareDoubles(const void *lhs, const void *rhs)
+{
+    double l = *(const double*) lhs, r = *(const double*) rhs;
+    return (l > r) - (l < r);
+}
+}
+
+State::State(uint64_t arg, size_t iterations)
+    : arg_(arg)
+    , iterations_(iterations)
+    , start_ns_(0)
+    , start_cycles_(0)
+    , elapsed_ns_(0)
+    , elapsed_cycles_(0)
+    , running_(false)
+    , bytes_per_iter_(0)
+    , items_per_iter_(0)
+    , num_counters_(0)
+{}
+
+void State::ResetTimer()
+{
+    elapsed_ns_ = elapsed_cycles_ = 0;
+    ResumeTimer();
+}
+
+void State::PauseTimer()
+{
+    if(running_) {
+        elapsed_cycles_ += NowCycles() - start_cycles_;
+        elapsed_ns_ += NowNs() - start_ns_;
+        running_ = false;
+    }
+}
+
+void State::ResumeTimer()
+{
+    running_ = true;
+    start_ns_ = NowNs();
+    start_cycles_ = NowCycles();
+}
+
+void State::SetCounter(const char *name, uint64_t numerator,
+                       uint64_t denominator)
+{
+    for(size_t i = 0; i < num_counters_; ++i) {
+        if(counters_[i].name_ == name) {
+            counters_[i] = {name, numerator, denominator};
+            return;
+        }
+    }
+    if(num_counters_ < MAX_COUNTERS) {
+        counters_[num_counters_++] = {name, numerator, denominator};
+    }
+}
+
+void Register(const char *name, case_fn_t fn, uint64_t arg, size_t iterations)
+{
+    if(num_cases == MAX_CASES) {
+        fprintf(stderr, "bench: too many cases, dropping %s\n", name);
+        return;
+    }
+    cases[num_cases++] = {name, fn, arg, iterations};
+}
+
+void Check(bool ok, const char *message)
+{
+    if(! ok) {
+        fprintf(stderr, "bench: %s (arg %llu) failed: %s\n",
+                current_case ? current_case->name_ : "setup",
+                current_case ? (unsigned long long) current_case->arg_ : 0ULL,
+                message);
+        exit(1);
+    }
+}
+
+/**
+ * Runs the registered cases and writes their results out as JSON.
+ */
+class Runner
+{
+public:
+    Runner(FILE *out, uint64_t min_time_ns, size_t repetitions)
+        : out_(out)
+        , min_time_ns_(min_time_ns)
+        , repetitions_(repetitions)
+        , num_results_(0)
+    {}
+
+    void Begin()
+    {
+        time_t now = time(nullptr);
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+        fprintf(out_, "{\n  \"context\": {\"commit\": \"%s\", \"date\": \"%s\", "
+                "\"repetitions\": %zu},\n  \"benchmarks\": [",
+                BENCH_COMMIT, date, repetitions_);
+    }
+
+    void End()
+    {
+        fprintf(out_, "\n  ]\n}\n");
+    }
+
+    void Run(const Case &c)
+    {
+        size_t iterations = c.iterations_ ? c.iterations_ : Calibrate(c);
+
+        double ns[MAX_REPETITIONS], cycles[MAX_REPETITIONS];
+        State state(c.arg_, iterations);
+        for(size_t rep = 0; rep < repetitions_; ++rep) {
+            state = State(c.arg_, iterations);
+            RunOnce(c, state);
+            ns[rep] = (double) state.elapsed_ns_ / iterations;
+            cycles[rep] = (double) state.elapsed_cycles_ / iterations;
+        }
+
+        double min_ns = ns[0];
+        for(size_t rep = 1; rep < repetitions_; ++rep) {
+            min_ns = ns[rep] < min_ns ? ns[rep] : min_ns;
+        }
+        qsort(ns, repetitions_, sizeof(double), CompareDoubles);
+        qsort(cycles, repetitions_, sizeof(double), CompareDoubles);
+        double med_ns = ns[repetitions_ / 2];
+        double med_cycles = cycles[repetitions_ / 2];
+
+        fprintf(out_, "%s\n    {\"name\": \"%s\", \"arg\": %llu, "
+                "\"iterations\": %zu, \"ns_per_iter\": %.3f, "
+                "\"ns_per_iter_min\": %.3f, \"cycles_per_iter\": %.1f",
+                num_results_++ ? "," : "", c.name_,
+                (unsigned long long) c.arg_, iterations, med_ns, min_ns,
+                med_cycles);
+        if(state.bytes_per_iter_) {
+            fprintf(out_, ", \"bytes_per_sec\": %.0f",
+                    state.bytes_per_iter_ * 1e9 / med_ns);
+        }
+        if(state.items_per_iter_) {
+            fprintf(out_, ", \"items_per_sec\": %.0f",
+                    state.items_per_iter_ * 1e9 / med_ns);
+        }
+        for(size_t i = 0; i < state.num_counters_; ++i) {
+            const State::Counter &counter = state.counters_[i];
+            fprintf(out_, ", \"%s\": %.6g", counter.name_,
+                    counter.denominator_ ?
+                        (double) counter.numerator_ / counter.denominator_ : 0.0);
+        }
+        fprintf(out_, "}");
+        fflush(out_);
+
+        fprintf(stderr, "%-48s %10llu %14.2f ns/iter", c.name_,
+                (unsigned long long) c.arg_, med_ns);
+        if(state.bytes_per_iter_) {
+            fprintf(stderr, " %10.2f GB/s", state.bytes_per_iter_ / med_ns);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    static constexpr size_t MAX_REPETITIONS = 32;
+
+private:
+    FILE *out_;
+    uint64_t min_time_ns_;
+    size_t repetitions_;
+    size_t num_results_;
+
+    static void RunOnce(const Case &c, State &state)
+    {
+        current_case = &c;
+        state.ResetTimer();
+        c.fn_(state);
+        state.PauseTimer();
+    }
+
+    /**
+     * Grow the iteration count until a run takes at least min_time_ns_.
+     */
+    size_t Calibrate(const Case &c)
+    {
+        size_t iterations = 1;
+        while(true) {
+            State state(c.arg_, iterations);
+            RunOnce(c, state);
+            if(state.elapsed_ns_ >= min_time_ns_) {
+                return iterations;
+            }
+
+            // Aim a little past the target, growing at most 10x per step in
+            // case the first runs were dominated by warm-up.
+            uint64_t elapsed = state.elapsed_ns_ ? state.elapsed_ns_ : 1;
+            double scale = 1.4 * min_time_ns_ / elapsed;
+            scale = scale < 2 ? 2 : scale > 10 ? 10 : scale;
+            iterations = (size_t) (iterations * scale);
+        }
+    }
+};
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = "";
+    const char *out_path = nullptr;
+    uint64_t min_time_ms = 50;
+    size_t repetitions = 5;
+
+    for(int i = 1; i < argc; ++i) {
+        if(! strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if(! strcmp(argv[i], "--out") && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if(! strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            min_time_ms = strtoull(argv[++i], nullptr, 10);
+        } else if(! strcmp(argv[i], "--repetitions") && i + 1 < argc) {
+            repetitions = strtoull(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--filter substring] [--out file.json] "
+                    "[--min-time-ms ms] [--repetitions n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(repetitions < 1 || repetitions > Bench::Runner::MAX_REPETITIONS) {
+        fprintf(stderr, "bench: repetitions must be from 1 to %zu\n",
+                Bench::Runner::MAX_REPETITIONS);
+        return 1;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if(! out) {
+        perror(out_path);
+        return 1;
+    }
+
+    Bench::RegisterLibcBenchmarks();
+    Bench::RegisterContainerBenchmarks();
+    Bench::RegisterCacheBenchmarks();
+    Bench::RegisterConcurrencyBenchmarks();
+    Bench::RegisterChecksumBenchmarks();
+
+    Bench::Runner runner(out, min_time_ms * 1000000, repetitions);
+    runner.Begin();
+    for(size_t i = 0; i < Bench::num_cases; ++i) {
+        if(strstr(Bench::cases[i].name_, filter)) {
+            runner.Run(Bench::cases[i]);
+        }
+    }
+    runner.End();
+
+    if(out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A small harness for timing kernel code on the host. Cases are compiled with
+ * the kernel's own CFLAGS against a malloc-backed KernelAllocator (see
+ * shim.cpp), so they measure the code the kernel would run, without booting
+ * it. Only the runner (bench.cpp) is built for the host, since it needs
+ * floating point to report results.
+ *
+ * Each case is a function run for a number of iterations the runner picks,
+ * growing it until a run takes long enough to time reliably, and then
+ * repeating the run to take the median.
+ */
+namespace Bench
+{
+/**
+ * Handed to each case to say how many iterations to run, and to collect what
+ * the case reports about them.
+ */
+class State
+{
+public:
+    State(uint64_t arg, size_t iterations);
+
+    /**
+     * @return The argument the case was registered with, e.g. a buffer size.
+     */
+    uint64_t Arg() const
+    {
+        return arg_;
+    }
+
+    /**
+     * @return How many times the case should run its timed loop body.
+     */
+    size_t Iterations() const
+    {
+        return iterations_;
+    }
+
+    /**
+     * Restart the clock from zero, leaving setup done so far out of the
+     * timing.
+     */
+    void ResetTimer();
+
+    /**
+     * Stop the clock, leaving work done from here on out of the timing, such
+     * as teardown or per-iteration setup.
+     */
+    void PauseTimer();
+
+    /**
+     * Start the clock again after PauseTimer, adding to the time so far.
+     */
+    void ResumeTimer();
+
+    /**
+     * @param bytes Bytes processed by each iteration, to report throughput.
+     */
+    void SetBytesPerIteration(uint64_t bytes)
+    {
+        bytes_per_iter_ = bytes;
+    }
+
+    /**
+     * @param items Operations done by each iteration, to report ops/sec when
+     *              one iteration covers many, e.g. a whole trace replay.
+     */
+    void SetItemsPerIteration(uint64_t items)
+    {
+        items_per_iter_ = items;
+    }
+
+    /**
+     * Report an extra figure, such as a hit ratio, as numerator / denominator
+     * so that cases needn't use floating point.
+     * @param name A string literal.
+     */
+    void SetCounter(const char *name, uint64_t numerator,
+                    uint64_t denominator = 1);
+
+private:
+    friend class Runner;
+
+    static constexpr size_t MAX_COUNTERS = 8;
+
+    struct Counter {
+        const char *name_;
+        uint64_t numerator_, denominator_;
+    };
+
+    uint64_t arg_;
+    size_t iterations_;
+    uint64_t start_ns_, start_cycles_;
+    uint64_t elapsed_ns_, elapsed_cycles_;
+    bool running_;
+    uint64_t bytes_per_iter_, items_per_iter_;
+    Counter counters_[MAX_COUNTERS];
+    size_t num_counters_;
+};
+
+typedef void (*case_fn_t)(State &state);
+
+/**
+ * Add a case to the suite.
+ * @param name Of the form "component/operation[/variant]"; a string literal.
+ * @param fn The case.
+ * @param arg Handed to the case through State::Arg.
+ * @param iterations A fixed iteration count for cases whose single iteration
+ *                   is already long, such as a trace replay or a multithreaded
+ *                   run; 0 lets the runner pick.
+ */
+void Register(const char *name, case_fn_t fn, uint64_t arg = 0,
+              size_t iterations = 0);
+
+/**
+ * Stop the whole run if a case finds the code under test misbehaving, so that
+ * a wrong result is never reported as a timing.
+ * @param ok Whether the case's expectation holds.
+ * @param message What went wrong; a string literal.
+ */
+void Check(bool ok, const char *message);
+
+/**
+ * Register a case once per argument.
+ */
+template <size_t num_args>
+void Register(const char *name, case_fn_t fn, const uint64_t (&args)[num_args],
+              size_t iterations = 0)
+{
+    for(uint64_t arg : args) {
+        Register(name, fn, arg, iterations);
+    }
+}
+
+/**
+ * Keep the compiler from discarding a value that's computed only to be timed.
+ */
+template <typename T>
+inline void DoNotOptimize(const T &val)
+{
+    asm volatile("" : : "r,m"(val) : "memory");
+}
+
+/**
+ * Keep the compiler from discarding or reordering stores around this point.
+ */
+inline void ClobberMemory()
+{
+    asm volatile("" : : : "memory");
+}
+
+/**
+ * A fast, deterministic generator for keys and traces, so that runs replay
+ * the same inputs from one commit to the next.
+ */
+class Rng
+{
+public:
+    explicit Rng(uint64_t seed = 0x9E3779B97F4A7C15ULL)
+        : state_(seed)
+    {}
+
+    uint64_t Next()
+    {
+        // splitmix64
+        uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * @return A value in [0, bound).
+     */
+    uint64_t Below(uint64_t bound)
+    {
+        return (uint64_t) (((unsigned __int128) Next() * bound) >> 64);
+    }
+
+private:
+    uint64_t state_;
+};
+
+// Each suite's registration function, called by the runner in turn.
+void RegisterLibcBenchmarks();
+void RegisterContainerBenchmarks();
+void RegisterCacheBenchmarks();
+void RegisterConcurrencyBenchmarks();
+void RegisterChecksumBenchmarks();
+}
+
+#endif
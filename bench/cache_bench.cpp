@@ -0,0 +1,209 @@
+#include "bench/bench.h"
+#include "ds/cache.h"
+
+namespace {
+const uint64_t CAPACITIES[] = {256, 1024, 4096};
+const size_t TRACE_LEN = 1 << 18;
+
+/**
+ * Synthetic access patterns, in units of cache capacity so that each stresses
+ * the cache the same way at every size.
+ */
+enum trace_t {
+    // Self-similar 80/20 accesses over 16x the capacity: 80% go to the
+    // hottest fifth of the keys, 80% of those to the hottest fifth of that,
+    // and so on.
+    SKEWED,
+    // SKEWED, interrupted by long sequential runs of keys used only once, as
+    // when a large file is read through the block cache.
+    SCAN,
+    // A cycle over 1.25x the capacity, on which LRU always misses.
+    LOOP
+};
+
+uint64_t Skewed(Bench::Rng &rng, uint64_t num_keys)
+{
+    uint64_t hi = num_keys;
+    while(hi > 1) {
+        uint64_t split = hi / 5 ? hi / 5 : 1;
+        if(rng.Below(100) >= 80) {
+            return split + rng.Below(hi - split);
+        }
+        hi = split;
+    }
+    return 0;
+}
+
+/**
+ * @return TRACE_LEN keys, in an array to be freed with KernelAllocator::Free.
+ */
+uint64_t *MakeTrace(trace_t trace, size_t capacity)
+{
+    auto *keys = (uint64_t*) KernelAllocator::Allocate(TRACE_LEN *
+                                                       sizeof(uint64_t));
+    Bench::Rng rng;
+    uint64_t next_cold = 1ULL << 32;
+    for(size_t i = 0; i < TRACE_LEN; ++i) {
+        switch(trace) {
+        case SKEWED:
+            keys[i] = Skewed(rng, 16 * capacity);
+            break;
+        case SCAN:
+            // Every 8 capacities' worth of accesses, scan 2 capacities' worth
+            // of new keys.
+            if(i % (8 * capacity) < 2 * capacity) {
+                keys[i] = next_cold++;
+            } else {
+                keys[i] = Skewed(rng, 16 * capacity);
+            }
+            break;
+        case LOOP:
+            keys[i] = i % (capacity + capacity / 4);
+            break;
+        }
+    }
+    return keys;
+}
+
+/**
+ * Replay a trace through a FixedCache, inserting each key that misses, and
+ * report the hit ratio along with the time taken.
+ */
+template <template <typename, typename, typename> class policy_t, trace_t trace>
+void HitRatio(Bench::State &state)
+{
+    size_t capacity = state.Arg();
+    uint64_t *keys = MakeTrace(trace, capacity);
+    uint64_t hits = 0;
+
+    state.ResetTimer();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::FixedCache<uint64_t, uint64_t, policy_t> cache(capacity);
+        hits = 0;
+        for(size_t i = 0; i < TRACE_LEN; ++i) {
+            if(cache.Lookup(keys[i])) {
+                ++hits;
+            } else {
+                cache.Insert(keys[i], i);
+            }
+        }
+    }
+    state.PauseTimer();
+
+    state.SetItemsPerIteration(TRACE_LEN);
+    state.SetCounter("hit_ratio", hits, TRACE_LEN);
+    KernelAllocator::Free(keys);
+}
+
+/**
+ * Churn an LRUCache the way its owners do: look up, insert on a miss, and
+ * evict down to a budget, so that each access may allocate and free.
+ */
+void LRUCacheChurn(Bench::State &state)
+{
+    size_t capacity = state.Arg();
+    uint64_t *keys = MakeTrace(SKEWED, capacity);
+    ds::LRUCache<uint64_t, uint64_t> cache;
+    uint64_t hits = 0;
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        if(cache.Lookup(keys[k])) {
+            ++hits;
+        } else {
+            cache.Insert(keys[k], i);
+            if(cache.NumEntries() > capacity) {
+                cache.Evict(1);
+            }
+        }
+        k = k + 1 == TRACE_LEN ? 0 : k + 1;
+    }
+    state.PauseTimer();
+
+    state.SetCounter("hit_ratio", hits, state.Iterations());
+    KernelAllocator::Free(keys);
+}
+
+/**
+ * KernelAllocator, counting the allocations it has outstanding.
+ */
+struct CountingAllocator {
+    static inline size_t outstanding_ = 0;
+
+    static void *Allocate(size_t size)
+    {
+        ++outstanding_;
+        return KernelAllocator::Allocate(size);
+    }
+
+    static void Free(void *allocation)
+    {
+        --outstanding_;
+        KernelAllocator::Free(allocation);
+    }
+};
+
+/**
+ * Churn a TwoQCache over a loop slightly longer than its budget, so that keys
+ * keep cycling from probation to the ghost queue, into the main queue, and
+ * out again. Once warmed up, the cache's allocations must stay bounded; a
+ * ghost queue that outgrew its limit would add to them on every cycle.
+ */
+void TwoQCacheChurn(Bench::State &state)
+{
+    size_t capacity = state.Arg();
+    size_t num_keys = capacity + capacity / 4;
+    ds::TwoQCache<uint64_t, uint64_t, CountingAllocator> cache;
+    size_t before = CountingAllocator::outstanding_;
+    size_t warm = 0;
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        uint64_t key = i % num_keys;
+        if(! cache.Lookup(key)) {
+            cache.Insert(key, i);
+            if(cache.NumEntries() > capacity) {
+                cache.Evict(1);
+            }
+        }
+
+        // Allow the ghost queue and the indices room to double after warming
+        // up before calling it growth.
+        if(i == 16 * num_keys) {
+            warm = CountingAllocator::outstanding_ - before;
+        } else if(warm && i % num_keys == 0) {
+            Bench::Check(CountingAllocator::outstanding_ - before <= 2 * warm,
+                         "2Q cache allocations grow without bound");
+        }
+    }
+    state.PauseTimer();
+}
+}
+
+namespace Bench {
+void RegisterCacheBenchmarks()
+{
+    // A replay is long enough to time in one go.
+    Register("cache/hit_ratio/lru/skewed", HitRatio<ds::LRUPolicy, SKEWED>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/clock/skewed", HitRatio<ds::ClockPolicy, SKEWED>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/2q/skewed", HitRatio<ds::TwoQPolicy, SKEWED>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/lru/scan", HitRatio<ds::LRUPolicy, SCAN>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/clock/scan", HitRatio<ds::ClockPolicy, SCAN>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/2q/scan", HitRatio<ds::TwoQPolicy, SCAN>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/lru/loop", HitRatio<ds::LRUPolicy, LOOP>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/clock/loop", HitRatio<ds::ClockPolicy, LOOP>,
+             CAPACITIES, 1);
+    Register("cache/hit_ratio/2q/loop", HitRatio<ds::TwoQPolicy, LOOP>,
+             CAPACITIES, 1);
+
+    Register("lru_cache/churn", LRUCacheChurn, CAPACITIES);
+    Register("two_q_cache/churn", TwoQCacheChurn, CAPACITIES);
+}
+}
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compare two runs of the host benchmarks, e.g. from before and after a commit.
+
+usage: compare.py old.json new.json [--threshold percent]
+
+Prints each case found in both runs with its median time per iteration
+before and after, and the change. Changes smaller than the threshold are
+marked as noise. Extra figures reported by a case, such as hit ratios, are
+printed alongside when they differ.
+"""
+import argparse
+import json
+
+STANDARD_FIELDS = {"name", "arg", "iterations", "ns_per_iter",
+                   "ns_per_iter_min", "cycles_per_iter", "bytes_per_sec",
+                   "items_per_sec"}
+
+
+def load(path):
+    with open(path) as f:
+        run = json.load(f)
+    return run["context"], {(b["name"], b["arg"]): b for b in run["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="percent change below which to call it noise")
+    args = parser.parse_args()
+
+    old_context, old = load(args.old)
+    new_context, new = load(args.new)
+    print("old: %s (%s)" % (old_context["commit"], old_context["date"]))
+    print("new: %s (%s)" % (new_context["commit"], new_context["date"]))
+    print()
+    print("%-44s %10s %14s %14s %9s" % ("case", "arg", "old ns/iter",
+                                        "new ns/iter", "change"))
+
+    for key in sorted(old.keys() & new.keys()):
+        before, after = old[key], new[key]
+        change = 100.0 * (after["ns_per_iter"] / before["ns_per_iter"] - 1)
+        mark = "" if abs(change) >= args.threshold else " ~"
+        print("%-44s %10d %14.2f %14.2f %+8.1f%%%s" % (
+            key[0], key[1], before["ns_per_iter"], after["ns_per_iter"],
+            change, mark))
+
+        for field in sorted((before.keys() | after.keys()) - STANDARD_FIELDS):
+            if before.get(field) != after.get(field):
+                print("%-44s %10s %14s %14s" % ("  " + field, "",
+                                                before.get(field, "-"),
+                                                after.get(field, "-")))
+
+    for key in sorted(old.keys() - new.keys()):
+        print("only in old: %s %d" % key)
+    for key in sorted(new.keys() - old.keys()):
+        print("only in new: %s %d" % key)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,205 @@
+#include "bench/bench.h"
+#include "ds/concurrent_hash_map.h"
+#include "ds/ring_buffer.h"
+#include "sys/log.h"
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+const uint64_t BATCH_SIZES[] = {1, 32};
+const uint64_t THREAD_COUNTS[] = {1, 2, 4, 8};
+const size_t MAX_THREADS = 8;
+
+const size_t RING_CAPACITY = 1024;
+const uint64_t RING_ITEMS = 1 << 20;
+
+const uint64_t MAP_KEYS = 1 << 16;
+const size_t MAP_OPS_PER_THREAD = 1 << 17;
+
+/**
+ * Run fn(arg, i) on each of num_threads threads and wait for them all.
+ */
+template <typename arg_t>
+void RunThreads(size_t num_threads, void (*fn)(arg_t*, size_t), arg_t *arg)
+{
+    struct Start {
+        void (*fn_)(arg_t*, size_t);
+        arg_t *arg_;
+        size_t ind_;
+    };
+
+    pthread_t threads[MAX_THREADS];
+    Start starts[MAX_THREADS];
+    for(size_t i = 0; i < num_threads; ++i) {
+        starts[i] = {fn, arg, i};
+        pthread_create(&threads[i], nullptr, [](void *start_arg) -> void* {
+            auto *start = (Start*) start_arg;
+            start->fn_(start->arg_, start->ind_);
+            return nullptr;
+        }, &starts[i]);
+    }
+    for(size_t i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+}
+
+/**
+ * A ring shared by producer and consumer threads. Threads below
+ * num_producers_ produce; the rest consume.
+ */
+template <typename ring_t>
+struct RingRun {
+    ring_t ring_;
+    size_t num_producers_, num_consumers_;
+    size_t batch_;
+    uint64_t consumed_;
+    uint64_t sum_;
+
+    RingRun(size_t num_producers, size_t num_consumers, size_t batch)
+        : ring_(RING_CAPACITY)
+        , num_producers_(num_producers)
+        , num_consumers_(num_consumers)
+        , batch_(batch)
+        , consumed_(0)
+        , sum_(0)
+    {}
+};
+
+template <typename ring_t>
+void RingThread(RingRun<ring_t> *run, size_t ind)
+{
+    uint64_t items[64];
+    if(ind < run->num_producers_) {
+        // Each producer pushes its share of 1..RING_ITEMS, so that the
+        // consumers' sum shows whether anything was lost or duplicated.
+        uint64_t next = ind + 1;
+        while(next <= RING_ITEMS) {
+            size_t num = 0;
+            for(uint64_t item = next; num < run->batch_ && item <= RING_ITEMS;
+                item += run->num_producers_)
+            {
+                items[num++] = item;
+            }
+
+            size_t pushed = run->batch_ == 1 ? run->ring_.Push(items[0])
+                                             : run->ring_.PushBatch(items, num);
+            next += pushed * run->num_producers_;
+            if(! pushed) {
+                sched_yield();
+            }
+        }
+        return;
+    }
+
+    uint64_t sum = 0;
+    while(__atomic_load_n(&run->consumed_, __ATOMIC_RELAXED) < RING_ITEMS) {
+        size_t popped;
+        if(run->batch_ == 1) {
+            ds::Optional<uint64_t> item = run->ring_.Pop();
+            popped = item ? 1 : 0;
+            sum += item ? item.Value() : 0;
+        } else {
+            popped = run->ring_.PopBatch(items, run->batch_);
+            for(size_t i = 0; i < popped; ++i) {
+                sum += items[i];
+            }
+        }
+
+        if(popped) {
+            __atomic_add_fetch(&run->consumed_, popped, __ATOMIC_RELAXED);
+        } else {
+            sched_yield();
+        }
+    }
+    __atomic_add_fetch(&run->sum_, sum, __ATOMIC_RELAXED);
+}
+
+/**
+ * Pass RING_ITEMS integers through a ring. On a machine with fewer cores
+ * than threads this mostly times the yields, so compare runs from the same
+ * machine only.
+ */
+template <typename ring_t, size_t num_producers, size_t num_consumers>
+void RingThroughput(Bench::State &state)
+{
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        RingRun<ring_t> run(num_producers, num_consumers, state.Arg());
+        RunThreads(num_producers + num_consumers, RingThread<ring_t>, &run);
+        if(run.sum_ != RING_ITEMS * (RING_ITEMS + 1) / 2) {
+            Log("[ERROR] Ring benchmark: items were lost or duplicated.\n");
+        }
+    }
+    state.SetItemsPerIteration(RING_ITEMS);
+}
+
+template <size_t num_shards>
+struct MapRun {
+    ds::ConcurrentHashMap<uint64_t, uint64_t, KernelAllocator,
+                          ds::MurmurHasher, num_shards> map_;
+};
+
+/**
+ * Mostly lookups, with a few inserts and deletes keeping the map at about
+ * half of MAP_KEYS, as in the VFS's tables of open files and cached vnodes.
+ */
+template <size_t num_shards>
+void MapThread(MapRun<num_shards> *run, size_t ind)
+{
+    Bench::Rng rng(ind + 1);
+    uint64_t found = 0;
+    for(size_t i = 0; i < MAP_OPS_PER_THREAD; ++i) {
+        uint64_t key = rng.Below(MAP_KEYS);
+        uint64_t op = rng.Below(100);
+        if(op < 90) {
+            found += run->map_.Contains(key);
+        } else if(op < 95) {
+            run->map_.Insert(key, i);
+        } else {
+            run->map_.Delete(key);
+        }
+    }
+    Bench::DoNotOptimize(found);
+}
+
+/**
+ * Time a fixed number of operations per thread, so that with enough cores
+ * perfect scaling keeps the time per iteration constant as threads are added.
+ */
+template <size_t num_shards>
+void MapScaling(Bench::State &state)
+{
+    size_t num_threads = state.Arg();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        state.PauseTimer();
+        auto *run = new MapRun<num_shards>;
+        for(uint64_t key = 0; key < MAP_KEYS; key += 2) {
+            run->map_.Insert(key, key);
+        }
+        state.ResumeTimer();
+
+        RunThreads(num_threads, MapThread<num_shards>, run);
+
+        state.PauseTimer();
+        delete run;
+        state.ResumeTimer();
+    }
+    state.SetItemsPerIteration(num_threads * MAP_OPS_PER_THREAD);
+}
+}
+
+namespace Bench {
+void RegisterConcurrencyBenchmarks()
+{
+    Register("ring/throughput/spsc", RingThroughput<ds::SPSCRing<uint64_t>, 1, 1>,
+             BATCH_SIZES, 1);
+    Register("ring/throughput/mpsc", RingThroughput<ds::MPSCRing<uint64_t>, 2, 1>,
+             BATCH_SIZES, 1);
+    Register("ring/throughput/mpmc", RingThroughput<ds::MPMCRing<uint64_t>, 2, 2>,
+             BATCH_SIZES, 1);
+
+    Register("concurrent_hash_map/mixed/shards_1", MapScaling<1>,
+             THREAD_COUNTS, 1);
+    Register("concurrent_hash_map/mixed/shards_16", MapScaling<16>,
+             THREAD_COUNTS, 1);
+}
+}
@@ -0,0 +1,578 @@
+#include "bench/bench.h"
+#include "ds/btree_map.h"
+#include "ds/dyn_array.h"
+#include "ds/hash_map.h"
+#include "ds/intrusive_rb_tree.h"
+#include "ds/rb_tree.h"
+#include "ds/string.h"
+
+namespace {
+const uint64_t MAP_SIZES[] = {1024, 65536, 1048576};
+const uint64_t ARRAY_SIZES[] = {16, 1024, 65536};
+const uint64_t STRING_LENGTHS[] = {8, 23, 64, 256};
+
+/**
+ * Distinct keys in a random order, shared by the map cases below. Keys are
+ * spread over the whole 64-bit range so that ordered maps can't benefit from
+ * sequential insertion.
+ */
+class Keys
+{
+public:
+    explicit Keys(size_t num, uint64_t seed = 1)
+        : num_(num)
+        , keys_((uint64_t*) KernelAllocator::Allocate(num * sizeof(uint64_t)))
+    {
+        Bench::Rng rng(seed);
+        for(size_t i = 0; i < num; ++i) {
+            // An odd multiplier permutes the integers, so keys never repeat.
+            keys_[i] = (i + 1) * 0x9E3779B97F4A7C15ULL;
+        }
+        for(size_t i = num - 1; i > 0; --i) {
+            size_t j = rng.Below(i + 1);
+            uint64_t tmp = keys_[i];
+            keys_[i] = keys_[j];
+            keys_[j] = tmp;
+        }
+    }
+
+    ~Keys()
+    {
+        KernelAllocator::Free(keys_);
+    }
+
+    uint64_t operator[](size_t i) const
+    {
+        return keys_[i];
+    }
+
+    size_t Len() const
+    {
+        return num_;
+    }
+
+private:
+    size_t num_;
+    uint64_t *keys_;
+};
+
+/**
+ * A key guaranteed to be absent from any Keys, which are all multiples of an
+ * odd constant times a nonzero index below 2^63.
+ */
+uint64_t MissingKey(size_t i)
+{
+    return (i + (1ULL << 63)) * 0x9E3779B97F4A7C15ULL;
+}
+
+void HashMapInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    state.ResetTimer();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::HashMap<uint64_t, uint64_t> map;
+        for(size_t i = 0; i < keys.Len(); ++i) {
+            map.Insert(keys[i], i);
+        }
+        Bench::DoNotOptimize(map.Len());
+    }
+    state.SetItemsPerIteration(keys.Len());
+}
+
+void HashMapLookupHit(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::HashMap<uint64_t, uint64_t> map;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        map.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(map.LookupPtr(keys[k]));
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+}
+
+void HashMapLookupMiss(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::HashMap<uint64_t, uint64_t> map;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        map.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(map.LookupPtr(MissingKey(i)));
+    }
+    state.PauseTimer();
+}
+
+/**
+ * Delete a key and insert it back, at a steady size, to time deletion along
+ * with the tombstones it leaves for inserts to reuse.
+ */
+void HashMapDeleteInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::HashMap<uint64_t, uint64_t> map;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        map.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        map.Delete(keys[k]);
+        map.Insert(keys[k], i);
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+}
+
+/**
+ * Look up String keys by StringView, as the VFS does with paths.
+ */
+void HashMapLookupString(Bench::State &state)
+{
+    const size_t NUM_KEYS = 1024;
+    ds::DynArray<ds::String> names;
+    ds::HashMap<ds::String, uint64_t> map;
+    // Names as long as the argument, differing only in their last few
+    // characters, like the files of one directory.
+    char name[64];
+    size_t len = state.Arg() < sizeof(name) ? state.Arg() : sizeof(name) - 1;
+    for(size_t j = 0; j < len; ++j) {
+        name[j] = 'f';
+    }
+    name[len] = '\0';
+    for(size_t i = 0; i < NUM_KEYS; ++i) {
+        for(size_t j = 0; j < 4; ++j) {
+            name[len - 1 - j] = "0123456789abcdef"[(i >> (4 * j)) & 0xF];
+        }
+        names.Append(ds::String(name));
+        map.Insert(names[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        ds::StringView view(names[i % NUM_KEYS].ToChars());
+        Bench::DoNotOptimize(map.LookupPtr(view));
+    }
+    state.PauseTimer();
+}
+
+/**
+ * Append to an empty array, growing it by doubling.
+ */
+void DynArrayAppend(Bench::State &state)
+{
+    size_t num = state.Arg();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::DynArray<uint64_t> arr;
+        for(size_t i = 0; i < num; ++i) {
+            arr.Append(i);
+        }
+        Bench::DoNotOptimize(arr.Size());
+    }
+    state.SetItemsPerIteration(num);
+}
+
+void DynArrayAppendReserved(Bench::State &state)
+{
+    size_t num = state.Arg();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::DynArray<uint64_t> arr;
+        arr.Reserve(num);
+        for(size_t i = 0; i < num; ++i) {
+            arr.Append(i);
+        }
+        Bench::DoNotOptimize(arr.Size());
+    }
+    state.SetItemsPerIteration(num);
+}
+
+/**
+ * Append Strings, which are relocated rather than copied as the array grows.
+ */
+void DynArrayAppendString(Bench::State &state)
+{
+    size_t num = state.Arg();
+    ds::String str("a string too long to be kept inline");
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::DynArray<ds::String> arr;
+        for(size_t i = 0; i < num; ++i) {
+            arr.Append(str);
+        }
+        Bench::DoNotOptimize(arr.Size());
+    }
+    state.SetItemsPerIteration(num);
+}
+
+/**
+ * Fill a buffer with a string of the case's length.
+ */
+char *MakeChars(size_t len)
+{
+    auto *chars = (char*) KernelAllocator::Allocate(len + 1);
+    for(size_t i = 0; i < len; ++i) {
+        chars[i] = 'a' + i % 26;
+    }
+    chars[len] = '\0';
+    return chars;
+}
+
+void StringConstruct(Bench::State &state)
+{
+    char *chars = MakeChars(state.Arg());
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        ds::String str(chars);
+        Bench::DoNotOptimize(str);
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(chars);
+}
+
+void StringCopy(Bench::State &state)
+{
+    char *chars = MakeChars(state.Arg());
+    ds::String str(chars);
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        ds::String copy(str);
+        Bench::DoNotOptimize(copy);
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(chars);
+}
+
+void StringConcat(Bench::State &state)
+{
+    char *chars = MakeChars(state.Arg() / 2);
+    ds::String half(chars);
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        ds::String str = half + half;
+        Bench::DoNotOptimize(str);
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(chars);
+}
+
+void StringCompare(Bench::State &state)
+{
+    char *chars = MakeChars(state.Arg());
+    ds::String lhs(chars), rhs(chars);
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(lhs == rhs);
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(chars);
+}
+
+void StringViewFind(Bench::State &state)
+{
+    char *chars = MakeChars(state.Arg());
+    ds::StringView view(chars);
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(view.Find('/'));
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(chars);
+}
+
+// BTreeMap and RbTree are timed on the same keys, to show what the B-tree's
+// denser nodes buy.
+
+void BTreeInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    state.ResetTimer();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::BTreeMap<uint64_t, uint64_t> map;
+        for(size_t i = 0; i < keys.Len(); ++i) {
+            map.Insert(keys[i], i);
+        }
+        // Freeing the tree is part of the cost of having built it.
+    }
+    state.SetItemsPerIteration(keys.Len());
+}
+
+void RbTreeInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    state.ResetTimer();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        ds::RbTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < keys.Len(); ++i) {
+            tree.Insert(keys[i], i);
+        }
+    }
+    state.SetItemsPerIteration(keys.Len());
+}
+
+/**
+ * A free address range, ordered by start, that tracks the longest range in
+ * its subtree so that a fitting one can be found without a scan.
+ */
+struct FreeRange : ds::RbLink<>
+{
+    uint64_t start_;
+    uint64_t len_;
+    uint64_t max_len_;
+};
+
+struct FreeRangeTraits
+{
+    static uint64_t Key(const FreeRange &range)
+    {
+        return range.start_;
+    }
+
+    static void Update(FreeRange &range, FreeRange *left, FreeRange *right)
+    {
+        uint64_t max_len = range.len_;
+        if(left && left->max_len_ > max_len) {
+            max_len = left->max_len_;
+        }
+        if(right && right->max_len_ > max_len) {
+            max_len = right->max_len_;
+        }
+        range.max_len_ = max_len;
+    }
+};
+
+typedef ds::IntrusiveRbTree<FreeRange, FreeRangeTraits> range_tree_t;
+
+/**
+ * One FreeRange per key, with random lengths, unlinked.
+ */
+FreeRange *MakeRanges(const Keys &keys, Bench::Rng &rng)
+{
+    auto *ranges = (FreeRange*) KernelAllocator::Allocate(keys.Len() *
+                                                          sizeof(FreeRange));
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        ranges[i] = FreeRange {};
+        ranges[i].start_ = keys[i];
+        ranges[i].len_ = 1 + rng.Below(4096);
+    }
+    return ranges;
+}
+
+/**
+ * The lowest-addressed range at least len long, found by descending towards
+ * whichever subtree has room.
+ */
+FreeRange *FindFit(const range_tree_t &tree, uint64_t len)
+{
+    FreeRange *node = tree.Root();
+    if(! node || node->max_len_ < len) {
+        return nullptr;
+    }
+
+    while(true) {
+        FreeRange *left = range_tree_t::Child(*node, ds::LEFT);
+        if(left && left->max_len_ >= len) {
+            node = left;
+        } else if(node->len_ >= len) {
+            return node;
+        } else {
+            node = range_tree_t::Child(*node, ds::RIGHT);
+        }
+    }
+}
+
+void IntrusiveRbTreeInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    Bench::Rng rng;
+    FreeRange *ranges = MakeRanges(keys, rng);
+    state.ResetTimer();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        // Insertion relinks each node from scratch, so they can be reused.
+        range_tree_t tree;
+        for(size_t i = 0; i < keys.Len(); ++i) {
+            tree.Insert(ranges[i]);
+        }
+        Bench::DoNotOptimize(tree.Size());
+    }
+    state.PauseTimer();
+    state.SetItemsPerIteration(keys.Len());
+    KernelAllocator::Free(ranges);
+}
+
+void IntrusiveRbTreeDeleteInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    Bench::Rng rng;
+    FreeRange *ranges = MakeRanges(keys, rng);
+    range_tree_t tree;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        tree.Insert(ranges[i]);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        tree.Erase(ranges[k]);
+        tree.Insert(ranges[k]);
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(ranges);
+}
+
+/**
+ * Resize a random range in place, as allocating from it would, then find the
+ * first range that fits a random request.
+ */
+void IntrusiveRbTreeFindFit(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    Bench::Rng rng;
+    FreeRange *ranges = MakeRanges(keys, rng);
+    range_tree_t tree;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        tree.Insert(ranges[i]);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        FreeRange &range = ranges[rng.Below(keys.Len())];
+        range.len_ = 1 + rng.Below(4096);
+        tree.Update(range);
+        Bench::DoNotOptimize(FindFit(tree, 1 + rng.Below(4096)));
+    }
+    state.PauseTimer();
+    KernelAllocator::Free(ranges);
+}
+
+void BTreeLookup(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::BTreeMap<uint64_t, uint64_t> map;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        map.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(map.Find(keys[k]).Valid());
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+}
+
+void RbTreeLookup(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::RbTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        tree.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    uint64_t val;
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(tree.Read(keys[k], val));
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+}
+
+/**
+ * Walk every entry in key order, which the B-tree does along its linked
+ * leaves.
+ */
+void BTreeScan(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::BTreeMap<uint64_t, uint64_t> map;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        map.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t it = 0; it < state.Iterations(); ++it) {
+        uint64_t sum = 0;
+        for(auto itr = map.LowerBound(0); itr.Valid(); itr.Forward()) {
+            sum += itr.Val();
+        }
+        Bench::DoNotOptimize(sum);
+    }
+    state.PauseTimer();
+    state.SetItemsPerIteration(keys.Len());
+}
+
+void BTreeDeleteInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::BTreeMap<uint64_t, uint64_t> map;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        map.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        map.Delete(keys[k]);
+        map.Insert(keys[k], i);
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+}
+
+void RbTreeDeleteInsert(Bench::State &state)
+{
+    Keys keys(state.Arg());
+    ds::RbTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < keys.Len(); ++i) {
+        tree.Insert(keys[i], i);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0, k = 0; i < state.Iterations(); ++i) {
+        tree.Delete(keys[k]);
+        tree.Insert(keys[k], i);
+        k = k + 1 == keys.Len() ? 0 : k + 1;
+    }
+    state.PauseTimer();
+}
+}
+
+namespace Bench {
+void RegisterContainerBenchmarks()
+{
+    Register("hash_map/insert", HashMapInsert, MAP_SIZES);
+    Register("hash_map/lookup_hit", HashMapLookupHit, MAP_SIZES);
+    Register("hash_map/lookup_miss", HashMapLookupMiss, MAP_SIZES);
+    Register("hash_map/delete_insert", HashMapDeleteInsert, MAP_SIZES);
+    Register("hash_map/lookup_string", HashMapLookupString, {8, 31});
+
+    Register("dyn_array/append", DynArrayAppend, ARRAY_SIZES);
+    Register("dyn_array/append_reserved", DynArrayAppendReserved, ARRAY_SIZES);
+    Register("dyn_array/append_string", DynArrayAppendString, ARRAY_SIZES);
+
+    Register("string/construct", StringConstruct, STRING_LENGTHS);
+    Register("string/copy", StringCopy, STRING_LENGTHS);
+    Register("string/concat", StringConcat, STRING_LENGTHS);
+    Register("string/compare", StringCompare, STRING_LENGTHS);
+    Register("string_view/find", StringViewFind, STRING_LENGTHS);
+
+    Register("ordered_map/insert/btree", BTreeInsert, MAP_SIZES);
+    Register("ordered_map/insert/rb_tree", RbTreeInsert, MAP_SIZES);
+    Register("ordered_map/lookup/btree", BTreeLookup, MAP_SIZES);
+    Register("ordered_map/lookup/rb_tree", RbTreeLookup, MAP_SIZES);
+    Register("ordered_map/delete_insert/btree", BTreeDeleteInsert, MAP_SIZES);
+    Register("ordered_map/delete_insert/rb_tree", RbTreeDeleteInsert,
+             MAP_SIZES);
+    Register("ordered_map/scan/btree", BTreeScan, MAP_SIZES);
+
+    Register("intrusive_rb_tree/insert", IntrusiveRbTreeInsert, MAP_SIZES);
+    Register("intrusive_rb_tree/delete_insert", IntrusiveRbTreeDeleteInsert,
+             MAP_SIZES);
+    Register("intrusive_rb_tree/find_fit", IntrusiveRbTreeFindFit, MAP_SIZES);
+}
+}
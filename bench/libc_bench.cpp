@@ -0,0 +1,148 @@
+#include "bench/bench.h"
+#include "libc/string.h"
+
+// The kernel's libc/string.cpp, with its symbols renamed by the Makefile so
+// that it links alongside the host's libc. The unprefixed functions are the
+// host's, timed alongside as a reference point.
+extern "C" {
+void *kernel_memcpy(void *dest, const void *src, size_t bytes);
+void *kernel_memmove(void *dest, const void *src, size_t bytes);
+void *kernel_memset(void *dest, int val, size_t bytes);
+int kernel_memcmp(const void *lhs, const void *rhs, size_t bytes);
+void *kernel_memchr(const void *str, int val, size_t bytes);
+size_t kernel_strlen(const char *str);
+int kernel_strcmp(const char *lhs, const char *rhs);
+}
+
+namespace {
+const uint64_t SIZES[] = {8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384,
+                          65536};
+// Room for the largest size, plus slack to misalign within.
+const size_t BUF_SIZE = 65536 + 64;
+
+typedef void *(*copy_fn_t)(void*, const void*, size_t);
+typedef void *(*set_fn_t)(void*, int, size_t);
+typedef int (*cmp_fn_t)(const void*, const void*, size_t);
+typedef void *(*chr_fn_t)(const void*, int, size_t);
+typedef size_t (*len_fn_t)(const char*);
+
+// Buffers are static rather than per case, so that every case sees the same
+// alignment and each has been touched before timing starts.
+alignas(64) unsigned char src_buf[BUF_SIZE];
+alignas(64) unsigned char dest_buf[BUF_SIZE];
+
+template <copy_fn_t copy, size_t dest_offset, size_t src_offset>
+void Copy(Bench::State &state)
+{
+    size_t size = state.Arg();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        copy(dest_buf + dest_offset, src_buf + src_offset, size);
+        Bench::ClobberMemory();
+    }
+    state.SetBytesPerIteration(size);
+}
+
+/**
+ * Move a buffer up by a few bytes within itself, the overlapping case that
+ * has to copy backwards.
+ */
+template <copy_fn_t move>
+void MoveOverlapping(Bench::State &state)
+{
+    size_t size = state.Arg();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        move(dest_buf + 8, dest_buf, size);
+        Bench::ClobberMemory();
+    }
+    state.SetBytesPerIteration(size);
+}
+
+template <set_fn_t set>
+void Set(Bench::State &state)
+{
+    size_t size = state.Arg();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        set(dest_buf, (int) i, size);
+        Bench::ClobberMemory();
+    }
+    state.SetBytesPerIteration(size);
+}
+
+/**
+ * Compare equal buffers, so the whole length is always scanned.
+ */
+template <cmp_fn_t cmp>
+void Compare(Bench::State &state)
+{
+    size_t size = state.Arg();
+    for(size_t i = 0; i < BUF_SIZE; ++i) {
+        src_buf[i] = dest_buf[i] = (unsigned char) (i * 7);
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(cmp(dest_buf, src_buf, size));
+    }
+    state.SetBytesPerIteration(size);
+}
+
+/**
+ * Search for a byte that's absent, so the whole length is always scanned.
+ */
+template <chr_fn_t chr>
+void Search(Bench::State &state)
+{
+    size_t size = state.Arg();
+    for(size_t i = 0; i < BUF_SIZE; ++i) {
+        src_buf[i] = 'a' + i % 26;
+    }
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(chr(src_buf, '!', size));
+    }
+    state.SetBytesPerIteration(size);
+}
+
+template <len_fn_t len>
+void Length(Bench::State &state)
+{
+    size_t size = state.Arg();
+    for(size_t i = 0; i < BUF_SIZE; ++i) {
+        src_buf[i] = 'a' + i % 26;
+    }
+    src_buf[size] = '\0';
+
+    state.ResetTimer();
+    for(size_t i = 0; i < state.Iterations(); ++i) {
+        Bench::DoNotOptimize(len((const char*) src_buf));
+    }
+    state.SetBytesPerIteration(size);
+}
+
+void *HostMemchr(const void *str, int val, size_t bytes)
+{
+    return (void*) __builtin_memchr(str, val, bytes);
+}
+}
+
+namespace Bench {
+void RegisterLibcBenchmarks()
+{
+    Register("libc/memcpy/kernel", Copy<kernel_memcpy, 0, 0>, SIZES);
+    Register("libc/memcpy/host", Copy<memcpy, 0, 0>, SIZES);
+    Register("libc/memcpy_unaligned/kernel", Copy<kernel_memcpy, 1, 3>, SIZES);
+    Register("libc/memcpy_unaligned/host", Copy<memcpy, 1, 3>, SIZES);
+    Register("libc/memmove_overlapping/kernel", MoveOverlapping<kernel_memmove>,
+             SIZES);
+    Register("libc/memmove_overlapping/host", MoveOverlapping<memmove>, SIZES);
+    Register("libc/memset/kernel", Set<kernel_memset>, SIZES);
+    Register("libc/memset/host", Set<memset>, SIZES);
+    Register("libc/memcmp/kernel", Compare<kernel_memcmp>, SIZES);
+    Register("libc/memcmp/host", Compare<memcmp>, SIZES);
+    Register("libc/memchr/kernel", Search<kernel_memchr>, SIZES);
+    Register("libc/memchr/host", Search<HostMemchr>, SIZES);
+    Register("libc/strlen/kernel", Length<kernel_strlen>, SIZES);
+    Register("libc/strlen/host", Length<strlen>, SIZES);
+}
+}
@@ -0,0 +1,76 @@
+#include "sys/fpu.h"
+#include "sys/kheap.h"
+#include "sys/io.h"
+#include "sys/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Stand-ins for the parts of the kernel that cases reach through ds/ and
+// libc/, backed by the host's malloc, so that benchmarks time the data
+// structures themselves rather than KHeap.
+
+void *KernelAllocator::Allocate(size_t size)
+{
+    return malloc(size);
+}
+
+void *KernelAllocator::Reallocate(void *allocation, size_t size)
+{
+    return realloc(allocation, size);
+}
+
+void KernelAllocator::Free(void *allocation)
+{
+    free(allocation);
+}
+
+void *KHeap::Allocate(size_t size)
+{
+    return malloc(size);
+}
+
+void *KHeap::Reallocate(void *allocation, size_t size)
+{
+    return realloc(allocation, size);
+}
+
+void KHeap::Free(void *allocation)
+{
+    free(allocation);
+}
+
+// kheap.h declares the placement forms rather than including <new>, so they
+// need defining here just as kheap.cpp does in the kernel.
+void *operator new(size_t, void *p) noexcept
+{
+    return p;
+}
+
+void *operator new[](size_t, void *p) noexcept
+{
+    return p;
+}
+
+void operator delete  (void *, void *) noexcept { }
+void operator delete[](void *, void *) noexcept { }
+
+// The host saves and restores each process's FPU registers, so they're
+// always usable, and regions needn't do anything.
+bool Fpu::Usable(uint32_t states)
+{
+    return ! (states & AVX) || __builtin_cpu_supports("avx");
+}
+
+void KernelFpuBegin()
+{}
+
+void KernelFpuEnd()
+{}
+
+// Log writes to the serial port; send it to stderr instead.
+void outportb(uint16_t port, uint8_t val)
+{
+    if(port == COM1_PORT) {
+        fputc(val, stderr);
+    }
+}
@@ -0,0 +1,389 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <ds/optional.h>
+#include <libc/string.h>
+#include <sys/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds {
+/**
+ * A fixed number of bits packed into 64-bit words, bit i living in bit
+ * (i % 64) of word (i / 64). A bitmap either owns its words or wraps memory
+ * that's already laid out this way, such as an ext2 block or inode bitmap
+ * read from disk, in which case changes land directly in that memory and
+ * copies of the bitmap share it.
+ *
+ * Searches work a word at a time: fully set (or fully clear) words are
+ * skipped with a single compare, and the bit within a word is found with
+ * ctz. Bits past the end of the bitmap in its last word are never reported.
+ */
+template <typename allocator_t = KernelAllocator>
+class Bitmap
+{
+public:
+    static constexpr size_t WORD_BITS = 64;
+
+    Bitmap()
+        : words_(nullptr)
+        , num_bits_(0)
+        , owned_(false)
+    {}
+
+    /**
+     * Allocate a bitmap with every bit clear.
+     * @param num_bits Number of bits.
+     */
+    explicit Bitmap(size_t num_bits)
+        : words_((uint64_t*) allocator_t::Allocate(NumWords(num_bits) *
+                                                   sizeof(uint64_t)))
+        , num_bits_(num_bits)
+        , owned_(true)
+    {
+        if(! words_) {
+            num_bits_ = 0;
+            return;
+        }
+        memset(words_, 0, NumWords(num_bits) * sizeof(uint64_t));
+    }
+
+    /**
+     * Wrap existing memory in place. The memory must outlive the bitmap and
+     * every copy of it.
+     * @param words The first word of the bitmap.
+     * @param num_bits Number of bits to consider part of the bitmap.
+     */
+    Bitmap(uint64_t *words, size_t num_bits)
+        : words_(words)
+        , num_bits_(num_bits)
+        , owned_(false)
+    {}
+
+    Bitmap(const Bitmap &rhs)
+        : words_(rhs.words_)
+        , num_bits_(rhs.num_bits_)
+        , owned_(rhs.owned_)
+    {
+        if(owned_) {
+            CopyWords(rhs);
+        }
+    }
+
+    Bitmap(Bitmap &&rhs)
+        : words_(rhs.words_)
+        , num_bits_(rhs.num_bits_)
+        , owned_(rhs.owned_)
+    {
+        rhs.words_ = nullptr;
+        rhs.num_bits_ = 0;
+        rhs.owned_ = false;
+    }
+
+    Bitmap &operator=(const Bitmap &rhs)
+    {
+        if(&rhs == this) {
+            return *this;
+        }
+
+        Release();
+        words_ = rhs.words_;
+        num_bits_ = rhs.num_bits_;
+        owned_ = rhs.owned_;
+        if(owned_) {
+            CopyWords(rhs);
+        }
+        return *this;
+    }
+
+    Bitmap &operator=(Bitmap &&rhs)
+    {
+        if(&rhs == this) {
+            return *this;
+        }
+
+        Release();
+        words_ = rhs.words_;
+        num_bits_ = rhs.num_bits_;
+        owned_ = rhs.owned_;
+        rhs.words_ = nullptr;
+        rhs.num_bits_ = 0;
+        rhs.owned_ = false;
+        return *this;
+    }
+
+    ~Bitmap()
+    {
+        Release();
+    }
+
+    size_t Size() const
+    {
+        return num_bits_;
+    }
+
+    uint64_t *Words()
+    {
+        return words_;
+    }
+
+    const uint64_t *Words() const
+    {
+        return words_;
+    }
+
+    bool Test(size_t ind) const
+    {
+        return words_[ind / WORD_BITS] & Bit(ind);
+    }
+
+    void Set(size_t ind)
+    {
+        words_[ind / WORD_BITS] |= Bit(ind);
+    }
+
+    void Clear(size_t ind)
+    {
+        words_[ind / WORD_BITS] &= ~Bit(ind);
+    }
+
+    /**
+     * Set len bits starting at start. Whole words are written at once.
+     */
+    void SetRange(size_t start, size_t len)
+    {
+        ApplyRange(start, len, true);
+    }
+
+    /**
+     * Clear len bits starting at start. Whole words are written at once.
+     */
+    void ClearRange(size_t start, size_t len)
+    {
+        ApplyRange(start, len, false);
+    }
+
+    /**
+     * @return Number of set bits in [start, start + len).
+     */
+    size_t Count(size_t start, size_t len) const
+    {
+        size_t end = Clamp(start, len);
+        size_t count = 0;
+        while(start < end) {
+            size_t word = start / WORD_BITS;
+            uint64_t mask = RangeMask(start, end);
+            count += __builtin_popcountll(words_[word] & mask);
+            start = (word + 1) * WORD_BITS;
+        }
+        return count;
+    }
+
+    /**
+     * @return Number of set bits in the whole bitmap.
+     */
+    size_t Count() const
+    {
+        return Count(0, num_bits_);
+    }
+
+    /**
+     * Find the first set bit at or after start, and before end.
+     * @param start First bit to consider.
+     * @param end One past the last bit to consider; clamped to Size().
+     * @return Index of the bit, or NullOpt if every bit in range is clear.
+     */
+    Optional<size_t> FindNextSet(size_t start, size_t end=SIZE_MAX) const
+    {
+        return FindNext<false>(start, end);
+    }
+
+    /**
+     * Find the first clear bit at or after start, and before end.
+     * @param start First bit to consider.
+     * @param end One past the last bit to consider; clamped to Size().
+     * @return Index of the bit, or NullOpt if every bit in range is set.
+     */
+    Optional<size_t> FindNextZero(size_t start, size_t end=SIZE_MAX) const
+    {
+        return FindNext<true>(start, end);
+    }
+
+    Optional<size_t> FindFirstSet() const
+    {
+        return FindNextSet(0);
+    }
+
+    Optional<size_t> FindFirstZero() const
+    {
+        return FindNextZero(0);
+    }
+
+    /**
+     * Find the first run of len consecutive clear bits starting at or after
+     * start. The search alternates between skipping to the next clear bit and
+     * skipping past the set bit that cuts a candidate run short, each jump
+     * passing over whole words at a time. Runs shorter than a word are first
+     * looked for within the word the candidate starts in.
+     * @param len Length of the run; must be non-zero.
+     * @param start First bit at which a run may begin.
+     * @return Index of the run's first bit, or NullOpt if there's none.
+     */
+    Optional<size_t> FindZeroRun(size_t len, size_t start=0) const
+    {
+        if(len == 0) {
+            return NullOpt;
+        }
+
+        while(start < num_bits_ && len <= num_bits_ - start) {
+            Optional<size_t> zero = FindNextZero(start);
+            if(! zero || len > num_bits_ - *zero) {
+                return NullOpt;
+            }
+
+            // Runs confined to a single word are found without leaving it.
+            size_t bit = *zero % WORD_BITS;
+            if(len < WORD_BITS && bit + len <= WORD_BITS) {
+                uint64_t free = ~words_[*zero / WORD_BITS] & (~0ULL << bit);
+                uint64_t starts = RunStarts(free, len);
+                if(starts) {
+                    size_t run = *zero - bit + __builtin_ctzll(starts);
+                    if(run + len > num_bits_) {
+                        return NullOpt;
+                    }
+                    return run;
+                }
+            }
+
+            Optional<size_t> blocker = FindNextSet(*zero, *zero + len);
+            if(! blocker) {
+                return *zero;
+            }
+            start = *blocker + 1;
+        }
+        return NullOpt;
+    }
+
+private:
+    uint64_t *words_;
+    size_t num_bits_;
+    bool owned_;
+
+    static size_t NumWords(size_t num_bits)
+    {
+        return (num_bits + WORD_BITS - 1) / WORD_BITS;
+    }
+
+    static uint64_t Bit(size_t ind)
+    {
+        return 1ULL << (ind % WORD_BITS);
+    }
+
+    /**
+     * Mask of the bits of start's word that lie within [start, end).
+     */
+    static uint64_t RangeMask(size_t start, size_t end)
+    {
+        uint64_t mask = ~0ULL << (start % WORD_BITS);
+        size_t word_end = (start / WORD_BITS + 1) * WORD_BITS;
+        if(end < word_end) {
+            mask &= ~0ULL >> (word_end - end);
+        }
+        return mask;
+    }
+
+    /**
+     * SWAR run detection: AND the word with shifted copies of itself,
+     * doubling the covered length each step, so bit i survives exactly when
+     * bits [i, i + len) were all set.
+     * @param free A word whose set bits are the candidates.
+     * @param len Length of the run, below 64.
+     * @return The bits at which a run of len set bits starts.
+     */
+    static uint64_t RunStarts(uint64_t free, size_t len)
+    {
+        size_t covered = 1;
+        while(covered < len && free) {
+            size_t shift = covered < len - covered ? covered : len - covered;
+            free &= free >> shift;
+            covered += shift;
+        }
+        // Runs that would spill past the word's top are not wholly in it.
+        return free & (~0ULL >> (len - 1));
+    }
+
+    size_t Clamp(size_t start, size_t len) const
+    {
+        if(start >= num_bits_) {
+            return start;
+        }
+        return len < num_bits_ - start ? start + len : num_bits_;
+    }
+
+    template <bool invert>
+    Optional<size_t> FindNext(size_t start, size_t end) const
+    {
+        if(end > num_bits_) {
+            end = num_bits_;
+        }
+        if(start >= end) {
+            return NullOpt;
+        }
+
+        size_t word = start / WORD_BITS;
+        size_t last_word = (end - 1) / WORD_BITS;
+        uint64_t bits = (invert ? ~words_[word] : words_[word]) &
+                        (~0ULL << (start % WORD_BITS));
+        while(! bits) {
+            if(++word > last_word) {
+                return NullOpt;
+            }
+            bits = invert ? ~words_[word] : words_[word];
+        }
+
+        size_t ind = word * WORD_BITS + __builtin_ctzll(bits);
+        if(ind >= end) {
+            return NullOpt;
+        }
+        return ind;
+    }
+
+    void ApplyRange(size_t start, size_t len, bool set)
+    {
+        size_t end = Clamp(start, len);
+        while(start < end) {
+            size_t word = start / WORD_BITS;
+            uint64_t mask = RangeMask(start, end);
+            if(set) {
+                words_[word] |= mask;
+            } else {
+                words_[word] &= ~mask;
+            }
+            start = (word + 1) * WORD_BITS;
+        }
+    }
+
+    void CopyWords(const Bitmap &rhs)
+    {
+        size_t size = NumWords(rhs.num_bits_) * sizeof(uint64_t);
+        words_ = (uint64_t*) allocator_t::Allocate(size);
+        if(! words_) {
+            num_bits_ = 0;
+            return;
+        }
+        memcpy(words_, rhs.words_, size);
+    }
+
+    void Release()
+    {
+        if(owned_ && words_) {
+            allocator_t::Free(words_);
+        }
+        words_ = nullptr;
+        num_bits_ = 0;
+        owned_ = false;
+    }
+};
+}
+
+#endif
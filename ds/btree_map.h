@@ -0,0 +1,718 @@
+#ifndef BTREE_MAP_H
+#define BTREE_MAP_H
+
+#include <ds/dyn_array.h>
+#include <ds/optional.h>
+#include <sys/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+namespace ds {
+/**
+ * An ordered map stored as a B+ tree. Each node holds its keys in one
+ * contiguous array, so a lookup costs one or two cache misses per level
+ * rather than one per key compared, and the tree is only a few levels deep.
+ * Entries live in the leaves, which are chained together for range scans.
+ *
+ * Keys and values must be default constructible, since nodes are allocated
+ * with every slot constructed.
+ *
+ * @tparam key_t Compared with <.
+ * @tparam val_t
+ * @tparam allocator_t
+ * @tparam node_size Approximate size of a node in bytes; a few cache lines.
+ */
+template <typename key_t,
+          typename val_t,
+          typename allocator_t = KernelAllocator,
+          size_t node_size     = 256>
+class BTreeMap
+{
+    struct Node {
+        uint16_t count_;
+        bool     leaf_;
+    };
+
+    static constexpr size_t Fit(size_t bytes, size_t per_slot)
+    {
+        return bytes / per_slot < 3 ? 3 : bytes / per_slot;
+    }
+
+    static constexpr size_t LEAF_CAP =
+        Fit(node_size - sizeof(Node) - sizeof(void*),
+            sizeof(key_t) + sizeof(val_t));
+    static constexpr size_t INNER_CAP =
+        Fit(node_size - sizeof(Node) - sizeof(void*),
+            sizeof(key_t) + sizeof(void*));
+    // Every node but the root is kept at least half full.
+    static constexpr size_t LEAF_MIN  = LEAF_CAP / 2;
+    static constexpr size_t INNER_MIN = INNER_CAP / 2;
+    // Even at the minimum fan-out of 2, a tree this deep holds billions of
+    // entries.
+    static constexpr size_t MAX_DEPTH = 32;
+
+    struct Leaf : Node {
+        Leaf  *next_;
+        key_t  keys_[LEAF_CAP];
+        val_t  vals_[LEAF_CAP];
+    };
+
+    // children_[i] holds keys less than keys_[i]; children_[i + 1] holds the
+    // rest.
+    struct Inner : Node {
+        key_t  keys_[INNER_CAP];
+        Node  *children_[INNER_CAP + 1];
+    };
+
+    // The inner nodes on the way down to a leaf, and the child taken at each.
+    struct Path {
+        Inner  *nodes_[MAX_DEPTH];
+        size_t  inds_[MAX_DEPTH];
+        size_t  depth_;
+    };
+
+public:
+    BTreeMap()
+        : root_(nullptr)
+        , size_(0)
+    {}
+
+    BTreeMap(const BTreeMap&) = delete;
+    BTreeMap &operator=(const BTreeMap&) = delete;
+
+    BTreeMap(BTreeMap &&rhs)
+        : root_(rhs.root_)
+        , size_(rhs.size_)
+    {
+        rhs.root_ = nullptr;
+        rhs.size_ = 0;
+    }
+
+    BTreeMap &operator=(BTreeMap &&rhs)
+    {
+        if(&rhs == this) {
+            return *this;
+        }
+
+        Clear();
+        root_ = rhs.root_;
+        size_ = rhs.size_;
+        rhs.root_ = nullptr;
+        rhs.size_ = 0;
+        return *this;
+    }
+
+    ~BTreeMap()
+    {
+        Clear();
+    }
+
+    /**
+     * A position in the map. Advancing past the last entry leaves it
+     * invalid.
+     */
+    class Itr {
+    public:
+        Itr()
+            : leaf_(nullptr)
+            , ind_(0)
+        {}
+
+        const key_t &Key() const
+        {
+            return leaf_->keys_[ind_];
+        }
+
+        val_t &Val() const
+        {
+            return leaf_->vals_[ind_];
+        }
+
+        bool Forward()
+        {
+            if(++ind_ == leaf_->count_) {
+                leaf_ = leaf_->next_;
+                ind_ = 0;
+            }
+            return Valid();
+        }
+
+        bool Valid() const
+        {
+            return leaf_ != nullptr;
+        }
+
+    private:
+        friend class BTreeMap;
+
+        Itr(Leaf *leaf, size_t ind)
+            : leaf_(leaf)
+            , ind_(ind)
+        {
+            // Positions one past the end of a leaf are the start of the next.
+            if(leaf_ && ind_ == leaf_->count_) {
+                leaf_ = leaf_->next_;
+                ind_ = 0;
+            }
+        }
+
+        Leaf   *leaf_;
+        size_t  ind_;
+    };
+
+    /**
+     * @return True if the key was inserted, false if it was already present.
+     */
+    bool Insert(const key_t &key, const val_t &val)
+    {
+        if(! root_) {
+            root_ = NewLeaf();
+        }
+
+        Path path;
+        Leaf *leaf = Descend(key, path);
+        size_t ind = LowerIndex(leaf->keys_, leaf->count_, key);
+        if(ind < leaf->count_ && ! (key < leaf->keys_[ind])) {
+            return false;
+        }
+
+        if(leaf->count_ < LEAF_CAP) {
+            LeafInsert(leaf, ind, key, val);
+        } else {
+            // Split the full leaf, then insert into whichever half the key
+            // belongs in. The right half's first key separates the two.
+            Leaf *right = NewLeaf();
+            size_t mid = LEAF_CAP / 2;
+            for(size_t i = mid; i < LEAF_CAP; ++i) {
+                right->keys_[i - mid] = std::move(leaf->keys_[i]);
+                right->vals_[i - mid] = std::move(leaf->vals_[i]);
+            }
+            right->count_ = LEAF_CAP - mid;
+            leaf->count_ = mid;
+            right->next_ = leaf->next_;
+            leaf->next_ = right;
+
+            if(ind <= mid) {
+                LeafInsert(leaf, ind, key, val);
+            } else {
+                LeafInsert(right, ind - mid, key, val);
+            }
+            InsertIntoParents(path, right->keys_[0], right);
+        }
+
+        ++size_;
+        return true;
+    }
+
+    /**
+     * Insert an entry, or assign to the value of an existing one.
+     * @return True if a new entry was inserted, false if one was assigned.
+     */
+    bool InsertOrAssign(const key_t &key, const val_t &val)
+    {
+        if(Itr itr = Find(key); itr.Valid()) {
+            itr.Val() = val;
+            return false;
+        }
+        return Insert(key, val);
+    }
+
+    ds::Optional<val_t> Lookup(const key_t &key) const
+    {
+        Itr itr = Find(key);
+        if(itr.Valid()) {
+            return itr.Val();
+        }
+        return ds::NullOpt;
+    }
+
+    bool Contains(const key_t &key) const
+    {
+        return Find(key).Valid();
+    }
+
+    /**
+     * @return True if the key was found and removed.
+     */
+    bool Delete(const key_t &key)
+    {
+        if(! root_) {
+            return false;
+        }
+
+        Path path;
+        Leaf *leaf = Descend(key, path);
+        size_t ind = LowerIndex(leaf->keys_, leaf->count_, key);
+        if(ind == leaf->count_ || key < leaf->keys_[ind]) {
+            return false;
+        }
+
+        for(size_t i = ind + 1; i < leaf->count_; ++i) {
+            leaf->keys_[i - 1] = std::move(leaf->keys_[i]);
+            leaf->vals_[i - 1] = std::move(leaf->vals_[i]);
+        }
+        --leaf->count_;
+        --size_;
+
+        Rebalance(leaf, path);
+        return true;
+    }
+
+    /**
+     * @return The entry with the given key, or an invalid iterator.
+     */
+    Itr Find(const key_t &key) const
+    {
+        Itr itr = LowerBound(key);
+        if(itr.Valid() && ! (key < itr.Key())) {
+            return itr;
+        }
+        return Itr();
+    }
+
+    /**
+     * @return The first entry whose key is not less than key.
+     */
+    Itr LowerBound(const key_t &key) const
+    {
+        if(! root_) {
+            return Itr();
+        }
+
+        Path path;
+        Leaf *leaf = Descend(key, path);
+        return Itr(leaf, LowerIndex(leaf->keys_, leaf->count_, key));
+    }
+
+    /**
+     * @return The first entry whose key is greater than key.
+     */
+    Itr UpperBound(const key_t &key) const
+    {
+        if(! root_) {
+            return Itr();
+        }
+
+        Path path;
+        Leaf *leaf = Descend(key, path);
+        return Itr(leaf, UpperIndex(leaf->keys_, leaf->count_, key));
+    }
+
+    /**
+     * @return The entry with the smallest key, if any.
+     */
+    Itr Begin() const
+    {
+        if(! root_) {
+            return Itr();
+        }
+
+        Node *node = root_;
+        while(! node->leaf_) {
+            node = ((Inner*) node)->children_[0];
+        }
+        return Itr((Leaf*) node, 0);
+    }
+
+    /**
+     * Replace the map's contents with entries already sorted by key. Leaves
+     * are packed as fully as the balance invariants allow, which is both
+     * faster than inserting one by one and yields a shallower tree.
+     * @param keys Strictly increasing keys.
+     * @param vals The corresponding values.
+     * @param num Number of entries.
+     */
+    void BulkLoad(const key_t *keys, const val_t *vals, size_t num)
+    {
+        Clear();
+        if(! num) {
+            return;
+        }
+
+        // Spread entries evenly across as few leaves as will hold them.
+        size_t num_leaves = (num + LEAF_CAP - 1) / LEAF_CAP;
+        DynArray<Node*> level;
+        level.Reserve(num_leaves);
+        Leaf *prev = nullptr;
+        size_t start = 0;
+        for(size_t i = 0; i < num_leaves; ++i) {
+            size_t end = num * (i + 1) / num_leaves;
+            Leaf *leaf = NewLeaf();
+            for(size_t j = start; j < end; ++j) {
+                leaf->keys_[j - start] = keys[j];
+                leaf->vals_[j - start] = vals[j];
+            }
+            leaf->count_ = end - start;
+            if(prev) {
+                prev->next_ = leaf;
+            }
+            prev = leaf;
+            level.Append(leaf);
+            start = end;
+        }
+
+        // Then build each level of inner nodes over the one below it.
+        while(level.Size() > 1) {
+            size_t num_nodes = (level.Size() + INNER_CAP) / (INNER_CAP + 1);
+            DynArray<Node*> parents;
+            parents.Reserve(num_nodes);
+            start = 0;
+            for(size_t i = 0; i < num_nodes; ++i) {
+                size_t end = level.Size() * (i + 1) / num_nodes;
+                Inner *inner = NewInner();
+                inner->children_[0] = level[start];
+                for(size_t j = start + 1; j < end; ++j) {
+                    inner->keys_[j - start - 1] = MinKey(level[j]);
+                    inner->children_[j - start] = level[j];
+                }
+                inner->count_ = end - start - 1;
+                parents.Append(inner);
+                start = end;
+            }
+            level = std::move(parents);
+        }
+
+        root_ = level[0];
+        size_ = num;
+    }
+
+    void Clear()
+    {
+        if(root_) {
+            FreeNode(root_);
+        }
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    size_t Len() const
+    {
+        return size_;
+    }
+
+private:
+    Node   *root_;
+    size_t  size_;
+
+    static Leaf *NewLeaf()
+    {
+        auto leaf = new (allocator_t::Allocate(sizeof(Leaf))) Leaf();
+        leaf->count_ = 0;
+        leaf->leaf_ = true;
+        leaf->next_ = nullptr;
+        return leaf;
+    }
+
+    static Inner *NewInner()
+    {
+        auto inner = new (allocator_t::Allocate(sizeof(Inner))) Inner();
+        inner->count_ = 0;
+        inner->leaf_ = false;
+        return inner;
+    }
+
+    static void DeleteNode(Node *node)
+    {
+        if(node->leaf_) {
+            ((Leaf*) node)->~Leaf();
+        } else {
+            ((Inner*) node)->~Inner();
+        }
+        allocator_t::Free(node);
+    }
+
+    static void FreeNode(Node *node)
+    {
+        if(! node->leaf_) {
+            auto inner = (Inner*) node;
+            for(size_t i = 0; i <= inner->count_; ++i) {
+                FreeNode(inner->children_[i]);
+            }
+        }
+        DeleteNode(node);
+    }
+
+    static const key_t &MinKey(Node *node)
+    {
+        while(! node->leaf_) {
+            node = ((Inner*) node)->children_[0];
+        }
+        return ((Leaf*) node)->keys_[0];
+    }
+
+    /**
+     * @return Index of the first key not less than key.
+     */
+    static size_t LowerIndex(const key_t *keys, size_t count,
+                             const key_t &key)
+    {
+        size_t lo = 0, hi = count;
+        while(lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if(keys[mid] < key) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    /**
+     * @return Index of the first key greater than key.
+     */
+    static size_t UpperIndex(const key_t *keys, size_t count,
+                             const key_t &key)
+    {
+        size_t lo = 0, hi = count;
+        while(lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if(key < keys[mid]) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        return lo;
+    }
+
+    /**
+     * Walk down to the leaf which does or would hold key.
+     * @param path Filled in with the inner nodes passed through.
+     */
+    Leaf *Descend(const key_t &key, Path &path) const
+    {
+        Node *node = root_;
+        path.depth_ = 0;
+        while(! node->leaf_) {
+            auto inner = (Inner*) node;
+            size_t ind = UpperIndex(inner->keys_, inner->count_, key);
+            path.nodes_[path.depth_] = inner;
+            path.inds_[path.depth_++] = ind;
+            node = inner->children_[ind];
+        }
+        return (Leaf*) node;
+    }
+
+    static void LeafInsert(Leaf *leaf, size_t ind, const key_t &key,
+                           const val_t &val)
+    {
+        for(size_t i = leaf->count_; i > ind; --i) {
+            leaf->keys_[i] = std::move(leaf->keys_[i - 1]);
+            leaf->vals_[i] = std::move(leaf->vals_[i - 1]);
+        }
+        leaf->keys_[ind] = key;
+        leaf->vals_[ind] = val;
+        ++leaf->count_;
+    }
+
+    /**
+     * Put a separator and the child to its right into an inner node, just
+     * after the child at ind.
+     */
+    static void InnerInsert(Inner *inner, size_t ind, key_t &&sep,
+                            Node *child)
+    {
+        for(size_t i = inner->count_; i > ind; --i) {
+            inner->keys_[i] = std::move(inner->keys_[i - 1]);
+            inner->children_[i + 1] = inner->children_[i];
+        }
+        inner->keys_[ind] = std::move(sep);
+        inner->children_[ind + 1] = child;
+        ++inner->count_;
+    }
+
+    /**
+     * Remove the separator at ind and the child to its right.
+     */
+    static void InnerRemove(Inner *inner, size_t ind)
+    {
+        for(size_t i = ind + 1; i < inner->count_; ++i) {
+            inner->keys_[i - 1] = std::move(inner->keys_[i]);
+            inner->children_[i] = inner->children_[i + 1];
+        }
+        --inner->count_;
+    }
+
+    /**
+     * Having split a node, hand the new right half up to its parent,
+     * splitting full ancestors in turn and growing a new root if need be.
+     */
+    void InsertIntoParents(Path &path, key_t sep, Node *right)
+    {
+        while(path.depth_ > 0) {
+            --path.depth_;
+            Inner *inner = path.nodes_[path.depth_];
+            size_t ind = path.inds_[path.depth_];
+            if(inner->count_ < INNER_CAP) {
+                InnerInsert(inner, ind, std::move(sep), right);
+                return;
+            }
+
+            // The middle separator moves up; those either side of it are
+            // shared between the halves.
+            Inner *new_inner = NewInner();
+            size_t mid = INNER_CAP / 2;
+            key_t up = std::move(inner->keys_[mid]);
+            for(size_t i = mid + 1; i < INNER_CAP; ++i) {
+                new_inner->keys_[i - mid - 1] = std::move(inner->keys_[i]);
+            }
+            for(size_t i = mid + 1; i <= INNER_CAP; ++i) {
+                new_inner->children_[i - mid - 1] = inner->children_[i];
+            }
+            new_inner->count_ = INNER_CAP - mid - 1;
+            inner->count_ = mid;
+
+            if(ind <= mid) {
+                InnerInsert(inner, ind, std::move(sep), right);
+            } else {
+                InnerInsert(new_inner, ind - mid - 1, std::move(sep), right);
+            }
+            sep = std::move(up);
+            right = new_inner;
+        }
+
+        Inner *root = NewInner();
+        root->keys_[0] = std::move(sep);
+        root->children_[0] = root_;
+        root->children_[1] = right;
+        root->count_ = 1;
+        root_ = root;
+    }
+
+    /**
+     * Top up a node left less than half full by a deletion, borrowing an
+     * entry from a sibling if either can spare one and otherwise merging
+     * with a sibling, which may leave the parent short in turn. Separators
+     * of deleted keys are left in place; they still separate correctly.
+     */
+    void Rebalance(Node *node, Path &path)
+    {
+        while(path.depth_ > 0) {
+            size_t min = node->leaf_ ? LEAF_MIN : INNER_MIN;
+            if(node->count_ >= min) {
+                return;
+            }
+
+            --path.depth_;
+            Inner *parent = path.nodes_[path.depth_];
+            size_t ind = path.inds_[path.depth_];
+            Node *left = ind > 0 ? parent->children_[ind - 1] : nullptr;
+            Node *right = ind < parent->count_ ? parent->children_[ind + 1]
+                                               : nullptr;
+
+            if(left && left->count_ > min) {
+                BorrowFromLeft(parent, ind, node, left);
+                return;
+            }
+            if(right && right->count_ > min) {
+                BorrowFromRight(parent, ind, node, right);
+                return;
+            }
+
+            if(left) {
+                Merge(parent, ind - 1, left, node);
+            } else {
+                Merge(parent, ind, node, right);
+            }
+            node = parent;
+        }
+
+        // The root may run empty; an inner root is then replaced by its only
+        // child, and a leaf root by nothing.
+        if(root_->count_ == 0) {
+            Node *old_root = root_;
+            root_ = root_->leaf_ ? nullptr : ((Inner*) root_)->children_[0];
+            DeleteNode(old_root);
+        }
+    }
+
+    static void BorrowFromLeft(Inner *parent, size_t ind, Node *node,
+                               Node *left)
+    {
+        if(node->leaf_) {
+            auto leaf = (Leaf*) node, from = (Leaf*) left;
+            LeafInsert(leaf, 0, from->keys_[from->count_ - 1],
+                       from->vals_[from->count_ - 1]);
+            --from->count_;
+            parent->keys_[ind - 1] = leaf->keys_[0];
+        } else {
+            auto inner = (Inner*) node, from = (Inner*) left;
+            for(size_t i = inner->count_; i > 0; --i) {
+                inner->keys_[i] = std::move(inner->keys_[i - 1]);
+            }
+            for(size_t i = inner->count_ + 1; i > 0; --i) {
+                inner->children_[i] = inner->children_[i - 1];
+            }
+            inner->keys_[0] = std::move(parent->keys_[ind - 1]);
+            inner->children_[0] = from->children_[from->count_];
+            ++inner->count_;
+            parent->keys_[ind - 1] = std::move(from->keys_[from->count_ - 1]);
+            --from->count_;
+        }
+    }
+
+    static void BorrowFromRight(Inner *parent, size_t ind, Node *node,
+                                Node *right)
+    {
+        if(node->leaf_) {
+            auto leaf = (Leaf*) node, from = (Leaf*) right;
+            leaf->keys_[leaf->count_] = std::move(from->keys_[0]);
+            leaf->vals_[leaf->count_] = std::move(from->vals_[0]);
+            ++leaf->count_;
+            for(size_t i = 1; i < from->count_; ++i) {
+                from->keys_[i - 1] = std::move(from->keys_[i]);
+                from->vals_[i - 1] = std::move(from->vals_[i]);
+            }
+            --from->count_;
+            parent->keys_[ind] = from->keys_[0];
+        } else {
+            auto inner = (Inner*) node, from = (Inner*) right;
+            inner->keys_[inner->count_] = std::move(parent->keys_[ind]);
+            inner->children_[inner->count_ + 1] = from->children_[0];
+            ++inner->count_;
+            parent->keys_[ind] = std::move(from->keys_[0]);
+            for(size_t i = 1; i < from->count_; ++i) {
+                from->keys_[i - 1] = std::move(from->keys_[i]);
+            }
+            for(size_t i = 1; i <= from->count_; ++i) {
+                from->children_[i - 1] = from->children_[i];
+            }
+            --from->count_;
+        }
+    }
+
+    /**
+     * Fold the right of two adjacent siblings into the left, then drop it
+     * and the separator between them from their parent.
+     */
+    static void Merge(Inner *parent, size_t sep_ind, Node *left, Node *right)
+    {
+        if(left->leaf_) {
+            auto to = (Leaf*) left, from = (Leaf*) right;
+            for(size_t i = 0; i < from->count_; ++i) {
+                to->keys_[to->count_ + i] = std::move(from->keys_[i]);
+                to->vals_[to->count_ + i] = std::move(from->vals_[i]);
+            }
+            to->count_ += from->count_;
+            to->next_ = from->next_;
+        } else {
+            auto to = (Inner*) left, from = (Inner*) right;
+            to->keys_[to->count_] = std::move(parent->keys_[sep_ind]);
+            for(size_t i = 0; i < from->count_; ++i) {
+                to->keys_[to->count_ + 1 + i] = std::move(from->keys_[i]);
+            }
+            for(size_t i = 0; i <= from->count_; ++i) {
+                to->children_[to->count_ + 1 + i] = from->children_[i];
+            }
+            to->count_ += from->count_ + 1;
+        }
+
+        InnerRemove(parent, sep_ind);
+        DeleteNode(right);
+    }
+};
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <ds/optional.h>
 #include <ds/hash_map.h>
+#include <ds/intrusive_list.h>
 
 namespace ds {
 template <typename key_t, typename val_t>
@@ -23,97 +24,535 @@ public:
     virtual size_t NumEntries() const        = 0;
 };
 
-template <typename key_t, typename val_t, typename allocator_t=KernelAllocator>
-class LRUCache : public Cache<key_t, val_t>
+/**
+ * A cached entry, linked into whichever queues its cache's replacement policy
+ * keeps. The policy owns every field but the key and value.
+ */
+template <typename key_t, typename val_t>
+struct CacheEntry : ListLink<>
+{
+    key_t key_;
+    val_t val_;
+    // Chains entries sharing a hash bucket, in caches that index their
+    // entries themselves rather than through a HashMap.
+    CacheEntry *hash_next_;
+    // Set on a hit by CLOCK-style policies, rather than relinking the entry.
+    bool referenced_;
+    // Which of a policy's queues holds the entry, for multi-queue policies.
+    uint8_t queue_;
+};
+
+/**
+ * A queue of cache entries. Entries are pushed at the front and taken from the
+ * back; a CLOCK hand is simply the front, with the entries behind it being
+ * those it will reach last, and advancing it rotates the front to the back.
+ */
+template <typename entry_t>
+using CacheQueue = IntrusiveList<entry_t>;
+
+/*
+ * Replacement policies decide which entry a ReplacementCache evicts. Each
+ * provides:
+ *   void Admit(entry_t *entry);  Link in a newly inserted entry.
+ *   void Touch(entry_t *entry);  Note a hit on an entry.
+ *   entry_t *Victim();           Unlink and return the entry to evict next.
+ *                                Only called while some entry is linked in.
+ * and may provide
+ *   void Reserve(size_t capacity);
+ * which fixed-capacity caches call once, up front, so that a policy keeping
+ * its own bookkeeping can preallocate it rather than allocating on eviction.
+ */
+
+/**
+ * Evict the least recently used entry. Every hit relinks the entry, and a
+ * single pass over more data than fits in memory flushes everything else.
+ */
+template <typename entry_t, typename allocator_t, typename hasher>
+class LRUPolicy
 {
 public:
-    LRUCache(void (*eviction_handler)(key_t, val_t) = nullptr)
-        : mru_(nullptr)
-        , lru_(nullptr)
-        , eviction_handler_(eviction_handler)
-        , num_entries_(0)
+    void Admit(entry_t *entry)
+    {
+        recency_.PushFront(*entry);
+    }
+
+    void Touch(entry_t *entry)
+    {
+        if(recency_.Front() != entry) {
+            recency_.Remove(*entry);
+            recency_.PushFront(*entry);
+        }
+    }
+
+    entry_t *Victim()
+    {
+        return recency_.PopBack();
+    }
+
+private:
+    CacheQueue<entry_t> recency_;
+};
+
+/**
+ * Approximate LRU by sweeping a hand round a ring of entries, evicting the
+ * first not referenced since the hand last passed it. A hit only sets a
+ * flag, so lookups never write to the queue.
+ */
+template <typename entry_t, typename allocator_t, typename hasher>
+class ClockPolicy
+{
+public:
+    void Admit(entry_t *entry)
+    {
+        // Just behind the hand, so a new entry gets a full sweep to prove
+        // itself.
+        entry->referenced_ = false;
+        ring_.PushBack(*entry);
+    }
+
+    void Touch(entry_t *entry)
+    {
+        entry->referenced_ = true;
+    }
+
+    entry_t *Victim()
+    {
+        return Sweep(ring_);
+    }
+
+    /**
+     * Advance a CLOCK hand past referenced entries, clearing their flags,
+     * and unlink the first unreferenced entry it reaches.
+     */
+    static entry_t *Sweep(CacheQueue<entry_t> &ring)
+    {
+        while(ring.Front()->referenced_) {
+            ring.Front()->referenced_ = false;
+            ring.Rotate();
+        }
+
+        return ring.PopFront();
+    }
+
+private:
+    CacheQueue<entry_t> ring_;
+};
+
+/**
+ * 2Q, with a CLOCK main queue. New entries go through a short FIFO probation
+ * queue, and hits there are ignored, so a scan passes straight through it
+ * without disturbing the main queue. Keys evicted from probation are
+ * remembered in a ghost queue; an entry whose key is re-inserted while still
+ * remembered has shown it's reused, and goes straight into the main queue.
+ * The queues are sized relative to the number of cached entries, since the
+ * cache itself has no fixed capacity.
+ */
+template <typename entry_t, typename allocator_t, typename hasher>
+class TwoQPolicy
+{
+    using key_t = decltype(entry_t::key_);
+
+    enum queue_t : uint8_t {
+        PROBATION,
+        MAIN
+    };
+
+    // Probation gets a quarter of the cache, and the ghost queue remembers
+    // half as many keys as are cached, or at least GHOST_MIN.
+    static constexpr size_t PROBATION_SHARE = 4;
+    static constexpr size_t GHOST_MIN = 32;
+
+    struct GhostEntry {
+        key_t key_;
+        GhostEntry *next_;
+        // Cleared when the key is re-admitted; the entry stays queued, and
+        // counts towards the queue's length, until it reaches the head.
+        bool live_;
+    };
+
+public:
+    TwoQPolicy()
+        : ghost_head_(nullptr)
+        , ghost_tail_(nullptr)
+        , ghost_pool_(nullptr)
+        , ghost_free_(nullptr)
+        , ghost_len_(0)
+        , ghost_limit_(0)
     {}
 
-    ~LRUCache()
+    TwoQPolicy(const TwoQPolicy&) = delete;
+    TwoQPolicy &operator=(const TwoQPolicy&) = delete;
+
+    ~TwoQPolicy()
     {
-        Evict(num_entries_);
+        while(ghost_head_) {
+            PopGhost();
+        }
+        if(ghost_pool_) {
+            allocator_t::Free(ghost_pool_);
+        }
     }
 
-    bool Insert(const key_t &key, const val_t &val) override
+    /**
+     * Fix the ghost queue's length for a cache of the given capacity, and
+     * preallocate it along with the index of remembered keys.
+     */
+    void Reserve(size_t capacity)
     {
-        if(BuddyAllocator::MemCritical()) {
-            Evict(1);
+        ghost_limit_ = capacity / 2 > 0 ? capacity / 2 : 1;
+        ghost_pool_ = (GhostEntry*) allocator_t::Allocate(ghost_limit_ *
+                                                          sizeof(GhostEntry));
+        for(size_t i = 0; i < ghost_limit_; ++i) {
+            ghost_pool_[i].next_ = ghost_free_;
+            ghost_free_ = &ghost_pool_[i];
+        }
+
+        // Keeping the index at most a sixth full means tombstones are always
+        // reclaimed in place, without growing the table.
+        ghosts_ = ds::HashMap<key_t, GhostEntry*, allocator_t, hasher>(
+            ghost_limit_ * 6);
+    }
+
+    void Admit(entry_t *entry)
+    {
+        entry->referenced_ = false;
+        if(ds::Optional<GhostEntry*> ghost = ghosts_.Lookup(entry->key_)) {
+            (*ghost)->live_ = false;
+            ghosts_.Delete(entry->key_);
+            entry->queue_ = MAIN;
+            main_.PushBack(*entry);
+        } else {
+            entry->queue_ = PROBATION;
+            probation_.PushFront(*entry);
         }
+    }
 
-        auto new_entry =
-            (LinkedListEntry*) allocator_t::Allocate(sizeof(LinkedListEntry));
-        new_entry->key_  = key;
-        new_entry->val_  = val;
-        new_entry->prev_ = nullptr;
-        new_entry->next_ = mru_;
-        if(new_entry->next_) {
-            new_entry->next_->prev_ = new_entry;
+    void Touch(entry_t *entry)
+    {
+        if(entry->queue_ == MAIN) {
+            entry->referenced_ = true;
         }
+    }
 
-        if (! entries_.Insert(key, new_entry)) {
-            return false;
+    entry_t *Victim()
+    {
+        size_t num_entries = probation_.Size() + main_.Size();
+        if(! main_.Size() ||
+           probation_.Size() * PROBATION_SHARE > num_entries)
+        {
+            entry_t *victim = probation_.PopBack();
+            RememberKey(victim->key_, num_entries - 1);
+            return victim;
+        }
+
+        return ClockPolicy<entry_t, allocator_t, hasher>::Sweep(main_);
+    }
+
+private:
+    CacheQueue<entry_t> probation_, main_;
+    GhostEntry *ghost_head_, *ghost_tail_;
+    // Preallocated ghost entries, if Reserve was called, and those of them
+    // not in the queue.
+    GhostEntry *ghost_pool_, *ghost_free_;
+    // Entries in the queue, live or dead.
+    size_t ghost_len_;
+    // Fixed length of the ghost queue, or 0 to size it by the cache.
+    size_t ghost_limit_;
+    ds::HashMap<key_t, GhostEntry*, allocator_t, hasher> ghosts_;
+
+    void RememberKey(const key_t &key, size_t num_entries)
+    {
+        size_t limit = ghost_limit_;
+        if(! limit) {
+            limit = num_entries / 2 > GHOST_MIN ? num_entries / 2 : GHOST_MIN;
+        }
+        // Dead entries count too; otherwise re-admitting remembered keys
+        // would queue one more dead entry each time without ever popping.
+        while(ghost_len_ >= limit) {
+            PopGhost();
         }
-        mru_ = new_entry;
-        if (lru_ == nullptr) {
-            lru_ = new_entry;
+
+        GhostEntry *ghost = NewGhost();
+        new (&ghost->key_) key_t(key);
+        ghost->next_ = nullptr;
+        ghost->live_ = true;
+        if(! ghosts_.Insert(key, ghost)) {
+            FreeGhost(ghost);
+            return;
+        }
+
+        if(ghost_tail_) {
+            ghost_tail_->next_ = ghost;
+        } else {
+            ghost_head_ = ghost;
+        }
+        ghost_tail_ = ghost;
+        ++ghost_len_;
+    }
+
+    GhostEntry *NewGhost()
+    {
+        if(! ghost_pool_) {
+            return (GhostEntry*) allocator_t::Allocate(sizeof(GhostEntry));
         }
+
+        // The queue is kept shorter than the pool, so one is always free.
+        GhostEntry *ghost = ghost_free_;
+        ghost_free_ = ghost->next_;
+        return ghost;
+    }
+
+    void FreeGhost(GhostEntry *ghost)
+    {
+        ghost->key_.~key_t();
+        if(ghost_pool_) {
+            ghost->next_ = ghost_free_;
+            ghost_free_ = ghost;
+        } else {
+            allocator_t::Free(ghost);
+        }
+    }
+
+    void PopGhost()
+    {
+        GhostEntry *ghost = ghost_head_;
+        ghost_head_ = ghost->next_;
+        if(! ghost_head_) {
+            ghost_tail_ = nullptr;
+        }
+        --ghost_len_;
+
+        if(ghost->live_) {
+            ghosts_.Delete(ghost->key_);
+        }
+        FreeGhost(ghost);
+    }
+};
+
+/**
+ * A cache with no fixed capacity; entries are evicted on request, which
+ * usually comes from the cache's owner registering it with the
+ * ShrinkerRegistry. Which entries go first is up to policy_t.
+ */
+template <typename key_t, typename val_t,
+          template <typename, typename, typename> class policy_t = LRUPolicy,
+          typename allocator_t=KernelAllocator, typename hasher=MurmurHasher>
+class ReplacementCache : public Cache<key_t, val_t>
+{
+    using entry_t = CacheEntry<key_t, val_t>;
+
+public:
+    ReplacementCache(void (*eviction_handler)(key_t, val_t) = nullptr)
+        : eviction_handler_(eviction_handler)
+        , num_entries_(0)
+    {}
+
+    ~ReplacementCache()
+    {
+        Evict(num_entries_);
+    }
+
+    bool Insert(const key_t &key, const val_t &val) override
+    {
+        if(entries_.Contains(key)) {
+            return false;
+        }
+
+        auto new_entry = (entry_t*) allocator_t::Allocate(sizeof(entry_t));
+        new_entry->prev_ = new_entry->next_ = nullptr;
+        new (&new_entry->key_) key_t(key);
+        new (&new_entry->val_) val_t(val);
+        entries_.Insert(key, new_entry);
+        policy_.Admit(new_entry);
         ++num_entries_;
         return true;
     }
 
     virtual ds::Optional<val_t> Lookup(const key_t& key) override
     {
-        if (ds::Optional<LinkedListEntry*> opt_entry = entries_.Lookup(key)) {
-            LinkedListEntry* entry = opt_entry.Value();
-            if (entry->prev_) {
-                entry->prev_->next_ = entry->next_;
-            }
-            if (entry->next_) {
-                entry->next_->prev_ = entry->prev_;
-            }
-            if (num_entries_ > 1 && lru_ == entry) {
-                lru_ = entry->prev_;
-            }
+        return LookupImpl(key);
+    }
 
-            entry->prev_ = nullptr;
-            if (mru_ != entry) {
-                entry->next_ = mru_;
-                mru_         = entry;
-            }
+    /**
+     * Look up an entry by a stand-in for key_t, such as a StringView for a
+     * String key, without constructing a key_t.
+     */
+    template <typename lookup_t>
+        requires IsTransparentKey<key_t, lookup_t>::value
+    ds::Optional<val_t> Lookup(const lookup_t& key)
+    {
+        return LookupImpl(key);
+    }
+
+    virtual size_t Evict(size_t entries_to_evict) override
+    {
+        size_t i;
+        for (i = 0; i < entries_to_evict && num_entries_; ++i) {
+            entry_t *entry_to_evict = policy_.Victim();
+            entries_.Delete(entry_to_evict->key_);
+            --num_entries_;
 
-            if(entry->next_) {
-                entry->next_->prev_ = entry;
+            // The eviction handler is useful in cases where the object requires
+            // some cleanup, e.g. if val_t is a pointer.
+            if (eviction_handler_) {
+                eviction_handler_(entry_to_evict->key_, entry_to_evict->val_);
             }
+
+            entry_to_evict->key_.~key_t();
+            entry_to_evict->val_.~val_t();
+            allocator_t::Free(entry_to_evict);
+        }
+
+        return i;
+    }
+
+    virtual void Flush() override
+    {
+        Evict(num_entries_);
+    }
+
+    virtual size_t NumEntries() const override
+    {
+        return num_entries_;
+    }
+
+private:
+    template <typename lookup_t>
+    ds::Optional<val_t> LookupImpl(const lookup_t& key)
+    {
+        if (ds::Optional<entry_t*> opt_entry = entries_.Lookup(key)) {
+            entry_t *entry = opt_entry.Value();
+            policy_.Touch(entry);
             return entry->val_;
         }
         return ds::NullOpt;
     }
 
+    policy_t<entry_t, allocator_t, hasher> policy_;
+    void (*eviction_handler_)(key_t key, val_t val);
+    ds::HashMap<key_t, entry_t*, allocator_t, hasher> entries_;
+    size_t num_entries_;
+};
+
+/**
+ * A cache holding at most a fixed number of entries, all allocated up front
+ * along with its hash table. Entries are chained through their own buckets
+ * rather than indexed by a separate HashMap, so inserting and evicting never
+ * touch the heap, and the cache's footprint is known from the start. When
+ * full, inserting evicts an entry chosen by policy_t.
+ */
+template <typename key_t, typename val_t,
+          template <typename, typename, typename> class policy_t = LRUPolicy,
+          typename allocator_t=KernelAllocator, typename hasher=MurmurHasher>
+class FixedCache : public Cache<key_t, val_t>
+{
+    using entry_t = CacheEntry<key_t, val_t>;
+
+public:
+    /**
+     * @param capacity The most entries the cache may hold.
+     * @param eviction_handler Called on each entry as it is evicted.
+     */
+    FixedCache(size_t capacity,
+               void (*eviction_handler)(key_t, val_t) = nullptr)
+        : capacity_(capacity > 0 ? capacity : 1)
+        , num_buckets_(1)
+        , eviction_handler_(eviction_handler)
+        , num_entries_(0)
+        , free_(nullptr)
+    {
+        while(num_buckets_ < capacity_) {
+            num_buckets_ <<= 1;
+        }
+
+        pool_ = (entry_t*) allocator_t::Allocate(capacity_ * sizeof(entry_t));
+        buckets_ = (entry_t**) allocator_t::Allocate(num_buckets_ *
+                                                     sizeof(entry_t*));
+        memset(buckets_, 0, num_buckets_ * sizeof(entry_t*));
+        for(size_t i = 0; i < capacity_; ++i) {
+            pool_[i].prev_ = pool_[i].next_ = nullptr;
+            pool_[i].hash_next_ = free_;
+            free_ = &pool_[i];
+        }
+
+        if constexpr(requires { policy_.Reserve(capacity_); }) {
+            policy_.Reserve(capacity_);
+        }
+    }
+
+    FixedCache(const FixedCache&) = delete;
+    FixedCache &operator=(const FixedCache&) = delete;
+
+    ~FixedCache()
+    {
+        Evict(num_entries_);
+        allocator_t::Free(buckets_);
+        allocator_t::Free(pool_);
+    }
+
+    bool Insert(const key_t &key, const val_t &val) override
+    {
+        uint32_t hash = hasher::Hash(key);
+        if(Find(key, hash)) {
+            return false;
+        }
+
+        if(! free_) {
+            Evict(1);
+        }
+
+        entry_t *entry = free_;
+        free_ = entry->hash_next_;
+        new (&entry->key_) key_t(key);
+        new (&entry->val_) val_t(val);
+
+        entry_t *&bucket = buckets_[hash & (num_buckets_ - 1)];
+        entry->hash_next_ = bucket;
+        bucket = entry;
+
+        policy_.Admit(entry);
+        ++num_entries_;
+        return true;
+    }
+
+    virtual ds::Optional<val_t> Lookup(const key_t& key) override
+    {
+        return LookupImpl(key);
+    }
+
+    /**
+     * Look up an entry by a stand-in for key_t, such as a StringView for a
+     * String key, without constructing a key_t.
+     */
+    template <typename lookup_t>
+        requires IsTransparentKey<key_t, lookup_t>::value
+    ds::Optional<val_t> Lookup(const lookup_t& key)
+    {
+        return LookupImpl(key);
+    }
+
     virtual size_t Evict(size_t entries_to_evict) override
     {
         size_t i;
         for (i = 0; i < entries_to_evict && num_entries_; ++i) {
-            LinkedListEntry* entry_to_evict = lru_;
-            lru_                            = lru_->prev_;
-            if (lru_) {
-                lru_->next_ = nullptr;
-            }
+            entry_t *entry_to_evict = policy_.Victim();
 
-            entries_.Delete(entry_to_evict->key_);
+            entry_t **link = &buckets_[hasher::Hash(entry_to_evict->key_) &
+                                       (num_buckets_ - 1)];
+            while(*link != entry_to_evict) {
+                link = &(*link)->hash_next_;
+            }
+            *link = entry_to_evict->hash_next_;
             --num_entries_;
 
-            // The eviction handler is useful in cases where the object requires
-            // some cleanup, e.g. if val_t is a pointer.
             if (eviction_handler_) {
                 eviction_handler_(entry_to_evict->key_, entry_to_evict->val_);
             }
 
-            allocator_t::Free(entry_to_evict);
+            entry_to_evict->key_.~key_t();
+            entry_to_evict->val_.~val_t();
+            entry_to_evict->hash_next_ = free_;
+            free_ = entry_to_evict;
         }
 
         return i;
@@ -129,20 +568,54 @@ public:
         return num_entries_;
     }
 
+    size_t Capacity() const
+    {
+        return capacity_;
+    }
+
 private:
-    struct LinkedListEntry
+    template <typename lookup_t>
+    entry_t *Find(const lookup_t& key, uint32_t hash) const
     {
-        key_t key_;
-        val_t val_;
-        LinkedListEntry *prev_, *next_;
-    };
+        entry_t *entry = buckets_[hash & (num_buckets_ - 1)];
+        while(entry && ! (entry->key_ == key)) {
+            entry = entry->hash_next_;
+        }
+        return entry;
+    }
 
-    LinkedListEntry *mru_, *lru_;
+    template <typename lookup_t>
+    ds::Optional<val_t> LookupImpl(const lookup_t& key)
+    {
+        if (entry_t *entry = Find(key, hasher::Hash(key))) {
+            policy_.Touch(entry);
+            return entry->val_;
+        }
+        return ds::NullOpt;
+    }
+
+    size_t capacity_, num_buckets_;
+    policy_t<entry_t, allocator_t, hasher> policy_;
     void (*eviction_handler_)(key_t key, val_t val);
-    ds::HashMap<key_t, LinkedListEntry*, allocator_t> entries_;
     size_t num_entries_;
+    entry_t *pool_, *free_;
+    entry_t **buckets_;
 };
 
+template <typename key_t, typename val_t, typename allocator_t=KernelAllocator,
+          typename hasher=MurmurHasher>
+using LRUCache = ReplacementCache<key_t, val_t, LRUPolicy, allocator_t, hasher>;
+
+template <typename key_t, typename val_t, typename allocator_t=KernelAllocator,
+          typename hasher=MurmurHasher>
+using ClockCache = ReplacementCache<key_t, val_t, ClockPolicy, allocator_t,
+                                    hasher>;
+
+template <typename key_t, typename val_t, typename allocator_t=KernelAllocator,
+          typename hasher=MurmurHasher>
+using TwoQCache = ReplacementCache<key_t, val_t, TwoQPolicy, allocator_t,
+                                   hasher>;
+
 }
 
 #endif
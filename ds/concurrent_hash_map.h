@@ -0,0 +1,199 @@
+#ifndef CONCURRENT_HASH_MAP_H
+#define CONCURRENT_HASH_MAP_H
+
+#include <ds/hash_map.h>
+#include <ds/optional.h>
+#include <ds/spin_lock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+namespace ds {
+/**
+ * A hash map that may be used from several cores at once. Keys are spread
+ * over num_shards independent HashMaps by the top bits of their hash, each
+ * guarded by its own lock, so operations on different shards never contend.
+ * Each shard also grows on its own: a rehash holds up only the keys of the
+ * shard being rehashed, never the whole table.
+ *
+ * Values can't be handed out by reference, since another core could move
+ * them as soon as the shard's lock is dropped. Lookup returns a copy, and
+ * in-place changes go through Modify and Upsert, whose callbacks run with the
+ * shard locked. Those callbacks must not use the same map.
+ */
+template <typename key_t,
+          typename val_t,
+          typename allocator_t = KernelAllocator,
+          typename hasher      = MurmurHasher,
+          size_t num_shards    = 16>
+class ConcurrentHashMap
+{
+    static_assert(num_shards && ! (num_shards & (num_shards - 1)),
+                  "Shard count must be a power of two.");
+
+    using map_t = HashMap<key_t, val_t, allocator_t, hasher>;
+
+public:
+    ConcurrentHashMap() = default;
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap &operator=(const ConcurrentHashMap&) = delete;
+
+    /**
+     * @return Was the key absent, and so the value inserted?
+     */
+    bool Insert(const key_t &key, const val_t &val)
+    {
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        return shard.map_.Insert(key, val);
+    }
+
+    /**
+     * Construct a value in place unless the key is already present.
+     * @return Was the value inserted?
+     */
+    template <typename... val_arg_ts>
+    bool TryEmplace(const key_t &key, val_arg_ts&&... val_args)
+    {
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        return shard.map_.TryEmplace(key, std::forward<val_arg_ts>(val_args)...);
+    }
+
+    /**
+     * @return Was the key absent, rather than its value overwritten?
+     */
+    template <typename val_arg_t>
+    bool InsertOrAssign(const key_t &key, val_arg_t &&val)
+    {
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        return shard.map_.InsertOrAssign(key, std::forward<val_arg_t>(val));
+    }
+
+    /**
+     * @return A copy of the value for key, or NullOpt if there's none.
+     */
+    Optional<val_t> Lookup(const key_t &key)
+    {
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        return shard.map_.Lookup(key);
+    }
+
+    bool Contains(const key_t &key)
+    {
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        return shard.map_.Contains(key);
+    }
+
+    /**
+     * @return Was there a value to delete?
+     */
+    bool Delete(const key_t &key)
+    {
+        // Destroy the value only once the shard is unlocked, in case its
+        // destructor comes back to this map.
+        Optional<val_t> doomed;
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        val_t *val = shard.map_.LookupPtr(key);
+        if(! val) {
+            return false;
+        }
+        doomed = std::move(*val);
+        return shard.map_.Delete(key);
+    }
+
+    /**
+     * Change the value for key in place, atomically with respect to every
+     * other operation on it.
+     * @param fn Called as fn(val_t&) with the shard locked. Returning false
+     *           deletes the entry.
+     * @return Was the key present?
+     */
+    template <typename fn_t>
+    bool Modify(const key_t &key, fn_t fn)
+    {
+        Optional<val_t> doomed;
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        val_t *val = shard.map_.LookupPtr(key);
+        if(! val) {
+            return false;
+        }
+
+        if(! fn(*val)) {
+            doomed = std::move(*val);
+            shard.map_.Delete(key);
+        }
+        return true;
+    }
+
+    /**
+     * Change the value for key in place if present, otherwise construct one,
+     * as a single atomic step.
+     * @param fn Called as fn(val_t&) with the shard locked, if key is present.
+     * @param val_args Used to construct the value if key is absent.
+     * @return Was the value newly inserted?
+     */
+    template <typename fn_t, typename... val_arg_ts>
+    bool Upsert(const key_t &key, fn_t fn, val_arg_ts&&... val_args)
+    {
+        Shard &shard = ShardOf(key);
+        SpinLockGuard guard(shard.lock_);
+        if(val_t *val = shard.map_.LookupPtr(key)) {
+            fn(*val);
+            return false;
+        }
+        return shard.map_.TryEmplace(key, std::forward<val_arg_ts>(val_args)...);
+    }
+
+    /**
+     * @return Number of entries. Shards are counted one at a time, so this is
+     *         only a snapshot while other cores are changing the map.
+     */
+    size_t Len()
+    {
+        size_t len = 0;
+        for(Shard &shard : shards_) {
+            SpinLockGuard guard(shard.lock_);
+            len += shard.map_.Len();
+        }
+        return len;
+    }
+
+private:
+    static constexpr size_t SHARD_BITS = __builtin_ctzll(num_shards);
+
+    /**
+     * Shards are padded out to whole cache lines, so that taking one shard's
+     * lock doesn't invalidate the line holding its neighbour's.
+     */
+    struct Shard {
+        SpinLock lock_;
+        map_t map_;
+        uint8_t pad_[CACHE_LINE_SIZE -
+                     (sizeof(SpinLock) + sizeof(map_t)) % CACHE_LINE_SIZE];
+    };
+
+    Shard shards_[num_shards];
+
+    /**
+     * HashMap picks slots with the low bits of the hash, so shards are picked
+     * with the high ones to keep the two independent.
+     */
+    Shard &ShardOf(const key_t &key)
+    {
+        if constexpr(num_shards == 1) {
+            return shards_[0];
+        } else {
+            return shards_[hasher::Hash(key) >> (32 - SHARD_BITS)];
+        }
+    }
+};
+}
+
+#endif
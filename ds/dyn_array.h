@@ -5,7 +5,10 @@
 #include <libc/string.h>
 #include <sys/log.h>
 #include <ds/optional.h>
+#include <ds/type_traits.h>
 #include <initializer_list>
+#include <type_traits>
+#include <utility>
 
 namespace ds {
 template <typename T, typename allocator_t = KernelAllocator>
@@ -16,45 +19,40 @@ public:
         : slots_used_(0)
         , capacity_(0)
         , arr_(nullptr)
+        , inline_arr_(nullptr)
     {}
 
     DynArray(size_t init_size)
         : slots_used_(0)
         , capacity_(init_size)
         , arr_((T*) allocator_t::Allocate(capacity_ * sizeof(T)))
+        , inline_arr_(nullptr)
     {
         if(arr_) {
-            memset(arr_, 0, capacity_ * sizeof(T));
+            memset((void*) arr_, 0, capacity_ * sizeof(T));
         }
     }
 
     DynArray(const std::initializer_list<T>& els)
-        : slots_used_(els.size())
-        , capacity_(els.size() > 1 ?
-                        1 << (8 * sizeof(typeof(slots_used_)) -
-                          __builtin_clz(els.size() - 1)) :
-                        1)
-        , arr_((T*) allocator_t::Allocate(capacity_ * sizeof(T)))
+        : DynArray()
     {
-        if(arr_) {
-            memset(arr_, 0, capacity_ * sizeof(T));
-        }
+        Reserve(els.size());
         for (size_t i = 0; i < els.size(); ++i) {
             arr_[i] = *(els.begin() + i);
         }
+        slots_used_ = els.size();
     }
 
     DynArray(const DynArray& rhs)
-        : slots_used_(rhs.slots_used_)
-        , capacity_(rhs.capacity_)
-        , arr_((T*) allocator_t::Allocate(capacity_ * sizeof(T)))
+        : DynArray()
     {
-        if(arr_) {
-            memset((void*) arr_, 0, capacity_ * sizeof(T));
-        }
-        for (size_t i = 0; i < rhs.Size(); ++i) {
-            arr_[i] = rhs[i];
-        }
+        CopyFrom(rhs);
+    }
+
+    DynArray(DynArray&& rhs)
+        : DynArray()
+    {
+        MoveFrom(rhs);
     }
 
     DynArray& operator=(const DynArray& rhs)
@@ -62,47 +60,48 @@ public:
         if (&rhs == this) {
             return *this;
         }
-        if (arr_) {
-            allocator_t::Free(arr_);
-        }
 
-        slots_used_ = rhs.slots_used_;
-        capacity_   = rhs.capacity_;
-        if(capacity_) {
-            arr_ = (T*) allocator_t::Allocate(capacity_ * sizeof(T));
-            memset(arr_, 0, capacity_ * sizeof(T));
+        Clear();
+        CopyFrom(rhs);
+        return *this;
+    }
 
-            for (size_t i = 0; i < rhs.Size(); ++i) {
-                arr_[i] = rhs.arr_[i];
-            }
+    DynArray& operator=(DynArray&& rhs)
+    {
+        if (&rhs == this) {
+            return *this;
         }
+
+        Clear();
+        MoveFrom(rhs);
         return *this;
     }
 
     ~DynArray()
     {
-        if(arr_) {
-            allocator_t::Free(arr_);
-        }
+        FreeArr();
     }
 
     void Append(const T& el)
     {
         if (slots_used_ == capacity_) {
-            capacity_ = capacity_ ? capacity_ * 2 : 1;
-            if(arr_) {
-                arr_ = (T*) allocator_t::Reallocate(arr_, capacity_ * sizeof(T));
-                memset(&arr_[slots_used_], 0,
-                       (capacity_ - slots_used_) * sizeof(T));
-
-            } else {
-                arr_ = (T*) allocator_t::Allocate(capacity_ * sizeof(T));
-                memset(arr_, 0, capacity_ * sizeof(T));
-            }
+            Grow(capacity_ ? capacity_ * 2 : 1);
         }
         arr_[slots_used_++] = el;
     }
 
+    /**
+     * Ensure there is room for at least the given number of elements, so
+     * that appending up to that many never reallocates.
+     * @param capacity Number of elements to make room for.
+     */
+    void Reserve(size_t capacity)
+    {
+        if (capacity > capacity_) {
+            Grow(capacity);
+        }
+    }
+
     T Lookup(int ind) const
     {
         // Bounds checking; if negative, abs(ind) should be less than no. slots
@@ -118,7 +117,11 @@ public:
 
     void Remove(size_t ind)
     {
-        memmove(&arr_[ind], arr_[ind + 1], --slots_used_ - ind);
+        Destroy(ind, ind + 1);
+        --slots_used_;
+        memmove((void*) &arr_[ind], (void*) &arr_[ind + 1],
+                (slots_used_ - ind) * sizeof(T));
+        ZeroFill(slots_used_, slots_used_ + 1);
     }
 
     size_t Size() const
@@ -126,6 +129,13 @@ public:
         return slots_used_;
     }
 
+    void Clear()
+    {
+        Destroy(0, slots_used_);
+        ZeroFill(0, slots_used_);
+        slots_used_ = 0;
+    }
+
     T Back() const
     {
         return arr_[slots_used_ - 1];
@@ -150,9 +160,188 @@ public:
     }
 
 protected:
+    // Trivially copyable elements are copied bytewise and never zeroed ahead
+    // of being overwritten. Anything else is assigned into zeroed slots, and
+    // destroyed when removed. Trivially relocatable elements are still moved
+    // bytewise when the array grows.
+    static constexpr bool TRIVIAL = std::is_trivially_copyable<T>::value;
+    static constexpr bool RELOCATABLE = IsTriviallyRelocatable<T>::value;
+
     size_t slots_used_, capacity_;
     T*     arr_;
+    // Storage embedded in a derived SmallDynArray, if any. It is never freed,
+    // and is only handed over to other arrays by copying.
+    T*     inline_arr_;
+
+    void ZeroFill(size_t start, size_t end)
+    {
+        if constexpr (! TRIVIAL) {
+            memset((void*) &arr_[start], 0, (end - start) * sizeof(T));
+        }
+    }
+
+    void Destroy(size_t start, size_t end)
+    {
+        if constexpr (! TRIVIAL) {
+            for (size_t i = start; i < end; ++i) {
+                arr_[i].~T();
+            }
+        }
+    }
+
+    void FreeArr()
+    {
+        Destroy(0, slots_used_);
+        if (arr_ && arr_ != inline_arr_) {
+            allocator_t::Free(arr_);
+        }
+    }
+
+    void Grow(size_t new_capacity)
+    {
+        if (RELOCATABLE && arr_ && arr_ != inline_arr_) {
+            arr_ = (T*) allocator_t::Reallocate(arr_, new_capacity * sizeof(T));
+        } else {
+            auto new_arr = (T*) allocator_t::Allocate(new_capacity *
+                                                      sizeof(T));
+            if constexpr (RELOCATABLE) {
+                if (slots_used_) {
+                    memcpy((void*) new_arr, (void*) arr_,
+                           slots_used_ * sizeof(T));
+                }
+            } else {
+                memset((void*) new_arr, 0, new_capacity * sizeof(T));
+                for (size_t i = 0; i < slots_used_; ++i) {
+                    new_arr[i] = std::move(arr_[i]);
+                }
+                Destroy(0, slots_used_);
+            }
+            if (arr_ != inline_arr_) {
+                allocator_t::Free(arr_);
+            }
+            arr_ = new_arr;
+        }
+
+        capacity_ = new_capacity;
+        ZeroFill(slots_used_, capacity_);
+    }
+
+    /**
+     * Copy rhs's elements into this (empty) array, reusing the current
+     * storage if it's large enough.
+     */
+    void CopyFrom(const DynArray& rhs)
+    {
+        Reserve(rhs.slots_used_);
+        if constexpr (TRIVIAL) {
+            if (rhs.slots_used_) {
+                memcpy(arr_, rhs.arr_, rhs.slots_used_ * sizeof(T));
+            }
+        } else {
+            for (size_t i = 0; i < rhs.slots_used_; ++i) {
+                arr_[i] = rhs.arr_[i];
+            }
+        }
+        slots_used_ = rhs.slots_used_;
+    }
+
+    /**
+     * Take over rhs's elements, leaving it empty. Heap storage is stolen
+     * outright; inline storage has to be copied.
+     */
+    void MoveFrom(DynArray& rhs)
+    {
+        if (rhs.arr_ == rhs.inline_arr_) {
+            CopyFrom(rhs);
+            rhs.Clear();
+            return;
+        }
+
+        FreeArr();
+        arr_ = rhs.arr_;
+        capacity_ = rhs.capacity_;
+        slots_used_ = rhs.slots_used_;
+        rhs.arr_ = rhs.inline_arr_;
+        rhs.capacity_ = 0;
+        rhs.slots_used_ = 0;
+    }
+};
+
+// A plain DynArray never points into itself, though a SmallDynArray does.
+template <typename T, typename allocator_t>
+struct IsTriviallyRelocatable<DynArray<T, allocator_t>> {
+    static constexpr bool value = true;
+};
+
+/**
+ * A DynArray whose first N elements are stored inline, so that short lists
+ * need no allocation at all. It may be passed anywhere a DynArray is
+ * expected.
+ */
+template <typename T, size_t N, typename allocator_t = KernelAllocator>
+class SmallDynArray : public DynArray<T, allocator_t>
+{
+    using base_t = DynArray<T, allocator_t>;
+
+public:
+    SmallDynArray()
+    {
+        UseInline();
+    }
+
+    SmallDynArray(const std::initializer_list<T>& els)
+    {
+        UseInline();
+        base_t::Reserve(els.size());
+        for (size_t i = 0; i < els.size(); ++i) {
+            this->arr_[i] = *(els.begin() + i);
+        }
+        this->slots_used_ = els.size();
+    }
+
+    SmallDynArray(const base_t& rhs)
+        : base_t()
+    {
+        UseInline();
+        base_t::CopyFrom(rhs);
+    }
+
+    SmallDynArray(const SmallDynArray& rhs)
+        : base_t()
+    {
+        UseInline();
+        base_t::CopyFrom(rhs);
+    }
+
+    SmallDynArray(SmallDynArray&& rhs)
+        : base_t()
+    {
+        UseInline();
+        base_t::MoveFrom(rhs);
+    }
+
+    SmallDynArray& operator=(const SmallDynArray& rhs)
+    {
+        base_t::operator=(rhs);
+        return *this;
+    }
+
+    SmallDynArray& operator=(SmallDynArray&& rhs)
+    {
+        base_t::operator=(std::move(rhs));
+        return *this;
+    }
+
+private:
+    alignas(T) char inline_storage_[N * sizeof(T)];
+
+    void UseInline()
+    {
+        this->arr_ = this->inline_arr_ = (T*) inline_storage_;
+        this->capacity_ = N;
+        base_t::ZeroFill(0, N);
+    }
 };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -3,9 +3,11 @@
 
 #include <ds/string.h>
 #include <ds/optional.h>
+#include <ds/type_traits.h>
 #include <libc/string.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <utility>
 
 namespace ds {
 class MurmurHasher
@@ -17,13 +19,39 @@ public:
         return murmur3_32((uint8_t*) &plaintext, sizeof(plaintext), 0);
     }
 
-    static uint32_t Hash(const ds::String &plaintext)
+    /**
+     * Integers and pointers, such as inode and sector numbers, go through a
+     * single finalizer rather than a full pass over their bytes.
+     */
+    template <typename T>
+        requires std::is_integral<T>::value || std::is_pointer<T>::value
+    static uint32_t Hash(const T& plaintext)
+    {
+        if constexpr (sizeof(T) <= sizeof(uint32_t)) {
+            return fmix32((uint32_t) plaintext);
+        } else {
+            uint64_t h = fmix64((uint64_t) plaintext);
+            return h ^ (h >> 32);
+        }
+    }
+
+    template <typename allocator_t>
+    static uint32_t Hash(const ds::BaseString<allocator_t> &plaintext)
     {
-        return murmur3_32((const uint8_t*) plaintext.ToChars(), plaintext.Len(),
-                          0);
+        return plaintext.CachedHash(&HashChars);
+    }
+
+    static uint32_t Hash(const ds::StringView &plaintext)
+    {
+        return HashChars(plaintext.Data(), plaintext.Len());
     }
 
 private:
+    static uint32_t HashChars(const char *chars, size_t len)
+    {
+        return murmur3_32((const uint8_t*) chars, len, 0);
+    }
+
     static inline uint32_t murmur_32_scramble(uint32_t k)
     {
         k *= 0xcc9e2d51;
@@ -32,6 +60,26 @@ private:
         return k;
     }
 
+    static uint32_t fmix32(uint32_t h)
+    {
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+
+    static uint64_t fmix64(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccd;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53;
+        k ^= k >> 33;
+        return k;
+    }
+
     static uint32_t murmur3_32(const uint8_t* key, size_t len, uint32_t seed)
     {
         uint32_t h = seed;
@@ -52,25 +100,249 @@ private:
 
         h ^= murmur_32_scramble(k);
         h ^= len;
-        h ^= h >> 16;
-        h *= 0x85ebca6b;
-        h ^= h >> 13;
-        h *= 0xc2b2ae35;
-        h ^= h >> 16;
-        return h;
+        return fmix32(h);
+    }
+};
+
+/**
+ * A hasher built on wyhash, which consumes 8 bytes per multiply rather than
+ * murmur's 4 and so is considerably faster on longer strings. Interchangeable
+ * with MurmurHasher through HashMap's hasher parameter.
+ */
+class WyHasher
+{
+public:
+    template <typename T>
+    static uint32_t Hash(const T& plaintext)
+    {
+        return wyhash((const uint8_t*) &plaintext, sizeof(plaintext), 0);
+    }
+
+    template <typename T>
+        requires std::is_integral<T>::value || std::is_pointer<T>::value
+    static uint32_t Hash(const T& plaintext)
+    {
+        uint64_t h = wymix((uint64_t) plaintext ^ SECRET[0], SECRET[1]);
+        return h ^ (h >> 32);
+    }
+
+    template <typename allocator_t>
+    static uint32_t Hash(const ds::BaseString<allocator_t> &plaintext)
+    {
+        return plaintext.CachedHash(&HashChars);
+    }
+
+    static uint32_t Hash(const ds::StringView &plaintext)
+    {
+        return HashChars(plaintext.Data(), plaintext.Len());
+    }
+
+private:
+    static constexpr uint64_t SECRET[4] = {
+        0x2d358dccaa6c78a5, 0x8bb84b93962eacc9,
+        0x4b33a62ed433d4a3, 0x4d5a2da51de1aa47
+    };
+
+    static uint32_t HashChars(const char *chars, size_t len)
+    {
+        uint64_t h = wyhash((const uint8_t*) chars, len, 0);
+        return h ^ (h >> 32);
+    }
+
+    static uint64_t wymix(uint64_t a, uint64_t b)
+    {
+        unsigned __int128 r = (unsigned __int128) a * b;
+        return (uint64_t) r ^ (uint64_t) (r >> 64);
+    }
+
+    static uint64_t wyr8(const uint8_t *p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t wyr4(const uint8_t *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t wyr3(const uint8_t *p, size_t len)
+    {
+        return ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) |
+               p[len - 1];
+    }
+
+    static uint64_t wyhash(const uint8_t *key, size_t len, uint64_t seed)
+    {
+        seed ^= wymix(seed ^ SECRET[0], SECRET[1]);
+        uint64_t a, b;
+        if (len <= 16) {
+            if (len >= 4) {
+                size_t mid = (len >> 3) << 2;
+                a = (wyr4(key) << 32) | wyr4(key + mid);
+                b = (wyr4(key + len - 4) << 32) | wyr4(key + len - 4 - mid);
+            } else if (len > 0) {
+                a = wyr3(key, len);
+                b = 0;
+            } else {
+                a = b = 0;
+            }
+        } else {
+            size_t rem = len;
+            if (rem > 48) {
+                uint64_t seed1 = seed, seed2 = seed;
+                do {
+                    seed = wymix(wyr8(key) ^ SECRET[1], wyr8(key + 8) ^ seed);
+                    seed1 = wymix(wyr8(key + 16) ^ SECRET[2],
+                                  wyr8(key + 24) ^ seed1);
+                    seed2 = wymix(wyr8(key + 32) ^ SECRET[3],
+                                  wyr8(key + 40) ^ seed2);
+                    key += 48;
+                    rem -= 48;
+                } while (rem > 48);
+                seed ^= seed1 ^ seed2;
+            }
+
+            while (rem > 16) {
+                seed = wymix(wyr8(key) ^ SECRET[1], wyr8(key + 8) ^ seed);
+                key += 16;
+                rem -= 16;
+            }
+            a = wyr8(key + rem - 16);
+            b = wyr8(key + rem - 8);
+        }
+
+        a ^= SECRET[1];
+        b ^= seed;
+        unsigned __int128 r = (unsigned __int128) a * b;
+        a = (uint64_t) r;
+        b = (uint64_t) (r >> 64);
+        return wymix(a ^ SECRET[0] ^ len, b ^ SECRET[1]);
+    }
+};
+
+/**
+ * Marks lookup_t as a stand-in for key_t: it hashes and compares equal
+ * exactly as the equivalent key_t would, so a map keyed by key_t can be probed
+ * with it directly, without constructing (and allocating) a key. Hashers used
+ * with such maps must give both types the same hash.
+ */
+template <typename key_t, typename lookup_t>
+struct IsTransparentKey {
+    static constexpr bool value = false;
+};
+
+template <typename allocator_t>
+struct IsTransparentKey<BaseString<allocator_t>, StringView> {
+    static constexpr bool value = true;
+};
+
+/**
+ * A group of 8 control bytes, matched 8 at a time within a general purpose
+ * register (SWAR). Lane i of a match is reported in bit 8i + 7. This is
+ * deliberately the only implementation: a header that picked SSE2 whenever
+ * __SSE2__ is defined would give *_simd.cpp units a different ProbeGroup,
+ * and so a different HashMap, than the rest of the kernel.
+ */
+class ProbeGroup
+{
+public:
+    static constexpr size_t WIDTH = 8;
+
+    class Mask
+    {
+    public:
+        explicit Mask(uint64_t mask)
+            : mask_(mask)
+        {}
+
+        explicit operator bool() const
+        {
+            return mask_ != 0;
+        }
+
+        size_t Lowest() const
+        {
+            return __builtin_ctzll(mask_) >> 3;
+        }
+
+        void ClearLowest()
+        {
+            mask_ &= mask_ - 1;
+        }
+
+        size_t TrailingZeros() const
+        {
+            return __builtin_ctzll(mask_) >> 3;
+        }
+
+        size_t LeadingZeros() const
+        {
+            return __builtin_clzll(mask_) >> 3;
+        }
+
+    private:
+        uint64_t mask_;
+    };
+
+    explicit ProbeGroup(const int8_t *ctrl)
+    {
+        memcpy(&ctrl_, ctrl, sizeof(ctrl_));
+    }
+
+    /**
+     * Find lanes holding a given H2 tag. The subtraction trick may report
+     * false positives in a lane directly above a true match; callers compare
+     * keys anyway, so these are harmless.
+     */
+    Mask Match(int8_t h2) const
+    {
+        uint64_t x = ctrl_ ^ (LSBS * (uint8_t) h2);
+        return Mask((x - LSBS) & ~x & MSBS);
     }
+
+    Mask MatchEmpty() const
+    {
+        // Empty (0x80) is the only value with bit 7 set and bit 1 clear.
+        return Mask(ctrl_ & (~ctrl_ << 6) & MSBS);
+    }
+
+    Mask MatchEmptyOrDeleted() const
+    {
+        // Empty (0x80) and deleted (0xFE) are the only values with bit 7 set
+        // and bit 0 clear.
+        return Mask(ctrl_ & (~ctrl_ << 7) & MSBS);
+    }
+
+private:
+    static constexpr uint64_t LSBS = 0x0101010101010101;
+    static constexpr uint64_t MSBS = 0x8080808080808080;
+
+    uint64_t ctrl_;
 };
 
 /**
+ * An open-addressing hash map in the style of Swiss tables. Each slot has a
+ * control byte in mdata_ which is either EMPTY, DELETED, or, for a full slot,
+ * the low 7 bits (H2) of its key's hash. Probing inspects a whole group of
+ * control bytes at a time, so most lookups touch one group and compare a
+ * single key. Capacity is always a power of two, and the first WIDTH - 1
+ * control bytes are mirrored past the end of mdata_ so that a group may be
+ * loaded from any slot without wrapping.
  *
  * @tparam key_t
  * @tparam val_t
  * @tparam allocator
  * @tparam inv_load_factor Inverse of the load factor. Using this instead of an
  *                         actual load factor, because I don't want to pollute
- *                         kernel code with floating points. When num_entries /
- *                         capacity exceeds 1 / inv_load_factor, increase size
- *                         of array by inv_load_factor.
+ *                         kernel code with floating points. When (full and
+ *                         deleted slots) / capacity would exceed
+ *                         1 / inv_load_factor, the table is rehashed: in
+ *                         place if tombstones make up most of the load,
+ *                         otherwise into twice the capacity.
  */
 template <typename key_t,
           typename val_t,
@@ -79,6 +351,8 @@ template <typename key_t,
           size_t inv_load_factor = 3>
 class HashMap
 {
+    static_assert(inv_load_factor > 1, "Table must keep an empty slot.");
+
     enum entry_type_t {
         EMPTY   = -128,
         DELETED = -2
@@ -89,33 +363,34 @@ class HashMap
         val_t val_;
     };
 
+    static constexpr size_t WIDTH = ProbeGroup::WIDTH;
+
 public:
+    /**
+     * @param initial_size Number of slots to reserve up front. Maps with an
+     *                     initial size of 0 or 1 allocate nothing until the
+     *                     first insertion.
+     */
     HashMap(size_t initial_size = 1)
-        : mdata_((int8_t*) allocator_t::Allocate(initial_size))
-        , capacity_(initial_size)
+        : mdata_(nullptr)
+        , capacity_(0)
         , num_entries_(0)
-        , map_((HashMapEntry*) allocator_t::Allocate(initial_size *
-                                                     sizeof(HashMapEntry)))
+        , num_deleted_(0)
+        , map_(nullptr)
     {
-        for (size_t i = 0; i < initial_size; ++i) {
-            mdata_[i] = EMPTY;
+        if(initial_size > 1) {
+            Allocate(NormalizeCapacity(initial_size));
         }
     }
 
     HashMap(const HashMap &rhs)
-        : mdata_((int8_t*) allocator_t::Allocate(rhs.capacity_))
-        , capacity_(rhs.capacity_)
-        , num_entries_(rhs.num_entries_)
-        , map_((HashMapEntry*) allocator_t::Allocate(capacity_ *
-                                                     sizeof(HashMapEntry)))
+        : mdata_(nullptr)
+        , capacity_(0)
+        , num_entries_(0)
+        , num_deleted_(0)
+        , map_(nullptr)
     {
-        for(size_t i = 0; i < capacity_; ++i) {
-            mdata_[i] = rhs.mdata_[i];
-            if(rhs.mdata_[i] != EMPTY && rhs.mdata_[i] != DELETED) {
-                new(&map_[i].key_) key_t(rhs.map_[i].key_);
-                new(&map_[i].val_) val_t(rhs.map_[i].val_);
-            }
-        }
+        CopyFrom(rhs);
     }
 
     HashMap &operator =(const HashMap &rhs)
@@ -123,32 +398,9 @@ public:
         if(&rhs == this) {
             return *this;
         }
-        if(mdata_) {
-            allocator_t::Free(mdata_);
-        }
-        if(map_) {
-            for(size_t i = 0; i < capacity_; ++i) {
-                if(mdata_[i] != EMPTY && mdata_[i] != DELETED) {
-                    map_[i].key_.~key_t();
-                    map_[i].val_.~val_t();
-                }
-            }
-            allocator_t::Free(map_);
-        }
-
-        mdata_ = (int8_t*) allocator_t::Allocate(rhs.capacity_);
-        capacity_ = rhs.capacity_;
-        num_entries_ = (rhs.num_entries_);
-        map_ = (HashMapEntry*) allocator_t::Allocate(capacity_ *
-                                                       sizeof(HashMapEntry));
-        for(size_t i = 0; i < rhs.capacity_; ++i) {
-            mdata_[i] = rhs.mdata_[i];
-            if(rhs.mdata_[i] != EMPTY && rhs.mdata_[i] != DELETED) {
-                new (&map_[i].key_) key_t(rhs.map_[i].key_);
-                new (&map_[i].val_) val_t(rhs.map_[i].val_);
-            }
-        }
 
+        Destroy();
+        CopyFrom(rhs);
         return *this;
     }
 
@@ -156,104 +408,158 @@ public:
             : mdata_(rhs.mdata_)
             , capacity_(rhs.capacity_)
             , num_entries_(rhs.num_entries_)
+            , num_deleted_(rhs.num_deleted_)
             , map_(rhs.map_)
     {
         rhs.mdata_ = nullptr;
         rhs.capacity_ = 0;
         rhs.num_entries_ = 0;
+        rhs.num_deleted_ = 0;
         rhs.map_ = nullptr;
     }
 
     HashMap &operator=(HashMap &&rhs) noexcept
     {
-        if(mdata_) {
-            allocator_t::Free(mdata_);
-        }
-        if(map_) {
-            for(size_t i = 0; i < capacity_; ++i) {
-                if(mdata_[i] != EMPTY && mdata_[i] != DELETED) {
-                    map_[i].key_.~key_t();
-                    map_[i].val_.~val_t();
-                }
-            }
-            allocator_t::Free(map_);
+        if(&rhs == this) {
+            return *this;
         }
 
+        Destroy();
         mdata_ = rhs.mdata_;
         capacity_ = rhs.capacity_;
         num_entries_ = rhs.num_entries_;
+        num_deleted_ = rhs.num_deleted_;
         map_ = rhs.map_;
 
         rhs.mdata_ = nullptr;
         rhs.capacity_ = 0;
         rhs.num_entries_ = 0;
+        rhs.num_deleted_ = 0;
         rhs.map_ = nullptr;
         return *this;
     }
 
     ~HashMap()
     {
-        if(mdata_) {
-            allocator_t::Free(mdata_);
-        }
-        if(map_) {
-            for(size_t i = 0; i < capacity_; ++i) {
-                if(mdata_[i] != EMPTY && mdata_[i] != DELETED) {
-                    map_[i].key_.~key_t();
-                    map_[i].val_.~val_t();
-                }
-            }
-            allocator_t::Free(map_);
-        }
+        Destroy();
     }
 
     bool Insert(const key_t& key, const val_t& val)
     {
-        size_t   ind;
-        uint32_t hash = hasher::Hash(key);
-        for (ind = H1(hash) % capacity_;
-             mdata_[ind] != EMPTY && mdata_[ind] != DELETED;
-             ind = (ind + 1) % capacity_) {
-            if (H2(hash) == mdata_[ind] && key == map_[ind].key_) {
-                return false;
-            }
-        }
+        return TryEmplace(key, val);
+    }
 
-        mdata_[ind] = H2(hash);
-        new (&map_[ind].val_) val_t(val);
-        new (&map_[ind].key_) key_t(key);
-        //map_[ind]   = (HashMapEntry){ key, val };
+    bool Insert(key_t&& key, val_t&& val)
+    {
+        return TryEmplace(std::move(key), std::move(val));
+    }
 
-        if (++num_entries_ > capacity_ / inv_load_factor) {
-            Rehash();
-        }
+    /**
+     * Insert an entry whose key and value are constructed in place from the
+     * given arguments. The key is always constructed, so prefer TryEmplace
+     * when a key_t is already at hand.
+     * @param key_arg Argument to construct the key from.
+     * @param val_args Arguments to construct the value from.
+     * @return False if an entry with an equal key already exists.
+     */
+    template <typename key_arg_t, typename... val_arg_ts>
+    bool Emplace(key_arg_t&& key_arg, val_arg_ts&&... val_args)
+    {
+        key_t key(std::forward<key_arg_t>(key_arg));
+        return TryEmplace(std::move(key),
+                          std::forward<val_arg_ts>(val_args)...);
+    }
 
-        return true;
+    /**
+     * Insert an entry if its key is not yet present. Nothing is constructed,
+     * and the arguments are left untouched, if it is.
+     * @param key The key, copied or moved into the map.
+     * @param val_args Arguments to construct the value from.
+     * @return Was the entry inserted?
+     */
+    template <typename... val_arg_ts>
+    bool TryEmplace(const key_t& key, val_arg_ts&&... val_args)
+    {
+        return TryEmplaceImpl(key, std::forward<val_arg_ts>(val_args)...);
+    }
+
+    template <typename... val_arg_ts>
+    bool TryEmplace(key_t&& key, val_arg_ts&&... val_args)
+    {
+        return TryEmplaceImpl(std::move(key),
+                              std::forward<val_arg_ts>(val_args)...);
+    }
+
+    /**
+     * Insert an entry, or assign to the value of the existing entry with an
+     * equal key.
+     * @return True if a new entry was inserted, false if one was assigned.
+     */
+    template <typename val_arg_t>
+    bool InsertOrAssign(const key_t& key, val_arg_t&& val)
+    {
+        return InsertOrAssignImpl(key, std::forward<val_arg_t>(val));
+    }
+
+    template <typename val_arg_t>
+    bool InsertOrAssign(key_t&& key, val_arg_t&& val)
+    {
+        return InsertOrAssignImpl(std::move(key), std::forward<val_arg_t>(val));
     }
 
     ds::Optional<val_t> Lookup(const key_t& key) const
     {
-        int64_t key_ind = Find(key);
-        if (key_ind == -1) {
-            return ds::NullOpt;
-        }
-        return map_[key_ind].val_;
+        return LookupImpl(key);
     }
 
-    bool Contains(const key_t& key)
+    template <typename lookup_t>
+        requires IsTransparentKey<key_t, lookup_t>::value
+    ds::Optional<val_t> Lookup(const lookup_t& key) const
     {
-        int64_t key_ind = Find(key);
-        return key_ind != -1;
+        return LookupImpl(key);
+    }
+
+    /**
+     * Look up a value without copying it.
+     * @return The value for key, or nullptr if there's none. The pointer is
+     *         only good until the map is next inserted into or deleted from.
+     */
+    val_t *LookupPtr(const key_t& key)
+    {
+        int64_t key_ind = Find(key, hasher::Hash(key));
+        return key_ind == -1 ? nullptr : &map_[key_ind].val_;
+    }
+
+    template <typename lookup_t>
+        requires IsTransparentKey<key_t, lookup_t>::value
+    val_t *LookupPtr(const lookup_t& key)
+    {
+        int64_t key_ind = Find(key, hasher::Hash(key));
+        return key_ind == -1 ? nullptr : &map_[key_ind].val_;
+    }
+
+    bool Contains(const key_t& key) const
+    {
+        return Find(key, hasher::Hash(key)) != -1;
+    }
+
+    template <typename lookup_t>
+        requires IsTransparentKey<key_t, lookup_t>::value
+    bool Contains(const lookup_t& key) const
+    {
+        return Find(key, hasher::Hash(key)) != -1;
     }
 
     bool Delete(const key_t& key)
     {
-        int64_t key_ind = Find(key);
-        if (key_ind == -1) {
-            return false;
-        }
-        mdata_[key_ind] = DELETED;
-        return true;
+        return DeleteImpl(key);
+    }
+
+    template <typename lookup_t>
+        requires IsTransparentKey<key_t, lookup_t>::value
+    bool Delete(const lookup_t& key)
+    {
+        return DeleteImpl(key);
     }
 
     size_t Len() const
@@ -263,13 +569,13 @@ public:
 
     val_t operator[](const key_t &key) const
     {
-        int64_t key_ind = Find(key);
-        return map_[key_ind];
+        int64_t key_ind = Find(key, hasher::Hash(key));
+        return map_[key_ind].val_;
     }
 
     val_t& operator[](const key_t &key)
     {
-        int64_t key_ind = Find(key);
+        int64_t key_ind = Find(key, hasher::Hash(key));
         return (val_t&) map_[key_ind].val_;
     }
 
@@ -283,7 +589,7 @@ public:
         ds::Optional<key_t> Key() const
         {
             if(Valid()) {
-                return hmap_->map_[ind_]->key_;
+                return hmap_->map_[ind_].key_;
             }
             return ds::NullOpt;
         }
@@ -291,7 +597,7 @@ public:
         ds::Optional<val_t> Val() const
         {
             if(Valid()) {
-                return hmap_->map_[ind_]->val_;
+                return hmap_->map_[ind_].val_;
             }
             return ds::NullOpt;
         }
@@ -299,28 +605,26 @@ public:
         void SetVal(const val_t &new_val)
         {
             if(Valid()) {
-                hmap_[ind_].val_.~val_t();
-                new(&hmap_[ind_].val_) val_t(new_val);
+                hmap_->map_[ind_].val_.~val_t();
+                new(&hmap_->map_[ind_].val_) val_t(new_val);
             }
         }
 
         bool Forward()
         {
-            do { ++ind_; } while(! Valid());
+            do { ++ind_; } while(InBounds() && ! Valid());
             return Valid();
         }
 
         bool Backward()
         {
-            do { --ind_; } while(! Valid());
+            do { --ind_; } while(InBounds() && ! Valid());
             return Valid();
         }
 
         bool Valid() const
         {
-            return ind_ < hmap_->capacity_ && ind_ > 0 &&
-                    hmap_->mdata_[ind_] != EMPTY &&
-                    hmap_->mdata_[ind_] != DELETED;
+            return InBounds() && hmap_->mdata_[ind_] >= 0;
         }
 
         void Reset()
@@ -343,13 +647,20 @@ public:
         }
 
     private:
-        Itr(HashMap *hmap, size_t ind)
+        friend class HashMap;
+
+        Itr(const HashMap *hmap, int64_t ind)
             : hmap_(hmap)
             , ind_(ind)
         {}
 
-        HashMap *hmap_;
-        size_t ind_;
+        bool InBounds() const
+        {
+            return ind_ >= 0 && (size_t) ind_ < hmap_->capacity_;
+        }
+
+        const HashMap *hmap_;
+        int64_t ind_;
     };
 
     Itr Begin() const
@@ -368,60 +679,334 @@ public:
 
 private:
     int8_t *mdata_;
-    size_t  capacity_, num_entries_;
+    size_t  capacity_, num_entries_, num_deleted_;
     HashMapEntry *map_;
 
-    int64_t Find(const key_t& key) const
+    static size_t NormalizeCapacity(size_t capacity)
+    {
+        if (capacity <= WIDTH) {
+            return WIDTH;
+        }
+        return (size_t) 1 << (64 - __builtin_clzl(capacity - 1));
+    }
+
+    static size_t MaxLoad(size_t capacity)
+    {
+        return capacity / inv_load_factor;
+    }
+
+    void Allocate(size_t capacity)
+    {
+        capacity_ = capacity;
+        mdata_ = (int8_t*) allocator_t::Allocate(capacity_ + WIDTH - 1);
+        map_ = (HashMapEntry*) allocator_t::Allocate(capacity_ *
+                                                     sizeof(HashMapEntry));
+        memset(mdata_, EMPTY, capacity_ + WIDTH - 1);
+    }
+
+    void Destroy()
+    {
+        if(map_) {
+            for(size_t i = 0; i < capacity_; ++i) {
+                if(mdata_[i] >= 0) {
+                    map_[i].key_.~key_t();
+                    map_[i].val_.~val_t();
+                }
+            }
+            allocator_t::Free(map_);
+        }
+        if(mdata_) {
+            allocator_t::Free(mdata_);
+        }
+
+        mdata_ = nullptr;
+        map_ = nullptr;
+        capacity_ = num_entries_ = num_deleted_ = 0;
+    }
+
+    void CopyFrom(const HashMap &rhs)
+    {
+        if(! rhs.capacity_) {
+            return;
+        }
+
+        // Same capacity, same hashes: every entry can keep its slot.
+        Allocate(rhs.capacity_);
+        memcpy(mdata_, rhs.mdata_, capacity_ + WIDTH - 1);
+        num_entries_ = rhs.num_entries_;
+        num_deleted_ = rhs.num_deleted_;
+        if constexpr (std::is_trivially_copyable<HashMapEntry>::value) {
+            memcpy(map_, rhs.map_, capacity_ * sizeof(HashMapEntry));
+            return;
+        }
+
+        for(size_t i = 0; i < capacity_; ++i) {
+            if(mdata_[i] >= 0) {
+                new (&map_[i].key_) key_t(rhs.map_[i].key_);
+                new (&map_[i].val_) val_t(rhs.map_[i].val_);
+            }
+        }
+    }
+
+    /**
+     * Set a control byte, along with its mirror past the end of the table
+     * if it is one of the first WIDTH - 1 slots.
+     */
+    void SetCtrl(size_t ind, int8_t ctrl)
+    {
+        mdata_[ind] = ctrl;
+        mdata_[((ind - (WIDTH - 1)) & (capacity_ - 1)) + (WIDTH - 1)] = ctrl;
+    }
+
+    template <typename key_arg_t, typename... val_arg_ts>
+    bool TryEmplaceImpl(key_arg_t&& key, val_arg_ts&&... val_args)
     {
         uint32_t hash = hasher::Hash(key);
+        if (Find(key, hash) != -1) {
+            return false;
+        }
 
-        for (uint32_t ind = H1(hash) % capacity_;
-             ind < capacity_ && mdata_[ind] != EMPTY;
-             ind = (ind + 1) % capacity_)
-        {
-            if (H2(hash) == mdata_[ind] && key == map_[ind].key_) {
-                return ind;
+        size_t ind = PrepareInsert(hash);
+        new (&map_[ind].key_) key_t(std::forward<key_arg_t>(key));
+        new (&map_[ind].val_) val_t(std::forward<val_arg_ts>(val_args)...);
+        return true;
+    }
+
+    template <typename key_arg_t, typename val_arg_t>
+    bool InsertOrAssignImpl(key_arg_t&& key, val_arg_t&& val)
+    {
+        uint32_t hash = hasher::Hash(key);
+        int64_t key_ind = Find(key, hash);
+        if (key_ind != -1) {
+            map_[key_ind].val_ = std::forward<val_arg_t>(val);
+            return false;
+        }
+
+        size_t ind = PrepareInsert(hash);
+        new (&map_[ind].key_) key_t(std::forward<key_arg_t>(key));
+        new (&map_[ind].val_) val_t(std::forward<val_arg_t>(val));
+        return true;
+    }
+
+    template <typename lookup_t>
+    ds::Optional<val_t> LookupImpl(const lookup_t& key) const
+    {
+        int64_t key_ind = Find(key, hasher::Hash(key));
+        if (key_ind == -1) {
+            return ds::NullOpt;
+        }
+        return map_[key_ind].val_;
+    }
+
+    template <typename lookup_t>
+    bool DeleteImpl(const lookup_t& key)
+    {
+        int64_t key_ind = Find(key, hasher::Hash(key));
+        if (key_ind == -1) {
+            return false;
+        }
+
+        map_[key_ind].key_.~key_t();
+        map_[key_ind].val_.~val_t();
+        --num_entries_;
+
+        // A probe only continues past a group if that group was full. If no
+        // window of WIDTH consecutive slots around this one has ever been
+        // entirely full, no probe can have passed over it, and the slot can
+        // be marked empty rather than left as a tombstone.
+        size_t mask = capacity_ - 1;
+        size_t ind_before = (key_ind - WIDTH) & mask;
+        auto empty_after = ProbeGroup(mdata_ + key_ind).MatchEmpty();
+        auto empty_before = ProbeGroup(mdata_ + ind_before).MatchEmpty();
+        bool was_never_full = empty_before && empty_after &&
+            empty_after.TrailingZeros() + empty_before.LeadingZeros() < WIDTH;
+
+        if (was_never_full) {
+            SetCtrl(key_ind, EMPTY);
+        } else {
+            SetCtrl(key_ind, DELETED);
+            ++num_deleted_;
+        }
+        return true;
+    }
+
+    template <typename lookup_t>
+    int64_t Find(const lookup_t& key, uint32_t hash) const
+    {
+        if (! capacity_) {
+            return -1;
+        }
+
+        size_t mask = capacity_ - 1;
+        size_t pos = H1(hash) & mask;
+        for (size_t step = WIDTH; step <= capacity_; step += WIDTH) {
+            ProbeGroup group(mdata_ + pos);
+            for (auto match = group.Match(H2(hash)); match;
+                 match.ClearLowest())
+            {
+                size_t ind = (pos + match.Lowest()) & mask;
+                if (map_[ind].key_ == key) {
+                    return ind;
+                }
+            }
+
+            if (group.MatchEmpty()) {
+                return -1;
             }
+            pos = (pos + step) & mask;
         }
 
         return -1;
     }
 
+    /**
+     * @return The first empty or deleted slot along the probe sequence of the
+     *         given hash. Since the table is never full, one always exists.
+     */
+    size_t FindFreeSlot(uint32_t hash) const
+    {
+        size_t mask = capacity_ - 1;
+        size_t pos = H1(hash) & mask;
+        for (size_t step = WIDTH; ; step += WIDTH) {
+            auto free = ProbeGroup(mdata_ + pos).MatchEmptyOrDeleted();
+            if (free) {
+                return (pos + free.Lowest()) & mask;
+            }
+            pos = (pos + step) & mask;
+        }
+    }
+
+    /**
+     * Claim a slot for a new key with the given hash, rehashing first if
+     * filling an empty slot would exceed the maximum load.
+     * @return The index of the claimed slot, whose key and value are yet to be
+     *         constructed.
+     */
+    size_t PrepareInsert(uint32_t hash)
+    {
+        if (! capacity_) {
+            Allocate(WIDTH);
+        }
+
+        size_t ind = FindFreeSlot(hash);
+        if (mdata_[ind] == EMPTY &&
+            num_entries_ + num_deleted_ + 1 > MaxLoad(capacity_))
+        {
+            Rehash();
+            ind = FindFreeSlot(hash);
+        }
+
+        if (mdata_[ind] == DELETED) {
+            --num_deleted_;
+        }
+        SetCtrl(ind, H2(hash));
+        ++num_entries_;
+        return ind;
+    }
+
     void Rehash()
     {
+        // When tombstones are most of the load, reclaiming them frees enough
+        // room without doubling the table.
+        if (num_entries_ < MaxLoad(capacity_) / 2) {
+            RehashInPlace();
+        } else {
+            Resize(capacity_ * 2);
+        }
+    }
+
+    void Resize(size_t new_capacity)
+    {
+        int8_t *old_mdata = mdata_;
+        HashMapEntry *old_map = map_;
         size_t old_capacity = capacity_;
-        // Bit lazy, but this gives us a good chance of getting a mersennes
-        // prime as a new capacity. Will implement some prime sieve later as
-        // a replacement.
-        capacity_       = (capacity_ + 1) * 2 - 1;
-        auto* new_mdata = (int8_t*) allocator_t::Allocate(capacity_);
-        auto* new_map   = (HashMapEntry*) allocator_t::Allocate(
-            capacity_ * sizeof(HashMapEntry));
-
-        for (uint32_t i = 0; i < capacity_; ++i) {
-            new_mdata[i] = EMPTY;
-        }
-
-        for (uint32_t i = 0; i < old_capacity; ++i) {
-            if (mdata_[i] != EMPTY && mdata_[i] != DELETED) {
-                uint32_t hash = hasher::Hash(map_[i].key_);
-
-                uint32_t new_ind;
-                for (new_ind = H1(hash) % capacity_;
-                     new_mdata[new_ind] != EMPTY;
-                     new_ind = (new_ind + 1) % capacity_)
-                    ;
-
-                new_mdata[new_ind] = H2(hash);
-                new (&new_map[new_ind].key_) key_t(map_[i].key_);
-                new (&new_map[new_ind].val_) val_t(map_[i].val_);
+
+        Allocate(new_capacity);
+        num_deleted_ = 0;
+
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_mdata[i] >= 0) {
+                uint32_t hash = hasher::Hash(old_map[i].key_);
+                size_t new_ind = FindFreeSlot(hash);
+                SetCtrl(new_ind, H2(hash));
+                Transfer(&map_[new_ind], &old_map[i]);
             }
         }
 
-        allocator_t::Free(mdata_);
-        allocator_t::Free(map_);
-        mdata_ = new_mdata;
-        map_   = new_map;
+        allocator_t::Free(old_mdata);
+        allocator_t::Free(old_map);
+    }
+
+    /**
+     * Drop all tombstones without reallocating. Every full slot is first
+     * marked DELETED and every tombstone EMPTY; each formerly-full entry is
+     * then placed at the first free slot of its probe sequence, swapping with
+     * any not-yet-placed entry found there.
+     */
+    void RehashInPlace()
+    {
+        size_t mask = capacity_ - 1;
+        for (size_t i = 0; i < capacity_; ++i) {
+            mdata_[i] = mdata_[i] >= 0 ? DELETED : EMPTY;
+        }
+        memcpy(mdata_ + capacity_, mdata_, WIDTH - 1);
+
+        alignas(HashMapEntry) uint8_t tmp_storage[sizeof(HashMapEntry)];
+        auto *tmp = (HashMapEntry*) tmp_storage;
+
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (mdata_[i] != DELETED) {
+                continue;
+            }
+
+            uint32_t hash = hasher::Hash(map_[i].key_);
+            size_t new_ind = FindFreeSlot(hash);
+
+            // If the entry already sits in the first group probed for it,
+            // it can stay where it is.
+            size_t probe_start = H1(hash) & mask;
+            if (((i - probe_start) & mask) / WIDTH ==
+                ((new_ind - probe_start) & mask) / WIDTH)
+            {
+                SetCtrl(i, H2(hash));
+                continue;
+            }
+
+            if (mdata_[new_ind] == EMPTY) {
+                SetCtrl(new_ind, H2(hash));
+                Transfer(&map_[new_ind], &map_[i]);
+                SetCtrl(i, EMPTY);
+            } else {
+                // Swap with the unplaced entry at new_ind, then place that
+                // entry on the next pass over slot i.
+                SetCtrl(new_ind, H2(hash));
+                Transfer(tmp, &map_[new_ind]);
+                Transfer(&map_[new_ind], &map_[i]);
+                Transfer(&map_[i], tmp);
+                --i;
+            }
+        }
+
+        num_deleted_ = 0;
+    }
+
+    /**
+     * Relocate the entry at src to dst, leaving src uninitialised. Entries
+     * that are trivially relocatable are simply copied bytewise; anything
+     * else is moved and the source destroyed.
+     */
+    static void Transfer(HashMapEntry *dst, HashMapEntry *src)
+    {
+        if constexpr (IsTriviallyRelocatable<key_t>::value &&
+                      IsTriviallyRelocatable<val_t>::value)
+        {
+            memcpy((void*) dst, (void*) src, sizeof(HashMapEntry));
+        } else {
+            new (&dst->key_) key_t(std::move(src->key_));
+            new (&dst->val_) val_t(std::move(src->val_));
+            src->key_.~key_t();
+            src->val_.~val_t();
+        }
     }
 
     static uint32_t H1(uint32_t hash)
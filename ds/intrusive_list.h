@@ -0,0 +1,330 @@
+#ifndef INTRUSIVE_LIST_H
+#define INTRUSIVE_LIST_H
+
+#include <sys/log.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds {
+/**
+ * The links an object needs to sit in an IntrusiveList. Objects derive from
+ * this, and an object that lives in several lists at once derives from one
+ * ListLink per list, each with a distinct tag type. A zeroed link is a valid,
+ * unlinked one, and the list resets a link to zero whenever it unlinks it.
+ */
+template <typename tag_t = void>
+struct ListLink
+{
+    ListLink *prev_, *next_;
+};
+
+/**
+ * A doubly linked list threaded through the objects it holds, so that pushing
+ * and removing never allocate and take O(1). The list doesn't own its objects.
+ *
+ * The list is null-terminated at both ends rather than circular, so a zeroed
+ * list is a valid, empty one; this lets lists live in statics that are in use
+ * before any constructors could have run, such as the allocators' free lists.
+ *
+ * Built with DEBUG, every push checks that the object isn't already linked,
+ * and every unlink checks that the object's neighbours point back at it,
+ * halting with a message on corruption rather than spreading it.
+ */
+template <typename T, typename tag_t = void>
+class IntrusiveList
+{
+    using link_t = ListLink<tag_t>;
+
+public:
+    /**
+     * Front-to-back iterator, for range-based for loops. The current object
+     * must not be unlinked while iterating; use Next to walk the list instead.
+     */
+    class Iterator
+    {
+    public:
+        Iterator(link_t *link)
+            : link_(link)
+        {}
+
+        T &operator*() const
+        {
+            return *ToObj(link_);
+        }
+
+        T *operator->() const
+        {
+            return ToObj(link_);
+        }
+
+        Iterator &operator++()
+        {
+            link_ = link_->next_;
+            return *this;
+        }
+
+        bool operator!=(const Iterator &rhs) const
+        {
+            return link_ != rhs.link_;
+        }
+
+    private:
+        link_t *link_;
+    };
+
+    constexpr IntrusiveList()
+        : head_(nullptr)
+        , tail_(nullptr)
+        , size_(0)
+    {}
+
+    // The list is threaded through its objects, so it can't be copied.
+    IntrusiveList(const IntrusiveList&) = delete;
+    IntrusiveList &operator=(const IntrusiveList&) = delete;
+
+    IntrusiveList(IntrusiveList &&rhs)
+        : head_(rhs.head_)
+        , tail_(rhs.tail_)
+        , size_(rhs.size_)
+    {
+        rhs.head_ = rhs.tail_ = nullptr;
+        rhs.size_ = 0;
+    }
+
+    IntrusiveList &operator=(IntrusiveList &&rhs)
+    {
+        if(&rhs != this) {
+            head_ = rhs.head_;
+            tail_ = rhs.tail_;
+            size_ = rhs.size_;
+            rhs.head_ = rhs.tail_ = nullptr;
+            rhs.size_ = 0;
+        }
+        return *this;
+    }
+
+    /**
+     * @param obj An object not currently in any list of this tag.
+     */
+    void PushFront(T &obj)
+    {
+        link_t *link = &obj;
+        CheckUnlinked(link);
+        link->prev_ = nullptr;
+        link->next_ = head_;
+        if(head_) {
+            head_->prev_ = link;
+        } else {
+            tail_ = link;
+        }
+        head_ = link;
+        ++size_;
+    }
+
+    /**
+     * @param obj An object not currently in any list of this tag.
+     */
+    void PushBack(T &obj)
+    {
+        link_t *link = &obj;
+        CheckUnlinked(link);
+        link->prev_ = tail_;
+        link->next_ = nullptr;
+        if(tail_) {
+            tail_->next_ = link;
+        } else {
+            head_ = link;
+        }
+        tail_ = link;
+        ++size_;
+    }
+
+    /**
+     * @return The object formerly at the front, or nullptr if empty.
+     */
+    T *PopFront()
+    {
+        if(! head_) {
+            return nullptr;
+        }
+        link_t *link = head_;
+        Unlink(link);
+        return ToObj(link);
+    }
+
+    /**
+     * @return The object formerly at the back, or nullptr if empty.
+     */
+    T *PopBack()
+    {
+        if(! tail_) {
+            return nullptr;
+        }
+        link_t *link = tail_;
+        Unlink(link);
+        return ToObj(link);
+    }
+
+    /**
+     * Unlink an object from the list.
+     * @param obj An object currently in this list.
+     */
+    void Remove(T &obj)
+    {
+        Unlink(&obj);
+    }
+
+    /**
+     * Is an object in this list? Only meaningful for objects that are either
+     * in this list or in no list of this tag, as a lone object's links are
+     * null either way.
+     */
+    bool Contains(const T &obj) const
+    {
+        const link_t *link = &obj;
+        return link->prev_ || link->next_ || head_ == link;
+    }
+
+    /**
+     * Move the front object to the back, e.g. to advance a CLOCK hand.
+     */
+    void Rotate()
+    {
+        if(head_ != tail_) {
+            link_t *link = head_;
+            head_ = link->next_;
+            head_->prev_ = nullptr;
+            link->prev_ = tail_;
+            link->next_ = nullptr;
+            tail_->next_ = link;
+            tail_ = link;
+        }
+    }
+
+    /**
+     * Move every object in another list onto the back of this one, in order,
+     * leaving the other list empty.
+     */
+    void Splice(IntrusiveList &rhs)
+    {
+        if(&rhs == this || ! rhs.head_) {
+            return;
+        }
+
+        if(tail_) {
+            tail_->next_ = rhs.head_;
+            rhs.head_->prev_ = tail_;
+        } else {
+            head_ = rhs.head_;
+        }
+        tail_ = rhs.tail_;
+        size_ += rhs.size_;
+        rhs.head_ = rhs.tail_ = nullptr;
+        rhs.size_ = 0;
+    }
+
+    T *Front() const
+    {
+        return head_ ? ToObj(head_) : nullptr;
+    }
+
+    T *Back() const
+    {
+        return tail_ ? ToObj(tail_) : nullptr;
+    }
+
+    /**
+     * @param obj An object currently in a list.
+     * @return The object after obj, or nullptr if obj is at the back.
+     */
+    static T *Next(T &obj)
+    {
+        link_t *next = static_cast<link_t&>(obj).next_;
+        return next ? ToObj(next) : nullptr;
+    }
+
+    /**
+     * @param obj An object currently in a list.
+     * @return The object before obj, or nullptr if obj is at the front.
+     */
+    static T *Prev(T &obj)
+    {
+        link_t *prev = static_cast<link_t&>(obj).prev_;
+        return prev ? ToObj(prev) : nullptr;
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    bool Empty() const
+    {
+        return ! head_;
+    }
+
+    Iterator begin() const
+    {
+        return Iterator(head_);
+    }
+
+    Iterator end() const
+    {
+        return Iterator(nullptr);
+    }
+
+private:
+    link_t *head_, *tail_;
+    size_t size_;
+
+    static T *ToObj(link_t *link)
+    {
+        return static_cast<T*>(link);
+    }
+
+    void Unlink(link_t *link)
+    {
+        CheckLinked(link);
+        if(link->prev_) {
+            link->prev_->next_ = link->next_;
+        } else {
+            head_ = link->next_;
+        }
+
+        if(link->next_) {
+            link->next_->prev_ = link->prev_;
+        } else {
+            tail_ = link->prev_;
+        }
+
+        link->prev_ = link->next_ = nullptr;
+        --size_;
+    }
+
+    void CheckUnlinked([[maybe_unused]] const link_t *link) const
+    {
+#ifdef DEBUG
+        if(link->prev_ || link->next_ || head_ == link) {
+            Log("[ERROR] IntrusiveList: pushing 0x%x, which is already "
+                "linked.\n", (uintptr_t) link);
+            while(1);
+        }
+#endif
+    }
+
+    void CheckLinked([[maybe_unused]] const link_t *link) const
+    {
+#ifdef DEBUG
+        if((link->prev_ ? link->prev_->next_ : head_) != link ||
+           (link->next_ ? link->next_->prev_ : tail_) != link)
+        {
+            Log("[ERROR] IntrusiveList: unlinking 0x%x, whose neighbours "
+                "don't point back to it.\n", (uintptr_t) link);
+            while(1);
+        }
+#endif
+    }
+};
+}
+
+#endif
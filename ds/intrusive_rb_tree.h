@@ -0,0 +1,531 @@
+#ifndef INTRUSIVE_RB_TREE_H
+#define INTRUSIVE_RB_TREE_H
+
+#include <ds/rb_tree.h>
+#include <stddef.h>
+
+namespace ds {
+/**
+ * The links an object needs to sit in an IntrusiveRbTree. Objects derive from
+ * this, and an object that lives in several trees at once derives from one
+ * RbLink per tree, each with a distinct tag type. A zeroed link is a valid,
+ * unlinked one.
+ */
+template <typename tag_t = void>
+struct RbLink
+{
+    RbLink *parent_;
+    RbLink *child_[2];
+    color_t color_;
+};
+
+/**
+ * A red-black tree whose nodes are embedded in the objects it orders, so
+ * that inserting and erasing never allocate. The tree doesn't own its
+ * objects; erasing one merely unlinks it.
+ *
+ * traits_t describes how objects are ordered:
+ *   static K Key(const T &obj);
+ * returns anything comparable with <. Lookups accept any type comparable with
+ * K in both directions. traits_t may also keep per-subtree data up to date by
+ * providing
+ *   static void Update(T &obj, T *left, T *right);
+ * which recomputes obj's subtree data from its own and its (possibly null)
+ * children's. It is called bottom-up whenever a subtree changes shape, so
+ * e.g. the largest free gap beneath each node of an address-range tree can be
+ * maintained, and a fitting range found in O(lg(n)) by descending from
+ * Root().
+ */
+template <typename T, typename traits_t, typename tag_t = void>
+class IntrusiveRbTree
+{
+    using link_t = RbLink<tag_t>;
+
+public:
+    /**
+     * In-order iterator, for range-based for loops.
+     */
+    class Iterator
+    {
+    public:
+        Iterator(link_t *link)
+            : link_(link)
+        {}
+
+        T &operator*() const
+        {
+            return *ToObj(link_);
+        }
+
+        T *operator->() const
+        {
+            return ToObj(link_);
+        }
+
+        Iterator &operator++()
+        {
+            link_ = NextLink(link_);
+            return *this;
+        }
+
+        bool operator!=(const Iterator &rhs) const
+        {
+            return link_ != rhs.link_;
+        }
+
+    private:
+        link_t *link_;
+    };
+
+    IntrusiveRbTree()
+        : root_(nullptr)
+        , size_(0)
+    {}
+
+    // The tree is threaded through its objects, so it can't be copied.
+    IntrusiveRbTree(const IntrusiveRbTree&) = delete;
+    IntrusiveRbTree &operator=(const IntrusiveRbTree&) = delete;
+
+    /**
+     * Link an object into the tree, unless one with an equal key is already
+     * present.
+     * @param obj An object not currently in the tree.
+     * @return True if obj was inserted, false if its key already existed.
+     */
+    bool Insert(T &obj)
+    {
+        return InsertImpl(obj, false);
+    }
+
+    /**
+     * Link an object into the tree, after any others with an equal key.
+     * @param obj An object not currently in the tree.
+     */
+    void InsertMulti(T &obj)
+    {
+        InsertImpl(obj, true);
+    }
+
+    /**
+     * Unlink an object from the tree.
+     * @param obj An object currently in the tree.
+     */
+    void Erase(T &obj)
+    {
+        link_t *node = &obj;
+        link_t *x, *x_parent;
+        color_t removed_color = node->color_;
+
+        if(! node->child_[LEFT] || ! node->child_[RIGHT]) {
+            // At most one child, which simply takes the node's place.
+            x = node->child_[node->child_[LEFT] ? LEFT : RIGHT];
+            x_parent = node->parent_;
+            Transplant(node, x);
+        } else {
+            // Two children; the in-order successor, which has no left child,
+            // takes the node's place, and its right child takes its own.
+            link_t *succ = MinLink(node->child_[RIGHT]);
+            removed_color = succ->color_;
+            x = succ->child_[RIGHT];
+            if(succ->parent_ == node) {
+                x_parent = succ;
+            } else {
+                x_parent = succ->parent_;
+                Transplant(succ, x);
+                succ->child_[RIGHT] = node->child_[RIGHT];
+                succ->child_[RIGHT]->parent_ = succ;
+            }
+            Transplant(node, succ);
+            succ->child_[LEFT] = node->child_[LEFT];
+            succ->child_[LEFT]->parent_ = succ;
+            succ->color_ = node->color_;
+        }
+
+        UpdatePath(x_parent);
+        if(removed_color == BLACK) {
+            EraseFix(x, x_parent);
+        }
+
+        node->parent_ = node->child_[LEFT] = node->child_[RIGHT] = nullptr;
+        --size_;
+    }
+
+    /**
+     * Recompute an object's subtree data, and that of its ancestors, after
+     * changing whatever it is derived from. The object's key must not change.
+     * @param obj An object currently in the tree.
+     */
+    void Update(T &obj)
+    {
+        UpdatePath(&obj);
+    }
+
+    /**
+     * @param key Key to look up.
+     * @return An object with the given key, or nullptr if there is none.
+     */
+    template <typename key_t>
+    T *Find(const key_t &key) const
+    {
+        link_t *node = root_;
+        while(node) {
+            if(key < traits_t::Key(*ToObj(node))) {
+                node = node->child_[LEFT];
+            } else if(traits_t::Key(*ToObj(node)) < key) {
+                node = node->child_[RIGHT];
+            } else {
+                return ToObj(node);
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @param key Key to look up.
+     * @return The first object whose key is not less than key, or nullptr.
+     */
+    template <typename key_t>
+    T *LowerBound(const key_t &key) const
+    {
+        link_t *node = root_, *bound = nullptr;
+        while(node) {
+            if(traits_t::Key(*ToObj(node)) < key) {
+                node = node->child_[RIGHT];
+            } else {
+                bound = node;
+                node = node->child_[LEFT];
+            }
+        }
+        return bound ? ToObj(bound) : nullptr;
+    }
+
+    /**
+     * @param key Key to look up.
+     * @return The first object whose key is greater than key, or nullptr.
+     */
+    template <typename key_t>
+    T *UpperBound(const key_t &key) const
+    {
+        link_t *node = root_, *bound = nullptr;
+        while(node) {
+            if(key < traits_t::Key(*ToObj(node))) {
+                bound = node;
+                node = node->child_[LEFT];
+            } else {
+                node = node->child_[RIGHT];
+            }
+        }
+        return bound ? ToObj(bound) : nullptr;
+    }
+
+    /**
+     * @return The object with the smallest key, or nullptr if empty.
+     */
+    T *First() const
+    {
+        return root_ ? ToObj(MinLink(root_)) : nullptr;
+    }
+
+    /**
+     * @return The object with the largest key, or nullptr if empty.
+     */
+    T *Last() const
+    {
+        if(! root_) {
+            return nullptr;
+        }
+
+        link_t *node = root_;
+        while(node->child_[RIGHT]) {
+            node = node->child_[RIGHT];
+        }
+        return ToObj(node);
+    }
+
+    /**
+     * @param obj An object currently in the tree.
+     * @return The object following obj in key order, or nullptr.
+     */
+    static T *Next(T &obj)
+    {
+        link_t *next = NextLink(&obj);
+        return next ? ToObj(next) : nullptr;
+    }
+
+    /**
+     * @param obj An object currently in the tree.
+     * @return The object preceding obj in key order, or nullptr.
+     */
+    static T *Prev(T &obj)
+    {
+        link_t *node = &obj;
+        if(node->child_[LEFT]) {
+            node = node->child_[LEFT];
+            while(node->child_[RIGHT]) {
+                node = node->child_[RIGHT];
+            }
+            return ToObj(node);
+        }
+
+        while(node->parent_ && node == node->parent_->child_[LEFT]) {
+            node = node->parent_;
+        }
+        return node->parent_ ? ToObj(node->parent_) : nullptr;
+    }
+
+    /**
+     * Structural accessors, for searches that descend the tree by subtree
+     * data rather than by key.
+     */
+    T *Root() const
+    {
+        return root_ ? ToObj(root_) : nullptr;
+    }
+
+    static T *Child(T &obj, direction_t dir)
+    {
+        link_t *child = static_cast<link_t&>(obj).child_[dir];
+        return child ? ToObj(child) : nullptr;
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    bool Empty() const
+    {
+        return size_ == 0;
+    }
+
+    Iterator begin() const
+    {
+        return Iterator(root_ ? MinLink(root_) : nullptr);
+    }
+
+    Iterator end() const
+    {
+        return Iterator(nullptr);
+    }
+
+private:
+    link_t *root_;
+    size_t  size_;
+
+    static T *ToObj(link_t *link)
+    {
+        return static_cast<T*>(link);
+    }
+
+    static link_t *MinLink(link_t *node)
+    {
+        while(node->child_[LEFT]) {
+            node = node->child_[LEFT];
+        }
+        return node;
+    }
+
+    static link_t *NextLink(link_t *node)
+    {
+        if(node->child_[RIGHT]) {
+            return MinLink(node->child_[RIGHT]);
+        }
+
+        while(node->parent_ && node == node->parent_->child_[RIGHT]) {
+            node = node->parent_;
+        }
+        return node->parent_;
+    }
+
+    static direction_t DirOf(link_t *node)
+    {
+        return node == node->parent_->child_[LEFT] ? LEFT : RIGHT;
+    }
+
+    static bool IsBlack(link_t *node)
+    {
+        return ! node || node->color_ == BLACK;
+    }
+
+    /**
+     * Recompute a single node's subtree data from its children's.
+     */
+    static void UpdateNode(link_t *node)
+    {
+        if constexpr(requires(T &obj) { traits_t::Update(obj, &obj, &obj); }) {
+            link_t *left = node->child_[LEFT], *right = node->child_[RIGHT];
+            traits_t::Update(*ToObj(node), left ? ToObj(left) : nullptr,
+                             right ? ToObj(right) : nullptr);
+        }
+    }
+
+    /**
+     * Recompute subtree data from a node up to the root.
+     */
+    static void UpdatePath(link_t *node)
+    {
+        if constexpr(requires(T &obj) { traits_t::Update(obj, &obj, &obj); }) {
+            for(; node; node = node->parent_) {
+                UpdateNode(node);
+            }
+        }
+    }
+
+    bool InsertImpl(T &obj, bool multi)
+    {
+        link_t *node = &obj, *parent = nullptr;
+        link_t **slot = &root_;
+        while(*slot) {
+            parent = *slot;
+            if(traits_t::Key(obj) < traits_t::Key(*ToObj(parent))) {
+                slot = &parent->child_[LEFT];
+            } else if(multi ||
+                      traits_t::Key(*ToObj(parent)) < traits_t::Key(obj)) {
+                slot = &parent->child_[RIGHT];
+            } else {
+                return false;
+            }
+        }
+
+        node->parent_ = parent;
+        node->child_[LEFT] = node->child_[RIGHT] = nullptr;
+        node->color_ = RED;
+        *slot = node;
+        ++size_;
+
+        UpdatePath(node);
+        InsertFix(node);
+        return true;
+    }
+
+    /**
+     * Restore the red-black properties after linking a red node, which may
+     * have a red parent. See RbTree::PostInsertFix for the reasoning behind
+     * each case; here the mirrored cases share code by way of direction_t.
+     */
+    void InsertFix(link_t *node)
+    {
+        while(node->parent_ && node->parent_->color_ == RED) {
+            // A red parent is never the root, so the grandparent exists.
+            link_t *parent = node->parent_;
+            link_t *grandparent = parent->parent_;
+            direction_t parent_dir = DirOf(parent);
+            link_t *uncle = grandparent->child_[InvertDir(parent_dir)];
+
+            if(! IsBlack(uncle)) {
+                parent->color_ = BLACK;
+                uncle->color_ = BLACK;
+                grandparent->color_ = RED;
+                node = grandparent;
+                continue;
+            }
+
+            if(DirOf(node) != parent_dir) {
+                node = parent;
+                Rotate(parent_dir, node);
+                parent = node->parent_;
+            }
+
+            parent->color_ = BLACK;
+            grandparent->color_ = RED;
+            Rotate(InvertDir(parent_dir), grandparent);
+        }
+        root_->color_ = BLACK;
+    }
+
+    /**
+     * Restore the red-black properties after unlinking a black node. node
+     * (possibly null) is one black short of its sibling's subtree, and
+     * parent is its parent. See RbTree::PreDeletionFix for the cases.
+     */
+    void EraseFix(link_t *node, link_t *parent)
+    {
+        while(node != root_ && IsBlack(node)) {
+            direction_t dir = node == parent->child_[LEFT] ? LEFT : RIGHT;
+            direction_t opp_dir = InvertDir(dir);
+            link_t *sibling = parent->child_[opp_dir];
+
+            if(sibling->color_ == RED) {
+                sibling->color_ = BLACK;
+                parent->color_ = RED;
+                Rotate(dir, parent);
+                sibling = parent->child_[opp_dir];
+            }
+
+            if(IsBlack(sibling->child_[LEFT]) &&
+               IsBlack(sibling->child_[RIGHT]))
+            {
+                sibling->color_ = RED;
+                node = parent;
+                parent = node->parent_;
+                continue;
+            }
+
+            if(IsBlack(sibling->child_[opp_dir])) {
+                sibling->child_[dir]->color_ = BLACK;
+                sibling->color_ = RED;
+                Rotate(opp_dir, sibling);
+                sibling = parent->child_[opp_dir];
+            }
+
+            sibling->color_ = parent->color_;
+            parent->color_ = BLACK;
+            sibling->child_[opp_dir]->color_ = BLACK;
+            Rotate(dir, parent);
+            node = root_;
+            break;
+        }
+
+        if(node) {
+            node->color_ = BLACK;
+        }
+    }
+
+    /**
+     * Make node into the dir child of its opposite child. Both nodes'
+     * subtree data is recomputed; that of their ancestors is unaffected,
+     * since the subtree they head keeps the same contents.
+     */
+    void Rotate(direction_t dir, link_t *node)
+    {
+        direction_t opp_dir = InvertDir(dir);
+        link_t *new_par = node->child_[opp_dir];
+
+        node->child_[opp_dir] = new_par->child_[dir];
+        if(node->child_[opp_dir]) {
+            node->child_[opp_dir]->parent_ = node;
+        }
+
+        new_par->parent_ = node->parent_;
+        if(! node->parent_) {
+            root_ = new_par;
+        } else {
+            node->parent_->child_[DirOf(node)] = new_par;
+        }
+
+        new_par->child_[dir] = node;
+        node->parent_ = new_par;
+
+        UpdateNode(node);
+        UpdateNode(new_par);
+    }
+
+    /**
+     * Put replacement (possibly null) where node hangs from its parent.
+     */
+    void Transplant(link_t *node, link_t *replacement)
+    {
+        if(! node->parent_) {
+            root_ = replacement;
+        } else {
+            node->parent_->child_[DirOf(node)] = replacement;
+        }
+
+        if(replacement) {
+            replacement->parent_ = node->parent_;
+        }
+    }
+};
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define OPTIONAL_H
 
 #include <sys/kheap.h>
+#include <utility>
 
 namespace ds {
 struct nullopt_t {};
@@ -30,32 +31,60 @@ public:
         , val_(obj)
     {}
 
+    Optional(T &&obj)
+        : has_val_(true)
+        , val_(std::move(obj))
+    {}
+
     Optional(const Optional &rhs)
         : has_val_(rhs.has_val_)
     {
-        memset(&val_, 0, sizeof(T));
         if(has_val_) {
-            val_ = rhs.val_;
+            new (&val_) T(rhs.val_);
+        } else {
+            memset(&val_, 0, sizeof(T));
+        }
+    }
+
+    Optional(Optional &&rhs)
+        : has_val_(rhs.has_val_)
+    {
+        if(has_val_) {
+            new (&val_) T(std::move(rhs.val_));
+        } else {
+            memset(&val_, 0, sizeof(T));
         }
     }
 
     Optional &operator =(const T &val)
     {
-        has_val_ = true;
         if(has_val_) {
-            val_.~T();
+            val_ = val;
+        } else {
+            new (&val_) T(val);
+            has_val_ = true;
+        }
+        return *this;
+    }
+
+    Optional &operator =(T &&val)
+    {
+        if(has_val_) {
+            val_ = std::move(val);
+        } else {
+            new (&val_) T(std::move(val));
+            has_val_ = true;
         }
-        val_ = val;
         return *this;
     }
 
     Optional &operator =(nullopt_t)
     {
-        has_val_ = false;
         if(has_val_) {
             val_.~T();
         }
-        dummy_ = 0;
+        has_val_ = false;
+        memset(&val_, 0, sizeof(T));
         return *this;
     }
 
@@ -65,13 +94,26 @@ public:
             return *this;
         }
 
-        if(has_val_) {
-            val_.~T();
+        if(! rhs.has_val_) {
+            return *this = NullOpt;
+        }
+        return *this = rhs.val_;
+    }
+
+    Optional &operator =(Optional &&rhs)
+    {
+        if(&rhs == this) {
+            return *this;
         }
 
-        has_val_ = rhs.has_val_;
-        if(rhs.has_val_) {
-            val_ = rhs.val_;
+        if(! rhs.has_val_) {
+            return *this = NullOpt;
+        }
+        if(has_val_) {
+            val_ = std::move(rhs.val_);
+        } else {
+            new (&val_) T(std::move(rhs.val_));
+            has_val_ = true;
         }
         return *this;
     }
@@ -83,27 +125,82 @@ public:
         }
     }
 
-    T Value() const
+    /**
+     * Construct a new value in place, destroying any current one first.
+     * @param args Arguments forwarded to T's constructor.
+     * @return The new value.
+     */
+    template <typename... arg_ts>
+    T &Emplace(arg_ts&&... args)
+    {
+        if(has_val_) {
+            val_.~T();
+        }
+        new (&val_) T(std::forward<arg_ts>(args)...);
+        has_val_ = true;
+        return val_;
+    }
+
+    T &Value() & noexcept
+    {
+        return val_;
+    }
+
+    const T &Value() const & noexcept
     {
         return val_;
     }
 
+    /**
+     * Taking the value of a temporary moves it out, so that
+     * `T val = *Func();` never deep-copies.
+     */
+    T Value() && noexcept
+    {
+        return std::move(val_);
+    }
+
+    /**
+     * @return The value if there is one, otherwise fallback.
+     */
+    T ValueOr(T fallback) const &
+    {
+        return has_val_ ? val_ : std::move(fallback);
+    }
+
+    T ValueOr(T fallback) &&
+    {
+        return has_val_ ? std::move(val_) : std::move(fallback);
+    }
+
     bool HasValue() const noexcept
     {
         return has_val_;
     }
 
-    T operator *() const noexcept
+    T &operator *() & noexcept
     {
         return val_;
     }
 
-    T* operator ->() const noexcept
+    const T &operator *() const & noexcept
     {
-        if(! has_val_) {
-            return (T*) (nullptr);
-        }
-        return (T*) (&val_);
+        return val_;
+    }
+
+    T operator *() && noexcept
+    {
+        return std::move(val_);
+    }
+
+    T *operator ->() noexcept
+    {
+        return has_val_ ? &val_ : nullptr;
+    }
+
+    const T *operator ->() const noexcept
+    {
+        return has_val_ ? &val_ : nullptr;
     }
 
     operator bool() const noexcept
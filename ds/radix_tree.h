@@ -0,0 +1,551 @@
+#ifndef RADIX_TREE_H
+#define RADIX_TREE_H
+
+#include <libc/string.h>
+#include <sys/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds {
+/**
+ * Marks that may be set on entries of a RadixTree, e.g. to find every dirty
+ * page or sector in index order without visiting the clean ones.
+ */
+enum radix_mark_t : uint8_t {
+    MARK_DIRTY = 0,
+    MARK_WRITEBACK = 1,
+    MARK_USER = 2,
+    NUM_RADIX_MARKS = 3
+};
+
+/**
+ * A sparse array mapping 64-bit indices to pointers, in the style of Linux's
+ * XArray. Each node covers 64 slots, so a lookup walks at most
+ * ceil(64 / 6) = 11 levels, and only as many as the largest index stored
+ * needs: a tree of sector numbers below 2^24 is four levels deep. Unlike a
+ * hash map, neighbouring indices share nodes, and entries can be walked in
+ * index order, optionally only those carrying a given mark.
+ *
+ * Every node keeps a bitmap of its occupied slots and, for each mark, a
+ * bitmap of the slots whose subtree holds a marked entry, so range walks skip
+ * empty and unmarked subtrees 64 slots at a time.
+ *
+ * Readers (Load, Find, GetMark) never write to the tree, and writers only
+ * publish fully initialized nodes, with release stores that readers' acquire
+ * loads pair with, so lookups may run concurrently with a single writer. The
+ * kernel has no grace-period mechanism yet, though, so nodes emptied by Erase
+ * are freed straight away; until they can be deferred, readers racing an
+ * erasing writer must still be excluded by the caller.
+ *
+ * The tree stores pointers; it never owns or frees the objects pointed to.
+ */
+template <typename T, typename allocator_t = KernelAllocator>
+class RadixTree
+{
+public:
+    RadixTree()
+        : root_(nullptr)
+        , size_(0)
+    {}
+
+    RadixTree(const RadixTree&) = delete;
+    RadixTree &operator=(const RadixTree&) = delete;
+
+    RadixTree(RadixTree &&rhs)
+        : root_(rhs.root_)
+        , size_(rhs.size_)
+    {
+        rhs.root_ = nullptr;
+        rhs.size_ = 0;
+    }
+
+    RadixTree &operator=(RadixTree &&rhs)
+    {
+        if(&rhs == this) {
+            return *this;
+        }
+
+        Clear();
+        root_ = rhs.root_;
+        size_ = rhs.size_;
+        rhs.root_ = nullptr;
+        rhs.size_ = 0;
+        return *this;
+    }
+
+    ~RadixTree()
+    {
+        Clear();
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    bool Empty() const
+    {
+        return size_ == 0;
+    }
+
+    /**
+     * @return The entry at index, or nullptr if there's none.
+     */
+    T *Load(uint64_t index) const
+    {
+        Node *node = LoadPtr(root_);
+        if(! node || index > MaxIndex(node)) {
+            return nullptr;
+        }
+
+        while(node->shift_) {
+            node = (Node*) LoadPtr(node->slots_[Offset(node, index)]);
+            if(! node) {
+                return nullptr;
+            }
+        }
+        return (T*) LoadPtr(node->slots_[Offset(node, index)]);
+    }
+
+    /**
+     * Store an entry, replacing any already at index. A replaced entry keeps
+     * its marks.
+     * @param index Where to store the entry.
+     * @param item The entry; storing nullptr erases index.
+     * @return Was the entry stored? This fails only if a node can't be
+     *         allocated.
+     */
+    bool Store(uint64_t index, T *item)
+    {
+        if(! item) {
+            Erase(index);
+            return true;
+        }
+
+        if(! Extend(index)) {
+            return false;
+        }
+
+        Node *node = root_;
+        while(node->shift_) {
+            uint8_t offset = Offset(node, index);
+            auto child = (Node*) node->slots_[offset];
+            if(! child) {
+                if(! (child = NewNode(node->shift_ - CHUNK_SHIFT, node,
+                                      offset)))
+                {
+                    return false;
+                }
+                StorePtr(node->slots_[offset], child);
+                SetUsed(node, offset);
+            }
+            node = child;
+        }
+
+        uint8_t offset = Offset(node, index);
+        bool added = ! node->slots_[offset];
+        StorePtr(node->slots_[offset], item);
+        if(added) {
+            SetUsed(node, offset);
+            ++size_;
+        }
+        return true;
+    }
+
+    /**
+     * Remove the entry at index along with its marks, freeing any nodes left
+     * empty.
+     * @return The removed entry, or nullptr if there was none.
+     */
+    T *Erase(uint64_t index)
+    {
+        Node *node = Leaf(index);
+        if(! node) {
+            return nullptr;
+        }
+
+        uint8_t offset = Offset(node, index);
+        auto item = (T*) node->slots_[offset];
+        if(! item) {
+            return nullptr;
+        }
+
+        for(uint8_t mark = 0; mark < NUM_RADIX_MARKS; ++mark) {
+            ClearMarkFrom(node, offset, (radix_mark_t) mark);
+        }
+        ClearUsed(node, offset);
+        StorePtr(node->slots_[offset], nullptr);
+        --size_;
+
+        // Unlink nodes left empty, then drop root levels that only lead to
+        // their first slot.
+        while(! node->used_) {
+            Node *parent = node->parent_;
+            if(! parent) {
+                StorePtr(root_, nullptr);
+            } else {
+                ClearUsed(parent, node->offset_);
+                StorePtr(parent->slots_[node->offset_], nullptr);
+            }
+            allocator_t::Free(node);
+            if(! (node = parent)) {
+                return item;
+            }
+        }
+        Shrink();
+        return item;
+    }
+
+    /**
+     * Mark the entry at index. Does nothing if there's no entry there.
+     */
+    void SetMark(uint64_t index, radix_mark_t mark)
+    {
+        Node *node = Leaf(index);
+        if(! node || ! node->slots_[Offset(node, index)]) {
+            return;
+        }
+
+        uint8_t offset = Offset(node, index);
+        while(node && ! (node->marks_[mark] & (1ULL << offset))) {
+            __atomic_or_fetch(&node->marks_[mark], 1ULL << offset,
+                              __ATOMIC_RELEASE);
+            offset = node->offset_;
+            node = node->parent_;
+        }
+    }
+
+    void ClearMark(uint64_t index, radix_mark_t mark)
+    {
+        if(Node *node = Leaf(index)) {
+            ClearMarkFrom(node, Offset(node, index), mark);
+        }
+    }
+
+    bool GetMark(uint64_t index, radix_mark_t mark) const
+    {
+        Node *node = Leaf(index);
+        return node && (__atomic_load_n(&node->marks_[mark], __ATOMIC_ACQUIRE) &
+                        (1ULL << Offset(node, index)));
+    }
+
+    /**
+     * Find the first entry at or after index and no later than last.
+     * @param index Where to start; set to the entry's index if one is found.
+     * @param last The greatest index to consider.
+     * @return The entry, or nullptr if there's none in range.
+     */
+    T *Find(uint64_t &index, uint64_t last=UINT64_MAX) const
+    {
+        return FindFrom(index, last, NUM_RADIX_MARKS);
+    }
+
+    /**
+     * Find the first entry carrying mark at or after index and no later than
+     * last.
+     * @param index Where to start; set to the entry's index if one is found.
+     * @param last The greatest index to consider.
+     * @param mark The mark the entry must carry.
+     * @return The entry, or nullptr if there's none in range.
+     */
+    T *FindMarked(uint64_t &index, uint64_t last, radix_mark_t mark) const
+    {
+        return FindFrom(index, last, mark);
+    }
+
+    /**
+     * Call fn(index, entry) for every entry in [first, last], in index order.
+     * fn may store to or erase the entry it's given, but no other.
+     */
+    template <typename fn_t>
+    void ForEach(uint64_t first, uint64_t last, fn_t fn)
+    {
+        ForEachFrom(first, last, NUM_RADIX_MARKS, fn);
+    }
+
+    /**
+     * Call fn(index, entry) for every entry in [first, last] carrying mark,
+     * in index order. fn may clear the mark on, store to or erase the entry
+     * it's given, but no other.
+     */
+    template <typename fn_t>
+    void ForEachMarked(uint64_t first, uint64_t last, radix_mark_t mark,
+                       fn_t fn)
+    {
+        ForEachFrom(first, last, mark, fn);
+    }
+
+    /**
+     * Remove every entry and free every node.
+     */
+    void Clear()
+    {
+        if(root_) {
+            FreeSubtree(root_);
+        }
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    static constexpr uint8_t CHUNK_SHIFT = 6;
+    static constexpr size_t CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static constexpr uint64_t CHUNK_MASK = CHUNK_SIZE - 1;
+
+    struct Node {
+        // Index bits below this node's slots.
+        uint8_t shift_;
+        // Slot of this node in its parent.
+        uint8_t offset_;
+        Node *parent_;
+        uint64_t used_;
+        uint64_t marks_[NUM_RADIX_MARKS];
+        // Entries if shift_ is 0, child nodes otherwise.
+        void *slots_[CHUNK_SIZE];
+    };
+
+    Node *root_;
+    size_t size_;
+
+    template <typename ptr_t>
+    static ptr_t LoadPtr(ptr_t const &ptr)
+    {
+        return __atomic_load_n(&ptr, __ATOMIC_ACQUIRE);
+    }
+
+    template <typename ptr_t, typename val_t>
+    static void StorePtr(ptr_t &ptr, val_t val)
+    {
+        __atomic_store_n(&ptr, (ptr_t) val, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * Slots are published before being flagged as used, and flagged unused
+     * before being emptied, so a reader never finds a used slot empty unless
+     * it races an erase.
+     */
+    static void SetUsed(Node *node, uint8_t offset)
+    {
+        __atomic_store_n(&node->used_, node->used_ | (1ULL << offset),
+                         __ATOMIC_RELEASE);
+    }
+
+    static void ClearUsed(Node *node, uint8_t offset)
+    {
+        __atomic_store_n(&node->used_, node->used_ & ~(1ULL << offset),
+                         __ATOMIC_RELEASE);
+    }
+
+    static uint8_t Offset(const Node *node, uint64_t index)
+    {
+        return (index >> node->shift_) & CHUNK_MASK;
+    }
+
+    /**
+     * @return Mask of the index bits that a node at shift doesn't resolve,
+     *         i.e. those selecting an entry within its subtree.
+     */
+    static uint64_t SubtreeMask(uint8_t shift)
+    {
+        return shift + CHUNK_SHIFT >= 64 ? ~0ULL :
+               (1ULL << (shift + CHUNK_SHIFT)) - 1;
+    }
+
+    static uint64_t MaxIndex(const Node *node)
+    {
+        return SubtreeMask(node->shift_);
+    }
+
+    Node *NewNode(uint8_t shift, Node *parent, uint8_t offset)
+    {
+        auto node = (Node*) allocator_t::Allocate(sizeof(Node));
+        if(! node) {
+            return nullptr;
+        }
+
+        memset(node, 0, sizeof(Node));
+        node->shift_ = shift;
+        node->parent_ = parent;
+        node->offset_ = offset;
+        return node;
+    }
+
+    /**
+     * Add levels above the root until index fits under it.
+     */
+    bool Extend(uint64_t index)
+    {
+        if(! root_) {
+            uint8_t shift = 0;
+            while(index > SubtreeMask(shift)) {
+                shift += CHUNK_SHIFT;
+            }
+            Node *root = NewNode(shift, nullptr, 0);
+            if(! root) {
+                return false;
+            }
+            StorePtr(root_, root);
+            return true;
+        }
+
+        while(index > MaxIndex(root_)) {
+            Node *root = NewNode(root_->shift_ + CHUNK_SHIFT, nullptr, 0);
+            if(! root) {
+                return false;
+            }
+
+            root->used_ = 1;
+            root->slots_[0] = root_;
+            for(uint8_t mark = 0; mark < NUM_RADIX_MARKS; ++mark) {
+                root->marks_[mark] = root_->marks_[mark] ? 1 : 0;
+            }
+            root_->parent_ = root;
+            StorePtr(root_, root);
+        }
+        return true;
+    }
+
+    /**
+     * Drop root levels whose only occupied slot is the first.
+     */
+    void Shrink()
+    {
+        while(root_->shift_ && root_->used_ == 1) {
+            Node *root = root_;
+            auto child = (Node*) root->slots_[0];
+            child->parent_ = nullptr;
+            StorePtr(root_, child);
+            allocator_t::Free(root);
+        }
+    }
+
+    /**
+     * @return The bottom-level node that would hold index, or nullptr.
+     */
+    Node *Leaf(uint64_t index) const
+    {
+        Node *node = LoadPtr(root_);
+        if(! node || index > MaxIndex(node)) {
+            return nullptr;
+        }
+
+        while(node && node->shift_) {
+            node = (Node*) LoadPtr(node->slots_[Offset(node, index)]);
+        }
+        return node;
+    }
+
+    void ClearMarkFrom(Node *node, uint8_t offset, radix_mark_t mark)
+    {
+        while(node && (node->marks_[mark] & (1ULL << offset))) {
+            uint64_t marks = __atomic_and_fetch(&node->marks_[mark],
+                                                ~(1ULL << offset),
+                                                __ATOMIC_RELEASE);
+            // Ancestors stay marked while any sibling subtree still is.
+            if(marks) {
+                return;
+            }
+            offset = node->offset_;
+            node = node->parent_;
+        }
+    }
+
+    /**
+     * Walk down from the root towards index, climbing back up whenever a
+     * node has nothing further to offer, until an entry is reached. pos
+     * always lies within the current node's range; it's only moved on once
+     * a later slot has been chosen.
+     * @param mark The mark to look for, or NUM_RADIX_MARKS for any entry.
+     */
+    T *FindFrom(uint64_t &index, uint64_t last, uint8_t mark) const
+    {
+        Node *root = LoadPtr(root_);
+        uint64_t pos = index;
+        if(! root || pos > MaxIndex(root) || pos > last) {
+            return nullptr;
+        }
+
+        Node *node = root;
+        size_t offset = Offset(node, pos);
+        for(;;) {
+            uint64_t slots = 0;
+            if(offset < CHUNK_SIZE) {
+                slots = mark == NUM_RADIX_MARKS ?
+                        __atomic_load_n(&node->used_, __ATOMIC_ACQUIRE) :
+                        __atomic_load_n(&node->marks_[mark], __ATOMIC_ACQUIRE);
+                slots &= ~0ULL << offset;
+            }
+
+            if(! slots) {
+                // Nothing left under this node; resume in the parent just
+                // past it.
+                if(! node->parent_) {
+                    return nullptr;
+                }
+                offset = node->offset_ + 1;
+                node = node->parent_;
+                continue;
+            }
+
+            uint8_t slot = __builtin_ctzll(slots);
+            if(slot != Offset(node, pos)) {
+                pos = (pos & ~SubtreeMask(node->shift_)) |
+                      ((uint64_t) slot << node->shift_);
+            }
+            if(pos > last) {
+                return nullptr;
+            }
+
+            void *child = LoadPtr(node->slots_[slot]);
+            if(! child) {
+                // Raced with an erase; start over past the emptied slot.
+                uint64_t slot_mask = (1ULL << node->shift_) - 1;
+                if((pos | slot_mask) == UINT64_MAX) {
+                    return nullptr;
+                }
+                pos = (pos | slot_mask) + 1;
+                if(pos > MaxIndex(root) || pos > last) {
+                    return nullptr;
+                }
+                node = root;
+                offset = Offset(node, pos);
+                continue;
+            }
+
+            if(! node->shift_) {
+                index = pos;
+                return (T*) child;
+            }
+            node = (Node*) child;
+            offset = Offset(node, pos);
+        }
+    }
+
+    template <typename fn_t>
+    void ForEachFrom(uint64_t first, uint64_t last, uint8_t mark, fn_t &fn)
+    {
+        uint64_t index = first;
+        while(T *item = FindFrom(index, last, mark)) {
+            fn(index, item);
+            if(index == last) {
+                return;
+            }
+            ++index;
+        }
+    }
+
+    void FreeSubtree(Node *node)
+    {
+        if(node->shift_) {
+            uint64_t used = node->used_;
+            while(used) {
+                FreeSubtree((Node*) node->slots_[__builtin_ctzll(used)]);
+                used &= used - 1;
+            }
+        }
+        allocator_t::Free(node);
+    }
+};
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef RB_TREE_H
 #define RB_TREE_H
 
+#include <stddef.h>
+
 namespace ds {
 enum color_t
 {
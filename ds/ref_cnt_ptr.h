@@ -1,42 +1,162 @@
 #ifndef REF_CNT_PTR_H
 #define REF_CNT_PTR_H
 
+#include <ds/type_traits.h>
 #include <sys/kheap.h>
 #include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
 
 namespace ds {
 
-template<typename T, typename allocator_t=KernelAllocator>
+/**
+ * Count policy for objects only ever shared on a single core.
+ */
+struct NonAtomicRefCount
+{
+    static void Inc(size_t &count)
+    {
+        ++count;
+    }
+
+    /**
+     * @return Was this the final reference?
+     */
+    static bool Dec(size_t &count)
+    {
+        return --count == 0;
+    }
+};
+
+/**
+ * Count policy for objects shared between cores. The final decrement
+ * synchronizes with every earlier one, so the object's last user sees all
+ * writes made through other references before destroying it.
+ */
+struct AtomicRefCount
+{
+    static void Inc(size_t &count)
+    {
+        __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+    }
+
+    static bool Dec(size_t &count)
+    {
+        return __atomic_sub_fetch(&count, 1, __ATOMIC_ACQ_REL) == 0;
+    }
+};
+
+/**
+ * Base for classes that embed their own reference count, such as VNode.
+ * RefCntPtr uses the embedded count rather than allocating one, and deletes
+ * the object once the count drops to zero, so such objects must be allocated
+ * with new and, if they're shared through a base class pointer, have a
+ * virtual destructor. Copying an object does not copy its count.
+ */
+class RefCounted
+{
+protected:
+    RefCounted()
+        : ref_cnt_(0)
+    {}
+
+    RefCounted(const RefCounted&)
+        : ref_cnt_(0)
+    {}
+
+    RefCounted &operator=(const RefCounted&)
+    {
+        return *this;
+    }
+
+private:
+    template<typename, typename, typename>
+    friend class RefCntPtr;
+
+    size_t ref_cnt_;
+};
+
+/**
+ * A shared pointer. The count lives in one of three places:
+ *  - inside the object, for classes deriving from RefCounted;
+ *  - just ahead of the object, in the same allocation, for objects created
+ *    by MakeRefCntPtr<T>(args...);
+ *  - in a separate allocation, for objects adopted from a raw pointer.
+ * The last of these costs an extra allocation per object, and is kept for
+ * memory that wasn't allocated for sharing in the first place.
+ */
+template<typename T, typename allocator_t=KernelAllocator,
+         typename count_t=NonAtomicRefCount>
 class RefCntPtr
 {
+    static constexpr bool INTRUSIVE = std::is_base_of<RefCounted, T>::value;
+
 public:
     RefCntPtr()
             : raw_ptr_(nullptr)
             , refs_(nullptr)
     {}
 
+    RefCntPtr(nullptr_t)
+            : raw_ptr_(nullptr)
+            , refs_(nullptr)
+    {}
+
     RefCntPtr(void *ptr)
-            : raw_ptr_((T*) ptr)
-            , refs_((size_t *) allocator_t::Allocate(sizeof(size_t)))
-    {
-        *refs_ = 1;
-    }
+            : RefCntPtr((T*) ptr)
+    {}
 
     RefCntPtr(T *ptr)
             : raw_ptr_(ptr)
-            , refs_((size_t *) allocator_t::Allocate(sizeof(size_t)))
+            , refs_(nullptr)
     {
-        *refs_ = 1;
+        if(! ptr) {
+            return;
+        }
+
+        if constexpr(INTRUSIVE) {
+            refs_ = &static_cast<RefCounted*>(ptr)->ref_cnt_;
+            count_t::Inc(*refs_);
+        } else {
+            refs_ = (size_t*) allocator_t::Allocate(sizeof(size_t));
+            *refs_ = 1;
+        }
     }
 
     RefCntPtr(const RefCntPtr &rhs)
             : raw_ptr_(rhs.raw_ptr_)
             , refs_(rhs.refs_)
     {
-        ++(*refs_);
-        if((uintptr_t) refs_ == 0x659007988001a710) {
-            Log("123");
-        }
+        Acquire();
+    }
+
+    /**
+     * Share an object through a pointer to one of its bases.
+     */
+    template<typename U>
+        requires (! std::is_same<U, T>::value) &&
+                 std::is_convertible<U*, T*>::value
+    RefCntPtr(const RefCntPtr<U, allocator_t, count_t> &rhs)
+            : raw_ptr_(rhs.raw_ptr_)
+            , refs_(rhs.refs_)
+    {
+        static_assert(RefCntPtr<U, allocator_t, count_t>::INTRUSIVE ==
+                      INTRUSIVE, "Both types must keep the count alike.");
+        Acquire();
+    }
+
+    template<typename U>
+        requires (! std::is_same<U, T>::value) &&
+                 std::is_convertible<U*, T*>::value
+    RefCntPtr(RefCntPtr<U, allocator_t, count_t> &&rhs)
+            : raw_ptr_(rhs.raw_ptr_)
+            , refs_(rhs.refs_)
+    {
+        static_assert(RefCntPtr<U, allocator_t, count_t>::INTRUSIVE ==
+                      INTRUSIVE, "Both types must keep the count alike.");
+        rhs.raw_ptr_ = nullptr;
+        rhs.refs_ = nullptr;
     }
 
     RefCntPtr &operator=(const RefCntPtr &rhs)
@@ -45,21 +165,10 @@ public:
             return *this;
         }
 
-        if(refs_) {
-            --(*refs_);
-            if (!*refs_) {
-                if (refs_) {
-                    allocator_t::Free(refs_);
-                }
-                if (raw_ptr_) {
-                    allocator_t::Free(raw_ptr_);
-                }
-            }
-        }
-
+        Release();
         raw_ptr_ = rhs.raw_ptr_;
         refs_    = rhs.refs_;
-        ++(*refs_);
+        Acquire();
 
         return *this;
     }
@@ -74,18 +183,11 @@ public:
 
     RefCntPtr &operator=(RefCntPtr &&rhs)
     {
-        if(refs_) {
-            --(*refs_);
-            if (!*refs_) {
-                if (refs_) {
-                    allocator_t::Free(refs_);
-                }
-                if (raw_ptr_) {
-                    allocator_t::Free(raw_ptr_);
-                }
-            }
+        if (&rhs == this) {
+            return *this;
         }
 
+        Release();
         raw_ptr_ = rhs.raw_ptr_;
         refs_    = rhs.refs_;
         rhs.refs_ = nullptr;
@@ -95,17 +197,7 @@ public:
 
     ~RefCntPtr()
     {
-        if(refs_) {
-            --(*refs_);
-            if (!*refs_) {
-                if (refs_) {
-                    allocator_t::Free(refs_);
-                }
-                if (raw_ptr_) {
-                    allocator_t::Free(raw_ptr_);
-                }
-            }
-        }
+        Release();
     }
 
     T &operator*() const noexcept
@@ -133,7 +225,7 @@ public:
         return (raw_ptr_ != nullptr);
     }
 
-    friend bool operator==(RefCntPtr &lhs, RefCntPtr &rhs)
+    friend bool operator==(const RefCntPtr &lhs, const RefCntPtr &rhs)
     {
         return lhs.raw_ptr_ == rhs.raw_ptr_;
     }
@@ -141,6 +233,65 @@ public:
 protected:
     T      *raw_ptr_;
     size_t *refs_;
+
+private:
+    template<typename, typename, typename>
+    friend class RefCntPtr;
+
+    template<typename U, typename alloc_u, typename count_u,
+             typename... arg_ts>
+    friend RefCntPtr<U, alloc_u, count_u> MakeRefCntPtr(arg_ts&&... args);
+
+    /**
+     * An object allocated together with its count. The count comes first, so
+     * the block can be found from the count alone whatever type the object
+     * is viewed as.
+     */
+    struct CoAllocated {
+        size_t refs_;
+        T obj_;
+    };
+
+    // Co-allocated counts are tagged in their low bit, which is otherwise
+    // always clear.
+    static constexpr uintptr_t CO_ALLOCATED = 1;
+
+    size_t *Refs() const
+    {
+        return (size_t*) ((uintptr_t) refs_ & ~CO_ALLOCATED);
+    }
+
+    void Acquire()
+    {
+        if(refs_) {
+            count_t::Inc(*Refs());
+        }
+    }
+
+    void Release()
+    {
+        if(! refs_ || ! count_t::Dec(*Refs())) {
+            return;
+        }
+
+        if constexpr(INTRUSIVE) {
+            delete raw_ptr_;
+        } else if((uintptr_t) refs_ & CO_ALLOCATED) {
+            raw_ptr_->~T();
+            allocator_t::Free(Refs());
+        } else {
+            if (raw_ptr_) {
+                raw_ptr_->~T();
+                allocator_t::Free(raw_ptr_);
+            }
+            allocator_t::Free(refs_);
+        }
+    }
+};
+
+template<typename T, typename allocator_t, typename count_t>
+struct IsTriviallyRelocatable<RefCntPtr<T, allocator_t, count_t>> {
+    static constexpr bool value = true;
 };
 
 template<typename T, typename allocator_t=KernelAllocator>
@@ -149,6 +300,39 @@ class RefCntPtr<T> MakeRefCntPtr(T *ptr)
     return RefCntPtr<T, allocator_t>(ptr);
 }
 
+/**
+ * Construct a shared object in place. Unless the object embeds its own count,
+ * the count is allocated alongside it, so sharing it costs one allocation
+ * rather than two and the count shares the object's cache lines.
+ * @param args Arguments forwarded to T's constructor.
+ * @return A pointer holding the only reference to the new object, or a null
+ *         pointer if allocation failed.
+ */
+template<typename T, typename allocator_t=KernelAllocator,
+         typename count_t=NonAtomicRefCount, typename... arg_ts>
+RefCntPtr<T, allocator_t, count_t> MakeRefCntPtr(arg_ts&&... args)
+{
+    using ptr_t = RefCntPtr<T, allocator_t, count_t>;
+    if constexpr(ptr_t::INTRUSIVE) {
+        return ptr_t(new T(std::forward<arg_ts>(args)...));
+    } else {
+        using block_t = typename ptr_t::CoAllocated;
+        auto block = (block_t*) allocator_t::Allocate(sizeof(block_t));
+        if(! block) {
+            return ptr_t();
+        }
+
+        block->refs_ = 1;
+        new (&block->obj_) T(std::forward<arg_ts>(args)...);
+
+        ptr_t ptr;
+        ptr.raw_ptr_ = &block->obj_;
+        ptr.refs_ = (size_t*) ((uintptr_t) &block->refs_ |
+                               ptr_t::CO_ALLOCATED);
+        return ptr;
+    }
+}
+
 }
 
 #endif
@@ -0,0 +1,460 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <ds/optional.h>
+#include <ds/spin_lock.h>
+#include <sys/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+namespace ds {
+/**
+ * Round a ring's requested capacity up to a power of two, so that positions
+ * map onto slots with a mask rather than a division.
+ */
+inline size_t RingCapacity(size_t requested)
+{
+    size_t capacity = 2;
+    while(capacity < requested) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/**
+ * A bounded, lock-free queue for exactly one producer and one consumer, e.g.
+ * an interrupt handler feeding a single kernel thread.
+ *
+ * Positions only ever grow; the slot for position p is p & mask_. The
+ * producer owns tail_ and the consumer owns head_, and each lives on its own
+ * cache line together with the owner's cached copy of the other index, so the
+ * two sides only touch each other's line when their cached view runs out.
+ * The kernel has no over-aligned operator new, so lines are kept apart with
+ * explicit padding rather than alignas.
+ *
+ * Neither side ever blocks: pushing into a full ring and popping from an
+ * empty one simply fail.
+ */
+template <typename T, typename allocator_t = KernelAllocator>
+class SPSCRing
+{
+public:
+    /**
+     * @param capacity Minimum number of elements the ring must hold; rounded
+     *                 up to a power of two. Check Capacity() for failure.
+     */
+    explicit SPSCRing(size_t capacity)
+        : slots_((T*) allocator_t::Allocate(RingCapacity(capacity) *
+                                            sizeof(T)))
+        , mask_(slots_ ? RingCapacity(capacity) - 1 : 0)
+        , head_(0)
+        , cached_tail_(0)
+        , tail_(0)
+        , cached_head_(0)
+    {}
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing &operator=(const SPSCRing&) = delete;
+
+    ~SPSCRing()
+    {
+        for(size_t pos = head_; pos != tail_; ++pos) {
+            slots_[pos & mask_].~T();
+        }
+        if(slots_) {
+            allocator_t::Free(slots_);
+        }
+    }
+
+    /**
+     * @return Number of elements the ring holds, or 0 if allocating the ring
+     *         failed.
+     */
+    size_t Capacity() const
+    {
+        return slots_ ? mask_ + 1 : 0;
+    }
+
+    /**
+     * @return Number of queued elements; exact only when called by either
+     *         end of the queue while the other is idle.
+     */
+    size_t Size() const
+    {
+        // Head first: it never passes the tail, however stale the read.
+        size_t head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) - head;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    /**
+     * Producer only.
+     * @return Was there room for the element?
+     */
+    bool Push(const T &item)
+    {
+        return Emplace(item);
+    }
+
+    bool Push(T &&item)
+    {
+        return Emplace(std::move(item));
+    }
+
+    /**
+     * Producer only. Copy as many of the given elements as fit, publishing
+     * them all to the consumer at once.
+     * @param items Elements to push, in order.
+     * @param num Number of elements in items.
+     * @return Number of elements pushed, from the front of items.
+     */
+    size_t PushBatch(const T *items, size_t num)
+    {
+        size_t tail = tail_;
+        size_t num_free = Reserve(tail, num);
+        size_t num_pushed = num < num_free ? num : num_free;
+        for(size_t i = 0; i < num_pushed; ++i) {
+            new (&slots_[(tail + i) & mask_]) T(items[i]);
+        }
+        __atomic_store_n(&tail_, tail + num_pushed, __ATOMIC_RELEASE);
+        return num_pushed;
+    }
+
+    /**
+     * Consumer only.
+     * @return The oldest element, or NullOpt if the ring is empty.
+     */
+    Optional<T> Pop()
+    {
+        size_t head = head_;
+        if(! Available(head, 1)) {
+            return NullOpt;
+        }
+
+        T &slot = slots_[head & mask_];
+        Optional<T> item(std::move(slot));
+        slot.~T();
+        __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+        return item;
+    }
+
+    /**
+     * Consumer only. Move up to num of the oldest elements out, releasing
+     * their slots to the producer at once.
+     * @param out Where to move the elements; must hold num elements.
+     * @param num Maximum number of elements to pop.
+     * @return Number of elements popped into the front of out.
+     */
+    size_t PopBatch(T *out, size_t num)
+    {
+        size_t head = head_;
+        size_t num_avail = Available(head, num);
+        size_t num_popped = num < num_avail ? num : num_avail;
+        for(size_t i = 0; i < num_popped; ++i) {
+            T &slot = slots_[(head + i) & mask_];
+            out[i] = std::move(slot);
+            slot.~T();
+        }
+        __atomic_store_n(&head_, head + num_popped, __ATOMIC_RELEASE);
+        return num_popped;
+    }
+
+private:
+    T *slots_;
+    size_t mask_;
+    uint8_t pad0_[CACHE_LINE_SIZE];
+
+    // Consumer's line.
+    size_t head_;
+    size_t cached_tail_;
+    uint8_t pad1_[CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+
+    // Producer's line.
+    size_t tail_;
+    size_t cached_head_;
+    uint8_t pad2_[CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+
+    template <typename arg_t>
+    bool Emplace(arg_t &&item)
+    {
+        size_t tail = tail_;
+        if(! Reserve(tail, 1)) {
+            return false;
+        }
+
+        new (&slots_[tail & mask_]) T(std::forward<arg_t>(item));
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @return Number of free slots after tail, rereading head_ only if the
+     *         cached copy shows fewer than wanted.
+     */
+    size_t Reserve(size_t tail, size_t wanted)
+    {
+        size_t num_free = Capacity() - (tail - cached_head_);
+        if(num_free < wanted) {
+            cached_head_ = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+            num_free = Capacity() - (tail - cached_head_);
+        }
+        return num_free;
+    }
+
+    /**
+     * @return Number of published elements from head on, rereading tail_
+     *         only if the cached copy shows fewer than wanted.
+     */
+    size_t Available(size_t head, size_t wanted)
+    {
+        size_t num_avail = cached_tail_ - head;
+        if(num_avail < wanted) {
+            cached_tail_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+            num_avail = cached_tail_ - head;
+        }
+        return num_avail;
+    }
+};
+
+/**
+ * A bounded, lock-free queue for several producers and either one or several
+ * consumers.
+ *
+ * Each slot carries a sequence number saying whose turn it is: a slot at
+ * position p is free for the producer of p when its sequence is p, and holds
+ * a published element for the consumer of p when its sequence is p + 1.
+ * Consuming the element hands the slot on to the producer of p + capacity.
+ * Producers claim positions by advancing tail_ with a CAS, and consumers do
+ * the same with head_ (or with a plain store, given a single consumer), so a
+ * batch is claimed with a single CAS once its slots have been seen to be
+ * ready. Nobody waits on a slot another core has claimed but not finished
+ * with; such a slot just ends the batch, so interrupt handlers may safely use
+ * the queue the code they interrupted was using.
+ */
+template <typename T, bool multi_consumer,
+          typename allocator_t = KernelAllocator>
+class MPRing
+{
+public:
+    /**
+     * @param capacity Minimum number of elements the ring must hold; rounded
+     *                 up to a power of two. Check Capacity() for failure.
+     */
+    explicit MPRing(size_t capacity)
+        : slots_((Slot*) allocator_t::Allocate(RingCapacity(capacity) *
+                                               sizeof(Slot)))
+        , mask_(slots_ ? RingCapacity(capacity) - 1 : 0)
+        , head_(0)
+        , tail_(0)
+    {
+        for(size_t i = 0; slots_ && i <= mask_; ++i) {
+            slots_[i].seq_ = i;
+        }
+    }
+
+    MPRing(const MPRing&) = delete;
+    MPRing &operator=(const MPRing&) = delete;
+
+    ~MPRing()
+    {
+        if(! slots_) {
+            return;
+        }
+
+        for(size_t pos = head_; pos != tail_; ++pos) {
+            ((T*) slots_[pos & mask_].item_)->~T();
+        }
+        allocator_t::Free(slots_);
+    }
+
+    size_t Capacity() const
+    {
+        return slots_ ? mask_ + 1 : 0;
+    }
+
+    /**
+     * @return Number of claimed, and possibly not yet published, elements.
+     *         Only a snapshot while the queue is in use.
+     */
+    size_t Size() const
+    {
+        size_t head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        size_t tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    /**
+     * @return Was there room for the element?
+     */
+    bool Push(const T &item)
+    {
+        return Emplace(item);
+    }
+
+    bool Push(T &&item)
+    {
+        return Emplace(std::move(item));
+    }
+
+    /**
+     * Copy as many of the given elements as there are free slots for, in
+     * order and at consecutive positions.
+     * @param items Elements to push.
+     * @param num Number of elements in items.
+     * @return Number of elements pushed, from the front of items.
+     */
+    size_t PushBatch(const T *items, size_t num)
+    {
+        size_t pos;
+        size_t num_claimed = Claim<true>(tail_, num, 0, pos);
+        for(size_t i = 0; i < num_claimed; ++i) {
+            Slot &slot = slots_[(pos + i) & mask_];
+            new (slot.item_) T(items[i]);
+            __atomic_store_n(&slot.seq_, pos + i + 1, __ATOMIC_RELEASE);
+        }
+        return num_claimed;
+    }
+
+    /**
+     * @return The oldest published element, or NullOpt if there's none.
+     */
+    Optional<T> Pop()
+    {
+        size_t pos;
+        if(! Claim<multi_consumer>(head_, 1, 1, pos)) {
+            return NullOpt;
+        }
+
+        Slot &slot = slots_[pos & mask_];
+        auto obj = (T*) slot.item_;
+        Optional<T> item(std::move(*obj));
+        obj->~T();
+        __atomic_store_n(&slot.seq_, pos + mask_ + 1, __ATOMIC_RELEASE);
+        return item;
+    }
+
+    /**
+     * Move out up to num of the oldest published elements.
+     * @param out Where to move the elements; must hold num elements.
+     * @param num Maximum number of elements to pop.
+     * @return Number of elements popped into the front of out.
+     */
+    size_t PopBatch(T *out, size_t num)
+    {
+        size_t pos;
+        size_t num_claimed = Claim<multi_consumer>(head_, num, 1, pos);
+        for(size_t i = 0; i < num_claimed; ++i) {
+            Slot &slot = slots_[(pos + i) & mask_];
+            auto obj = (T*) slot.item_;
+            out[i] = std::move(*obj);
+            obj->~T();
+            __atomic_store_n(&slot.seq_, pos + i + mask_ + 1,
+                             __ATOMIC_RELEASE);
+        }
+        return num_claimed;
+    }
+
+private:
+    struct Slot {
+        size_t seq_;
+        alignas(T) uint8_t item_[sizeof(T)];
+    };
+
+    Slot *slots_;
+    size_t mask_;
+    uint8_t pad0_[CACHE_LINE_SIZE];
+
+    size_t head_;
+    uint8_t pad1_[CACHE_LINE_SIZE - sizeof(size_t)];
+
+    size_t tail_;
+    uint8_t pad2_[CACHE_LINE_SIZE - sizeof(size_t)];
+
+    template <typename arg_t>
+    bool Emplace(arg_t &&item)
+    {
+        size_t pos;
+        if(! Claim<true>(tail_, 1, 0, pos)) {
+            return false;
+        }
+
+        Slot &slot = slots_[pos & mask_];
+        new (slot.item_) T(std::forward<arg_t>(item));
+        __atomic_store_n(&slot.seq_, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * Claim up to num consecutive ready positions from an index.
+     * @param index Either tail_ (for producers) or head_ (for consumers).
+     * @param num Maximum number of positions to claim.
+     * @param ready Offset of a ready slot's sequence from its position: 0 for
+     *              free slots, 1 for published ones.
+     * @param pos Set to the first claimed position.
+     * @return Number of positions claimed, which may be 0.
+     */
+    template <bool shared>
+    size_t Claim(size_t &index, size_t num, size_t ready, size_t &pos)
+    {
+        pos = __atomic_load_n(&index, __ATOMIC_RELAXED);
+        if(! slots_) {
+            return 0;
+        }
+
+        for(;;) {
+            size_t num_ready = 0;
+            bool stale = false;
+            while(num_ready < num && num_ready <= mask_) {
+                size_t seq = __atomic_load_n(
+                        &slots_[(pos + num_ready) & mask_].seq_,
+                        __ATOMIC_ACQUIRE);
+                size_t expected = pos + num_ready + ready;
+                if(seq != expected) {
+                    // A sequence ahead of the one expected means another
+                    // claimer has moved the index on since we read it.
+                    stale = num_ready == 0 && (intptr_t) (seq - expected) > 0;
+                    break;
+                }
+                ++num_ready;
+            }
+
+            if(num_ready == 0) {
+                if(! stale) {
+                    return 0;
+                }
+                pos = __atomic_load_n(&index, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            if constexpr(! shared) {
+                __atomic_store_n(&index, pos + num_ready, __ATOMIC_RELAXED);
+                return num_ready;
+            } else if(__atomic_compare_exchange_n(&index, &pos,
+                                                  pos + num_ready, true,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED))
+            {
+                return num_ready;
+            }
+        }
+    }
+};
+
+template <typename T, typename allocator_t = KernelAllocator>
+using MPSCRing = MPRing<T, false, allocator_t>;
+
+template <typename T, typename allocator_t = KernelAllocator>
+using MPMCRing = MPRing<T, true, allocator_t>;
+}
+
+#endif
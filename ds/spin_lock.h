@@ -0,0 +1,89 @@
+#ifndef SPIN_LOCK_H
+#define SPIN_LOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds {
+static constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * Tell the CPU we're busy-waiting, so it can yield to a sibling hyperthread
+ * and avoid the memory-order mis-speculation penalty on leaving the loop.
+ */
+inline void CpuRelax()
+{
+    __builtin_ia32_pause();
+}
+
+/**
+ * A test-and-test-and-set lock. Waiters spin on a plain load, which is served
+ * from their own cache, and only retry the exchange once the lock looks free,
+ * so a contended lock doesn't bounce its line between waiting cores.
+ *
+ * The lock doesn't mask interrupts, so it must not be taken both by an
+ * interrupt handler and by the code that handler may interrupt.
+ */
+class SpinLock
+{
+public:
+    SpinLock()
+        : locked_(false)
+    {}
+
+    SpinLock(const SpinLock&) = delete;
+    SpinLock &operator=(const SpinLock&) = delete;
+
+    void Lock()
+    {
+        while(__atomic_exchange_n(&locked_, true, __ATOMIC_ACQUIRE)) {
+            while(__atomic_load_n(&locked_, __ATOMIC_RELAXED)) {
+                CpuRelax();
+            }
+        }
+    }
+
+    /**
+     * @return Was the lock free, and is it now held?
+     */
+    bool TryLock()
+    {
+        return ! __atomic_load_n(&locked_, __ATOMIC_RELAXED) &&
+               ! __atomic_exchange_n(&locked_, true, __ATOMIC_ACQUIRE);
+    }
+
+    void Unlock()
+    {
+        __atomic_store_n(&locked_, false, __ATOMIC_RELEASE);
+    }
+
+private:
+    bool locked_;
+};
+
+/**
+ * Holds a SpinLock for the rest of the enclosing scope.
+ */
+class SpinLockGuard
+{
+public:
+    explicit SpinLockGuard(SpinLock &lock)
+        : lock_(lock)
+    {
+        lock_.Lock();
+    }
+
+    SpinLockGuard(const SpinLockGuard&) = delete;
+    SpinLockGuard &operator=(const SpinLockGuard&) = delete;
+
+    ~SpinLockGuard()
+    {
+        lock_.Unlock();
+    }
+
+private:
+    SpinLock &lock_;
+};
+}
+
+#endif
@@ -1,52 +1,167 @@
 #ifndef VARDAROS_STRING_H
 #define VARDAROS_STRING_H
 
+#include <ds/optional.h>
+#include <ds/type_traits.h>
 #include <libc/string.h>
 #include <sys/kheap.h>
 #include <sys/log.h>
+#include <stdint.h>
 
 namespace ds {
+template<typename allocator_t>
+class BaseString;
+
+/**
+ * A non-owning view of a run of characters, which need not be NUL-terminated.
+ * Views are cheap to copy and never allocate, so they're the preferred way of
+ * passing around pieces of an existing string. Note that, unlike
+ * BaseString::Len(), Len() counts only characters and not a terminator.
+ */
+class StringView
+{
+public:
+    StringView()
+        : chars_("")
+        , len_(0)
+    {}
+
+    StringView(const char *str)
+        : chars_(str)
+        , len_(strlen(str))
+    {}
+
+    StringView(const char *str, size_t len)
+        : chars_(str)
+        , len_(len)
+    {}
+
+    template<typename allocator_t>
+    StringView(const BaseString<allocator_t> &str)
+        : chars_(str.ToChars())
+        , len_(str.Len() ? str.Len() - 1 : 0)
+    {}
+
+    const char *Data() const
+    {
+        return chars_;
+    }
+
+    size_t Len() const
+    {
+        return len_;
+    }
+
+    char operator [](size_t i) const
+    {
+        return chars_[i];
+    }
+
+    /**
+     * @param start Index of the first character of the substring.
+     * @param end Index one past its final character.
+     * @return A view of [start, end), clamped to this view's bounds.
+     */
+    StringView Substr(size_t start, size_t end) const
+    {
+        end = end < len_ ? end : len_;
+        start = start < end ? start : end;
+        return StringView(chars_ + start, end - start);
+    }
+
+    /**
+     * @param c Character to search for.
+     * @param start Index to begin searching from.
+     * @return Index of the first occurrence of c at or after start.
+     */
+    ds::Optional<size_t> Find(char c, size_t start = 0) const
+    {
+        for(size_t i = start; i < len_; ++i) {
+            if(chars_[i] == c) {
+                return i;
+            }
+        }
+        return ds::NullOpt;
+    }
+
+    /**
+     * @param c Character to search for.
+     * @return Index of the last occurrence of c.
+     */
+    ds::Optional<size_t> RFind(char c) const
+    {
+        for(size_t i = len_; i > 0; --i) {
+            if(chars_[i - 1] == c) {
+                return i - 1;
+            }
+        }
+        return ds::NullOpt;
+    }
+
+    friend bool operator ==(const StringView &lhs, const StringView &rhs)
+    {
+        return lhs.len_ == rhs.len_ && memcmp(lhs.chars_, rhs.chars_,
+                                              lhs.len_) == 0;
+    }
+
+    friend bool operator !=(const StringView &lhs, const StringView &rhs)
+    {
+        return ! (lhs == rhs);
+    }
+
+private:
+    const char *chars_;
+    size_t len_;
+};
+
+/**
+ * An owning, NUL-terminated string. Len() counts the terminator. Strings of
+ * fewer than INLINE_CAP characters, which covers nearly every file name, are
+ * kept inline in the object itself and never touch the allocator. Since
+ * nothing points into the object, it remains trivially relocatable.
+ */
 template<typename allocator_t=KernelAllocator>
 class BaseString
 {
 public:
-    BaseString() = default;
+    static constexpr size_t INLINE_CAP = 24;
+
+    BaseString()
+        : len_(1)
+    {
+        inline_[0] = '\0';
+    }
 
     BaseString(size_t len)
             : len_(len + 1)
-            , chars_((char*) allocator_t::Allocate(len_))
     {
-        memset(chars_, 0, len_);
+        memset(Init(), 0, len_);
     }
 
     BaseString(const char *str)
         : len_(strlen(str) + 1)
-        , chars_((char*) allocator_t::Allocate(len_))
     {
-        for(size_t i = 0; i < len_; ++i) {
-            chars_[i] = str[i];
-        }
-        chars_[len_ - 1] = '\0';
+        memcpy(Init(), str, len_);
     }
 
     BaseString(const char *str, size_t len)
         : len_(len ? str[len-1] == '\0' ? len : len + 1 : 1)
-        , chars_((char*) allocator_t::Allocate(len_))
     {
-        size_t i;
-        for(i = 0; i < len; ++i) {
-            chars_[i] = str[i];
-        }
-        chars_[len_ - 1] = '\0';
+        char *chars = Init();
+        memcpy(chars, str, len);
+        chars[len_ - 1] = '\0';
     }
 
+    explicit BaseString(const StringView &view)
+        : BaseString(view.Data(), view.Len())
+    {}
+
     BaseString(const BaseString &rhs)
         : len_(rhs.len_)
-        , chars_((char*) allocator_t::Allocate(len_))
+        , hash_(rhs.hash_)
+        , hash_fn_(rhs.hash_fn_)
     {
-        for(size_t i = 0; i < len_; ++i) {
-            chars_[i] = rhs.chars_[i];
-        }
+        memcpy(Init(), rhs.Chars(), len_);
     }
 
     BaseString &operator =(const BaseString &rhs)
@@ -55,22 +170,40 @@ public:
             return *this;
         }
 
-        allocator_t::Free(chars_);
-
+        Release();
         len_ = rhs.len_;
-        chars_ = (char*) allocator_t::Allocate(len_);
-        for(size_t i = 0; i < len_; ++i) {
-            chars_[i] = rhs.chars_[i];
+        memcpy(Init(), rhs.Chars(), len_);
+        hash_ = rhs.hash_;
+        hash_fn_ = rhs.hash_fn_;
+
+        return *this;
+    }
+
+    BaseString(BaseString &&rhs)
+        : len_(rhs.len_)
+        , hash_(rhs.hash_)
+        , hash_fn_(rhs.hash_fn_)
+    {
+        Steal(rhs);
+    }
+
+    BaseString &operator =(BaseString &&rhs)
+    {
+        if(&rhs == this) {
+            return *this;
         }
 
+        Release();
+        len_ = rhs.len_;
+        hash_ = rhs.hash_;
+        hash_fn_ = rhs.hash_fn_;
+        Steal(rhs);
         return *this;
     }
 
     ~BaseString()
     {
-        if(chars_) {
-            allocator_t::Free(chars_);
-        }
+        Release();
     }
 
     BaseString Substr(int start, int end) const
@@ -82,7 +215,7 @@ public:
         if(end_ind == start_ind) {
             return "";
         }
-        BaseString str(&chars_[start_ind], end_ind - start_ind);
+        BaseString str(&Chars()[start_ind], end_ind - start_ind);
         return str;
     }
 
@@ -93,38 +226,43 @@ public:
 
     const char *ToChars() const
     {
-        return chars_;
+        return Chars();
     }
 
     friend BaseString operator +(const BaseString &lhs, const BaseString &rhs)
     {
-        const char *concatenation = strcat(lhs, rhs);
-        return BaseString(concatenation);
+        BaseString concatenation(lhs);
+        concatenation += rhs;
+        return concatenation;
     }
 
     BaseString &operator +=(const BaseString &rhs)
     {
-        size_t lhs_len = len_;
-        len_ += rhs.len_;
-        chars_ = allocator_t::Reallocate(chars_, len_);
+        // Both lengths count a terminator, only one of which is kept.
+        size_t lhs_chars = len_ - 1;
+        size_t rhs_chars = rhs.len_ - 1;
+        size_t new_len = lhs_chars + rhs_chars + 1;
 
-        for(size_t i = 0; i < rhs.len_; ++i)
-        {
-            chars_[lhs_len + i] = rhs[i];
+        if(new_len <= INLINE_CAP) {
+            memcpy(inline_ + lhs_chars, rhs.Chars(), rhs_chars);
+        } else {
+            // rhs may be this string, so only release after copying it.
+            auto chars = (char*) allocator_t::Allocate(new_len);
+            memcpy(chars, Chars(), lhs_chars);
+            memcpy(chars + lhs_chars, rhs.Chars(), rhs_chars);
+            Release();
+            heap_ = chars;
         }
-        chars_[lhs_len + rhs.len_] = '\0';
-        return this;
+
+        len_ = new_len;
+        Chars()[len_ - 1] = '\0';
+        hash_fn_ = nullptr;
+        return *this;
     }
 
     friend bool operator ==(const BaseString &lhs, const BaseString &rhs)
     {
-        if(lhs.len_ != rhs.len_) {
-            return false;
-        }
-        if(! lhs.chars_ && ! rhs.chars_) {
-            return true;
-        }
-        return (strncmp(lhs.chars_, rhs.chars_, lhs.len_) == 0);
+        return StringView(lhs) == StringView(rhs);
     }
 
     friend bool operator !=(const BaseString &lhs, const BaseString &rhs)
@@ -132,28 +270,134 @@ public:
         return ! (lhs == rhs);
     }
 
+    friend bool operator ==(const BaseString &lhs, const StringView &rhs)
+    {
+        return StringView(lhs) == rhs;
+    }
+
+    friend bool operator !=(const BaseString &lhs, const StringView &rhs)
+    {
+        return ! (lhs == rhs);
+    }
+
+    // Exact overloads for literals, which could otherwise convert to either
+    // a BaseString or a StringView.
+    friend bool operator ==(const BaseString &lhs, const char *rhs)
+    {
+        return StringView(lhs) == StringView(rhs);
+    }
+
+    friend bool operator !=(const BaseString &lhs, const char *rhs)
+    {
+        return ! (lhs == rhs);
+    }
+
     char &operator [](int i)
     {
+        // The caller may write through the reference.
+        hash_fn_ = nullptr;
         if(i >= 0) {
-            return (char&) chars_[i];
+            return (char&) Chars()[i];
         } else if(i < 0) {
-            return (char&) chars_[len_ - i];
+            return (char&) Chars()[len_ - i];
         }
     }
 
     char operator [](int i) const
     {
         if(i >= 0 && i < (int) len_) {
-            return chars_[i];
+            return Chars()[i];
         } else if(i < 0 && (i + (int) len_) < 0) {
-            return chars_[len_ - i];
+            return Chars()[len_ - i];
         }
         return '\0';
     }
 
+    /**
+     * Retrieve the hash of the string's characters (excluding the
+     * terminator) under the given function. The hash is remembered along
+     * with the function that produced it, so repeated lookups with the same
+     * key hash it only once; any mutation forgets it.
+     * @param hash_fn A hash function over a run of characters.
+     * @return hash_fn(ToChars(), Len() - 1)
+     */
+    uint32_t CachedHash(uint32_t (*hash_fn)(const char*, size_t)) const
+    {
+        if(hash_fn_ != hash_fn) {
+            hash_ = hash_fn(Chars(), len_ - 1);
+            hash_fn_ = hash_fn;
+        }
+        return hash_;
+    }
+
 private:
+    // Includes the terminator, so is never 0.
     size_t len_;
-    char *chars_;
+    union {
+        char *heap_;
+        char inline_[INLINE_CAP];
+    };
+    // Every constructor that doesn't copy the cache starts without one.
+    mutable uint32_t hash_ = 0;
+    mutable uint32_t (*hash_fn_)(const char*, size_t) = nullptr;
+
+    bool IsInline() const
+    {
+        return len_ <= INLINE_CAP;
+    }
+
+    char *Chars()
+    {
+        return IsInline() ? inline_ : heap_;
+    }
+
+    const char *Chars() const
+    {
+        return IsInline() ? inline_ : heap_;
+    }
+
+    /**
+     * Find room for len_ characters, allocating only if they won't fit
+     * inline.
+     * @return Where the characters are to be stored.
+     */
+    char *Init()
+    {
+        if(IsInline()) {
+            return inline_;
+        }
+        heap_ = (char*) allocator_t::Allocate(len_);
+        return heap_;
+    }
+
+    void Release()
+    {
+        if(! IsInline()) {
+            allocator_t::Free(heap_);
+        }
+    }
+
+    /**
+     * Take over rhs's characters, whose length is already in len_, leaving
+     * rhs empty.
+     */
+    void Steal(BaseString &rhs)
+    {
+        if(IsInline()) {
+            memcpy(inline_, rhs.inline_, len_);
+        } else {
+            heap_ = rhs.heap_;
+        }
+
+        rhs.len_ = 1;
+        rhs.inline_[0] = '\0';
+        rhs.hash_fn_ = nullptr;
+    }
+};
+
+template <typename allocator_t>
+struct IsTriviallyRelocatable<BaseString<allocator_t>> {
+    static constexpr bool value = true;
 };
 
 using String = BaseString<KernelAllocator>;
@@ -0,0 +1,20 @@
+#ifndef DS_TYPE_TRAITS_H
+#define DS_TYPE_TRAITS_H
+
+#include <type_traits>
+
+namespace ds {
+/**
+ * Whether an object of type T may be moved to a new address with a plain
+ * memcpy, with the source then being forgotten rather than destroyed. This
+ * holds for trivially copyable types, as well as for types that merely own
+ * heap memory through a pointer and never point into themselves; the latter
+ * should specialize this to true.
+ */
+template <typename T>
+struct IsTriviallyRelocatable {
+    static constexpr bool value = std::is_trivially_copyable<T>::value;
+};
+}
+
+#endif
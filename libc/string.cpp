@@ -1,102 +1,413 @@
 #include "libc/string.h"
+#include "sys/cpu_features.h"
 #include "sys/log.h"
 #include <stddef.h>
 #include <stdint.h>
 
 
+namespace {
+// Views of memory that may be unaligned and alias anything, so that buffers
+// can be moved a word at a time however the caller aligned them.
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+typedef uint16_t __attribute__((may_alias, aligned(1))) unaligned_u16;
+// Aligned words, for scans that read whole words around a buffer's edges.
+typedef uint64_t __attribute__((may_alias)) aliased_u64;
+
+// Sizes up to this are moved with at most two overlapping loads and stores.
+const size_t SMALL_SIZE = 16;
+// From these sizes on, REP MOVSB/STOSB beat the word loops: almost at once
+// with fast short REP MOV, and once their startup cost is amortised with
+// enhanced REP MOVSB alone.
+const size_t FSRM_THRESHOLD = 128;
+const size_t ERMS_THRESHOLD = 512;
+// Without either, REP MOVSQ/STOSQ still beat the word loops on large sizes.
+const size_t REP_QWORD_THRESHOLD = 2048;
+
+inline uint64_t Load64(const unsigned char *p)
+{
+    return *(const unaligned_u64*) p;
+}
+
+inline void Store64(unsigned char *p, uint64_t val)
+{
+    *(unaligned_u64*) p = val;
+}
+
+/**
+ * Flag a word's zero bytes by setting their top bits. Bytes above a zero byte
+ * may be flagged too, so only the lowest flag is exact.
+ */
+inline uint64_t ZeroBytes(uint64_t word)
+{
+    return (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+}
+
+/**
+ * Flag exactly a word's zero bytes by setting their top bits.
+ */
+inline uint64_t ExactZeroBytes(uint64_t word)
+{
+    const uint64_t low_bits = 0x7F7F7F7F7F7F7F7FULL;
+    return ~(((word & low_bits) + low_bits) | word | low_bits);
+}
+
+/**
+ * Would an unaligned word read at p spill onto the next page?
+ */
+inline bool CrossesPage(const unsigned char *p)
+{
+    return ((uintptr_t) p & 0xFFF) > 0x1000 - 8;
+}
+
+/**
+ * Should a copy or fill of this many bytes use REP MOVSB/STOSB?
+ */
+inline bool UseRepByte(size_t bytes)
+{
+    if(bytes < FSRM_THRESHOLD) {
+        return false;
+    }
+    return CpuFeatures::Has(bytes < ERMS_THRESHOLD ?
+                            CpuFeatures::FSRM : CpuFeatures::ERMS);
+}
+
+/**
+ * Copy up to SMALL_SIZE bytes. Every load happens before any store, so the
+ * buffers may overlap either way.
+ */
+inline void CopySmall(unsigned char *dest, const unsigned char *source,
+                      size_t bytes)
+{
+    if(bytes >= 8) {
+        uint64_t head = Load64(source);
+        uint64_t tail = Load64(source + bytes - 8);
+        Store64(dest, head);
+        Store64(dest + bytes - 8, tail);
+    } else if(bytes >= 4) {
+        uint32_t head = *(const unaligned_u32*) source;
+        uint32_t tail = *(const unaligned_u32*) (source + bytes - 4);
+        *(unaligned_u32*) dest = head;
+        *(unaligned_u32*) (dest + bytes - 4) = tail;
+    } else if(bytes >= 2) {
+        uint16_t head = *(const unaligned_u16*) source;
+        uint16_t tail = *(const unaligned_u16*) (source + bytes - 2);
+        *(unaligned_u16*) dest = head;
+        *(unaligned_u16*) (dest + bytes - 2) = tail;
+    } else if(bytes) {
+        *dest = *source;
+    }
+}
+
+/**
+ * Copy more than SMALL_SIZE bytes from the front. Each load precedes the
+ * stores that could overwrite it, so dest may overlap the end of source.
+ */
+void CopyForward(unsigned char *dest, const unsigned char *source,
+                 size_t bytes)
+{
+    // Read first, since the copy may overwrite it if the buffers overlap.
+    uint64_t tail = Load64(source + bytes - 8);
+
+    // String instructions are defined to move one element after another,
+    // so they're also safe with dest below source.
+    if(UseRepByte(bytes)) {
+        asm volatile("rep movsb"
+                     : "+D"(dest), "+S"(source), "+c"(bytes)
+                     :
+                     : "memory");
+        return;
+    }
+
+    if(bytes >= REP_QWORD_THRESHOLD) {
+        size_t words = (bytes - 1) / 8;
+        unsigned char *end = dest + bytes - 8;
+        asm volatile("rep movsq"
+                     : "+D"(dest), "+S"(source), "+c"(words)
+                     :
+                     : "memory");
+        Store64(end, tail);
+        return;
+    }
+
+    size_t i = 0;
+    for(; bytes - i > 32; i += 32) {
+        uint64_t a = Load64(source + i);
+        uint64_t b = Load64(source + i + 8);
+        uint64_t c = Load64(source + i + 16);
+        uint64_t d = Load64(source + i + 24);
+        Store64(dest + i, a);
+        Store64(dest + i + 8, b);
+        Store64(dest + i + 16, c);
+        Store64(dest + i + 24, d);
+    }
+    for(; bytes - i > 8; i += 8) {
+        Store64(dest + i, Load64(source + i));
+    }
+    Store64(dest + bytes - 8, tail);
+}
+
+/**
+ * Copy more than SMALL_SIZE bytes from the back, for dest overlapping the
+ * start of source. REP MOVSB backwards is slow on most CPUs, so this always
+ * uses words.
+ */
+void CopyBackward(unsigned char *dest, const unsigned char *source,
+                  size_t bytes)
+{
+    uint64_t head = Load64(source);
+
+    size_t i = bytes;
+    for(; i > 40; i -= 32) {
+        uint64_t a = Load64(source + i - 8);
+        uint64_t b = Load64(source + i - 16);
+        uint64_t c = Load64(source + i - 24);
+        uint64_t d = Load64(source + i - 32);
+        Store64(dest + i - 8, a);
+        Store64(dest + i - 16, b);
+        Store64(dest + i - 24, c);
+        Store64(dest + i - 32, d);
+    }
+    for(; i > 8; i -= 8) {
+        Store64(dest + i - 8, Load64(source + i - 8));
+    }
+    Store64(dest, head);
+}
+}
+
 void *memcpy(void *dest, const void *source, size_t bytes)
 {
-    char *dest_bytes = (char*) dest;
-    const char *source_bytes = (char*) source;
-    for(size_t i = 0; i < bytes; ++i) {
-        dest_bytes[i] = source_bytes[i];
+    auto *dest_bytes = (unsigned char*) dest;
+    auto *source_bytes = (const unsigned char*) source;
+    if(bytes <= SMALL_SIZE) {
+        CopySmall(dest_bytes, source_bytes, bytes);
+    } else {
+        CopyForward(dest_bytes, source_bytes, bytes);
     }
     return dest;
 }
 
 void *memmove(void *dest, const void *source, size_t bytes)
 {
-    unsigned char *dest_bytes = (unsigned char*) dest;
-    const unsigned char *source_bytes = (unsigned char*) source;
-    for(int i = bytes - 1; i >= 0; --i) {
-        dest_bytes[i] = source_bytes[i];
+    auto *dest_bytes = (unsigned char*) dest;
+    auto *source_bytes = (const unsigned char*) source;
+    if(bytes <= SMALL_SIZE) {
+        CopySmall(dest_bytes, source_bytes, bytes);
+    } else if((uintptr_t) dest_bytes - (uintptr_t) source_bytes >= bytes) {
+        // dest starts below source, or past its end; with unsigned
+        // wraparound, one comparison covers both.
+        CopyForward(dest_bytes, source_bytes, bytes);
+    } else {
+        CopyBackward(dest_bytes, source_bytes, bytes);
     }
     return dest;
 }
 
-void  *memset(void *b, int c, size_t len)
+void *memset(void *dest, int val, size_t bytes)
 {
-    unsigned char *p = (unsigned char*) b;
-    //for(unsigned char *p = (unsigned char *) b; len > 0; ++p, --len) {
-    //    *p = c;
-    //}
-    while(len > 0)
-    {
-        *p = c;
-        p++;
-        len--;
+    auto *dest_bytes = (unsigned char*) dest;
+    uint64_t word = 0x0101010101010101ULL * (unsigned char) val;
+
+    if(bytes <= SMALL_SIZE) {
+        if(bytes >= 8) {
+            Store64(dest_bytes, word);
+            Store64(dest_bytes + bytes - 8, word);
+        } else if(bytes >= 4) {
+            *(unaligned_u32*) dest_bytes = word;
+            *(unaligned_u32*) (dest_bytes + bytes - 4) = word;
+        } else {
+            for(size_t i = 0; i < bytes; ++i) {
+                dest_bytes[i] = val;
+            }
+        }
+        return dest;
     }
-    return(b);
-}
 
-//void *memset(void *dest, int val, size_t bytes)
-//{
-//    int *dest_dwords = (int*) dest;
-//    for(size_t i = 0; i < bytes; i += sizeof(int)) {
-//        dest_dwords[i] = val;
-//    }
-//    return dest;
-//}
+    if(UseRepByte(bytes)) {
+        asm volatile("rep stosb"
+                     : "+D"(dest_bytes), "+c"(bytes)
+                     : "a"(val)
+                     : "memory");
+        return dest;
+    }
+
+    Store64(dest_bytes + bytes - 8, word);
+    if(bytes >= REP_QWORD_THRESHOLD) {
+        size_t words = (bytes - 1) / 8;
+        asm volatile("rep stosq"
+                     : "+D"(dest_bytes), "+c"(words)
+                     : "a"(word)
+                     : "memory");
+        return dest;
+    }
+
+    size_t i = 0;
+    for(; bytes - i > 32; i += 32) {
+        Store64(dest_bytes + i, word);
+        Store64(dest_bytes + i + 8, word);
+        Store64(dest_bytes + i + 16, word);
+        Store64(dest_bytes + i + 24, word);
+    }
+    for(; bytes - i > 8; i += 8) {
+        Store64(dest_bytes + i, word);
+    }
+    return dest;
+}
 
 char *strcat (char *dest, const char *source)
 {
-    size_t concat_offset = strlen(dest);
-    for(size_t i = 0; i < strlen(source); ++i) {
-        dest[concat_offset + i] = source[i];
-    }
-    dest[concat_offset + strlen(source)] = '\0';
+    memcpy(dest + strlen(dest), source, strlen(source) + 1);
     return dest;
 }
 
 char *strncat (char *dest, const char *source, size_t len)
 {
-   size_t concat_offset = strlen(dest);
-   for(size_t i = 0; i < len; ++i) {
-       dest[concat_offset + i] = source[i];
-   }
-   dest[concat_offset + len] = '\0';
-   return dest;
+    const void *terminator = memchr(source, '\0', len);
+    if(terminator) {
+        len = (const char*) terminator - source;
+    }
+
+    char *end = dest + strlen(dest);
+    memcpy(end, source, len);
+    end[len] = '\0';
+    return dest;
 }
 
 int strcmp (const char *lhs, const char *rhs)
 {
-    for(; *lhs && *rhs && *lhs == *rhs; ++lhs, ++rhs);
-    return *((const unsigned char*) lhs) -  *((const unsigned char*) rhs);
+    return strncmp(lhs, rhs, SIZE_MAX);
 }
 
 int strncmp (const char *lhs, const char *rhs, size_t len)
 {
-    size_t i;
-    for(i = 0; i < len - 1 && *lhs && *rhs && *lhs == *rhs; ++lhs, ++rhs, ++i);
-    return *((const unsigned char*) lhs) -  *((const unsigned char*) rhs);
+    auto *lhs_bytes = (const unsigned char*) lhs;
+    auto *rhs_bytes = (const unsigned char*) rhs;
+    size_t i = 0;
+    while(i < len) {
+        // Compare a word at a time where that can't read onto a page past
+        // either string's terminator, and where the whole word is in bounds.
+        if(len - i >= 8 && ! CrossesPage(lhs_bytes + i) &&
+           ! CrossesPage(rhs_bytes + i))
+        {
+            uint64_t lhs_word = Load64(lhs_bytes + i);
+            uint64_t rhs_word = Load64(rhs_bytes + i);
+            uint64_t stop = (lhs_word ^ rhs_word) | ZeroBytes(lhs_word);
+            if(! stop) {
+                i += 8;
+                continue;
+            }
+            // The first byte that differs, or ends both strings.
+            i += __builtin_ctzll(stop) / 8;
+            return lhs_bytes[i] - rhs_bytes[i];
+        }
+
+        if(lhs_bytes[i] != rhs_bytes[i] || ! lhs_bytes[i]) {
+            return lhs_bytes[i] - rhs_bytes[i];
+        }
+        ++i;
+    }
+    return 0;
 }
 
 size_t strlen(const char *str)
 {
-    size_t i;
-    for(i = 0; *str; ++i, ++str);
-    return i;
+    // Aligned words never straddle a page, so reading whole words from the
+    // one holding str is safe even past the terminator. Bytes before str in
+    // the first word are forced non-zero so they can't end the string.
+    uintptr_t addr = (uintptr_t) str;
+    auto *word = (const aliased_u64*) (addr & ~7ULL);
+    uint64_t before = (1ULL << (8 * (addr & 7))) - 1;
+    uint64_t zeros = ZeroBytes(*word | before);
+    while(! zeros) {
+        zeros = ZeroBytes(*++word);
+    }
+    return (const char*) word + __builtin_ctzll(zeros) / 8 - str;
 }
 
 int memcmp (const void *str1, const void *str2, size_t count)
 {
-    const auto *s1 = (const unsigned char*)str1;
-    const auto *s2 = (const unsigned char*)str2;
+    auto *s1 = (const unsigned char*) str1;
+    auto *s2 = (const unsigned char*) str2;
 
-    while (count-- > 0)
-    {
-        if (*s1++ != *s2++)
-            return s1[-1] < s2[-1] ? -1 : 1;
+    if(count >= 8) {
+        // The last word may overlap ones already found equal, which can't
+        // change which byte differs first.
+        for(size_t i = 0; i < count; i += 8) {
+            size_t offset = count - i < 8 ? count - 8 : i;
+            uint64_t diff = Load64(s1 + offset) ^ Load64(s2 + offset);
+            if(diff) {
+                offset += __builtin_ctzll(diff) / 8;
+                return s1[offset] < s2[offset] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    for(size_t i = 0; i < count; ++i) {
+        if(s1[i] != s2[i]) {
+            return s1[i] < s2[i] ? -1 : 1;
+        }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+void *memchr (const void *str, int val, size_t count)
+{
+    if(! count) {
+        return nullptr;
+    }
+
+    // Scan the aligned words covering the buffer. Bytes of the first word
+    // before the buffer are forced not to match, as in strlen, and matches in
+    // bytes of the last word after it are ignored.
+    uintptr_t addr = (uintptr_t) str;
+    uintptr_t last = addr + count - 1;
+    auto *word = (const aliased_u64*) (addr & ~7ULL);
+    auto *last_word = (const aliased_u64*) (last & ~7ULL);
+    uint64_t pattern = 0x0101010101010101ULL * (unsigned char) val;
+    uint64_t before = (1ULL << (8 * (addr & 7))) - 1;
+
+    uint64_t matches = ZeroBytes((*word ^ pattern) | before);
+    while(true) {
+        if(word == last_word) {
+            matches &= ~0ULL >> (8 * (7 - (last & 7)));
+        }
+        if(matches) {
+            return (void*) ((const char*) word + __builtin_ctzll(matches) / 8);
+        }
+        if(word == last_word) {
+            return nullptr;
+        }
+        matches = ZeroBytes(*++word ^ pattern);
+    }
+}
+
+void *memrchr (const void *str, int val, size_t count)
+{
+    if(! count) {
+        return nullptr;
+    }
+
+    // As memchr, but from the back, which needs the exact zero-byte test:
+    // the cheap one may flag bytes above a real match.
+    uintptr_t addr = (uintptr_t) str;
+    uintptr_t last = addr + count - 1;
+    auto *first_word = (const aliased_u64*) (addr & ~7ULL);
+    auto *word = (const aliased_u64*) (last & ~7ULL);
+    uint64_t pattern = 0x0101010101010101ULL * (unsigned char) val;
+
+    uint64_t matches = ExactZeroBytes(*word ^ pattern) &
+                       (~0ULL >> (8 * (7 - (last & 7))));
+    while(true) {
+        if(word == first_word) {
+            matches &= ~0ULL << (8 * (addr & 7));
+        }
+        if(matches) {
+            return (void*) ((const char*) word + (63 - __builtin_clzll(matches)) / 8);
+        }
+        if(word == first_word) {
+            return nullptr;
+        }
+        matches = ExactZeroBytes(*--word ^ pattern);
+    }
+}
@@ -7,7 +7,8 @@ extern "C" void *memcpy (void *dest, const void *src, size_t bytes);
 extern "C" void *memmove (void *dest, const void *source, size_t bytes);
 extern "C" void *memset (void *dest, int val, size_t bytes);
 extern "C" int memcmp (const void *, const void *, size_t);
-//void *memchr (const void *, int, size_t);
+extern "C" void *memchr (const void *, int, size_t);
+extern "C" void *memrchr (const void *, int, size_t);
 //
 //char *strcpy (char *__restrict, const char *__restrict);
 //char *strncpy (char *__restrict, const char *__restrict, size_t);
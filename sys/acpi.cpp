@@ -68,7 +68,7 @@ ParseRoot(stivale2_struct_tag_rsdp* rsdp_hdr)
         if (ValidateSDT((void*) sdt, sdt->length_)) {
             // Need to specify len, since signature isn't null-terminated.
             ds::String tab_name(sdt->signature_, 4);
-            if (! tables.Insert(tab_name, (void*) sdt)) {
+            if (! tables.TryEmplace(std::move(tab_name), (void*) sdt)) {
                 Log("Insert to hash map failed.\n");
                 return ds::NullOpt;
             }
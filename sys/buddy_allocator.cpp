@@ -1,20 +1,22 @@
 #include "buddy_allocator.h"
 #include "sys/log.h"
+#include "sys/shrinker.h"
 #include "libc/string.h"
+#include <ds/intrusive_list.h>
 
 namespace BuddyAllocator {
 
 // A struct tracking the status of a page. Each page will be assigned such
-// an entry; forward_ and backward_ pointers allow this to struct be placed
-// in a freelist. The order_ field gives log2([NUM PAGES IN ENTRY]). The
-// entry also maintains info about whether or not this page is currently
-// free.
-struct FreeListEntry {
-    FreeListEntry *forward_, *backward_;
+// an entry; its list links allow this struct to be placed in a freelist.
+// The order_ field gives log2([NUM PAGES IN ENTRY]). The entry also
+// maintains info about whether or not this page is currently free.
+struct FreeListEntry : ds::ListLink<> {
     uint8_t order_;
     bool free_;
 };
 
+using FreeList = ds::IntrusiveList<FreeListEntry>;
+
 // A range of memory that has been entrusted to this allocator. Some segment
 // of memory at the start of each range will be reserved for metadata
 // regarding the set of pages within this range; this range will have size
@@ -36,9 +38,9 @@ const static size_t MIN_ALLOCATION = 0x1000;
 // mem_ranges_ is an array of contiguous ranges of usable memory.
 static MemRange *mem_ranges_;
 static size_t num_ranges_, num_blocks_;
-// free_lists_[n] gives the head of a linked list of free list entries referring
-// to blocks of size 2^n bytes.
-static FreeListEntry *free_lists_[MAX_ORDER-MIN_ORDER] = {nullptr};
+// free_lists_[n] is the linked list of free list entries referring to blocks
+// of size 2^(n + MIN_ORDER) bytes.
+static FreeList free_lists_[MAX_ORDER-MIN_ORDER];
 
 static size_t mem_in_use_, total_mem_;
 
@@ -167,7 +169,8 @@ static void PushFront(uint8_t order, FreeListEntry *entry);
 static FreeListEntry *PopFront(uint8_t order);
 
 /**
- * Remove the given entry from the freelist which it currently resides in.
+ * Remove the given entry from the freelist which it currently resides in, if
+ * any.
  * @param entry The entry to remove.
  */
 static void Remove(FreeListEntry *entry);
@@ -179,6 +182,25 @@ static void Remove(FreeListEntry *entry);
  */
 static inline uint8_t CeilLog2(size_t size);
 
+/**
+ * Compute floor(log2(size)).
+ * @param size Some positive number.
+ * @return floor(log2(size)).
+ */
+static inline uint8_t FloorLog2(size_t size);
+
+/**
+ * @param order The order of a block.
+ * @return The size of a block of that order, in bytes.
+ */
+static inline size_t BlockBytes(uint8_t order);
+
+/**
+ * @param order The order of a block, at least MIN_ORDER.
+ * @return The number of pages in a block of that order.
+ */
+static inline size_t BlockPages(uint8_t order);
+
 /**
  * Round to the nearest multiple of MIN_ALLOCATION.
  * @param size Some positive number, representing a value in bytes.
@@ -196,6 +218,9 @@ void InitBuddyAllocator(const struct stivale2_struct_tag_memmap &memmap)
     mem_ranges_ = nullptr;
     mem_in_use_ = 0;
     total_mem_ = 0;
+    for (FreeList &free_list : free_lists_) {
+        free_list = FreeList();
+    }
 
     // Count number of usable memory ranges in the computer's memory map.
     size_t num_usable = 0;
@@ -213,8 +238,9 @@ void InitBuddyAllocator(const struct stivale2_struct_tag_memmap &memmap)
     size_t memrange_arr_size = sizeof(MemRange) * num_usable;
     int selected_range = -1;
     for (size_t i = 0; i < memmap.entries; ++i) {
-        size_t mdata_size =
-                memrange_arr_size + CeilLog2(memmap.memmap[i].length);
+        size_t num_pages = memmap.memmap[i].length / MIN_ALLOCATION;
+        size_t mdata_size = RoundUp(memrange_arr_size) +
+                            RoundUp(num_pages * sizeof(FreeListEntry));
 
         if (memmap.memmap[i].type == STIVALE2_MMAP_USABLE &&
             memmap.memmap[i].length > mdata_size)
@@ -246,20 +272,15 @@ void InitBuddyAllocator(const struct stivale2_struct_tag_memmap &memmap)
     initialized_ = true;
 }
 
-void *Allocate(size_t size)
+static void *AllocateBlock(size_t size)
 {
-    if (! initialized_) {
-        return nullptr;
-    }
-
     uint8_t order = CeilLog2(size);
     uint8_t block_order = order > MIN_ORDER ? order : MIN_ORDER;
     FreeListEntry *entry = nullptr;
-    num_blocks_ -= (1 << (block_order - MIN_ORDER));
 
     // Find first block with size greater than requested, pop from free list.
     for (order = block_order; order < MAX_ORDER; ++order) {
-        if (free_lists_[order - MIN_ORDER]) {
+        if (! free_lists_[order - MIN_ORDER].Empty()) {
             entry = PopFront(order);
             break;
         }
@@ -279,10 +300,25 @@ void *Allocate(size_t size)
     entry->free_ = false;
     entry->order_ = block_order;
 
-    mem_in_use_ += (1 << entry->order_);
+    num_blocks_ -= BlockPages(block_order);
+    mem_in_use_ += BlockBytes(block_order);
     return (void *) EntryToAddr(entry);
 }
 
+void *Allocate(size_t size)
+{
+    if (! initialized_) {
+        return nullptr;
+    }
+
+    ShrinkerRegistry::Balance();
+    void *allocation = AllocateBlock(size);
+    if (! allocation && ShrinkerRegistry::Reclaim()) {
+        allocation = AllocateBlock(size);
+    }
+    return allocation;
+}
+
 void *Realloc(void *allocation, size_t size)
 {
     if (!initialized_ || !allocation) {
@@ -291,21 +327,25 @@ void *Realloc(void *allocation, size_t size)
 
     uintptr_t alloc_addr = (uintptr_t) allocation;
     FreeListEntry *alloc_entry = AddrToEntry(alloc_addr);
+    if (!alloc_entry) {
+        return nullptr;
+    }
 
     // Buddy allocators have a lot of internal fragmentation; there's
     // some space at the end of each allocation to ensure that the
     // allocation consists of 2^n blocks; if the requested new size can
     // fit in the already-allocation block, then there's no need to copy
     // data to a new allocation.
-    size_t alloc_size = (1 << alloc_entry->order_);
-    if (size < alloc_size) {
-        mem_in_use_ += alloc_size;
+    size_t alloc_size = BlockBytes(alloc_entry->order_);
+    if (size <= alloc_size) {
         return allocation;
     }
 
+    // On failure the existing allocation is left as it was.
     void *new_alloc = Allocate(size);
-    // THis memset somehow fucks everything up.
-    memset(new_alloc, 0, size);
+    if (!new_alloc) {
+        return nullptr;
+    }
     memcpy(new_alloc, allocation, alloc_size);
     Free(allocation);
     return new_alloc;
@@ -320,7 +360,13 @@ void Free(void *allocation)
 
     uintptr_t alloc_addr = (uintptr_t) allocation;
     FreeListEntry *alloc_entry = AddrToEntry(alloc_addr);
-    num_blocks_ += (1 << alloc_entry->order_);
+    if (!alloc_entry || alloc_entry->free_) {
+        Log("[WARNING] Attempting to free non-allocated pages at 0x%x.\n",
+            alloc_addr);
+        return;
+    }
+    num_blocks_ += BlockPages(alloc_entry->order_);
+    mem_in_use_ -= BlockBytes(alloc_entry->order_);
 
     FreeListEntry *buddy_entry = BuddyOf(alloc_addr, alloc_entry->order_);
 
@@ -341,8 +387,6 @@ void Free(void *allocation)
         alloc_addr = EntryToAddr(alloc_entry);
         buddy_entry = BuddyOf(alloc_addr, alloc_entry->order_);
     }
-
-    mem_in_use_ -= (1 << alloc_entry->order_);
 }
 
 
@@ -370,14 +414,10 @@ void Print()
 {
     size_t mem = 0;
     for (uint8_t order = MIN_ORDER; order < MAX_ORDER; ++order) {
-        if (free_lists_[order - MIN_ORDER]) {
-            size_t num_entries = 0;
-            FreeListEntry *curr = free_lists_[order - MIN_ORDER];
-            do {
-                ++num_entries;
-            } while ((curr = curr->forward_));
-            mem += num_entries * (1 << order);
-            Log("\t%d blocks of size %d\n", num_entries, (1 << order));
+        if (! free_lists_[order - MIN_ORDER].Empty()) {
+            size_t num_entries = free_lists_[order - MIN_ORDER].Size();
+            mem += num_entries * BlockBytes(order);
+            Log("\t%d blocks of size %d\n", num_entries, BlockBytes(order));
         }
     }
     Log("TOTAL MEM: %d blocks\n", mem / MIN_ALLOCATION);
@@ -388,6 +428,59 @@ size_t NumBlocks()
     return num_blocks_;
 }
 
+bool Verify()
+{
+    size_t free_pages = 0;
+    for (uint8_t order = MIN_ORDER; order < MAX_ORDER; ++order) {
+        FreeList &free_list = free_lists_[order - MIN_ORDER];
+        for (FreeListEntry &entry : free_list) {
+            uintptr_t addr = EntryToAddr(&entry);
+            int range_ind = EntryRange(addr);
+            if (range_ind == -1 || !entry.free_ || entry.order_ != order) {
+                Log("FREE BLOCK AT 0x%x ON LIST %d IS INVALID.\n", addr, order);
+                return false;
+            }
+
+            const MemRange &range = mem_ranges_[range_ind];
+            if ((addr - range.base_) % BlockBytes(order) ||
+                addr + BlockBytes(order) > range.base_ + range.size_)
+            {
+                Log("FREE BLOCK AT 0x%x OF ORDER %d IS MISPLACED.\n",
+                    addr, order);
+                return false;
+            }
+
+            // Free buddies should have been merged when the second was freed.
+            FreeListEntry *buddy = BuddyOf(addr, order);
+            if (buddy && Mergeable(&entry, buddy) &&
+                free_list.Contains(*buddy))
+            {
+                Log("FREE BLOCK AT 0x%x OF ORDER %d HAS A FREE BUDDY.\n",
+                    addr, order);
+                return false;
+            }
+            free_pages += BlockPages(order);
+        }
+    }
+
+    if (free_pages != num_blocks_) {
+        Log("FREE LISTS HOLD %d PAGES, BUT %d ARE COUNTED.\n",
+            free_pages, num_blocks_);
+        return false;
+    }
+
+    size_t usable_mem = 0;
+    for (size_t i = 0; i < num_ranges_; ++i) {
+        usable_mem += mem_ranges_[i].size_ / MIN_ALLOCATION * MIN_ALLOCATION;
+    }
+    if (free_pages * MIN_ALLOCATION + mem_in_use_ != usable_mem) {
+        Log("%d BYTES FREE AND %d IN USE DON'T ADD UP TO %d.\n",
+            free_pages * MIN_ALLOCATION, mem_in_use_, usable_mem);
+        return false;
+    }
+    return true;
+}
+
 static uintptr_t EntryToAddr(FreeListEntry *entry)
 {
     // The free list entry for a given address in range r is stored at
@@ -431,7 +524,8 @@ static void CatalogRange(const stivale2_mmap_entry &range,
     range_entry->mdata_size_ = RoundUp(init_mdata_size);
     range_entry->mdata_size_ +=
             RoundUp(num_page_structs * sizeof(FreeListEntry));
-    range_entry->size_ = range.length - range_entry->mdata_size_;
+    range_entry->size_ = range.length > range_entry->mdata_size_ ?
+                         range.length - range_entry->mdata_size_ : 0;
 
     range_entry->mdata_base_ = range.base + init_mdata_size;
     range_entry->base_ = range.base + range_entry->mdata_size_;
@@ -445,21 +539,26 @@ static void CatalogRange(const stivale2_mmap_entry &range,
 
     // For each page in the memory range, make an entry in page_entries_.
     for (size_t j = region_base; j < region_bound; j += MIN_ALLOCATION) {
-        size_t entry_ind = (j - range.base) / MIN_ALLOCATION;
+        size_t entry_ind = (j - region_base) / MIN_ALLOCATION;
         range_entry->page_entries_[entry_ind] =
-                (FreeListEntry){nullptr, nullptr, MIN_ORDER, true};
+                (FreeListEntry){{nullptr, nullptr}, MIN_ORDER, true};
     }
 
-    // Divide the region into entries consisting of powers of 2 that are greater
-    // than the size of a page (MIN_ALLOCATION).
-    for (size_t j = CeilLog2(region_size) - 1; region_size > MIN_ALLOCATION;
-         --j)
+    // Divide the region into entries consisting of powers of 2 that are at
+    // least the size of a page (MIN_ALLOCATION), largest first, so that each
+    // block is aligned to its size relative to the start of the region.
+    if (region_size < MIN_ALLOCATION) {
+        return;
+    }
+    uint8_t j = FloorLog2(region_size);
+    for (j = j < MAX_ORDER - 1 ? j : MAX_ORDER - 1;
+         region_size >= MIN_ALLOCATION; --j)
     {
-        if (region_size >= (1ULL << j)) {
-            num_blocks_ += (1 << (j - MIN_ORDER));
+        while (region_size >= BlockBytes(j)) {
+            num_blocks_ += BlockPages(j);
             PushFront(j, AddrToEntry(region_base));
-            region_size -= (1 << j);
-            region_base += (1 << j);
+            region_size -= BlockBytes(j);
+            region_base += BlockBytes(j);
         }
     }
 }
@@ -471,8 +570,14 @@ static FreeListEntry *BuddyOf(uintptr_t addr, uint8_t order)
         return nullptr;
     }
 
+    // A block at the end of a range may have no buddy; if it would run past
+    // the end, the address may belong to the next range instead.
     uintptr_t base = mem_ranges_[range_index].base_;
-    uintptr_t buddy_addr = ((addr - base) ^ (1 << (order))) + base;
+    uintptr_t buddy_addr = ((addr - base) ^ BlockBytes(order)) + base;
+    size_t range_size = mem_ranges_[range_index].size_;
+    if (buddy_addr + BlockBytes(order) > base + range_size) {
+        return nullptr;
+    }
     return AddrToEntry(buddy_addr);
 }
 
@@ -512,7 +617,7 @@ static int EntryRange(uintptr_t addr)
         size_t base = mem_ranges_[i].base_;
         size_t bound = mem_ranges_[i].base_ + mem_ranges_[i].size_;
 
-        if (base <= addr && addr <= bound) {
+        if (base <= addr && addr < bound) {
             return i;
         }
     }
@@ -527,7 +632,7 @@ static int EntryRange(FreeListEntry *entry)
         size_t base = mem_ranges_[i].mdata_base_;
         size_t bound = mem_ranges_[i].mdata_base_ + mem_ranges_[i].mdata_size_;
 
-        if (base <= addr && addr <= bound) {
+        if (base <= addr && addr < bound) {
             return i;
         }
     }
@@ -537,7 +642,7 @@ static int EntryRange(FreeListEntry *entry)
 
 static bool Mergeable(FreeListEntry *entry, FreeListEntry *buddy)
 {
-    if (EntryRange(EntryToAddr(buddy)) == -1) {
+    if (!buddy || EntryRange(EntryToAddr(buddy)) == -1) {
         return false;
     }
 
@@ -546,45 +651,24 @@ static bool Mergeable(FreeListEntry *entry, FreeListEntry *buddy)
 
 static void PushFront(uint8_t order, FreeListEntry *entry)
 {
-    // Linked list insertion.
     entry->order_ = order;
-    entry->forward_ = free_lists_[order - MIN_ORDER];
-    if (free_lists_[order - MIN_ORDER]) {
-        free_lists_[order - MIN_ORDER]->backward_ = entry;
-    }
-    free_lists_[order - MIN_ORDER] = entry;
+    free_lists_[order - MIN_ORDER].PushFront(*entry);
 }
 
 static FreeListEntry *PopFront(uint8_t order)
 {
-    // Linked list pop.
-    FreeListEntry *head = free_lists_[order - MIN_ORDER];
-    free_lists_[order - MIN_ORDER] = head->forward_;
-    if (free_lists_[order - MIN_ORDER]) {
-        free_lists_[order - MIN_ORDER]->backward_ = nullptr;
-    }
-    return head;
+    return free_lists_[order - MIN_ORDER].PopFront();
 }
 
 static void Remove(FreeListEntry *entry)
 {
-    // Standard linked list removal.
-    if (entry->forward_) {
-        entry->forward_->backward_ = entry->backward_;
-    }
-
-    if (entry->backward_) {
-        entry->backward_->forward_ = entry->forward_;
-    }
-
+    // Split and Merge remove both halves of a block without knowing whether
+    // either is free, so an entry on no list is left as it is.
     if (entry->order_ >= MIN_ORDER &&
-        free_lists_[entry->order_ - MIN_ORDER] == entry)
+        free_lists_[entry->order_ - MIN_ORDER].Contains(*entry))
     {
-        free_lists_[entry->order_ - MIN_ORDER] = entry->forward_;
+        free_lists_[entry->order_ - MIN_ORDER].Remove(*entry);
     }
-
-    entry->forward_ = nullptr;
-    entry->backward_ = nullptr;
 }
 
 static uint8_t CeilLog2(size_t size)
@@ -594,6 +678,21 @@ static uint8_t CeilLog2(size_t size)
     return i;
 }
 
+static uint8_t FloorLog2(size_t size)
+{
+    return 63 - __builtin_clzl(size);
+}
+
+static size_t BlockBytes(uint8_t order)
+{
+    return (size_t) 1 << order;
+}
+
+static size_t BlockPages(uint8_t order)
+{
+    return (size_t) 1 << (order - MIN_ORDER);
+}
+
 static size_t RoundUp(size_t size)
 {
     return ((size + MIN_ALLOCATION - 1) / MIN_ALLOCATION) * MIN_ALLOCATION;
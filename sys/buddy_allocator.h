@@ -76,6 +76,15 @@ void Print();
  */
 size_t NumBlocks();
 
+/**
+ * Check that the freelists agree with each other and with the allocator's
+ * accounting: every free block is aligned and within its range, no two free
+ * buddies are left unmerged, and free plus in-use memory adds up to the
+ * memory cataloged. Logs the first discrepancy found.
+ * @return Whether all of the above holds.
+ */
+bool Verify();
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "sys/checksum.h"
+#include "sys/cpu_features.h"
+#include "sys/fpu.h"
+
+namespace Checksum {
+namespace {
+// Both CRCs are computed bit-reflected, least significant bit first, so the
+// polynomials are too.
+const uint32_t CRC32_POLY = 0xEDB88320;
+const uint32_t CRC32C_POLY = 0x82F63B78;
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+
+// With SSE4.2, the buffer is split into three blocks of this size, which are
+// checksummed in one interleaved pass to hide the CRC32 instruction's
+// latency, then combined. Long blocks amortise combining; short ones pick up
+// what's left.
+const size_t LONG_BLOCK = 8192;
+const size_t SHORT_BLOCK = 256;
+// Folding with PCLMULQDQ takes at least this much data.
+const size_t CLMUL_THRESHOLD = 64;
+
+/**
+ * Tables for slicing-by-8: slice_[k][b] is the CRC of byte b followed by k
+ * zero bytes, so that eight bytes are folded in with eight independent
+ * lookups rather than a chain of eight.
+ */
+struct SliceTables {
+    uint32_t slice_[8][256];
+};
+
+/**
+ * Tables that append a fixed number of zero bytes to a CRC: byte_[k][b] is
+ * the effect of doing so on byte k of the CRC having value b. Appending
+ * zeros is linear, so the four lookups XOR together.
+ */
+struct ShiftTables {
+    uint32_t byte_[4][256];
+};
+
+constexpr SliceTables MakeSliceTables(uint32_t poly)
+{
+    SliceTables tables = {};
+    for(uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+        }
+        tables.slice_[0][i] = crc;
+    }
+    for(size_t k = 1; k < 8; ++k) {
+        for(size_t i = 0; i < 256; ++i) {
+            uint32_t prev = tables.slice_[k - 1][i];
+            tables.slice_[k][i] = (prev >> 8) ^ tables.slice_[0][prev & 0xFF];
+        }
+    }
+    return tables;
+}
+
+/**
+ * Fold eight bytes into a CRC.
+ */
+constexpr uint32_t Slice8(const SliceTables &tables, uint32_t crc,
+                          uint64_t word)
+{
+    const auto &t = tables.slice_;
+    word ^= crc;
+    return t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^
+           t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+           t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+           t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+}
+
+constexpr ShiftTables MakeShiftTables(const SliceTables &tables,
+                                      size_t num_zeros)
+{
+    // Shift each bit of a CRC on its own, then combine them for each byte.
+    uint32_t shifted_bits[32] = {};
+    for(size_t bit = 0; bit < 32; ++bit) {
+        uint32_t crc = 1U << bit;
+        for(size_t i = 0; i < num_zeros; i += 8) {
+            crc = Slice8(tables, crc, 0);
+        }
+        shifted_bits[bit] = crc;
+    }
+
+    ShiftTables shift = {};
+    for(size_t k = 0; k < 4; ++k) {
+        for(size_t b = 0; b < 256; ++b) {
+            for(size_t bit = 0; bit < 8; ++bit) {
+                if(b & (1 << bit)) {
+                    shift.byte_[k][b] ^= shifted_bits[8 * k + bit];
+                }
+            }
+        }
+    }
+    return shift;
+}
+
+// Built at compile time, since the kernel runs no global constructors.
+constexpr SliceTables CRC32_TABLES = MakeSliceTables(CRC32_POLY);
+constexpr SliceTables CRC32C_TABLES = MakeSliceTables(CRC32C_POLY);
+constexpr ShiftTables LONG_SHIFT = MakeShiftTables(CRC32C_TABLES, LONG_BLOCK);
+constexpr ShiftTables SHORT_SHIFT = MakeShiftTables(CRC32C_TABLES,
+                                                    SHORT_BLOCK);
+
+/**
+ * Fold data into a CRC, without the inversions either side that the
+ * standard CRCs apply.
+ */
+uint32_t UpdateSoftware(const SliceTables &tables, uint32_t crc,
+                        const unsigned char *bytes, size_t size)
+{
+    for(; size >= 8; bytes += 8, size -= 8) {
+        crc = Slice8(tables, crc, *(const unaligned_u64*) bytes);
+    }
+    for(; size; ++bytes, --size) {
+        crc = tables.slice_[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+inline uint32_t Crc32cByte(uint32_t crc, uint8_t byte)
+{
+    asm("crc32 %0, %1" : "+r"(crc) : "rm"(byte));
+    return crc;
+}
+
+inline uint64_t Crc32cWord(uint64_t crc, uint64_t word)
+{
+    asm("crc32 %0, %1" : "+r"(crc) : "rm"(word));
+    return crc;
+}
+
+inline uint32_t Shift(const ShiftTables &shift, uint32_t crc)
+{
+    return shift.byte_[0][crc & 0xFF] ^ shift.byte_[1][(crc >> 8) & 0xFF] ^
+           shift.byte_[2][(crc >> 16) & 0xFF] ^ shift.byte_[3][crc >> 24];
+}
+
+/**
+ * Fold as many runs of three blocks of block_size as fit into a CRC, three
+ * words at a time.
+ */
+template <size_t block_size>
+uint64_t UpdateInterleaved(const ShiftTables &shift, uint64_t crc,
+                           const unsigned char *&bytes, size_t &size)
+{
+    for(; size >= 3 * block_size; bytes += 3 * block_size,
+                                  size -= 3 * block_size)
+    {
+        uint64_t crc1 = 0, crc2 = 0;
+        for(size_t i = 0; i < block_size; i += 8) {
+            crc = Crc32cWord(crc, *(const unaligned_u64*) (bytes + i));
+            crc1 = Crc32cWord(crc1, *(const unaligned_u64*)
+                                    (bytes + block_size + i));
+            crc2 = Crc32cWord(crc2, *(const unaligned_u64*)
+                                    (bytes + 2 * block_size + i));
+        }
+        // The CRC of a block followed by another is the first's shifted
+        // over the second, XORed with the second's from zero.
+        crc = Shift(shift, crc) ^ crc1;
+        crc = Shift(shift, crc) ^ crc2;
+    }
+    return crc;
+}
+
+uint32_t UpdateHardware(uint32_t crc, const unsigned char *bytes, size_t size)
+{
+    // Align, so that no word straddles a cache line.
+    for(; size && (uintptr_t) bytes % 8; ++bytes, --size) {
+        crc = Crc32cByte(crc, *bytes);
+    }
+
+    uint64_t crc64 = crc;
+    crc64 = UpdateInterleaved<LONG_BLOCK>(LONG_SHIFT, crc64, bytes, size);
+    crc64 = UpdateInterleaved<SHORT_BLOCK>(SHORT_SHIFT, crc64, bytes, size);
+    for(; size >= 8; bytes += 8, size -= 8) {
+        crc64 = Crc32cWord(crc64, *(const unaligned_u64*) bytes);
+    }
+
+    crc = crc64;
+    for(; size; ++bytes, --size) {
+        crc = Crc32cByte(crc, *bytes);
+    }
+    return crc;
+}
+}
+
+uint32_t Crc32(const void *data, size_t bytes, uint32_t crc)
+{
+    auto *next = (const unsigned char*) data;
+    crc = ~crc;
+    if(bytes >= CLMUL_THRESHOLD && CpuFeatures::Has(CpuFeatures::PCLMUL) &&
+       Fpu::Usable())
+    {
+        // Fold the whole blocks, leaving the tail to the tables.
+        size_t folded = bytes & ~(size_t) 15;
+        KernelFpuBegin();
+        crc = detail::Crc32Clmul(next, folded, crc);
+        KernelFpuEnd();
+        next += folded;
+        bytes -= folded;
+    }
+    return ~UpdateSoftware(CRC32_TABLES, crc, next, bytes);
+}
+
+uint32_t Crc32c(const void *data, size_t bytes, uint32_t crc)
+{
+    if(CpuFeatures::Has(CpuFeatures::SSE4_2)) {
+        return ~UpdateHardware(~crc, (const unsigned char*) data, bytes);
+    }
+    return Crc32cSoftware(data, bytes, crc);
+}
+
+uint32_t Crc32Software(const void *data, size_t bytes, uint32_t crc)
+{
+    return ~UpdateSoftware(CRC32_TABLES, ~crc, (const unsigned char*) data,
+                           bytes);
+}
+
+uint32_t Crc32cSoftware(const void *data, size_t bytes, uint32_t crc)
+{
+    return ~UpdateSoftware(CRC32C_TABLES, ~crc, (const unsigned char*) data,
+                           bytes);
+}
+}
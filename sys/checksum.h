@@ -0,0 +1,54 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Checksums of on-disk and in-memory structures.
+namespace Checksum
+{
+/**
+ * The CRC-32 of IEEE 802.3, as used by GPT, zlib and PNG. Folded with
+ * PCLMULQDQ where the CPU and FPU allow, for all but short data. To
+ * checksum data in pieces, pass each piece the CRC of those before it:
+ *
+ *     uint32_t crc = Crc32(first, first_size);
+ *     crc = Crc32(second, second_size, crc);
+ *
+ * gives the same result as one call over both.
+ * @param data The data to checksum.
+ * @param bytes The size of the data, in bytes.
+ * @param crc The CRC of the data preceding this, or 0 to start afresh.
+ * @return The CRC of all the data so far.
+ */
+uint32_t Crc32(const void *data, size_t bytes, uint32_t crc = 0);
+
+/**
+ * CRC-32C (Castagnoli), as used by ext4's metadata_csum, iSCSI and SCTP.
+ * Faster than Crc32 on CPUs with SSE4.2, which compute it in hardware.
+ * Pieces chain as with Crc32.
+ * @param data The data to checksum.
+ * @param bytes The size of the data, in bytes.
+ * @param crc The CRC of the data preceding this, or 0 to start afresh.
+ * @return The CRC of all the data so far.
+ */
+uint32_t Crc32c(const void *data, size_t bytes, uint32_t crc = 0);
+
+/**
+ * Crc32 and Crc32c with tables alone, for testing and benchmarking them
+ * against their faster paths.
+ */
+uint32_t Crc32Software(const void *data, size_t bytes, uint32_t crc = 0);
+uint32_t Crc32cSoftware(const void *data, size_t bytes, uint32_t crc = 0);
+
+namespace detail {
+/**
+ * Fold data into a CRC-32 with PCLMULQDQ, without the inversions either
+ * side. Built with SSE, so only to be called within an FPU region.
+ * @param bytes At least 64, and a multiple of 16.
+ */
+uint32_t Crc32Clmul(const unsigned char *data, size_t bytes, uint32_t crc);
+}
+}
+
+#endif
@@ -0,0 +1,78 @@
+#include "sys/checksum.h"
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+// Built with SSE; see sys/fpu.h.
+
+namespace Checksum {
+namespace detail {
+namespace {
+// Folding constants for the reflected CRC-32 polynomial, from Intel's "Fast
+// CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction":
+// x^(4*128+32) and x^(4*128-32) mod P to fold 64 bytes at once, x^(128+32)
+// and x^(128-32) mod P to fold 16, x^64 mod P to reduce to 64 bits, and P
+// with its Barrett constant to reduce to 32.
+alignas(16) const uint64_t FOLD_64[2] = {0x0154442BD4, 0x01C6E41596};
+alignas(16) const uint64_t FOLD_16[2] = {0x01751997D0, 0x00CCAA009E};
+alignas(16) const uint64_t FOLD_8[2] = {0x0163CD6124, 0};
+alignas(16) const uint64_t BARRETT[2] = {0x01DB710641, 0x01F7011641};
+
+/**
+ * Fold 128 bits into the next 128 ahead of them.
+ */
+__attribute__((target("pclmul")))
+inline __m128i Fold(__m128i x, __m128i k, __m128i next)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+}
+
+__attribute__((target("pclmul")))
+uint32_t Crc32Clmul(const unsigned char *data, size_t bytes, uint32_t crc)
+{
+    // Four lanes of 16 bytes, each folded 64 bytes ahead at a time.
+    __m128i x1 = _mm_loadu_si128((const __m128i*) data);
+    __m128i x2 = _mm_loadu_si128((const __m128i*) (data + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i*) (data + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i*) (data + 48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    data += 64;
+    bytes -= 64;
+
+    __m128i k = _mm_load_si128((const __m128i*) FOLD_64);
+    for(; bytes >= 64; data += 64, bytes -= 64) {
+        x1 = Fold(x1, k, _mm_loadu_si128((const __m128i*) data));
+        x2 = Fold(x2, k, _mm_loadu_si128((const __m128i*) (data + 16)));
+        x3 = Fold(x3, k, _mm_loadu_si128((const __m128i*) (data + 32)));
+        x4 = Fold(x4, k, _mm_loadu_si128((const __m128i*) (data + 48)));
+    }
+
+    // Fold the lanes into one, then fold in any remaining blocks.
+    k = _mm_load_si128((const __m128i*) FOLD_16);
+    x1 = Fold(x1, k, x2);
+    x1 = Fold(x1, k, x3);
+    x1 = Fold(x1, k, x4);
+    for(; bytes >= 16; data += 16, bytes -= 16) {
+        x1 = Fold(x1, k, _mm_loadu_si128((const __m128i*) data));
+    }
+
+    // Reduce 128 bits to 64.
+    __m128i low_32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    k = _mm_loadl_epi64((const __m128i*) FOLD_8);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low_32), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits.
+    k = _mm_load_si128((const __m128i*) BARRETT);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low_32), k, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low_32), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+}
+}
@@ -0,0 +1,37 @@
+#include "sys/cpu_features.h"
+#include <cpuid.h>
+
+namespace CpuFeatures {
+namespace detail {
+uint32_t features_;
+}
+
+void Detect()
+{
+    uint32_t features = DETECTED;
+    uint32_t eax, ebx, ecx, edx;
+
+    // Leaf 1: processor info and feature bits.
+    if(__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if(ecx & (1 << 1)) {
+            features |= PCLMUL;
+        }
+        if(ecx & (1 << 20)) {
+            features |= SSE4_2;
+        }
+    }
+
+    // Leaf 7, subleaf 0: structured extended features.
+    if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        if(ebx & (1 << 9)) {
+            features |= ERMS;
+        }
+        if(edx & (1 << 4)) {
+            features |= FSRM;
+        }
+    }
+
+    // Every core reads the same answer, so racing detections are harmless.
+    __atomic_store_n(&detail::features_, features, __ATOMIC_RELAXED);
+}
+}
@@ -0,0 +1,54 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <stdint.h>
+
+// A namespace rather than a class for the same reason as BuddyAllocator:
+// there's exactly one CPU to describe.
+namespace CpuFeatures
+{
+/**
+ * Optional instruction set features that some code paths are specialised
+ * for. Each is a bit of a mask, so that callers can test several at once.
+ */
+enum feature_t : uint32_t {
+    // Enhanced REP MOVSB/STOSB: byte-granular string instructions run as
+    // fast as the widest moves for large sizes.
+    ERMS     = 1 << 0,
+    // Fast short REP MOV: REP MOVSB is fast even for short copies.
+    FSRM     = 1 << 1,
+    // SSE4.2, for its CRC32 instruction.
+    SSE4_2   = 1 << 2,
+    // Carry-less multiplication, for folding CRCs.
+    PCLMUL   = 1 << 3,
+    // Set once the features have been read, so that a zeroed mask, as
+    // before any code has asked, is told apart from a CPU with none.
+    DETECTED = 1U << 31
+};
+
+/**
+ * Read the CPU's features with CPUID. Called on first use, but may be called
+ * up front to keep CPUID out of hot paths.
+ */
+void Detect();
+
+namespace detail {
+extern uint32_t features_;
+}
+
+/**
+ * @param features A mask of feature_t bits.
+ * @return Does the CPU support every one of the given features?
+ */
+inline bool Has(uint32_t features)
+{
+    uint32_t detected = __atomic_load_n(&detail::features_, __ATOMIC_RELAXED);
+    if(! (detected & DETECTED)) {
+        Detect();
+        detected = __atomic_load_n(&detail::features_, __ATOMIC_RELAXED);
+    }
+    return (detected & features) == features;
+}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define DISK_MEM_H
 
 #include <ds/ref_cnt_ptr.h>
+#include <utility>
 
 template<typename T>
 class DiskMem : public ds::RefCntPtr<T>
@@ -28,6 +29,35 @@ public:
             , num_sectors_(num_sectors)
     {}
 
+    // Every DiskMem writes its sectors back when destroyed, so copies would
+    // each write them again; share one through a RefCntPtr instead.
+    DiskMem(const DiskMem&) = delete;
+    DiskMem &operator=(const DiskMem&) = delete;
+
+    DiskMem(DiskMem &&rhs)
+            : ds::RefCntPtr<T>(std::move(rhs))
+            , disk_(rhs.disk_)
+            , base_sector_(rhs.base_sector_)
+            , num_sectors_(rhs.num_sectors_)
+    {
+        rhs.disk_ = nullptr;
+    }
+
+    DiskMem &operator=(DiskMem &&rhs)
+    {
+        if(&rhs == this) {
+            return *this;
+        }
+
+        WriteBack();
+        ds::RefCntPtr<T>::operator=(std::move(rhs));
+        disk_ = rhs.disk_;
+        base_sector_ = rhs.base_sector_;
+        num_sectors_ = rhs.num_sectors_;
+        rhs.disk_ = nullptr;
+        return *this;
+    }
+
     ~DiskMem()
     {
         WriteBack();
@@ -47,7 +77,7 @@ public:
 
     friend bool operator ==(const DiskMem &lhs, const DiskMem &rhs)
     {
-        return lhs.raw_ptr_ = rhs.raw_ptr_;
+        return lhs.raw_ptr_ == rhs.raw_ptr_;
     }
 
     using ds::RefCntPtr<T>::operator bool;
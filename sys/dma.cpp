@@ -0,0 +1,274 @@
+#include "dma.h"
+#include "sys/buddy_allocator.h"
+#include "sys/log.h"
+#include "libc/string.h"
+
+namespace DMA {
+namespace {
+// Pooled buffers are linked through a header stored in the buffer itself, so
+// the pool never needs to allocate.
+struct PooledBuffer {
+    PooledBuffer *next_;
+    uintptr_t paddr_;
+};
+
+const size_t PAGE_SIZE = 0x1000;
+const uintptr_t PHYS_ADDR_MASK = 0x000FFFFFFFFFF000;
+
+// Buffers of order 0 (4KiB) through 10 (4MiB, the size of a PRDT) are pooled;
+// anything larger is rare enough to go straight to the buddy allocator.
+const uint8_t NUM_POOL_ORDERS = 11;
+const size_t MAX_POOLED_PER_ORDER = 4;
+
+PageMap *page_map_;
+PooledBuffer *pool_[NUM_POOL_ORDERS];
+size_t pool_sizes_[NUM_POOL_ORDERS];
+
+uint8_t BufferOrder(size_t size)
+{
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    return pages > 1 ? 64 - __builtin_clzl(pages - 1) : 0;
+}
+
+void *PAddrToVAddr(uintptr_t paddr)
+{
+    // Only the first 4GiB are direct-mapped into the higher half; the kernel
+    // page map identity maps everything above that.
+    if(paddr < KERN_DIRECT_MAP_SIZE) {
+        return ToHighMem((void*) paddr);
+    }
+    return (void*) paddr;
+}
+
+bool SegmentFits(const Segment &segment, const Constraints &constraints)
+{
+    size_t align = constraints.alignment_ ? constraints.alignment_ : 1;
+    return segment.paddr_ % align == 0 && segment.len_ % align == 0 &&
+           segment.paddr_ + segment.len_ - 1 <= constraints.addr_limit_;
+}
+
+/**
+ * Append a physically contiguous range to a scatter list, merging it into the
+ * final segment where it directly follows it and splitting it wherever it
+ * would exceed the maximum segment length.
+ * @param segments The scatter list to extend.
+ * @param paddr Start of the physical range.
+ * @param len Length of the physical range.
+ * @param max_len Maximum segment length, or 0 for no limit.
+ */
+void AppendRange(ds::DynArray<Segment> &segments, uintptr_t paddr, size_t len,
+                 size_t max_len)
+{
+    while(len > 0) {
+        if(segments.Size()) {
+            Segment &last = segments[-1];
+            size_t room = max_len ? max_len - last.len_ : len;
+            if(last.paddr_ + last.len_ == paddr && room > 0) {
+                size_t bytes = room < len ? room : len;
+                last.len_ += bytes;
+                paddr += bytes;
+                len -= bytes;
+                continue;
+            }
+        }
+
+        size_t bytes = max_len && max_len < len ? max_len : len;
+        segments.Append({ paddr, bytes });
+        paddr += bytes;
+        len -= bytes;
+    }
+}
+}
+}
+
+DMA::Mapping::Mapping()
+    : vaddr_(nullptr)
+    , len_(0)
+    , direction_(BIDIRECTIONAL)
+    , bounce_({ nullptr, 0, 0 })
+{}
+
+DMA::Mapping::~Mapping()
+{
+    Unmap();
+}
+
+bool DMA::Mapping::Map(void *vaddr, size_t len, direction_t direction,
+                       const Constraints &constraints)
+{
+    Unmap();
+    vaddr_ = vaddr;
+    len_ = len;
+    direction_ = direction;
+
+    // Walk the buffer a page at a time; physically adjacent pages collapse
+    // into a single segment. Stop early if the list can't possibly be used.
+    auto addr = (uintptr_t) vaddr;
+    size_t rem_bytes = len;
+    while(rem_bytes > 0) {
+        size_t page_rem = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+        size_t bytes = page_rem < rem_bytes ? page_rem : rem_bytes;
+        uintptr_t paddr = VAddrToPAddr(addr);
+        if(! paddr) {
+            // There's nothing to bounce from or back into.
+            Log("[DMA] 0x%x is unmapped.\n", addr);
+            segments_.Clear();
+            vaddr_ = nullptr;
+            len_ = 0;
+            return false;
+        }
+
+        AppendRange(segments_, paddr, bytes, constraints.max_segment_len_);
+        if(constraints.max_segments_ &&
+           segments_.Size() > constraints.max_segments_)
+        {
+            return Bounce(constraints);
+        }
+
+        addr += bytes;
+        rem_bytes -= bytes;
+    }
+
+    for(size_t i = 0; i < segments_.Size(); ++i) {
+        if(! SegmentFits(segments_[i], constraints)) {
+            return Bounce(constraints);
+        }
+    }
+
+    return true;
+}
+
+void DMA::Mapping::Unmap()
+{
+    if(bounce_.vaddr_) {
+        if(direction_ != TO_DEVICE) {
+            memcpy(vaddr_, bounce_.vaddr_, len_);
+        }
+        FreeBuffer(bounce_);
+        bounce_ = { nullptr, 0, 0 };
+    }
+
+    segments_.Clear();
+    vaddr_ = nullptr;
+    len_ = 0;
+}
+
+size_t DMA::Mapping::NumSegments() const
+{
+    return segments_.Size();
+}
+
+DMA::Segment DMA::Mapping::operator[](size_t ind) const
+{
+    return segments_[ind];
+}
+
+bool DMA::Mapping::Bounced() const
+{
+    return bounce_.vaddr_ != nullptr;
+}
+
+bool DMA::Mapping::Bounce(const Constraints &constraints)
+{
+    segments_.Clear();
+
+    // Devices transfer whole units of the required alignment, so pad the
+    // bounce buffer out to one. Only len_ bytes are ever copied back.
+    size_t align = constraints.alignment_ ? constraints.alignment_ : 1;
+    size_t padded_len = ((len_ + align - 1) / align) * align;
+
+    ds::Optional<Buffer> buffer = AllocBuffer(padded_len);
+    if(! buffer) {
+        Log("[DMA] Unable to allocate 0x%x-byte bounce buffer.\n", padded_len);
+        return false;
+    }
+
+    if(buffer->paddr_ + padded_len - 1 > constraints.addr_limit_) {
+        Log("[DMA] Bounce buffer 0x%x is out of device range.\n",
+            buffer->paddr_);
+        FreeBuffer(*buffer);
+        return false;
+    }
+
+    AppendRange(segments_, buffer->paddr_, padded_len,
+                constraints.max_segment_len_);
+    if(constraints.max_segments_ &&
+       segments_.Size() > constraints.max_segments_)
+    {
+        Log("[DMA] 0x%x-byte transfer needs more than %d segments.\n",
+            len_, constraints.max_segments_);
+        segments_.Clear();
+        FreeBuffer(*buffer);
+        return false;
+    }
+
+    bounce_ = *buffer;
+    if(direction_ != FROM_DEVICE) {
+        memcpy(bounce_.vaddr_, vaddr_, len_);
+    }
+    return true;
+}
+
+void DMA::Init(PageMap *page_map)
+{
+    page_map_ = page_map;
+}
+
+uintptr_t DMA::VAddrToPAddr(uintptr_t vaddr)
+{
+    if(! page_map_) {
+        return 0;
+    }
+
+    uintptr_t page = vaddr & ~(PAGE_SIZE - 1);
+    uintptr_t frame = page_map_->VAddrToPAddr(page) & PHYS_ADDR_MASK;
+    if(! frame) {
+        return 0;
+    }
+    return frame | (vaddr & (PAGE_SIZE - 1));
+}
+
+ds::Optional<DMA::Buffer> DMA::AllocBuffer(size_t size)
+{
+    uint8_t order = BufferOrder(size);
+    size_t buffer_size = PAGE_SIZE << order;
+
+    if(order < NUM_POOL_ORDERS && pool_[order]) {
+        PooledBuffer *pooled = pool_[order];
+        pool_[order] = pooled->next_;
+        --pool_sizes_[order];
+        return Buffer { pooled, pooled->paddr_, buffer_size };
+    }
+
+    auto paddr = (uintptr_t) BuddyAllocator::Allocate(buffer_size);
+    if(! paddr) {
+        return ds::NullOpt;
+    }
+    return Buffer { PAddrToVAddr(paddr), paddr, buffer_size };
+}
+
+void DMA::FreeBuffer(const Buffer &buffer)
+{
+    uint8_t order = BufferOrder(buffer.size_);
+    if(order < NUM_POOL_ORDERS && pool_sizes_[order] < MAX_POOLED_PER_ORDER) {
+        auto *pooled = (PooledBuffer*) buffer.vaddr_;
+        pooled->paddr_ = buffer.paddr_;
+        pooled->next_ = pool_[order];
+        pool_[order] = pooled;
+        ++pool_sizes_[order];
+        return;
+    }
+
+    BuddyAllocator::Free((void*) buffer.paddr_);
+}
+
+void DMA::DrainPool()
+{
+    for(uint8_t order = 0; order < NUM_POOL_ORDERS; ++order) {
+        while(PooledBuffer *pooled = pool_[order]) {
+            pool_[order] = pooled->next_;
+            BuddyAllocator::Free((void*) pooled->paddr_);
+        }
+        pool_sizes_[order] = 0;
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include "page_map.h"
+#include <ds/dyn_array.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Devices address memory physically, while the rest of the kernel hands
+// around virtual addresses. This namespace translates the latter into the
+// former. A virtual buffer is walked page by page through the kernel page map
+// and described as a list of physically contiguous (paddr, len) segments,
+// which is what PRDTs and other scatter/gather tables want. Where a buffer
+// cannot be described within a device's limits (misaligned segments,
+// addresses the device can't reach, or simply too many segments), the
+// transfer is routed through a physically contiguous bounce buffer instead.
+// Buffers with unmapped pages can't be transferred at all. Bounce buffers
+// come from a small pool of buddy allocations so that repeated transfers
+// don't thrash the buddy allocator.
+namespace DMA
+{
+enum direction_t {
+    TO_DEVICE,
+    FROM_DEVICE,
+    BIDIRECTIONAL
+};
+
+/**
+ * A physically contiguous piece of a mapped buffer.
+ */
+struct Segment {
+    uintptr_t paddr_;
+    size_t len_;
+};
+
+/**
+ * Limits imposed on a scatter list by the device consuming it. A zero
+ * max_segments_ or max_segment_len_ means "unlimited".
+ */
+struct Constraints {
+    size_t max_segments_;
+    size_t max_segment_len_;
+    // Every segment's base and length must be a multiple of this.
+    size_t alignment_;
+    // Highest physical address the device is able to reach.
+    uintptr_t addr_limit_;
+};
+
+/**
+ * A physically contiguous, page-aligned buffer from the DMA pool.
+ */
+struct Buffer {
+    void *vaddr_;
+    uintptr_t paddr_;
+    size_t size_;
+};
+
+/**
+ * The scatter list of a single transfer. Callers map a buffer before
+ * programming the device and unmap it once the device is done with it; for
+ * bounced reads, unmapping is what copies the data back into the caller's
+ * buffer.
+ */
+class Mapping {
+public:
+    Mapping();
+
+    Mapping(const Mapping&) = delete;
+    Mapping &operator=(const Mapping&) = delete;
+
+    ~Mapping();
+
+    /**
+     * Build a scatter list for a virtual buffer, bouncing it if it does not
+     * satisfy the given constraints. An existing mapping is released first.
+     *
+     * @param vaddr The start of the buffer.
+     * @param len Length of the buffer in bytes.
+     * @param direction Direction data flows in; determines when a bounce
+     *                  buffer is copied to/from the caller's buffer.
+     * @param constraints Device limitations the scatter list must satisfy.
+     * @return Did mapping succeed? This fails when part of the buffer is
+     *         unmapped, or when a bounce buffer is needed and none can be
+     *         allocated within the constraints.
+     */
+    bool Map(void *vaddr, size_t len, direction_t direction,
+             const Constraints &constraints);
+
+    /**
+     * Release the mapping. For bounced transfers from the device, copy the
+     * bounce buffer back into the original buffer first.
+     */
+    void Unmap();
+
+    size_t NumSegments() const;
+
+    Segment operator[](size_t ind) const;
+
+    bool Bounced() const;
+
+private:
+    ds::SmallDynArray<Segment, 4> segments_;
+    void *vaddr_;
+    size_t len_;
+    direction_t direction_;
+    Buffer bounce_;
+
+    bool Bounce(const Constraints &constraints);
+};
+
+/**
+ * Record the page map used to translate virtual addresses. Must be called
+ * before any buffer is mapped.
+ * @param page_map The kernel's page map.
+ */
+void Init(PageMap *page_map);
+
+/**
+ * Translate a virtual address through the kernel page map.
+ * @param vaddr Any virtual address.
+ * @return The corresponding physical address, or 0 if vaddr is unmapped.
+ */
+uintptr_t VAddrToPAddr(uintptr_t vaddr);
+
+/**
+ * Retrieve a physically contiguous, page-aligned buffer of at least size
+ * bytes, reusing a pooled buffer of the same order when one is available.
+ * @param size Requested size in bytes.
+ * @return The buffer, or NullOpt if physical memory is exhausted.
+ */
+ds::Optional<Buffer> AllocBuffer(size_t size);
+
+/**
+ * Return a buffer to the pool. Buffers beyond the pool's per-order limit go
+ * straight back to the buddy allocator.
+ * @param buffer A buffer from AllocBuffer.
+ */
+void FreeBuffer(const Buffer &buffer);
+
+/**
+ * Hand every pooled buffer back to the buddy allocator.
+ */
+void DrainPool();
+}
+
+#endif
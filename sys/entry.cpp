@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <sys/acpi.h>
 #include <sys/buddy_allocator.h>
+#include <sys/dma.h>
+#include <sys/fpu.h>
 #include <sys/kheap.h>
 #include <sys/log.h>
 #include <sys/page_map.h>
@@ -120,14 +122,16 @@ void _start(struct stivale2_struct *stivale2_struct)
     auto *rsdp_tag  = (stivale2_struct_tag_rsdp *)
             stivale2_get_tag(stivale2_struct, rsdp_id);
 
+    Fpu::Init();
     BuddyAllocator::InitBuddyAllocator(*memmap);
     PageMap kernel_page_map(memmap, kern_base, pmrs);
     kernel_page_map.Load();
     KHeap::Init(1024, &kernel_page_map);
+    DMA::Init(&kernel_page_map);
 
     ds::Optional<ds::HashMap<ds::String, void *>> acpi_tabs;
     if (acpi_tabs = ACPI::ParseRoot(rsdp_tag)) {
-        if (ds::Optional<void *> addr = acpi_tabs->Lookup("MCFG")) {
+        if (ds::Optional<void *> addr = acpi_tabs->Lookup(ds::StringView("MCFG"))) {
             PCIeTree                 pcie_tree(*addr);
             ds::DynArray<PCIeDevice> hba_controllers =
                                              pcie_tree.GetDevicesBySubclass(
@@ -148,13 +152,13 @@ void _start(struct stivale2_struct *stivale2_struct)
                     VFS vfs(port, *ext2_opts);
                     ds::Optional<FileHandle> ho = vfs.Open("/test_dir/test_dir2/test_dir3/test.txt");
                     ds::Optional<FileHandle> h1o = vfs.Open("/test_dir/test_dir2/test_dir3/test.txt");
-                    FileHandle h1 = *h1o;
+                    FileHandle h1 = std::move(*h1o);
                     ds::Optional<FileHandle> h2o = vfs.Open("/test_dir/test_dir2/test_dir3/test.txt");
-                    FileHandle h2 = *h2o;
+                    FileHandle h2 = std::move(*h2o);
                     vfs.Close(h1);
                     //ds::Optional<FileHandle> ho = vfs.Open("/test_dir/test_dir2/test_dir3/test.txt");
                     if(ho) {
-                        FileHandle h = *ho;
+                        FileHandle h = std::move(*ho);
                         ds::Optional<ds::String> text = h2.Read(h.GetLength());
                         if(text) {
                             Log("%s", *text);
@@ -0,0 +1,209 @@
+#include "sys/fpu.h"
+#include "sys/log.h"
+#include <cpuid.h>
+#include <stddef.h>
+
+namespace {
+const uint64_t CR0_MP = 1 << 1;
+const uint64_t CR0_EM = 1 << 2;
+const uint64_t CR0_TS = 1 << 3;
+const uint64_t CR0_NE = 1 << 5;
+const uint64_t CR4_OSFXSR = 1 << 9;
+const uint64_t CR4_OSXMMEXCPT = 1 << 10;
+const uint64_t CR4_OSXSAVE = 1 << 18;
+
+const uint64_t XCR0_X87 = 1 << 0;
+const uint64_t XCR0_SSE = 1 << 1;
+const uint64_t XCR0_AVX = 1 << 2;
+
+// Exceptions masked, round to nearest.
+const uint32_t DEFAULT_MXCSR = 0x1F80;
+
+// Regions can nest this deep: a thread, an interrupt, and an NMI or machine
+// check on top, with one to spare.
+const size_t MAX_DEPTH = 4;
+// x87, SSE and AVX state take 832 bytes in the standard XSAVE layout; the
+// legacy FXSAVE area, 512.
+const size_t SAVE_AREA_SIZE = 1024;
+
+// There's only one CPU until the APs are brought up, at which point these
+// become per-CPU.
+//
+// The registers of each region that has had another nested within it, by
+// depth.
+alignas(64) uint8_t save_areas[MAX_DEPTH - 1][SAVE_AREA_SIZE];
+// The number of regions open.
+uint32_t depth;
+
+uint32_t usable_states;
+bool use_xsave;
+bool use_xsaveopt;
+// The state components XSAVE saves.
+uint64_t xsave_mask;
+
+uint64_t ReadCR0()
+{
+    uint64_t cr0;
+    asm volatile("mov %0, cr0" : "=r"(cr0));
+    return cr0;
+}
+
+void WriteCR0(uint64_t cr0)
+{
+    asm volatile("mov cr0, %0" : : "r"(cr0) : "memory");
+}
+
+uint64_t ReadCR4()
+{
+    uint64_t cr4;
+    asm volatile("mov %0, cr4" : "=r"(cr4));
+    return cr4;
+}
+
+void WriteCR4(uint64_t cr4)
+{
+    asm volatile("mov cr4, %0" : : "r"(cr4) : "memory");
+}
+
+#ifdef DEBUG
+/**
+ * Switch the FPU off or on: while CR0.TS is set, any FPU or SIMD instruction
+ * faults with #NM.
+ */
+void SetTaskSwitched(bool set)
+{
+    if(set) {
+        WriteCR0(ReadCR0() | CR0_TS);
+    } else {
+        asm volatile("clts" : : : "memory");
+    }
+}
+#endif
+
+void Save(uint8_t *area)
+{
+    uint32_t lo = xsave_mask, hi = xsave_mask >> 32;
+    if(use_xsaveopt) {
+        // Skips state unchanged since it was last restored from this area.
+        asm volatile("xsaveopt64 [%0]" : : "r"(area), "a"(lo), "d"(hi)
+                     : "memory");
+    } else if(use_xsave) {
+        asm volatile("xsave64 [%0]" : : "r"(area), "a"(lo), "d"(hi)
+                     : "memory");
+    } else {
+        asm volatile("fxsave64 [%0]" : : "r"(area) : "memory");
+    }
+}
+
+void Restore(const uint8_t *area)
+{
+    uint32_t lo = xsave_mask, hi = xsave_mask >> 32;
+    if(use_xsave) {
+        asm volatile("xrstor64 [%0]" : : "r"(area), "a"(lo), "d"(hi)
+                     : "memory");
+    } else {
+        asm volatile("fxrstor64 [%0]" : : "r"(area) : "memory");
+    }
+}
+}
+
+namespace Fpu {
+void Init()
+{
+    uint32_t eax, ebx, ecx, edx;
+    if(! __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return;
+    }
+    // FXSAVE and SSE2 are part of x86-64, but check rather than trust.
+    bool fxsr = edx & (1 << 24), sse2 = edx & (1 << 26);
+    bool xsave = ecx & (1 << 26), avx = ecx & (1 << 28);
+    if(! fxsr || ! sse2) {
+        Log("[WARNING] No FXSAVE or SSE2; SIMD is unavailable.\n");
+        return;
+    }
+
+    WriteCR0((ReadCR0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    uint64_t cr4 = ReadCR4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    WriteCR4(xsave ? cr4 | CR4_OSXSAVE : cr4);
+
+    uint32_t states = SSE;
+    if(xsave) {
+        uint64_t xcr0 = XCR0_X87 | XCR0_SSE | (avx ? XCR0_AVX : 0);
+        asm volatile("xsetbv" : : "c"(0), "a"((uint32_t) xcr0),
+                                  "d"((uint32_t) (xcr0 >> 32)));
+
+        // The save area's size for the components now enabled.
+        __cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+        if(ebx > SAVE_AREA_SIZE) {
+            Log("[WARNING] XSAVE needs %d bytes; falling back to FXSAVE.\n",
+                ebx);
+            xcr0 = XCR0_X87 | XCR0_SSE;
+            asm volatile("xsetbv" : : "c"(0), "a"((uint32_t) xcr0), "d"(0));
+            xsave = avx = false;
+        } else {
+            __cpuid_count(0xD, 1, eax, ebx, ecx, edx);
+            use_xsaveopt = eax & 1;
+        }
+        xsave_mask = xcr0;
+        use_xsave = xsave;
+        states |= avx ? (uint32_t) AVX : 0;
+    }
+
+    uint32_t mxcsr = DEFAULT_MXCSR;
+    asm volatile("fninit\n\t"
+                 "ldmxcsr [%0]" : : "r"(&mxcsr) : "memory");
+#ifdef DEBUG
+    SetTaskSwitched(true);
+#endif
+    usable_states = states;
+}
+
+bool Usable(uint32_t states)
+{
+    return (usable_states & states) == states;
+}
+}
+
+// Nothing outside a region owns the registers yet, so an outermost region
+// saves nothing; once threads use the FPU, theirs will need saving first.
+// A nested region saves its parent's registers on the way in and restores
+// them on the way out. Each saves before it increments the depth, and
+// restores before it decrements it, so that a region interrupting either
+// step finds the depth consistent with what's been saved.
+void KernelFpuBegin()
+{
+    if(depth >= MAX_DEPTH) {
+        Log("[ERROR] FPU regions nested more than %d deep.\n", MAX_DEPTH);
+        while(1);
+    }
+    if(depth > 0) {
+        Save(save_areas[depth - 1]);
+    }
+#ifdef DEBUG
+    else {
+        SetTaskSwitched(false);
+    }
+#endif
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    ++depth;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void KernelFpuEnd()
+{
+    if(depth == 0) {
+        Log("[ERROR] Ending an FPU region that never began.\n");
+        while(1);
+    }
+    if(depth > 1) {
+        Restore(save_areas[depth - 2]);
+    }
+#ifdef DEBUG
+    else {
+        SetTaskSwitched(true);
+    }
+#endif
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    --depth;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,79 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+// The kernel is built without floating point or SIMD, so that it never has
+// to save FPU registers on entry. Code that wants SIMD goes in a translation
+// unit named *_simd.cpp, which the Makefile builds with SSE and SSE2, and is
+// called only between KernelFpuBegin() and KernelFpuEnd(), which save and
+// restore any registers it would clobber. In DEBUG builds, the FPU is
+// switched off outside of such regions, so stray use faults with #NM.
+//
+// A *_simd.cpp file may include only headers that declare, plus compiler
+// intrinsics headers. Any inline function or template it instantiates is
+// emitted as a COMDAT copy built with SSE, and the linker is free to keep that
+// copy for the whole kernel, where it runs outside any FPU region. For the
+// same reason, kernel headers must not pick an implementation based on
+// __SSE2__ or similar macros.
+namespace Fpu
+{
+/**
+ * Register state a region may use. Each is a bit of a mask, so that callers
+ * can ask for several at once.
+ */
+enum state_t : uint32_t {
+    // x87, SSE and the XMM registers.
+    SSE = 1 << 0,
+    // The upper halves of the YMM registers.
+    AVX = 1 << 1
+};
+
+/**
+ * Enable the FPU on this CPU: SSE through CR0 and CR4, and, where
+ * supported, XSAVE and AVX through CR4 and XCR0.
+ */
+void Init();
+
+/**
+ * @param states A mask of state_t bits.
+ * @return Has Init enabled every one of the given states, so that code using
+ *         them may run within KernelFpuBegin() and KernelFpuEnd()?
+ */
+bool Usable(uint32_t states = SSE);
+}
+
+/**
+ * Begin a region in which the FPU and SIMD registers may be used. Regions
+ * nest, e.g. within an interrupt handler that interrupted another region,
+ * and the registers are only saved when one does. Mustn't sleep.
+ */
+void KernelFpuBegin();
+
+/**
+ * End the innermost region, restoring the registers of the region it was
+ * nested in, if any.
+ */
+void KernelFpuEnd();
+
+/**
+ * A region lasting as long as the object.
+ */
+class KernelFpuRegion
+{
+public:
+    KernelFpuRegion()
+    {
+        KernelFpuBegin();
+    }
+
+    ~KernelFpuRegion()
+    {
+        KernelFpuEnd();
+    }
+
+    KernelFpuRegion(const KernelFpuRegion&) = delete;
+    KernelFpuRegion &operator=(const KernelFpuRegion&) = delete;
+};
+
+#endif
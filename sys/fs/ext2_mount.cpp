@@ -9,10 +9,21 @@ Ext2Mount::Ext2Mount(SATAPort *disk, uint64_t partition_base_sector)
         , sectors_per_block_(block_size_ / 512)
         , bgdt_(disk, partition_base_sector + 2 + (block_size_ >= 2048 ? 1 : 2),
                 sectors_per_block_)
-        , inode_tab_cache_(&Ext2Mount::WriteBackDiskMem<Ext2INode>)
-        , inode_bmap_cache_(&Ext2Mount::WriteBackDiskMem<uint64_t>)
-        , block_bmap_cache_(&Ext2Mount::WriteBackDiskMem<uint64_t>)
-{}
+        , inode_tab_shrinker_(ShrinkerRegistry::ForCache(&inode_tab_cache_))
+        , inode_bmap_shrinker_(ShrinkerRegistry::ForCache(&inode_bmap_cache_))
+        , block_bmap_shrinker_(ShrinkerRegistry::ForCache(&block_bmap_cache_))
+{
+    ShrinkerRegistry::Register(&inode_tab_shrinker_);
+    ShrinkerRegistry::Register(&inode_bmap_shrinker_);
+    ShrinkerRegistry::Register(&block_bmap_shrinker_);
+}
+
+Ext2Mount::~Ext2Mount()
+{
+    ShrinkerRegistry::Unregister(&inode_tab_shrinker_);
+    ShrinkerRegistry::Unregister(&inode_bmap_shrinker_);
+    ShrinkerRegistry::Unregister(&block_bmap_shrinker_);
+}
 
 uint32_t Ext2Mount::GetBlockSize() const
 {
@@ -82,11 +93,9 @@ VNode *Ext2Mount::ReadVNode(uint32_t ino)
     uint32_t block_group = (ino - 1) / super_->s_inodes_per_group;
     uint32_t local_ind = (ino - 1) % super_->s_inodes_per_group;
 
-    ds::Optional<DiskMem<Ext2INode>> inode_tab_opt;
-    if((inode_tab_opt = ReadINodeTable(block_group))) {
+    if(disk_mem_ptr_t<Ext2INode> inode_tab = ReadINodeTable(block_group)) {
         size_t inode_offset = local_ind * super_->s_inode_size;
-        DiskMem<Ext2INode> inode_tab = *inode_tab_opt;
-        const char *inode_tab_bytes = inode_tab.ToBytes();
+        const char *inode_tab_bytes = inode_tab->ToBytes();
         auto inode = (Ext2INode*) (inode_tab_bytes + inode_offset);
         return new Ext2VNode(*inode, ino, *this);
     }
@@ -107,27 +116,17 @@ Ext2VNode *Ext2Mount::AllocVNode(Ext2FileMode type, uint16_t perms,
     int64_t free_inode = -1;
     for(uint32_t i = 0 ; i < no_bgroups && free_inode == -1; ++i) {
         if(bgdt_[i].bg_free_inodes_count) {
-            if(auto inode_bmap_opt = ReadINodeBitmap(i)) {
-                DiskMem<uint64_t> inode_bmap = *inode_bmap_opt;
-                for(uint32_t j = 0; j < block_size_ / 8; ++j) {
-                    if(inode_bmap[j] != 0xFFFFFFFFFFFFFFFF) {
-                        // Ino 1 is not valid.
-                        uint64_t free_inos = (i == 0 && j == 0) ?
-                                             ~(inode_bmap[j] | 1) : ~(inode_bmap[j]);
-                        // Branchless bmap lookup; if all inodes are free,
-                        // just ignore (undefined) clzl result and return
-                        // first inode in group. Otherwise, return first
-                        // index of first unset bit in bitmap.
-                        uint64_t unset = __builtin_ffsll(free_inos);
-                        uint32_t bg_inode_base = i * super_->s_inodes_per_group;
-                        free_inode = bg_inode_base + (j * 64) + unset;
-                        inode_bmap[j] |= (1ULL << (unset - 1));
-                        --bgdt_[i].bg_free_inodes_count;
-                        --super_->s_free_inodes_count;
-                        bgdt_.WriteBack();
-                        inode_bmap.WriteBack();
-                        break;
-                    }
+            if(disk_mem_ptr_t<uint64_t> inode_bmap = ReadINodeBitmap(i)) {
+                ds::Bitmap<> bmap(&(*inode_bmap)[0], block_size_ * 8);
+                // Ino 1 is not valid.
+                if(auto unset = bmap.FindNextZero(i == 0 ? 1 : 0)) {
+                    uint32_t bg_inode_base = i * super_->s_inodes_per_group;
+                    free_inode = bg_inode_base + *unset + 1;
+                    bmap.Set(*unset);
+                    --bgdt_[i].bg_free_inodes_count;
+                    --super_->s_free_inodes_count;
+                    bgdt_.WriteBack();
+                    inode_bmap->WriteBack();
                 }
             }
         }
@@ -147,36 +146,34 @@ Ext2VNode *Ext2Mount::AllocVNode(Ext2FileMode type, uint16_t perms,
 }
 
 ds::Optional<uint32_t> Ext2Mount::AllocBlock()
+{
+    return AllocBlocks(1);
+}
+
+ds::Optional<uint32_t> Ext2Mount::AllocBlocks(uint32_t num_blocks)
 {
     // Write back superblock at some point.
     size_t no_bgroups = super_->s_blocks_count / super_->s_blocks_per_group;
-    int64_t free_block = -1;
-    for(uint32_t i = 0 ; i < no_bgroups && free_block == -1; ++i) {
-        if(bgdt_[i].bg_free_blocks_count) {
-            if(auto block_bmap_opt = ReadBlockBitmap(i)) {
-                DiskMem<uint64_t> block_bmap = *block_bmap_opt;
-                for(uint32_t j = 0; j < block_size_ / 8; ++j) {
-                    if(block_bmap[j] != 0xFFFFFFFFFFFFFFFF) {
-                        uint64_t free_blocks = i == 0 && j == 0 ?
-                                               ~(block_bmap[j] | 1) : ~(block_bmap[j]);
-                        uint64_t unset = __builtin_ffsll(free_blocks);
-                        uint32_t bg_inode_base = i * super_->s_blocks_per_group;
-                        free_block = bg_inode_base + (j * 64) + unset;
-                        //Log("\t unset %d, before 0x%x, ", unset, block_bmap[j]);
-                        block_bmap[j] |= (1ULL << (unset - 1));
-                        //Log("after 0x%x\n", block_bmap[j]);
-                        block_bmap.WriteBack();
-                        --bgdt_[i].bg_free_blocks_count;
-                        break;
-                    }
-                }
+    for(uint32_t i = 0 ; i < no_bgroups; ++i) {
+        if(bgdt_[i].bg_free_blocks_count < num_blocks) {
+            continue;
+        }
+
+        if(disk_mem_ptr_t<uint64_t> block_bmap = ReadBlockBitmap(i)) {
+            ds::Bitmap<> bmap(&(*block_bmap)[0], block_size_ * 8);
+            // The first bit of the first group is never handed out.
+            if(auto unset = bmap.FindZeroRun(num_blocks, i == 0 ? 1 : 0)) {
+                uint32_t bg_block_base = i * super_->s_blocks_per_group;
+                uint32_t free_block = bg_block_base + *unset + 1;
+                bmap.SetRange(*unset, num_blocks);
+                block_bmap->WriteBack();
+                bgdt_[i].bg_free_blocks_count -= num_blocks;
+                return free_block + 1;
             }
         }
     }
 
-    if(free_block == -1) { return ds::NullOpt; }
-    //Log("Free block %d\n", free_block);
-    return free_block + 1;
+    return ds::NullOpt;
 }
 
 
@@ -185,9 +182,9 @@ bool Ext2Mount::DeleteINode(uint32_t ino)
     uint32_t block_group = (ino - 1) / super_->s_inodes_per_group;
     uint32_t local_ind = (ino - 1) % super_->s_inodes_per_group;
 
-    if(auto inode_bmap_opt = ReadINodeBitmap(block_group)) {
-        DiskMem<uint64_t> inode_bmap = *inode_bmap_opt;
-        inode_bmap[local_ind / 64] &= ~(1ULL << (local_ind % 64));
+    if(disk_mem_ptr_t<uint64_t> inode_bmap = ReadINodeBitmap(block_group)) {
+        (*inode_bmap)[local_ind / 64] &= ~(1ULL << (local_ind % 64));
+        inode_bmap->WriteBack();
         return true;
     }
 
@@ -198,9 +195,9 @@ bool Ext2Mount::FreeBlock(uint32_t block_no)
 {
     uint32_t block_group = (block_no - 1) / super_->s_blocks_per_group;
     uint32_t local_ind = (block_no - 1) % super_->s_blocks_per_group;
-    if(auto block_bmap_opt = ReadBlockBitmap(block_group)) {
-        DiskMem<uint64_t> block_bmap = *block_bmap_opt;
-        block_bmap[local_ind / 64] &= ~(1ULL << (local_ind % 64));
+    if(disk_mem_ptr_t<uint64_t> block_bmap = ReadBlockBitmap(block_group)) {
+        ds::Bitmap<>(&(*block_bmap)[0], block_size_ * 8).Clear(local_ind);
+        block_bmap->WriteBack();
         return true;
     }
     return false;
@@ -245,7 +242,7 @@ Ext2Mount::ReadBlock(uint32_t block, size_t num_blocks) const
 
 bool Ext2Mount::ReadBlocks(const ds::DynArray<Extent> &extents, void *buff)
 {
-    ds::DynArray<DiskRange> ranges;
+    ds::SmallDynArray<DiskRange, 4> ranges;
     uint64_t first_block = partition_base_sector_ + 2;
     for(int i = 0; i < extents.Size(); ++i) {
         uint32_t sector_no = (extents[i].start_ - 1) * sectors_per_block_;
@@ -258,7 +255,7 @@ bool Ext2Mount::ReadBlocks(const ds::DynArray<Extent> &extents, void *buff)
 
 bool Ext2Mount::WriteBlocks(const ds::DynArray<Extent> &extents, void *buff)
 {
-    ds::DynArray<DiskRange> ranges;
+    ds::SmallDynArray<DiskRange, 4> ranges;
     uint64_t first = partition_base_sector_ + 2;
     for(int i = 0; i < extents.Size(); ++i) {
         Log("Extent %d-%d\n", extents[i].start_,
@@ -278,12 +275,10 @@ bool Ext2Mount::AppendToArr(ds::DynArray<uint32_t> &block_arr,
     return true;
 }
 
-ds::Optional<DiskMem<Ext2INode>>
-Ext2Mount::ReadINodeTable(uint32_t block_group_no)
+disk_mem_ptr_t<Ext2INode> Ext2Mount::ReadINodeTable(uint32_t block_group_no)
 {
-    ds::Optional<DiskMem<Ext2INode>> tab;
-    if((tab = inode_tab_cache_.Lookup(block_group_no))) {
-        return tab;
+    if(auto tab = inode_tab_cache_.Lookup(block_group_no)) {
+        return *tab;
     }
 
     Ext2BlockGroupDescriptor bgdt_entry = bgdt_[block_group_no];
@@ -296,80 +291,78 @@ Ext2Mount::ReadINodeTable(uint32_t block_group_no)
     uint64_t tab_blks = (tab_size / block_size_) + (tab_size % block_size_ > 0);
     uint64_t tab_sectors = tab_blks * sectors_per_block_;
 
-    DiskMem<Ext2INode> table(disk_, start_lba, tab_sectors);
-    if(table) {
-        inode_tab_cache_.Insert(block_group_no, (table));
+    auto table = ds::MakeRefCntPtr<DiskMem<Ext2INode>>(disk_, start_lba,
+                                                       tab_sectors);
+    if(table && *table) {
+        inode_tab_cache_.Insert(block_group_no, table);
         return table;
     }
 
-    return ds::NullOpt;
+    return nullptr;
 }
 
-ds::Optional<DiskMem<uint64_t>>
-Ext2Mount::ReadINodeBitmap(uint32_t block_group_no)
+disk_mem_ptr_t<uint64_t> Ext2Mount::ReadINodeBitmap(uint32_t block_group_no)
 {
-    ds::Optional<DiskMem<uint64_t>> cache_bmap;
-    if((cache_bmap = inode_bmap_cache_.Lookup(block_group_no))) {
-        return cache_bmap;
+    if(auto cache_bmap = inode_bmap_cache_.Lookup(block_group_no)) {
+        return *cache_bmap;
     }
 
     uint32_t bmap_block_no = bgdt_[block_group_no].bg_inode_bitmap;
     uint64_t bmap_sector = partition_base_sector_ + 2 + (bmap_block_no - 1) *
                                                         sectors_per_block_;
-    DiskMem<uint64_t> bmap(disk_, bmap_sector, sectors_per_block_);
+    auto bmap = ds::MakeRefCntPtr<DiskMem<uint64_t>>(disk_, bmap_sector,
+                                                     sectors_per_block_);
     Log("BMAP SECTOR: %d\n", bmap_sector);
-    if(bmap) {
+    if(bmap && *bmap) {
         inode_bmap_cache_.Insert(block_group_no, bmap);
         return bmap;
     }
 
-    return ds::NullOpt;
+    return nullptr;
 }
 
-ds::Optional<DiskMem<uint64_t>>
-Ext2Mount::ReadBlockBitmap(uint32_t block_group_no)
+disk_mem_ptr_t<uint64_t> Ext2Mount::ReadBlockBitmap(uint32_t block_group_no)
 {
-    ds::Optional<DiskMem<uint64_t>> cache_bmap;
-    if((cache_bmap = block_bmap_cache_.Lookup(block_group_no))) {
-        return cache_bmap;
+    if(auto cache_bmap = block_bmap_cache_.Lookup(block_group_no)) {
+        return *cache_bmap;
     }
 
     uint32_t bmap_block_no = bgdt_[block_group_no].bg_block_bitmap;
     uint64_t bmap_sector = partition_base_sector_ + 2 + (bmap_block_no - 1) *
                                                         sectors_per_block_;
-    DiskMem<uint64_t> bmap(disk_, bmap_sector, sectors_per_block_);
-    if(bmap) {
+    auto bmap = ds::MakeRefCntPtr<DiskMem<uint64_t>>(disk_, bmap_sector,
+                                                     sectors_per_block_);
+    if(bmap && *bmap) {
         block_bmap_cache_.Insert(block_group_no, bmap);
         return bmap;
     }
 
-    return ds::NullOpt;
+    return nullptr;
 }
 
 void Ext2Mount::Pin(const ds::RefCntPtr<VNode> &vnode)
 {
-    uint32_t ino = vnode->GetIno();
-    if(pinned_vnodes_.Contains(ino)) {
-        ++num_pins_[ino];
-    } else {
-        num_pins_.Insert(ino, 1);
-        pinned_vnodes_.Insert(ino, vnode);
-    }
+    pinned_vnodes_.Upsert(vnode->GetIno(),
+                          [](PinnedVNode &pinned) { ++pinned.pins_; },
+                          PinnedVNode{vnode, 1});
 }
 
 void Ext2Mount::Unpin(uint32_t ino)
 {
-    if(num_pins_.Contains(ino) && --num_pins_[ino] == 0) {
-        num_pins_.Delete(ino);
-        pinned_vnodes_.Delete(ino);
-    }
+    pinned_vnodes_.Modify(ino, [](PinnedVNode &pinned) {
+        return --pinned.pins_ > 0;
+    });
 }
 
 ds::Optional<ds::RefCntPtr<VNode>> Ext2Mount::GetVNode(uint32_t ino)
 {
-    if(ds::Optional<ds::RefCntPtr<VNode>> vnode_opt = pinned_vnodes_.Lookup(ino)) {
-        ++num_pins_[ino];
-        return *vnode_opt;
+    ds::Optional<ds::RefCntPtr<VNode>> vnode_opt;
+    if(pinned_vnodes_.Modify(ino, [&vnode_opt](PinnedVNode &pinned) {
+        ++pinned.pins_;
+        vnode_opt = pinned.vnode_;
+        return true;
+    })) {
+        return vnode_opt;
     }
 
     if(VNode *vnode = ReadVNode(ino)) {
@@ -1,9 +1,13 @@
 #ifndef EXT2_MOUNT_H
 #define EXT2_MOUNT_H
 
+#include <ds/bitmap.h>
+#include <ds/concurrent_hash_map.h>
+#include <ds/dyn_array.h>
 #include <ds/hash_map.h>
 #include <ds/ref_cnt_ptr.h>
 #include <sys/sata_port.h>
+#include <sys/shrinker.h>
 #include <sys/fs/vnode.h>
 #include <sys/disk_mem.h>
 #include <sys/fs/vmount.h>
@@ -125,11 +129,25 @@ struct Extent {
     uint32_t len_;
 };
 
+// Most I/O touches only a handful of extents, which then fit inline.
+using extent_list_t = ds::SmallDynArray<Extent, 4>;
+
+// Cached metadata blocks are shared between the cache and its callers, and
+// written back once the last of them lets go.
+template <typename T>
+using disk_mem_ptr_t = ds::RefCntPtr<DiskMem<T>>;
+
 class Ext2Mount
 {
 public:
     Ext2Mount(SATAPort *disk, uint64_t partition_base_sector);
 
+    // Registered with the ShrinkerRegistry by address.
+    Ext2Mount(const Ext2Mount&) = delete;
+    Ext2Mount &operator=(const Ext2Mount&) = delete;
+
+    ~Ext2Mount();
+
     uint8_t GetPreallocBlocks() const;
     uint8_t GetPreallocDirBlocks() const;
     ds::Optional<Ext2INode> ReadINode(uint32_t ino);
@@ -142,6 +160,15 @@ public:
 
     ds::Optional<uint32_t> AllocBlock();
 
+    /**
+     * Allocate a run of contiguous blocks within a single block group, with
+     * one scan of each group's bitmap.
+     * @param num_blocks Number of blocks in the run; must be non-zero.
+     * @return The first block of the run, or NullOpt if no group has a free
+     *         run that long.
+     */
+    ds::Optional<uint32_t> AllocBlocks(uint32_t num_blocks);
+
     bool DeleteINode(uint32_t ino);
 
     bool FreeBlock(uint32_t block_no);
@@ -172,29 +199,28 @@ private:
     uint32_t block_size_;
     uint32_t sectors_per_block_;
     DiskMem<Ext2BlockGroupDescriptor> bgdt_;
-    ds::LRUCache<uint32_t, DiskMem<Ext2INode>> inode_tab_cache_;
-    ds::LRUCache<uint32_t, DiskMem<uint64_t>> inode_bmap_cache_;
-    ds::LRUCache<uint32_t, DiskMem<uint64_t>> block_bmap_cache_;
-    ds::HashMap<uint32_t, ds::RefCntPtr<VNode>> pinned_vnodes_;
-    ds::HashMap<uint32_t, size_t> num_pins_;
+    ds::LRUCache<uint32_t, disk_mem_ptr_t<Ext2INode>> inode_tab_cache_;
+    ds::LRUCache<uint32_t, disk_mem_ptr_t<uint64_t>> inode_bmap_cache_;
+    ds::LRUCache<uint32_t, disk_mem_ptr_t<uint64_t>> block_bmap_cache_;
+    Shrinker inode_tab_shrinker_, inode_bmap_shrinker_, block_bmap_shrinker_;
 
-    enum traversal_t { POSTORDER, PREORDER, LEAVES_ONLY };
+    struct PinnedVNode {
+        ds::RefCntPtr<VNode> vnode_;
+        size_t pins_;
+    };
 
-    ds::Optional<DiskMem<Ext2INode>> ReadINodeTable(uint32_t block_group_no);
+    // Pin counts live next to their vnodes so both change under one lock.
+    ds::ConcurrentHashMap<uint32_t, PinnedVNode> pinned_vnodes_;
 
-    ds::Optional<DiskMem<uint64_t>> ReadINodeBitmap(uint32_t block_group_no);
+    enum traversal_t { POSTORDER, PREORDER, LEAVES_ONLY };
 
-    ds::Optional<DiskMem<uint64_t>> ReadBlockBitmap(uint32_t block_group_no);
+    disk_mem_ptr_t<Ext2INode> ReadINodeTable(uint32_t block_group_no);
 
-    bool AppendToArr(ds::DynArray<uint32_t> &block_arr, uint32_t block_no);
+    disk_mem_ptr_t<uint64_t> ReadINodeBitmap(uint32_t block_group_no);
 
+    disk_mem_ptr_t<uint64_t> ReadBlockBitmap(uint32_t block_group_no);
 
-    template<typename T>
-    static void WriteBackDiskMem(uint32_t no, DiskMem<T> disk_mem)
-    {
-        Log("Writing back disk mem\n");
-        disk_mem.WriteBack();
-    }
+    bool AppendToArr(ds::DynArray<uint32_t> &block_arr, uint32_t block_no);
 
 };
 
@@ -193,10 +193,13 @@ ds::Optional<ds::RefCntPtr<VNode>> Ext2VNode::MkDir(const ds::String &name)
         vnode->InitializeDir(ino_);
         vnode->Chmod(0x1FF);
         vnode->WriteBack();
-        if(MakeDirEntry(name, vnode)) {
+        // Hold a reference across the call; passing vnode itself would wrap
+        // it in a temporary RefCntPtr that frees it on return.
+        ds::RefCntPtr<VNode> vnode_ptr((VNode*) vnode);
+        if(MakeDirEntry(name, vnode_ptr)) {
             ++inode_.i_links_count;
             WriteBack();
-            return ds::MakeRefCntPtr((VNode*) vnode);
+            return vnode_ptr;
         }
     }
 
@@ -209,8 +212,9 @@ ds::Optional<ds::RefCntPtr<VNode>> Ext2VNode::Touch(const ds::String &name)
         vnode->Prealloc();
         vnode->Chmod(0x1FF);
         vnode->WriteBack();
-        if(MakeDirEntry(name, vnode)) {
-            return ds::MakeRefCntPtr((VNode*) vnode);
+        ds::RefCntPtr<VNode> vnode_ptr((VNode*) vnode);
+        if(MakeDirEntry(name, vnode_ptr)) {
+            return vnode_ptr;
         }
     }
 
@@ -246,14 +250,15 @@ ds::Optional<ds::HashMap<ds::String, ds::RefCntPtr<VNode>>> Ext2VNode::ReadDir()
         while(block_off < block_size && rem) {
             if(entry->inode) {
                 ds::String name(entry->name, entry->name_len);
+                Log("%s (ino %d), len %d\n", name, entry->inode, entry->rec_len);
+
                 ds::Optional<ds::RefCntPtr<VNode>> vnode_opt;
                 if((vnode_opt = mount_.GetVNode(entry->inode))) {
-                    vnodes.Insert(name, *vnode_opt);
+                    vnodes.TryEmplace(std::move(name), std::move(*vnode_opt));
                 } else {
+                    KHeap::Free(entries);
                     return ds::NullOpt;
                 }
-
-                Log("%s (ino %d), len %d\n", name, entry->inode, entry->rec_len);
             }
             block_off += entry->rec_len;
             rem -= entry->rec_len;
@@ -269,12 +274,15 @@ ds::Optional<ds::HashMap<ds::String, ds::RefCntPtr<VNode>>> Ext2VNode::ReadDir()
     return vnodes;
 }
 
-ds::Optional<ds::RefCntPtr<VNode>> Ext2VNode::Lookup(const ds::String &name)
+ds::Optional<ds::RefCntPtr<VNode>>
+Ext2VNode::Lookup(const ds::StringView &name)
 {
-    int len;
-    int start = name[0] == '/' ? 1 : 0;
-    for(len = start; len < name.Len() && name[len] != '/'; ++len);
-    ds::String child = name.Substr(start, len+1);
+    // Both the child's name and the rest of the path are views into name, so
+    // walking a path never copies any of it.
+    size_t start = name.Len() && name[0] == '/' ? 1 : 0;
+    ds::Optional<size_t> slash = name.Find('/', start);
+    size_t len = slash ? *slash : name.Len();
+    ds::StringView child = name.Substr(start, len);
 
     ds::RefCntPtr<VNode> child_vnode;
     if(ds::Optional<RawDirEntry> raw_entry_opt = GetDirEntry(child)) {
@@ -286,23 +294,23 @@ ds::Optional<ds::RefCntPtr<VNode>> Ext2VNode::Lookup(const ds::String &name)
             return ds::NullOpt;
         }
 
-        child_vnode = *child_opt;
+        child_vnode = std::move(*child_opt);
         KHeap::Free(raw_entry.mem);
     } else if(ds::Optional<ds::RefCntPtr<VNode>> mnt_opt = mnts_.Lookup(child)) {
-        child_vnode = *mnt_opt;
+        child_vnode = std::move(*mnt_opt);
     } else {
         return ds::NullOpt;
     }
 
-    ds::String remaining = name.Substr(len, name.Len());
-    if(remaining == "" || remaining == "/") {
+    ds::StringView remaining = name.Substr(len, name.Len());
+    if(remaining.Len() == 0 || remaining == "/") {
         return child_vnode;
     }
     return child_vnode->Lookup(remaining);
 }
 
 ds::Optional<ds::RefCntPtr<VNode>>
-Ext2VNode::LookupAndPin(const ds::String &name)
+Ext2VNode::LookupAndPin(const ds::StringView &name)
 {
     ds::Optional<ds::RefCntPtr<VNode>> vnode_opt = Lookup(name);
     if(vnode_opt) {
@@ -317,7 +325,7 @@ void Ext2VNode::Unpin()
     mount_.Unpin(ino_);
 }
 
-bool Ext2VNode::Remove(const ds::String &child_name)
+bool Ext2VNode::Remove(const ds::StringView &child_name)
 {
     ds::Optional<RawDirEntry> raw_entry_opt;
     if(! (raw_entry_opt = GetDirEntry(child_name))) {
@@ -341,13 +349,13 @@ bool Ext2VNode::Remove(const ds::String &child_name)
         return true;
     }
 
-    ds::Optional<ds::DynArray<Extent>> exts_opt;
+    ds::Optional<extent_list_t> exts_opt;
     size_t no_data_blks = child.GetLength() / mount_.GetBlockSize();
     if(! (exts_opt = child.GetOrCreateExtents(0, no_data_blks, false, true))) {
         return false;
     }
 
-    ds::DynArray<Extent> exts = *exts_opt;
+    extent_list_t exts = std::move(*exts_opt);
     for(int ext = 0; ext < exts.Size(); ++ext) {
         uint32_t final_blk = exts[ext].start_ + exts[ext].len_;
         for(uint32_t blk = exts[ext].start_; blk < final_blk; ++blk) {
@@ -364,16 +372,16 @@ bool Ext2VNode::Remove(const ds::String &child_name)
 }
 
 ds::Optional<Ext2VNode::RawDirEntry>
-Ext2VNode::GetDirEntry(const ds::String &name)
+Ext2VNode::GetDirEntry(const ds::StringView &name)
 {
     if(GetExt2FileType() != EXT2_S_IFDIR) {
         return ds::NullOpt;
     }
 
-    ds::Optional<ds::DynArray<Extent>> exts_opt;
-    ds::DynArray<Extent> exts;
+    ds::Optional<extent_list_t> exts_opt;
+    extent_list_t exts;
     if((exts_opt = GetOrCreateExtents(0, inode_.i_blocks, false))) {
-        exts = *exts_opt;
+        exts = std::move(*exts_opt);
     } else {
         return ds::NullOpt;
     }
@@ -381,7 +389,6 @@ Ext2VNode::GetDirEntry(const ds::String &name)
     size_t rem = inode_.i_size;
     size_t blk_size = mount_.GetBlockSize();
     void *entries = KHeap::Allocate(mount_.GetBlockSize());
-    const char *name_cstr = name.ToChars();
 
     for(int ext = 0; ext < exts.Size(); ++ext) {
         size_t final_blk = exts[ext].start_ + exts[ext].len_;
@@ -398,7 +405,9 @@ Ext2VNode::GetDirEntry(const ds::String &name)
                     return ds::NullOpt;
                 }
 
-                if(strncmp(name_cstr, entry->name, entry->name_len) == 0) {
+                if(entry->name_len == name.Len() &&
+                   memcmp(name.Data(), entry->name, entry->name_len) == 0)
+                {
                     return (RawDirEntry) {
                             .block_no = blk,
                             .offset = (uintptr_t) entry - (uintptr_t) entries,
@@ -467,14 +476,14 @@ bool Ext2VNode::ReadWrite(void *buff_param, size_t offset, size_t len,
     size_t remaining_len = len;
     while(remaining_len >= block_size) {
         size_t block_ind = offset / block_size;
-        ds::Optional<ds::DynArray<Extent>> extents_opt = GetOrCreateExtents(
+        ds::Optional<extent_list_t> extents_opt = GetOrCreateExtents(
                 block_ind, remaining_len / block_size, write);
 
         if(! extents_opt) {
             return false;
         }
 
-        ds::DynArray<Extent> extents = *extents_opt;
+        extent_list_t extents = std::move(*extents_opt);
         if(write) {
             if(! mount_.WriteBlocks(extents, buff_ptr)) {
                 return false;
@@ -593,18 +602,18 @@ bool Ext2VNode::MakeDirEntry(const ds::String &name,
 ds::Optional<uint32_t> Ext2VNode::GetOrCreateBlock(uint32_t block_no,
                                                    bool create)
 {
-    ds::Optional<ds::DynArray<Extent>> extents;
+    ds::Optional<extent_list_t> extents;
     if((extents = GetOrCreateExtents(block_no, 1, create))) {
         return (*extents)[0].start_;
     }
     return ds::NullOpt;
 }
 
-ds::Optional<ds::DynArray<Extent>>
+ds::Optional<extent_list_t>
 Ext2VNode::GetOrCreateExtents(uint32_t block_no, size_t len, bool create,
                               bool mdata)
 {
-    ds::DynArray<Extent> extents;
+    extent_list_t extents;
     int64_t parent_ind = -1;
     size_t rem_len = len;
     auto parent = (uint32_t *) KHeap::Allocate(mount_.GetBlockSize());
@@ -616,13 +625,21 @@ Ext2VNode::GetOrCreateExtents(uint32_t block_no, size_t len, bool create,
         ds::Optional<uint32_t> ret = ds::NullOpt;
         if(block_no < 12) {
             if(inode_.i_block[block_no] == 0 && create) {
-                if(ds::Optional<uint32_t> block_opt = mount_.AllocBlock()) {
-                    inode_.i_block[block_no] = *block_opt;
-                    ++inode_.i_blocks;
-                } else {
+                uint32_t hole = 1;
+                while(hole < rem_len && block_no + hole < 12 &&
+                      inode_.i_block[block_no + hole] == 0)
+                {
+                    ++hole;
+                }
+
+                ds::Optional<uint32_t> first = CreateBlocks(hole);
+                if(! first) {
                     KHeap::Free(parent);
                     return ds::NullOpt;
                 }
+                for(uint32_t i = 0; i < hole; ++i) {
+                    inode_.i_block[block_no + i] = *first + i;
+                }
             }
 
             AddToExtentList(extents, inode_.i_block[block_no]);
@@ -706,12 +723,18 @@ int64_t Ext2VNode::GetOrCreateExtents(uint32_t *parent, uint32_t block_no,
         for(uint32_t i = 0; i < len; ++i, ++blocks_read) {
             uint32_t ind = block_no + i;
             if(create && parent[ind] == 0) {
-                if(ds::Optional<uint32_t> free_block = mount_.AllocBlock()) {
-                    parent[ind] = *free_block;
-                    ++inode_.i_blocks;
-                } else {
+                uint32_t hole = 1;
+                while(i + hole < len && parent[ind + hole] == 0) {
+                    ++hole;
+                }
+
+                ds::Optional<uint32_t> first = CreateBlocks(hole);
+                if(! first) {
                     return -1;
                 }
+                for(uint32_t j = 0; j < hole; ++j) {
+                    parent[ind + j] = *first + j;
+                }
             }
 
             if(! parent[ind]) {
@@ -776,6 +799,21 @@ int64_t Ext2VNode::GetOrCreateExtents(uint32_t *parent, uint32_t block_no,
     return blocks_read;
 }
 
+ds::Optional<uint32_t> Ext2VNode::CreateBlocks(uint32_t &num_blocks)
+{
+    // Fall back to a single block if the hole can't be filled contiguously.
+    ds::Optional<uint32_t> first = mount_.AllocBlocks(num_blocks);
+    if(! first) {
+        num_blocks = 1;
+        first = mount_.AllocBlock();
+    }
+
+    if(first) {
+        inode_.i_blocks += num_blocks;
+    }
+    return first;
+}
+
 void Ext2VNode::AddToExtentList(ds::DynArray<Extent> &extents, uint32_t block)
 {
     if(extents.Size()) {
@@ -855,7 +893,7 @@ ds::Optional<ds::RefCntPtr<VNode>> Ext2VNode::Link(const ds::String &name,
                                                    uint32_t ino)
 {
     if(ds::Optional<ds::RefCntPtr<VNode>> src_file_opt = mount_.GetVNode(ino)) {
-        auto src_file = *src_file_opt;
+        auto src_file = std::move(*src_file_opt);
         if(MakeDirEntry(name, src_file)) {
             src_file->WriteBack();
             return src_file;
@@ -865,7 +903,7 @@ ds::Optional<ds::RefCntPtr<VNode>> Ext2VNode::Link(const ds::String &name,
     return ds::NullOpt;
 }
 
-bool Ext2VNode::Unlink(const ds::String &name)
+bool Ext2VNode::Unlink(const ds::StringView &name)
 {
     // For ext2 in particular, a hard link is just a distinct directory entry
     // pointing to an inode, so we remove the dir entry. In other FSs, it can
@@ -898,7 +936,7 @@ bool Ext2VNode::Mount(const ds::String &mntpt, const ds::RefCntPtr<VNode> &root)
     return mnts_.Insert(mntpt, root);
 }
 
-bool Ext2VNode::Unmount(const ds::String &mntpt)
+bool Ext2VNode::Unmount(const ds::StringView &mntpt)
 {
     return mnts_.Delete(mntpt);
 }
@@ -29,7 +29,7 @@ public:
     virtual ds::Optional<ds::RefCntPtr<VNode>> Link(const ds::String &name,
                                                     uint32_t ino) override;
 
-    virtual bool Unlink(const ds::String &name) override;
+    virtual bool Unlink(const ds::StringView &name) override;
 
     virtual bool SymLink(const ds::String &name, const ds::String &target)
     override;
@@ -43,20 +43,20 @@ public:
     // virtual bool RmDir() override;
 
     virtual ds::Optional<ds::RefCntPtr<VNode>>
-    Lookup(const ds::String &name) override;
+    Lookup(const ds::StringView &name) override;
 
     virtual ds::Optional<ds::RefCntPtr<VNode>>
-    LookupAndPin(const ds::String &name) override;
+    LookupAndPin(const ds::StringView &name) override;
 
     virtual void Unpin() override;
 
-    virtual bool Remove(const ds::String &child_name) override;
+    virtual bool Remove(const ds::StringView &child_name) override;
 
     virtual bool Chmod(uint16_t perms) override;
 
     virtual bool Mount(const ds::String &mntpt, const ds::RefCntPtr<VNode> &root) override;
 
-    virtual bool Unmount(const ds::String &mntpt) override;
+    virtual bool Unmount(const ds::StringView &mntpt) override;
 
     virtual size_t GetNumMounts() const override;
 
@@ -71,7 +71,7 @@ private:
         void *mem;
     };
 
-    ds::Optional<RawDirEntry> GetDirEntry(const ds::String &name);
+    ds::Optional<RawDirEntry> GetDirEntry(const ds::StringView &name);
 
     void Prealloc();
     ds::Optional<ds::RefCntPtr<VNode>>
@@ -88,7 +88,7 @@ private:
      */
     ds::Optional<uint32_t> GetOrCreateBlock(uint32_t block_no, bool create);
 
-    ds::Optional<ds::DynArray<Extent>>
+    ds::Optional<extent_list_t>
     GetOrCreateExtents(uint32_t start_block, size_t len, bool create,
                        bool mdata=false);
     int64_t GetOrCreateExtents(uint32_t *parent, uint32_t block_no, size_t len,
@@ -97,6 +97,16 @@ private:
 
     size_t PtrsPerIndirectBlock(uint8_t level);
 
+    /**
+     * Allocate blocks to fill a hole of num_blocks missing blocks in the file,
+     * so that they're contiguous on disk and read back as a single extent.
+     * @param num_blocks Length of the hole; set to the number of blocks
+     *                   actually allocated, which is 1 if no free run was
+     *                   long enough.
+     * @return The first allocated block, or NullOpt if the disk is full.
+     */
+    ds::Optional<uint32_t> CreateBlocks(uint32_t &num_blocks);
+
     void AddToExtentList(ds::DynArray<Extent> &extents, uint32_t block);
     bool ReadWrite(void *buffer, size_t offset, size_t len, bool write);
     uint16_t GetExt2FileType() const;
@@ -59,7 +59,7 @@ VFS::VFS(SATAPort *port, size_t part_num)
     if(ds::Optional<GPTEntry> part_opt = port->GetNthPartition(part_num)) {
         ds::Optional<ds::RefCntPtr<VNode>> root_opt;
         if((root_opt = GetRootVNode(port, *part_opt))) {
-            root_ = *root_opt;
+            root_ = std::move(*root_opt);
         }
     }
 }
@@ -68,7 +68,7 @@ VFS::VFS(SATAPort *port, const GPTEntry &entry)
 {
     ds::Optional<ds::RefCntPtr<VNode>> root_opt;
     if((root_opt = GetRootVNode(port, entry))) {
-        root_ = *root_opt;
+        root_ = std::move(*root_opt);
     }
 }
 
@@ -76,14 +76,9 @@ ds::Optional<FileHandle> VFS::Open(const ds::String &filename, bool read,
                                    bool write, bool create)
 {
     ds::Optional<ds::RefCntPtr<VNode>> vnode_opt;
-    KHeap::Verify();
     if((vnode_opt = FindVNode(filename, create, true))) {
-        if(open_handles_.Contains(filename)) {
-            ++open_handles_[filename];
-        } else {
-            open_handles_.Insert(filename, 1);
-        }
-        return FileHandle(*vnode_opt, filename, read, write);
+        open_handles_.Upsert(filename, [](size_t &count) { ++count; }, 1);
+        return FileHandle(std::move(*vnode_opt), filename, read, write);
     }
 
     return ds::NullOpt;
@@ -95,7 +90,8 @@ bool VFS::Close(FileHandle &handle)
     return true;
 }
 
-bool VFS::Mount(const ds::String &mnt_path_str, SATAPort *port, size_t part_num)
+bool VFS::Mount(const ds::StringView &mnt_path_str, SATAPort *port,
+                size_t part_num)
 {
     Path mnt_path = DecomposePath(mnt_path_str);
 
@@ -103,24 +99,24 @@ bool VFS::Mount(const ds::String &mnt_path_str, SATAPort *port, size_t part_num)
     if(! (mnt_parent_opt = root_->LookupAndPin(mnt_path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> mnt_parent = *mnt_parent_opt;
+    ds::RefCntPtr<VNode> mnt_parent = std::move(*mnt_parent_opt);
 
     ds::Optional<GPTEntry> part_opt;
     if(! (part_opt = port->GetNthPartition(part_num))) {
         return false;
     }
-    GPTEntry part = *part_opt;
+    GPTEntry part = std::move(*part_opt);
 
     ds::Optional<ds::RefCntPtr<VNode>> mnt_root = GetRootVNode(port, part);
     if(! mnt_root) {
         return false;
     }
 
-    mnt_parent->Mount(mnt_path.file, *mnt_root);
+    mnt_parent->Mount(ds::String(mnt_path.file), std::move(*mnt_root));
     return true;
 }
 
-bool VFS::Unmount(const ds::String &mnt_path_str)
+bool VFS::Unmount(const ds::StringView &mnt_path_str)
 {
     Path mnt_path = DecomposePath(mnt_path_str);
 
@@ -128,7 +124,7 @@ bool VFS::Unmount(const ds::String &mnt_path_str)
     if(! (mnt_parent_opt = root_->Lookup(mnt_path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> mnt_parent = *mnt_parent_opt;
+    ds::RefCntPtr<VNode> mnt_parent = std::move(*mnt_parent_opt);
 
     if(! mnt_parent->Unmount(mnt_path.file)) {
         return false;
@@ -141,40 +137,41 @@ bool VFS::Unmount(const ds::String &mnt_path_str)
     return true;
 }
 
-bool VFS::Touch(const ds::String &name)
+bool VFS::Touch(const ds::StringView &name)
 {
     Path path = DecomposePath(name);
     ds::Optional<ds::RefCntPtr<VNode>> parent_dir_opt;
     if (!(parent_dir_opt = root_->Lookup(path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> parent_dir = *parent_dir_opt;
-    return parent_dir->Touch(path.file).HasValue();
+    ds::RefCntPtr<VNode> parent_dir = std::move(*parent_dir_opt);
+    return parent_dir->Touch(ds::String(path.file)).HasValue();
 }
 
-bool VFS::MkDir(const ds::String &name)
+bool VFS::MkDir(const ds::StringView &name)
 {
     Path path = DecomposePath(name);
     ds::Optional<ds::RefCntPtr<VNode>> parent_dir_opt;
     if (!(parent_dir_opt = root_->Lookup(path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> parent_dir = *parent_dir_opt;
-    return parent_dir->MkDir(path.file);
+    ds::RefCntPtr<VNode> parent_dir = std::move(*parent_dir_opt);
+    return parent_dir->MkDir(ds::String(path.file));
 }
 
-bool VFS::Remove(const ds::String &name)
+bool VFS::Remove(const ds::StringView &name)
 {
     Path path = DecomposePath(name);
     ds::Optional<ds::RefCntPtr<VNode>> parent_dir_opt;
     if (!(parent_dir_opt = root_->Lookup(path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> parent_dir = *parent_dir_opt;
+    ds::RefCntPtr<VNode> parent_dir = std::move(*parent_dir_opt);
     return parent_dir->Remove(path.file);
 }
 
-bool VFS::Link(const ds::String &name, const ds::String &target)
+bool VFS::Link(const ds::StringView &name,
+               const ds::StringView &target)
 {
     ds::Optional<ds::RefCntPtr<VNode>> vnode_opt;
     if ((vnode_opt = FindVNode(name, false))) {
@@ -184,14 +181,16 @@ bool VFS::Link(const ds::String &name, const ds::String &target)
         if (!(parent_dir_opt = root_->Lookup(target_path.dir))) {
             return false;
         }
-        ds::RefCntPtr<VNode> parent_dir = *parent_dir_opt;
+        ds::RefCntPtr<VNode> parent_dir = std::move(*parent_dir_opt);
 
-        return parent_dir->Link(target_path.file, (*vnode_opt)->GetIno());
+        return parent_dir->Link(ds::String(target_path.file),
+                                (*vnode_opt)->GetIno());
     }
     return false;
 }
 
-bool VFS::SymLink(const ds::String &name, const ds::String &target)
+bool VFS::SymLink(const ds::StringView &name,
+                  const ds::StringView &target)
 {
     Path target_path = DecomposePath(target);
 
@@ -199,33 +198,36 @@ bool VFS::SymLink(const ds::String &name, const ds::String &target)
     if (!(parent_dir_opt = root_->Lookup(target_path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> parent_dir = *parent_dir_opt;
-    return parent_dir->SymLink(target_path.file, name);
+    ds::RefCntPtr<VNode> parent_dir = std::move(*parent_dir_opt);
+    return parent_dir->SymLink(ds::String(target_path.file),
+                               ds::String(name));
 }
 
-bool VFS::Unlink(const ds::String &name, const ds::String &target)
+bool VFS::Unlink(const ds::StringView &name,
+                 const ds::StringView &target)
 {
     Path target_path = DecomposePath(target);
     ds::Optional<ds::RefCntPtr<VNode>> parent_dir_opt;
     if (!(parent_dir_opt = root_->Lookup(target_path.dir))) {
         return false;
     }
-    ds::RefCntPtr<VNode> parent_dir = *parent_dir_opt;
+    ds::RefCntPtr<VNode> parent_dir = std::move(*parent_dir_opt);
     return parent_dir->Unlink(target_path.file);
 }
 
-VFS::Path VFS::DecomposePath(const ds::String &path_str)
+VFS::Path VFS::DecomposePath(const ds::StringView &path_str)
 {
-    int i;
-    for(i = path_str.Len(); i >= 0 && path_str[i] != '/'; --i);
+    // The directory keeps its trailing slash.
+    ds::Optional<size_t> slash = path_str.RFind('/');
+    size_t split = slash ? *slash + 1 : 0;
     Path path {};
-    path.dir = path_str.Substr(0, i+1);
-    path.file = path_str.Substr(i+1, path_str.Len());
+    path.dir = path_str.Substr(0, split);
+    path.file = path_str.Substr(split, path_str.Len());
     return path;
 }
 
-ds::Optional<ds::RefCntPtr<VNode>> VFS::FindVNode(const ds::String &filename,
-                                                  bool create, bool pin)
+ds::Optional<ds::RefCntPtr<VNode>>
+VFS::FindVNode(const ds::StringView &filename, bool create, bool pin)
 {
     ds::Optional<ds::RefCntPtr<VNode>> vnode_opt;
     if(create) {
@@ -234,10 +236,11 @@ ds::Optional<ds::RefCntPtr<VNode>> VFS::FindVNode(const ds::String &filename,
         if(path.dir == "/") {
             parent_dir = root_;
         } else if(ds::Optional<ds::RefCntPtr<VNode>> pd = root_->Lookup(path.dir)) {
-            parent_dir = *pd;
+            parent_dir = std::move(*pd);
         }
 
-        vnode_opt = parent_dir ? parent_dir->Touch(path.file) : ds::NullOpt;
+        vnode_opt = parent_dir ? parent_dir->Touch(ds::String(path.file))
+                               : ds::NullOpt;
     } else {
         vnode_opt = pin ? root_->LookupAndPin(filename) : root_->Lookup(filename);
     }
@@ -1,6 +1,7 @@
 #ifndef VFS_H
 #define VFS_H
 
+#include <ds/concurrent_hash_map.h>
 #include <ds/string.h>
 #include <sys/fs/vmount.h>
 #include <sys/gpt.h>
@@ -42,37 +43,38 @@ public:
 
     bool Close(FileHandle &handle);
 
-    bool Mount(const ds::String &mnt_path_str, SATAPort *port,
+    bool Mount(const ds::StringView &mnt_path_str, SATAPort *port,
                size_t part_num=1);
 
-    bool Unmount(const ds::String &mnt_path_str);
+    bool Unmount(const ds::StringView &mnt_path_str);
 
-    bool Touch(const ds::String &name);
+    bool Touch(const ds::StringView &name);
 
-    bool MkDir(const ds::String &name);
+    bool MkDir(const ds::StringView &name);
 
-    bool Remove(const ds::String &name);
+    bool Remove(const ds::StringView &name);
 
-    bool Link(const ds::String &name, const ds::String &target);
+    bool Link(const ds::StringView &name, const ds::StringView &target);
 
-    bool SymLink(const ds::String &name, const ds::String &target);
+    bool SymLink(const ds::StringView &name, const ds::StringView &target);
 
-    bool Unlink(const ds::String &name, const ds::String &target);
+    bool Unlink(const ds::StringView &name, const ds::StringView &target);
 
 private:
-    ds::HashMap<ds::String, size_t> open_handles_;
+    ds::ConcurrentHashMap<ds::String, size_t> open_handles_;
     ds::RefCntPtr<VNode> root_;
 
+    // Both halves view the decomposed path, so must not outlive it.
     struct Path {
-        ds::String dir;
-        ds::String file;
+        ds::StringView dir;
+        ds::StringView file;
     };
 
 
-    Path DecomposePath(const ds::String &path_str);
+    Path DecomposePath(const ds::StringView &path_str);
 
-    ds::Optional<ds::RefCntPtr<VNode>> FindVNode(const ds::String &filename,
-                                                 bool create, bool pin=false);
+    ds::Optional<ds::RefCntPtr<VNode>>
+    FindVNode(const ds::StringView &filename, bool create, bool pin=false);
 
     ds::Optional<ds::RefCntPtr<VNode>> GetRootVNode(SATAPort *port,
                                                     GPTEntry part);
@@ -102,7 +102,7 @@ static void ParseMADT()
             case ACPI::MADT::IO_APIC: {
                 ACPI::MADT::IOAPICRecord ioapic_rec {};
                 memcpy(&ioapic_rec, record, sizeof(ACPI::MADT::IOAPICRecord));
-                ioapics_.Append(ds::MakeRefCntPtr(new IOAPIC(ioapic_rec)));
+                ioapics_.Append(ds::MakeRefCntPtr<IOAPIC>(ioapic_rec));
             } break;
             case ACPI::MADT::INTERRUPT_SOURCE_OVERRIDE: {
                 ACPI::MADT::ISORecord iso {};
@@ -1,15 +1,18 @@
 #include "kheap.h"
 #include "sys/log.h"
+#include "sys/shrinker.h"
 #include <ds/cache.h>
+#include <ds/intrusive_list.h>
 #include "libc/string.h"
 
 namespace KHeap {
 namespace {
-struct FreeListEntry {
-    FreeListEntry *forward_, *backward_;
+struct FreeListEntry : ds::ListLink<> {
     size_t size_, prev_size_;
 };
 
+using FreeList = ds::IntrusiveList<FreeListEntry>;
+
 // Final bit of size in FreeListEntry denotes whether or not chunk is free
 // (0) or in use (1). Since we align to 32 bytes, we can actually use first
 // five bits; just adjust SIZE_MASK accordingly.
@@ -17,15 +20,17 @@ const uint8_t IN_USE = 1;
 const uint64_t SIZE_MASK = ~(0b11111);
 
 // First 32 bins (under 1024 bytes) are spaced 32 bytes apart. Past that, we
-// have 4 bins between every power of 2. Going up to 64 bins, that allows us
-// to store chunks of at most 256 KiB. Beyond this, we use the PMM to request
-// more memory.
-const size_t NUM_BINS = 256;
-const size_t NUM_BMAP_ENTRIES = NUM_BINS / 64;
+// have 2 bins between every power of 2. Going up to 64 bins, that allows us
+// to bin chunks of up to 64 MiB; the last bin takes any chunk larger still,
+// so that the bitmap of non-empty bins fits in a single word. Allocations
+// from PMM_THRESHOLD up go straight to the PMM.
+const size_t NUM_BINS = 64;
 const size_t PMM_THRESHOLD = 0x4000;
-const uint64_t HEAP_BASE = KERNEL_DATA_BASE + KERN_DIRECT_MAP_SIZE;
+// The smallest chunk worth splitting off from another: a header, plus the
+// smallest allocation.
+const size_t MIN_CHUNK_SIZE = 64;
 
-FreeListEntry *free_lists_[NUM_BINS] = {nullptr};
+FreeList free_lists_[NUM_BINS];
 uint64_t free_lists_bitmap_;
 
 PageMap *page_map_;
@@ -48,64 +53,61 @@ uint8_t BinIndex(size_t size)
     static const uint8_t log2_min_size = 11;
     uint8_t msb_index = __builtin_clzl(size);
     uint8_t floor_log2_size = sizeof(size_t) * 8 - msb_index;
-    uint8_t index = (floor_log2_size - log2_min_size) * 2;
+    size_t index = (floor_log2_size - log2_min_size) * 2;
     index += ((size >> (floor_log2_size - 2)) & 1);
-    //index += ((size >> (floor_log2_size - 3)) & 1);
-    return 32 + index;
+    return 32 + index < NUM_BINS ? 32 + index : NUM_BINS - 1;
 }
 
-FreeListEntry *PopFront(uint8_t ind)
+/**
+ * Round a requested allocation up to the size of the chunk holding it,
+ * header included.
+ */
+size_t ChunkSize(size_t size)
 {
-    FreeListEntry *entry = free_lists_[ind];
-    if (entry) {
-        free_lists_[ind] = entry->forward_;
-        if (free_lists_[ind]) {
-            free_lists_[ind]->backward_ = nullptr;
-        } else {
-            free_lists_bitmap_ &= ~(1ULL << ind);
-        }
-
-        entry->forward_ = entry->backward_ = nullptr;
-        return entry;
-    }
+    size += sizeof(FreeListEntry);
+    return ((size + 32 - 1) / 32) * 32;
+}
 
-    return nullptr;
+/**
+ * Allocations of PMM_THRESHOLD or more come from the PMM, and live outside
+ * the heap. Telling them apart by address rather than by size means that a
+ * small allocation given a large chunk is still freed to the heap.
+ */
+bool InHeap(FreeListEntry *entry)
+{
+    return (uintptr_t) entry >= (uintptr_t) heap_ &&
+           (uintptr_t) entry < (uintptr_t) heap_ + heap_size_;
 }
 
 void Remove(FreeListEntry *entry)
 {
-    if (entry->forward_) {
-        entry->forward_->backward_ = entry->backward_;
-    }
-
-    if (entry->backward_) {
-        entry->backward_->forward_ = entry->forward_;
-    }
-
     uint8_t entry_bin = BinIndex(entry->size_ & SIZE_MASK);
-    if (free_lists_[entry_bin] == entry) {
-        PopFront(entry_bin);
+    // The top chunk is never on a free list, but is merged like any other.
+    if (! free_lists_[entry_bin].Contains(*entry)) {
+        return;
     }
 
-    entry->forward_ = entry->backward_ = nullptr;
+    free_lists_[entry_bin].Remove(*entry);
+    if (free_lists_[entry_bin].Empty()) {
+        free_lists_bitmap_ &= ~(1ULL << entry_bin);
+    }
 }
 
 FreeListEntry *FindEntry(size_t size)
 {
+    // Every chunk in a bin above size's own is large enough, so only the
+    // first non-empty bin may need searching past its head.
     uint8_t bin_ind = BinIndex(size);
-    size_t free_list_mask = free_lists_bitmap_ & -(1ULL << bin_ind);
+    uint64_t free_list_mask = free_lists_bitmap_ & (~0ULL << bin_ind);
     while(free_list_mask) {
-        uint8_t smallest_sufficient_bin = 63 - __builtin_clzl(free_list_mask);
-        FreeListEntry *entry = free_lists_[smallest_sufficient_bin];
-        while(entry) {
-            if(entry->size_ > size) {
-                Remove(entry);
-                return entry;
+        uint8_t smallest_sufficient_bin = __builtin_ctzll(free_list_mask);
+        for(FreeListEntry &entry : free_lists_[smallest_sufficient_bin]) {
+            if(entry.size_ >= size) {
+                Remove(&entry);
+                return &entry;
             }
-            entry = entry->forward_;
         }
-        ++bin_ind;
-        free_list_mask &= ~(1ULL << bin_ind);
+        free_list_mask &= free_list_mask - 1;
     }
 
     return nullptr;
@@ -113,14 +115,7 @@ FreeListEntry *FindEntry(size_t size)
 
 void PushFront(uint8_t ind, FreeListEntry *entry)
 {
-    entry->forward_ = free_lists_[ind];
-    if((uintptr_t) free_lists_[ind] == 1) {
-        Log("Issue in push front (ind %d)\n", ind);
-    }
-    if (entry->forward_) {
-        entry->forward_->backward_ = entry;
-    }
-    free_lists_[ind] = entry;
+    free_lists_[ind].PushFront(*entry);
     free_lists_bitmap_ |= (1ULL << ind);
 }
 
@@ -140,7 +135,7 @@ FreeListEntry *Split(FreeListEntry *entry, size_t size)
     size_t old_size = entry->size_ & SIZE_MASK;
     char *raw_mem = (char *) entry;
     auto *next = (FreeListEntry *) (raw_mem + size);
-    next->forward_ = next->backward_ = nullptr;
+    next->prev_ = next->next_ = nullptr;
     entry->size_ = size | IN_USE;
     next->size_ = (old_size - size) & ~(IN_USE);
     next->prev_size_ = entry->size_;
@@ -164,7 +159,6 @@ void SplitAndPush(FreeListEntry *entry, size_t size)
 
 FreeListEntry *MergeWithNeighbors(FreeListEntry *entry)
 {
-    // size_t old_size = entry->size_;
     if (!(entry->prev_size_ & IN_USE) && entry->prev_size_ > 0) {
         size_t current_size = entry->size_;
         FreeListEntry *prev = PrevChunk(entry);
@@ -190,77 +184,82 @@ FreeListEntry *MergeWithNeighbors(FreeListEntry *entry)
     return entry;
 }
 
-void GrowHeap()
+/**
+ * Merge a chunk no longer in use with its free neighbors, and bin the
+ * result unless it has become part of the top chunk.
+ * @param entry A chunk within the heap, already marked free.
+ */
+void Release(FreeListEntry *entry)
 {
-    page_map_->UnmapRange({(uintptr_t) heap_, (uintptr_t) heap_ + heap_size_});
-
-    if(BuddyAllocator::MemInUse() < max_heap_size_) {
-        heap_size_ = heap_size_ * 2 > max_heap_size_ ?
-                          max_heap_size_ : heap_size_ * 2;
-        heap_paddr_ = (uintptr_t) BuddyAllocator::Realloc((void*) heap_paddr_,
-                                                          heap_size_);
-
-        page_map_->MapRange({ heap_paddr_, heap_paddr_ + heap_size_ },
-                            HEAP_BASE - heap_paddr_);
-        page_map_->Load();
-        top_->size_ += heap_size_ / 2;
+    entry = MergeWithNeighbors(entry);
+    if (entry != top_) {
+        PushFront(BinIndex(entry->size_), entry);
     }
 }
 
-}
-}
-
-void KHeap::Init(size_t initial_size, PageMap *page_map, size_t max_heap_size)
+/**
+ * Double the heap, up to max_heap_size_. The heap keeps its virtual
+ * address; its contents are copied to the new physical allocation.
+ * @return Whether the heap grew. On failure, the heap is left as it was.
+ */
+bool GrowHeap()
 {
-    // Smallest possible allocation is 32 bits, so heap size should be a
-    // multiple of 32; this also lets us use the final 5 bits of addresses
-    // to store metadata. (Currently, only the final bit is used, in order to
-    // denote whether a block is in use or free.)
-    initial_size = ((initial_size + 32 - 1) / 32) * 32;
-    max_heap_size_ = max_heap_size;
+    if(heap_size_ >= max_heap_size_) {
+        return false;
+    }
 
-    free_lists_bitmap_ = 0;
-    heap_size_ = initial_size;
-    heap_ = (void*) HEAP_BASE;
-    top_ = (FreeListEntry*) heap_;
-    page_map_ = page_map;
-    heap_paddr_ = (uintptr_t) BuddyAllocator::Allocate(heap_size_);
+    // Both the buddy allocation and the page tables for the new mapping may
+    // run shrinkers, whose evictions use the heap; mid-way through moving
+    // it, that would grow or free the very allocation being copied. Callers
+    // reclaim beforehand instead.
+    ShrinkerRegistry::SuspendReclaim();
+    size_t new_size = heap_size_ * 2 > max_heap_size_ ?
+                          max_heap_size_ : heap_size_ * 2;
+    void *new_paddr = BuddyAllocator::Realloc((void*) heap_paddr_, new_size);
+    if(! new_paddr) {
+        ShrinkerRegistry::ResumeReclaim();
+        return false;
+    }
 
-    page_map->MapRange({ heap_paddr_, heap_paddr_ + heap_size_ },
-                        HEAP_BASE - heap_paddr_);
-    page_map->Load();
-    top_->size_ = heap_size_;
-    top_->forward_ = top_->backward_ = nullptr;
-    top_->prev_size_ = 0;
+    page_map_->UnmapRange({(uintptr_t) heap_, (uintptr_t) heap_ + heap_size_});
+    heap_paddr_ = (uintptr_t) new_paddr;
+    page_map_->MapRange({ heap_paddr_, heap_paddr_ + new_size },
+                        (uintptr_t) heap_ - heap_paddr_);
+    page_map_->Load();
+    top_->size_ += new_size - heap_size_;
+    heap_size_ = new_size;
+    ShrinkerRegistry::ResumeReclaim();
+    return true;
 }
 
-void *KHeap::Allocate(size_t size)
+void *AllocateChunk(size_t size)
 {
-    if(! heap_ || ! size) {
-        return nullptr;
-    }
-
-    Verify();
-
     FreeListEntry *entry = nullptr;
-    // Account for necessary metadata, round up to nearest multiple of 32 if
-    // less than 1024 bytes.
-    size += sizeof(FreeListEntry);
-    size = ((size + 32 - 1) / 32) * 32;
-
     if(size >= PMM_THRESHOLD) {
-        entry = (FreeListEntry *) BuddyAllocator::Allocate(size);
+        void *pages = BuddyAllocator::Allocate(size);
+        if(! pages) {
+            return nullptr;
+        }
+        entry = (FreeListEntry *) ToHighMem(pages);
         entry->size_ = size | IN_USE;
-        return ToHighMem(entry + 1);
+        return (void*) (entry + 1);
     }
 
     // Now, find the first free list containing blocks larger than or
-    // equal to the required size. This bit hack sets all bits less than
-    // the bin index to 0 and and-s all indices greater than this. Then
-    // trim down to
-    if((entry = FindEntry(size))) {
+    // equal to the required size.
+    entry = FindEntry(size);
+
+    // Before growing the heap under memory pressure, see whether shrinking
+    // the kernel's caches frees up a chunk that fits.
+    if(! entry && size >= top_->size_ && ShrinkerRegistry::UnderPressure() &&
+       ShrinkerRegistry::Reclaim())
+    {
+        entry = FindEntry(size);
+    }
+
+    if(entry) {
         size_t entry_size = entry->size_ & SIZE_MASK;
-        if(size >= 1024 && entry_size > size) {
+        if(entry_size - size >= MIN_CHUNK_SIZE) {
             SplitAndPush(entry, size);
         }
     }
@@ -270,7 +269,9 @@ void *KHeap::Allocate(size_t size)
     // heap.
     else {
         while(size >= top_->size_) {
-            GrowHeap();
+            if(! GrowHeap()) {
+                return nullptr;
+            }
         }
         entry = top_;
         top_ = Split(top_, size);
@@ -279,108 +280,180 @@ void *KHeap::Allocate(size_t size)
     FreeListEntry *next = NextChunk(entry);
     entry->size_ = entry->size_ | IN_USE;
     next->prev_size_ = entry->size_;
-
-    Verify();
     return (void*) (entry + 1);
 }
 
-void *KHeap::Reallocate(void *allocation, size_t size)
+void FreeChunk(void *allocation)
 {
-    if (!heap_ || !size) {
-        return nullptr;
+    auto *entry = (FreeListEntry * )((char *) allocation - sizeof(FreeListEntry));
+    if(! (entry->size_ & IN_USE)) {
+        Log("[WARNING] Attempting to free non-allocated memory.\n");
+        return;
+    }
+    if (! InHeap(entry)) {
+        BuddyAllocator::Free(ToPAddr(entry));
+        return;
     }
 
-    Verify();
-
-    size += sizeof(FreeListEntry);
-    size = ((size + 32 - 1) / 32) * 32;
+    entry->size_ &= ~(IN_USE);
+    Release(entry);
+}
 
+void *ReallocateChunk(void *allocation, size_t size)
+{
     auto *entry = (FreeListEntry * )
             ((char *) allocation - sizeof(FreeListEntry));
-    size_t original_size = entry->size_;
+    size_t original_size = entry->size_ & SIZE_MASK;
 
-    if(! (original_size & IN_USE)) {
+    if(! (entry->size_ & IN_USE)) {
         Log("[WARNING] Attempting to reallocate non-allocated memory.\n");
         return nullptr;
     }
 
-    if (original_size >= PMM_THRESHOLD) {
-        auto *new_alloc = (FreeListEntry*)
-            BuddyAllocator::Realloc(ToPAddr(entry), size);
-        new_alloc->size_ = size & IN_USE;
-        return (void*) (new_alloc + 1);
-    } else if (size >= PMM_THRESHOLD) {
-        auto *new_allocation = (FreeListEntry *) BuddyAllocator::Allocate(size);
-        memcpy(new_allocation, entry, size);
-        new_allocation->size_ = size;
-        Free(allocation);
-        return (void *) (new_allocation + 1);
+    // The PMM can often grow an allocation in place, and copies it if not.
+    if (! InHeap(entry)) {
+        void *pages = BuddyAllocator::Realloc(ToPAddr(entry), size);
+        if(! pages) {
+            return nullptr;
+        }
+        entry = (FreeListEntry *) ToHighMem(pages);
+        entry->size_ = size | IN_USE;
+        return (void *) (entry + 1);
     }
 
+    // Shrink in place, freeing the tail if it's worth splitting off.
+    if (original_size >= size) {
+        if (original_size - size >= MIN_CHUNK_SIZE) {
+            FreeListEntry *tail = Split(entry, size);
+            Release(tail);
+        }
+        return allocation;
+    }
 
-    // Merge with neighbors. Note that, even if the resulting chunk is not
-    // large enough, we'd just end up calling free, which would merge the
-    // chunk anyway, so this is useful in either case.
-    entry = MergeWithNeighbors(entry);
-    // if ((entry->size_ & SIZE_MASK) > size) {
-    //     SplitAndPush(entry, size);
-    // }
-    // if ((entry->size_ & SIZE_MASK) >= size) {
-    //     memcpy((entry + 1), allocation, original_size & SIZE_MASK);
-    //     Verify();
-    //     return (void *) (entry + 1);
-    // } else {
-    //     FreeListEntry *next = NextChunk(entry);
-    //     next->prev_size_ = entry->size_;
-    // }
-
-    if ((entry->size_ & SIZE_MASK) > size) {
-        SplitAndPush(entry, size);
-        memcpy((entry + 1), allocation, original_size & SIZE_MASK);
-        Verify();
-        return (void *) (entry + 1);
-    } else if((entry->size_ & SIZE_MASK) == size) {
-        memcpy((entry + 1), allocation, original_size & SIZE_MASK);
-        Verify();
-        return (void *) (entry + 1);
-    } else {
-        FreeListEntry *next = NextChunk(entry);
-        next->prev_size_ = entry->size_;
+    // Otherwise, grow in place if the next chunk is free and large enough.
+    // Merging with the previous chunk would mean moving the data anyway, so
+    // that's left to the general case below.
+    FreeListEntry *next = NextChunk(entry);
+    size_t next_size = next->size_ & SIZE_MASK;
+    if (size < PMM_THRESHOLD && !(next->size_ & IN_USE)) {
+        if (next == top_ && original_size + next_size > size) {
+            // Splitting the top chunk leaves the remainder as the top.
+            entry->size_ = original_size + next_size;
+            top_ = entry;
+            Split(entry, size);
+            return allocation;
+        } else if (next != top_ && original_size + next_size >= size) {
+            Remove(next);
+            entry->size_ = (original_size + next_size) | IN_USE;
+            NextChunk(entry)->prev_size_ = entry->size_;
+            if (original_size + next_size - size >= MIN_CHUNK_SIZE) {
+                Release(Split(entry, size));
+            }
+            return allocation;
+        }
     }
 
-    void *result = Allocate(size);
-    memcpy(result, allocation, original_size);
-    Free((void *) (entry + 1));
-    Verify();
+    void *result = AllocateChunk(size);
+    if(! result) {
+        return nullptr;
+    }
+    memcpy(result, allocation, original_size - sizeof(FreeListEntry));
+    FreeChunk(allocation);
     return result;
 }
 
-void KHeap::Free(void *allocation)
+/**
+ * Walking the whole heap on every call is far too slow for anything but
+ * debugging.
+ */
+void DebugVerify()
 {
-    if (!heap_ || !allocation) {
-        return;
+#ifdef DEBUG
+    if(! Verify()) {
+        Print();
     }
+#endif
+}
 
-    auto *entry = (FreeListEntry * )((char *) allocation - sizeof(FreeListEntry));
-    if(! (entry->size_ & IN_USE)) {
-        Log("[WARNING] Attempting to free non-allocated memory.\n");
+}
+}
+
+void KHeap::Init(size_t initial_size, PageMap *page_map, size_t max_heap_size,
+                 uintptr_t heap_base)
+{
+    // Smallest possible allocation is 32 bits, so heap size should be a
+    // multiple of 32; this also lets us use the final 5 bits of addresses
+    // to store metadata. (Currently, only the final bit is used, in order to
+    // denote whether a block is in use or free.)
+    initial_size = ((initial_size + 32 - 1) / 32) * 32;
+    max_heap_size_ = max_heap_size;
+
+    for(FreeList &free_list : free_lists_) {
+        free_list = FreeList();
     }
-    if (entry->size_ >= PMM_THRESHOLD) {
-        BuddyAllocator::Free(ToPAddr(entry));
-        Verify();
+    free_lists_bitmap_ = 0;
+    heap_size_ = initial_size;
+    heap_ = nullptr;
+    page_map_ = page_map;
+    heap_paddr_ = (uintptr_t) BuddyAllocator::Allocate(heap_size_);
+    if(! heap_paddr_) {
+        Log("[ERROR] Unable to allocate the kernel heap.\n");
         return;
     }
 
-    entry->size_ &= ~(IN_USE);
-    entry = MergeWithNeighbors(entry);
-    if (entry != top_) {
-        FreeListEntry *next = NextChunk(entry);
-        next->prev_size_ = entry->size_;
-        uint8_t bin_ind = BinIndex(entry->size_);
-        PushFront(bin_ind, entry);
+    heap_ = (void*) heap_base;
+    top_ = (FreeListEntry*) heap_;
+    page_map->MapRange({ heap_paddr_, heap_paddr_ + heap_size_ },
+                        heap_base - heap_paddr_);
+    page_map->Load();
+    top_->size_ = heap_size_;
+    top_->prev_ = top_->next_ = nullptr;
+    top_->prev_size_ = 0;
+}
+
+void *KHeap::Allocate(size_t size)
+{
+    if(! heap_ || ! size) {
+        return nullptr;
+    }
+
+    void *allocation = AllocateChunk(ChunkSize(size));
+#ifdef KHEAP_TRACE
+    Log("[KHEAP] a %x %d\n", (uintptr_t) allocation, size);
+#endif
+    DebugVerify();
+    return allocation;
+}
+
+void *KHeap::Reallocate(void *allocation, size_t size)
+{
+    if (!heap_ || !size) {
+        return nullptr;
+    }
+    if (!allocation) {
+        return Allocate(size);
+    }
+
+    void *result = ReallocateChunk(allocation, ChunkSize(size));
+#ifdef KHEAP_TRACE
+    Log("[KHEAP] r %x %x %d\n", (uintptr_t) allocation, (uintptr_t) result,
+        size);
+#endif
+    DebugVerify();
+    return result;
+}
+
+void KHeap::Free(void *allocation)
+{
+    if (!heap_ || !allocation) {
+        return;
     }
 
-    Verify();
+    FreeChunk(allocation);
+#ifdef KHEAP_TRACE
+    Log("[KHEAP] f %x\n", (uintptr_t) allocation);
+#endif
+    DebugVerify();
 }
 
 void KHeap::Print()
@@ -419,14 +492,14 @@ void *KHeap::ToPAddr(void *vaddr)
 
 uintptr_t KHeap::ToPAddr(uintptr_t vaddr)
 {
-    // There's no reason a vaddr would be mapped below KERNEL_DATA_BASE, so
-    // this is almost certainly a paddr.
-    if(vaddr < KERNEL_DATA_BASE) {
-        return vaddr;
-    } else if(vaddr <= HEAP_BASE) {
-        return vaddr - KERNEL_DATA_BASE;
+    if(heap_ && vaddr >= (uintptr_t) heap_ &&
+       vaddr < (uintptr_t) heap_ + heap_size_)
+    {
+        return vaddr - (uintptr_t) heap_ + heap_paddr_;
     }
-    return vaddr + heap_paddr_ - HEAP_BASE;
+    // There's no reason a vaddr outside the heap would be mapped anywhere
+    // but the direct map, so this is either there or already a paddr.
+    return FromHighMem(vaddr);
 }
 
 void *KHeap::ToVAddr(void *paddr)
@@ -436,7 +509,7 @@ void *KHeap::ToVAddr(void *paddr)
 
 uintptr_t KHeap::ToVAddr(uintptr_t paddr)
 {
-    return paddr - heap_paddr_ + HEAP_BASE;
+    return paddr - heap_paddr_ + (uintptr_t) heap_;
 }
 
 void KHeap::SetSizeLimit(size_t max_heap_size)
@@ -444,61 +517,112 @@ void KHeap::SetSizeLimit(size_t max_heap_size)
     max_heap_size_ = max_heap_size;
 }
 
-void KHeap::Verify()
+bool KHeap::Verify()
 {
-    if (heap_ == top_) {
-        return;
+    if (! heap_) {
+        return true;
     }
-    FreeListEntry *chunk = (FreeListEntry *) heap_;
+
     FreeListEntry *prev = nullptr;
     size_t i = 0;
     size_t sum = 0;
-    do {
-        sum += (chunk->size_ & SIZE_MASK);
-        if ((uintptr_t) chunk > (uintptr_t) top_) {
-            Log("WARNING: SIZE GOES PAST TOP.\n");
-            Print();
-            return;
+    size_t num_free = 0;
+    for (FreeListEntry *chunk = (FreeListEntry *) heap_; chunk != top_;
+         chunk = NextChunk(chunk), ++i)
+    {
+        size_t size = chunk->size_ & SIZE_MASK;
+        if ((uintptr_t) chunk > (uintptr_t) top_ || size == 0) {
+            Log("CHUNK %d OF SIZE 0x%x GOES PAST TOP.\n", i, size);
+            return false;
         }
-        if (prev) {
-            if (chunk->prev_size_ != prev->size_) {
-                Log("CHUNK %d PREV SIZE IS 0x%x, SHOULD BE 0x%x.\n",
-                    i, chunk->prev_size_, prev->size_);
-                Print();
-                return;
-            }
+        if (chunk->prev_size_ != (prev ? prev->size_ : 0)) {
+            Log("CHUNK %d PREV SIZE IS 0x%x, SHOULD BE 0x%x.\n",
+                i, chunk->prev_size_, prev ? prev->size_ : 0);
+            return false;
         }
 
-        if (chunk->backward_ && chunk->backward_->forward_ &&
-            chunk->backward_->forward_ == chunk->backward_->forward_->forward_) {
-            Log("LOOP IN CHUNK %d\n", i);
-            Print();
-            return;
-        }
-        if (chunk->backward_ && chunk->forward_ &&
-            chunk->backward_->forward_ == chunk->backward_) {
-            Log("LOOP IN CHUNK %d\n", i);
-            Print();
-            return;
+        if (chunk->size_ & IN_USE) {
+            if (chunk->prev_ || chunk->next_) {
+                Log("CHUNK %d IS IN USE, BUT ON A FREE LIST.\n", i);
+                return false;
+            }
+        } else {
+            uint8_t bin = BinIndex(size);
+            if (prev && !(prev->size_ & IN_USE)) {
+                Log("CHUNK %d IS FREE, BUT WASN'T MERGED WITH CHUNK %d.\n",
+                    i, i - 1);
+                return false;
+            }
+            if (! free_lists_[bin].Contains(*chunk) ||
+                ! (free_lists_bitmap_ & (1ULL << bin)))
+            {
+                Log("CHUNK %d IS FREE, BUT NOT IN BIN %d.\n", i, bin);
+                return false;
+            }
+            ++num_free;
         }
 
+        sum += size;
         prev = chunk;
-        chunk = (FreeListEntry *)
-                ((uintptr_t) chunk + (chunk->size_ & SIZE_MASK));
-        ++i;
-    } while (chunk != top_);
+    }
 
-    if(top_->forward_ || top_->backward_) {
+    if (top_->prev_ || top_->next_) {
         Log("TOP ON FREE LIST\n");
-        while(1);
+        return false;
+    }
+    if (top_->prev_size_ != (prev ? prev->size_ : 0) ||
+        (prev && !(prev->size_ & IN_USE)))
+    {
+        Log("TOP CHUNK'S PREV SIZE IS WRONG, OR IT WASN'T MERGED.\n");
+        return false;
+    }
+
+    // Every chunk on a free list should have been found in the walk above.
+    size_t num_binned = 0;
+    for (size_t bin = 0; bin < NUM_BINS; ++bin) {
+        num_binned += free_lists_[bin].Size();
+        if (free_lists_[bin].Empty() == !!(free_lists_bitmap_ & (1ULL << bin))) {
+            Log("BITMAP DISAGREES WITH BIN %d.\n", bin);
+            return false;
+        }
+    }
+    if (num_binned != num_free) {
+        Log("%d CHUNKS ARE BINNED, BUT %d ARE FREE.\n", num_binned, num_free);
+        return false;
     }
 
     sum += top_->size_;
     if(sum != heap_size_) {
         Log("Sum of chunks (%d) differs from heap size (%d)\n",
             sum, heap_size_);
-        Print();
+        return false;
+    }
+    return true;
+}
+
+KHeap::Stats KHeap::GetStats()
+{
+    Stats stats = {heap_size_, 0, 0, 0};
+    if (! heap_) {
+        return stats;
+    }
+
+    for (FreeListEntry *chunk = (FreeListEntry *) heap_; chunk != top_;
+         chunk = NextChunk(chunk))
+    {
+        size_t size = chunk->size_ & SIZE_MASK;
+        if (chunk->size_ & IN_USE) {
+            stats.in_use_ += size;
+        } else {
+            stats.free_ += size;
+            stats.largest_free_ = size > stats.largest_free_ ?
+                                  size : stats.largest_free_;
+        }
     }
+    stats.free_ += top_->size_;
+    stats.largest_free_ = top_->size_ > stats.largest_free_ ?
+                          top_->size_ : stats.largest_free_;
+    return stats;
 }
 
 void *KernelAllocator::Allocate(size_t size)
@@ -3,17 +3,38 @@
 
 #include "buddy_allocator.h"
 #include "page_map.h"
+#include "libc/string.h"
 #include <cstdint>
-#include <cstdio>
-#include <cstdlib>
-#include <cstring>
 #include <stddef.h>
 
 namespace ds { class MemCache; }
 
 namespace KHeap {
+    // Where the heap is mapped, just past the direct map of physical memory.
+    const uintptr_t HEAP_BASE = KERNEL_DATA_BASE + KERN_DIRECT_MAP_SIZE;
+
+    /**
+     * A tally of the heap's chunks, headers included. Allocations large
+     * enough to come straight from the PMM aren't part of the heap.
+     */
+    struct Stats {
+        size_t heap_size_;
+        size_t in_use_;
+        // Free chunks, including the top chunk.
+        size_t free_;
+        size_t largest_free_;
+    };
+
+    /**
+     * @param initial_size Initial size of the heap, in bytes. It doubles as
+     *                     needed, up to max_heap_size.
+     * @param page_map The page map into which to map the heap.
+     * @param max_heap_size Size beyond which the heap won't grow.
+     * @param heap_base Virtual address at which to map the heap. Enough
+     *                  address space must be free there for max_heap_size.
+     */
     void Init(size_t initial_size, PageMap *page_map,
-              size_t max_heap_size=0x40000000);
+              size_t max_heap_size=0x40000000, uintptr_t heap_base=HEAP_BASE);
 
     void *Allocate(size_t size);
 
@@ -25,7 +46,18 @@ namespace KHeap {
 
     void SetSizeLimit(size_t max_heap_size);
 
-    void Verify();
+    /**
+     * Walk the heap, checking that chunk sizes add up, that free chunks are
+     * merged and binned, and that the bins hold nothing else. Logs the first
+     * discrepancy found.
+     * @return Whether the heap is consistent.
+     */
+    bool Verify();
+
+    /**
+     * Walk the heap, tallying its chunks. Takes time linear in their number.
+     */
+    Stats GetStats();
 
     void *ToPAddr(void *vaddr);
     uintptr_t ToPAddr(uintptr_t vaddr);
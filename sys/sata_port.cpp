@@ -1,9 +1,18 @@
 #include "sata_port.h"
 #include <libc/string.h>
 #include <sys/buddy_allocator.h>
+#include <sys/checksum.h>
 #include <sys/log.h>
 #include <sys/disk_mem.h>
 
+struct SATAPort::SectorSlab : ds::ListLink<> {
+    char bufs_[SLAB_SECTORS][SECTOR_SIZE];
+    CachedSector sectors_[SLAB_SECTORS];
+    // Free sectors in this slab, linked through next_free_.
+    CachedSector *free_;
+    size_t num_free_;
+};
+
 ds::DynArray<SATAPort*> EnumerateDevices(volatile void *hba_mmio_base)
 {
     // NOTE: At some point, I'll make a base class for all types of supported
@@ -46,9 +55,17 @@ SATAPort::SATAPort(volatile HBAMem* mem, volatile HBAPort* port)
     , num_slots_(NumberSlots())
     , slots_bitmap_(0)
     , ncq_tag_bitmap_(0)
-    , disk_cache_(&SATAPort::HandleEviction)
+    , disk_cache_(DiskCacheSectors(), &SATAPort::HandleEviction)
+    , num_dirty_(0)
+    , shrinker_({
+            .count_ = &SATAPort::CountCleanSectors,
+            .scan_ = &SATAPort::ShrinkCache,
+            .cache_ = this,
+            .next_ = nullptr
+      })
     , max_lba_(-1)
 {
+    ShrinkerRegistry::Register(&shrinker_);
     Log("Configuring\n");
     Configure();
     Log("ID Device\n");
@@ -68,8 +85,22 @@ SATAPort::SATAPort(SATAPort &&rhs) noexcept
     , num_slots_(rhs.num_slots_)
     , slots_bitmap_(rhs.slots_bitmap_)
     , ncq_tag_bitmap_(rhs.ncq_tag_bitmap_)
+    , disk_cache_(DiskCacheSectors(), &SATAPort::HandleEviction)
+    , num_dirty_(0)
+    , shrinker_({
+            .count_ = &SATAPort::CountCleanSectors,
+            .scan_ = &SATAPort::ShrinkCache,
+            .cache_ = this,
+            .next_ = nullptr
+      })
     , max_lba_(rhs.max_lba_)
 {
+    // Cached sectors write themselves back through the port that cached
+    // them, so they must go while rhs can still reach the disk.
+    rhs.Sync();
+    rhs.disk_cache_.Flush();
+    rhs.ReleaseFreeSlabs();
+    ShrinkerRegistry::Register(&shrinker_);
     rhs.mem_ = nullptr;
     rhs.port_ = nullptr;
     rhs.cmd_header_ = nullptr;
@@ -84,6 +115,12 @@ SATAPort &SATAPort::operator =(SATAPort &&rhs) noexcept
         return *this;
     }
 
+    Sync();
+    disk_cache_.Flush();
+    ReleaseFreeSlabs();
+    rhs.Sync();
+    rhs.disk_cache_.Flush();
+    rhs.ReleaseFreeSlabs();
     SuspendCommands();
     rhs.SuspendCommands();
 
@@ -119,7 +156,10 @@ SATAPort &SATAPort::operator =(SATAPort &&rhs) noexcept
 
 SATAPort::~SATAPort()
 {
+    ShrinkerRegistry::Unregister(&shrinker_);
+    Sync();
     disk_cache_.Flush();
+    ReleaseFreeSlabs();
     SuspendCommands();
     for(uint8_t i = 0; i < num_slots_; ++i) {
         uintptr_t paddr = cmd_header_[i].cmd_tab_addr_lo_;
@@ -131,7 +171,6 @@ SATAPort::~SATAPort()
 
     KHeap::Free(gpt_.hdr_);
     KHeap::Free(gpt_.entries_);
-
 }
 
 void SATAPort::ActivateCommands()
@@ -259,24 +298,32 @@ bool SATAPort::RangeReadWrite(const ds::DynArray<DiskRange> &ranges, void *buff,
             }
 
             uint32_t used_slot_bmap = 0;
-            for (int i = 0; i < open_slots.Size(); ++i, ++range_ind) {
-                SetupReadWrite(open_slots[i], ranges[i].start_lba_,
-                               ranges[i].len_, buff_ptr, write, 0, true);
+            bool mapped = true;
+            for (int i = 0; i < open_slots.Size() && mapped; ++i, ++range_ind) {
+                mapped = SetupReadWrite(open_slots[i], ranges[i].start_lba_,
+                                        ranges[i].len_, buff_ptr, write, 0,
+                                        true);
                 used_slot_bmap |= (1 << i);
                 buff_ptr += ranges[i].len_ * SECTOR_SIZE;
             }
 
+            bool failed = ! mapped;
+            if(mapped) {
+                while(IsBusy());
+                ActivateCommands();
 
-            while(IsBusy());
-            ActivateCommands();
-
-            port_->sata_active_ = used_slot_bmap;
-            port_->cmd_issue_ = used_slot_bmap;
+                port_->sata_active_ = used_slot_bmap;
+                port_->cmd_issue_ = used_slot_bmap;
 
+                while((port_->sata_active_ & used_slot_bmap) && ! OpFailed());
+                failed = OpFailed();
+            }
 
-            while((port_->sata_active_ & used_slot_bmap) && ! OpFailed());
+            for (size_t i = 0; i < open_slots.Size(); ++i) {
+                slot_dma_[open_slots[i]].Unmap();
+            }
 
-            if(OpFailed()) {
+            if(failed) {
                 Log("Op failed");
                 SuspendCommands();
                 return false;
@@ -299,7 +346,7 @@ bool SATAPort::RangeReadWrite(const ds::DynArray<DiskRange> &ranges, void *buff,
     return true;
 }
 
-ds::Optional<uint64_t> SATAPort::GetDiskCapacity()
+ds::Optional<uint64_t> SATAPort::GetMaxLBA()
 {
     if(max_lba_ != -1) {
         return max_lba_;
@@ -332,16 +379,18 @@ ds::Optional<uint64_t> SATAPort::GetDiskCapacity()
         return ds::NullOpt;
     }
 
-    auto max_disk_sectors = (uint64_t) received_fis_->reg_fis_.lba0;
-    max_disk_sectors |= ((uint64_t) received_fis_->reg_fis_.lba1 << 8);
-    max_disk_sectors |= ((uint64_t) received_fis_->reg_fis_.lba2 << 16);
-    max_disk_sectors |= ((uint64_t) received_fis_->reg_fis_.lba3 << 24);
-    max_disk_sectors |= ((uint64_t) received_fis_->reg_fis_.lba4 << 32);
-    max_disk_sectors |= ((uint64_t) received_fis_->reg_fis_.lba5 << 40);
+    // READ NATIVE MAX ADDRESS EXT returns the last LBA, not a count.
+    auto max_lba = (uint64_t) received_fis_->reg_fis_.lba0;
+    max_lba |= ((uint64_t) received_fis_->reg_fis_.lba1 << 8);
+    max_lba |= ((uint64_t) received_fis_->reg_fis_.lba2 << 16);
+    max_lba |= ((uint64_t) received_fis_->reg_fis_.lba3 << 24);
+    max_lba |= ((uint64_t) received_fis_->reg_fis_.lba4 << 32);
+    max_lba |= ((uint64_t) received_fis_->reg_fis_.lba5 << 40);
 
     slots_bitmap_ |= (1 << free_slot);
     SuspendCommands();
-    return max_disk_sectors;
+    max_lba_ = (int64_t) max_lba;
+    return max_lba;
 }
 
 bool SATAPort::IsBusy() const
@@ -379,16 +428,27 @@ bool SATAPort::IdentifyDevice()
     fis->cmd_ctrl_ = 1;
     fis->command_ = IDENTIFY_DEVICE;
 
+    // Identify device always returns a 512-byte struct, so the mapping is a
+    // single segment unless it had to bounce.
+    DMA::Mapping &mapping = slot_dma_[free_slot];
+    if(! mapping.Map(dev_info_, SECTOR_SIZE, DMA::FROM_DEVICE,
+                     DMAConstraints()))
+    {
+        Log("Unable to map device info for DMA\n");
+        slots_bitmap_ |= (1 << free_slot);
+        return false;
+    }
+
     header->cmd_fis_len_ = sizeof(DeviceToHostRegisterFIS) / 4;
     header->write_ = 0;
-    header->no_prdt_entries_ = 1;
+    header->no_prdt_entries_ = mapping.NumSegments();
 
-    // Identify device always returns a 512-byte struct, so only one PRDT
-    // is needed.
-    uintptr_t buff_paddr = KHeap::ToPAddr((uintptr_t) dev_info_);
-    tab->prdt_entries[0].data_addr_lo_ = (uint32_t) (buff_paddr);
-    tab->prdt_entries[0].data_addr_hi_ = (uint32_t) (buff_paddr >> 32);
-    tab->prdt_entries[0].byte_count_ = 511;
+    for(uint16_t i = 0; i < mapping.NumSegments(); ++i) {
+        DMA::Segment segment = mapping[i];
+        tab->prdt_entries[i].data_addr_lo_ = (uint32_t) (segment.paddr_);
+        tab->prdt_entries[i].data_addr_hi_ = (uint32_t) (segment.paddr_ >> 32);
+        tab->prdt_entries[i].byte_count_ = segment.len_ - 1;
+    }
 
     while (IsBusy());
     ActivateCommands();
@@ -397,18 +457,23 @@ bool SATAPort::IdentifyDevice()
     while(OpInProgress(free_slot) && ! OpFailed());
 
     bool ret = ! OpFailed();
+    mapping.Unmap();
     slots_bitmap_ |= (1 << free_slot);
     SuspendCommands();
     Log("WORD 75 IS 0x%x\n", dev_info_[75]);
     Log("MAX SIZE OF DISK IS 0x%x\n", *((uint64_t*)&dev_info_[100]));
-    max_lba_ = (int64_t) *((uint64_t*)&dev_info_[100]);
+    // Words 100-103 count the addressable sectors; the last is one less.
+    uint64_t num_sectors = *((uint64_t*)&dev_info_[100]);
+    if(ret && num_sectors) {
+        max_lba_ = (int64_t) (num_sectors - 1);
+    }
     return ret;
 }
 
 bool SATAPort::CacheReadWrite(uint64_t disk_addr, size_t num_sectors, void *buff,
                               bool write, uint8_t prio)
 {
-    uintptr_t buff_paddr = KHeap::ToPAddr((uintptr_t) buff);
+    auto buff_ptr = (char*) buff;
     ds::Optional<CachedSector*> cached_block;
     for(size_t i = 0; i < num_sectors; ++i) {
         // Iterate through blocks until we find one that has been cached.
@@ -423,39 +488,48 @@ bool SATAPort::CacheReadWrite(uint64_t disk_addr, size_t num_sectors, void *buff
         // If there are uncached blocks and this is a read, read from the disk.
         // If it's a write, just write to the cache and it'll get written back
         // eventually.
-        uintptr_t uncached_dma_base = SECTOR_SIZE * first_uncached + buff_paddr;
+        char *uncached_base = buff_ptr + SECTOR_SIZE * first_uncached;
         if(num_uncached && ! write) {
             bool ret = DiskReadWrite(disk_addr + first_uncached, num_uncached,
-                                     (void*) uncached_dma_base, false, prio);
+                                     uncached_base, false, prio);
             if(! ret) {
                 return false;
             }
         }
 
+        // Deal with the cached block first, since caching the uncached ones
+        // may evict it.
+        char *cached_base = buff_ptr + SECTOR_SIZE * i;
+        if(cached_block) {
+            if(write) {
+                memcpy((*cached_block)->sector_, cached_base, SECTOR_SIZE);
+                MarkDirty(disk_addr + i, *cached_block);
+            } else {
+                memcpy(cached_base, (*cached_block)->sector_, SECTOR_SIZE);
+            }
+        }
+
         // For each uncached block, read it into cache and alter its contents
         // there. This will eventually be written back to the disk.
         for(size_t j = 0; j < num_uncached; ++j) {
-            void *cache_entry = KHeap::Allocate(SECTOR_SIZE);
-            memcpy(cache_entry, (void*) (uncached_dma_base + j * SECTOR_SIZE),
+            CachedSector *cached_sector = AllocCachedSector();
+            if(! cached_sector) {
+                // Without a cache, writes go straight to the disk.
+                if(write && ! DiskReadWrite(disk_addr + first_uncached + j,
+                                            num_uncached - j,
+                                            uncached_base + j * SECTOR_SIZE,
+                                            true, prio))
+                {
+                    return false;
+                }
+                break;
+            }
+            memcpy(cached_sector->sector_, uncached_base + j * SECTOR_SIZE,
                    SECTOR_SIZE);
-            auto cached_sector = new CachedSector {
-                .sector_ = cache_entry,
-                .dirty_ = write,
-                .disk_ = this
-            };
-
+            cached_sector->dirty_ = false;
             disk_cache_.Insert(disk_addr + first_uncached + j, cached_sector);
-        }
-
-        uintptr_t cached_dma_base = SECTOR_SIZE * i + buff_paddr;
-        if(cached_block) {
             if(write) {
-                (*cached_block)->dirty_ = true;
-                memcpy((*cached_block)->sector_, (void*) cached_dma_base,
-                       SECTOR_SIZE);
-            } else {
-                memcpy((void*) cached_dma_base, (*cached_block)->sector_,
-                       SECTOR_SIZE);
+                MarkDirty(disk_addr + first_uncached + j, cached_sector);
             }
         }
     }
@@ -465,17 +539,21 @@ bool SATAPort::CacheReadWrite(uint64_t disk_addr, size_t num_sectors, void *buff
 bool SATAPort::DiskReadWrite(uint64_t disk_addr, size_t num_sectors, void *buff,
                              bool write, uint8_t priority)
 {
-    size_t capacity = GetDiskCapacity();
-    if(disk_addr > max_lba_) {
-        Log("disk_addr 0x%x exceeds disk capacity 0x%x\n", disk_addr, capacity);
+    ds::Optional<uint64_t> max_lba = GetMaxLBA();
+    if(max_lba && disk_addr > *max_lba) {
+        Log("disk_addr 0x%x exceeds max LBA 0x%x\n", disk_addr, *max_lba);
         return false;
     }
 
     uint8_t free_slot;
     bool use_ncq = NCQCapable();
     do { free_slot = FirstFreeSlot(); } while(free_slot > NumberSlots());
-    SetupReadWrite(free_slot, disk_addr, num_sectors, buff, write, priority,
-                   use_ncq);
+    if(! SetupReadWrite(free_slot, disk_addr, num_sectors, buff, write,
+                        priority, use_ncq))
+    {
+        Log("Unable to map 0x%x sectors for DMA\n", num_sectors);
+        return false;
+    }
 
     while (IsBusy());
     ActivateCommands();
@@ -489,6 +567,7 @@ bool SATAPort::DiskReadWrite(uint64_t disk_addr, size_t num_sectors, void *buff,
         Log("Op failed\n");
         status = false;
     }
+    slot_dma_[free_slot].Unmap();
     slots_bitmap_ |= (1 << free_slot);
 
     SuspendCommands();
@@ -496,35 +575,38 @@ bool SATAPort::DiskReadWrite(uint64_t disk_addr, size_t num_sectors, void *buff,
 }
 
 
-void SATAPort::SetupReadWrite(uint8_t free_slot, uint64_t disk_addr,
+bool SATAPort::SetupReadWrite(uint8_t free_slot, uint64_t disk_addr,
                               size_t num_sectors, void *buff, bool write,
                               uint8_t priority, bool use_ncq)
 {
     volatile HBACmd *header = &cmd_header_[free_slot];
     volatile HBACmdTable *tab = SlotToCmdTab(free_slot);
 
+    // The buffer need not be physically contiguous (or even reachable by the
+    // HBA); the mapping describes it as one PRDT per physical segment, or
+    // bounces it if that isn't possible.
+    DMA::Mapping &mapping = slot_dma_[free_slot];
+    DMA::direction_t direction = write ? DMA::TO_DEVICE : DMA::FROM_DEVICE;
+    if(! mapping.Map(buff, num_sectors * SECTOR_SIZE, direction,
+                     DMAConstraints()))
+    {
+        return false;
+    }
+
     // Clear out any remaining config info from last use of this table.
     memset((void*) tab, 0, sizeof(HBACmdTable));
 
 
     header->cmd_fis_len_ = sizeof(DeviceToHostRegisterFIS) / 4;
     header->write_ = write;
-    header->no_prdt_entries_ = ((num_sectors - 1) / SECTORS_PER_PRDT) + 1;
-
-    uintptr_t buff_paddr = KHeap::ToPAddr((uintptr_t) buff);
-    size_t rem_bytes = num_sectors * SECTOR_SIZE;
+    header->no_prdt_entries_ = mapping.NumSegments();
 
-    for(uint16_t i = 0; i < header->no_prdt_entries_ && rem_bytes > 0; ++i) {
-        uintptr_t dma_base = KHeap::ToPAddr(buff_paddr + i * PRDT_SIZE);
-        size_t bytes = (rem_bytes < PRDT_SIZE) ? rem_bytes : PRDT_SIZE;
-        rem_bytes -= bytes;
-
-        tab->prdt_entries[i].data_addr_lo_ = (uint32_t) (dma_base);
-        tab->prdt_entries[i].data_addr_hi_ = (uint32_t) (dma_base >> 32);
-        tab->prdt_entries[i].byte_count_ = bytes - 1;
+    for(uint16_t i = 0; i < mapping.NumSegments(); ++i) {
+        DMA::Segment segment = mapping[i];
+        tab->prdt_entries[i].data_addr_lo_ = (uint32_t) (segment.paddr_);
+        tab->prdt_entries[i].data_addr_hi_ = (uint32_t) (segment.paddr_ >> 32);
+        tab->prdt_entries[i].byte_count_ = segment.len_ - 1;
         tab->prdt_entries[i].interrupt_ = 1;
-
-        //Log("Reading 0x%x bytes into 0x%x\n", bytes, dma_base);
     }
 
     auto fis = (HostToDevRegisterFIS*) &tab->cmd_fis_;
@@ -550,6 +632,21 @@ void SATAPort::SetupReadWrite(uint8_t free_slot, uint64_t disk_addr,
         fis->count_lo_ = (uint8_t) (num_sectors);
         fis->count_hi_ = (uint8_t) (num_sectors >> 8);
     }
+
+    return true;
+}
+
+DMA::Constraints SATAPort::DMAConstraints() const
+{
+    // PRDT data base addresses must be word-aligned and byte counts even
+    // (AHCI 1.3.1, 4.2.3.3); HBAs without S64A only see 32-bit addresses.
+    bool addr_64bit = mem_->capability_ & ADDR_64BIT_CAPABLE;
+    return {
+        .max_segments_ = num_prdts_,
+        .max_segment_len_ = PRDT_SIZE,
+        .alignment_ = 2,
+        .addr_limit_ = addr_64bit ? ~(uintptr_t) 0 : 0xFFFFFFFF
+    };
 }
 
 
@@ -602,14 +699,158 @@ bool SATAPort::NCQCapable() const
 
 void SATAPort::HandleEviction(uint64_t sector_no, CachedSector *cache_entry)
 {
+    SATAPort *disk = cache_entry->disk_;
     if(cache_entry->dirty_) {
-        cache_entry->disk_->DiskReadWrite(sector_no, 1, cache_entry->sector_,
-                                         true);
+        disk->DiskReadWrite(sector_no, 1, cache_entry->sector_, true);
+        disk->dirty_sectors_.Erase(sector_no);
+        cache_entry->dirty_ = false;
+        --disk->num_dirty_;
+    }
+
+    disk->FreeCachedSector(cache_entry);
+}
+
+size_t SATAPort::DiskCacheSectors()
+{
+    size_t sectors = BuddyAllocator::TotalMem() / DISK_CACHE_SHARE /
+                     SECTOR_SIZE;
+    return sectors > DISK_CACHE_MIN ? sectors : DISK_CACHE_MIN;
+}
+
+size_t SATAPort::CountCleanSectors(void *port)
+{
+    auto disk = (SATAPort*) port;
+    return disk->disk_cache_.NumEntries() - disk->num_dirty_;
+}
+
+size_t SATAPort::ShrinkCache(void *port, size_t num_sectors)
+{
+    // The cache's policy picks the victims, so a dirty one is written back on
+    // its way out.
+    auto disk = (SATAPort*) port;
+    size_t evicted = disk->disk_cache_.Evict(num_sectors);
+    disk->ReleaseFreeSlabs();
+    return evicted;
+}
+
+void SATAPort::MarkDirty(uint64_t sector_no, CachedSector *sector)
+{
+    if(sector->dirty_) {
+        return;
     }
 
-    KHeap::Free(cache_entry->sector_);
-    delete cache_entry;
+    if(dirty_sectors_.Store(sector_no, sector)) {
+        sector->dirty_ = true;
+        ++num_dirty_;
+    } else {
+        DiskReadWrite(sector_no, 1, sector->sector_, true);
+    }
 }
+
+bool SATAPort::Sync()
+{
+    auto buff = (char*) KHeap::Allocate(MAX_WRITEBACK_SECTORS * SECTOR_SIZE);
+    if(! buff) {
+        return false;
+    }
+
+    bool ret = true;
+    uint64_t run_start = 0;
+    while(CachedSector *sector = dirty_sectors_.Find(run_start)) {
+        // Gather the run of consecutive dirty sectors starting here.
+        size_t run_len = 0;
+        do {
+            memcpy(buff + run_len * SECTOR_SIZE, sector->sector_, SECTOR_SIZE);
+            ++run_len;
+        } while(run_len < MAX_WRITEBACK_SECTORS &&
+                (sector = dirty_sectors_.Load(run_start + run_len)));
+
+        if(DiskReadWrite(run_start, run_len, buff, true)) {
+            for(size_t i = 0; i < run_len; ++i) {
+                dirty_sectors_.Erase(run_start + i)->dirty_ = false;
+            }
+            num_dirty_ -= run_len;
+        } else {
+            ret = false;
+        }
+        run_start += run_len;
+    }
+
+    KHeap::Free(buff);
+    return ret;
+}
+
+SATAPort::CachedSector *SATAPort::AllocCachedSector()
+{
+    if(partial_slabs_.Empty() &&
+       (disk_cache_.NumEntries() >= disk_cache_.Capacity() || ! AddSlab()))
+    {
+        disk_cache_.Evict(1);
+    }
+    if(partial_slabs_.Empty()) {
+        return nullptr;
+    }
+
+    SectorSlab *slab = partial_slabs_.Front();
+    CachedSector *cached_sector = slab->free_;
+    slab->free_ = cached_sector->next_free_;
+    if(! --slab->num_free_) {
+        partial_slabs_.Remove(*slab);
+        full_slabs_.PushFront(*slab);
+    }
+    return cached_sector;
+}
+
+void SATAPort::FreeCachedSector(CachedSector *sector)
+{
+    SectorSlab *slab = sector->slab_;
+    sector->next_free_ = slab->free_;
+    slab->free_ = sector;
+    if(! slab->num_free_++) {
+        // It's the busiest of the partial slabs, so allocate from it first,
+        // leaving emptier slabs to drain for the shrinker.
+        full_slabs_.Remove(*slab);
+        partial_slabs_.PushFront(*slab);
+    }
+}
+
+bool SATAPort::AddSlab()
+{
+    auto slab = (SectorSlab*) KHeap::Allocate(sizeof(SectorSlab));
+    if(! slab) {
+        return false;
+    }
+
+    slab->prev_ = slab->next_ = nullptr;
+    slab->free_ = nullptr;
+    slab->num_free_ = SLAB_SECTORS;
+    for(size_t i = 0; i < SLAB_SECTORS; ++i) {
+        slab->sectors_[i] = {
+            .sector_ = slab->bufs_[i],
+            .dirty_ = false,
+            .disk_ = this,
+            .slab_ = slab,
+            .next_free_ = slab->free_
+        };
+        slab->free_ = &slab->sectors_[i];
+    }
+    partial_slabs_.PushBack(*slab);
+    return true;
+}
+
+void SATAPort::ReleaseFreeSlabs()
+{
+    SectorSlab *slab = partial_slabs_.Front();
+    while(slab) {
+        SectorSlab *next = partial_slabs_.Next(*slab);
+        if(slab->num_free_ == SLAB_SECTORS) {
+            partial_slabs_.Remove(*slab);
+            KHeap::Free(slab);
+        }
+        slab = next;
+    }
+}
+
 ds::Optional<GPTEntry> SATAPort::GetNthPartition(size_t n)
 {
     if (n < gpt_.hdr_->num_part_entries_) {
@@ -654,20 +895,90 @@ SATAPort::GetPartitionRanges(const GPTEntry &part)
 
 ds::Optional<SATAPort::GPTHeaderAndEntries> SATAPort::ReadGPT()
 {
-    void *lba1 = Read(1, 1);
-    auto gpt_hdr = (GPTHeader*) lba1;
-    if(gpt_hdr->signature_ != GPT_MAGIC) {
-        KHeap::Free(lba1);
-        return ds::NullOpt;
+    uint64_t backup_lba = 0;
+    if(GPTHeader *hdr = ReadGPTHeader(PRIMARY_GPT_LBA)) {
+        if(char *entries = ReadGPTEntries(*hdr)) {
+            return (GPTHeaderAndEntries) {
+                    .hdr_ = hdr,
+                    .entries_ = entries
+            };
+        }
+        backup_lba = hdr->alt_header_lba_;
+        KHeap::Free(hdr);
+    } else if(ds::Optional<uint64_t> max_lba = GetMaxLBA()) {
+        // With no primary header to say where the backup is, it's in the
+        // last sector.
+        backup_lba = *max_lba;
     }
 
-    ds::DynArray<DiskRange> ranges;
-    size_t arr_size = gpt_hdr->num_part_entries_ * gpt_hdr->entry_size_;
-    size_t no_sectors = arr_size / SECTOR_SIZE + (arr_size % SECTOR_SIZE > 0);
-    void *entry_arr = Read(gpt_hdr->entry_arr_lba_, no_sectors);
+    if(backup_lba <= PRIMARY_GPT_LBA) {
+        return ds::NullOpt;
+    }
+    Log("[WARNING] Primary GPT is corrupt; using the backup at LBA 0x%x.\n",
+        backup_lba);
+    GPTHeader *hdr = ReadGPTHeader(backup_lba);
+    if(! hdr) {
+        return ds::NullOpt;
+    }
+    char *entries = ReadGPTEntries(*hdr);
+    if(! entries) {
+        KHeap::Free(hdr);
+        return ds::NullOpt;
+    }
 
     return (GPTHeaderAndEntries) {
-            .hdr_ = (GPTHeader*) lba1,
-            .entries_ = (char*) entry_arr
+            .hdr_ = hdr,
+            .entries_ = entries
     };
 }
+
+GPTHeader *SATAPort::ReadGPTHeader(uint64_t lba)
+{
+    auto *hdr = (GPTHeader*) Read(lba, 1);
+    if(! hdr) {
+        return nullptr;
+    }
+
+    bool valid = hdr->signature_ == GPT_MAGIC &&
+                 hdr->header_size_ >= GPT_HEADER_SIZE &&
+                 hdr->header_size_ <= SECTOR_SIZE &&
+                 hdr->header_lba_ == lba;
+    if(valid) {
+        // The CRC covers the header with the CRC itself zeroed.
+        uint32_t checksum = hdr->header_checksum_;
+        hdr->header_checksum_ = 0;
+        valid = Checksum::Crc32(hdr, hdr->header_size_) == checksum;
+        hdr->header_checksum_ = checksum;
+    }
+
+    if(! valid) {
+        Log("[WARNING] Invalid GPT header at LBA 0x%x.\n", lba);
+        KHeap::Free(hdr);
+        return nullptr;
+    }
+    return hdr;
+}
+
+char *SATAPort::ReadGPTEntries(const GPTHeader &hdr)
+{
+    size_t arr_size = (size_t) hdr.num_part_entries_ * hdr.entry_size_;
+    if(hdr.entry_size_ < GPT_MIN_ENTRY_SIZE || hdr.entry_size_ % 8 ||
+       arr_size > GPT_MAX_ENTRIES_SIZE)
+    {
+        Log("[WARNING] Invalid GPT entry array of %d entries of %d bytes.\n",
+            hdr.num_part_entries_, hdr.entry_size_);
+        return nullptr;
+    }
+
+    size_t no_sectors = arr_size / SECTOR_SIZE + (arr_size % SECTOR_SIZE > 0);
+    auto *entries = (char*) Read(hdr.entry_arr_lba_, no_sectors);
+    if(entries &&
+       Checksum::Crc32(entries, arr_size) != hdr.part_arr_checksum_)
+    {
+        Log("[WARNING] GPT entry array at LBA 0x%x fails its CRC.\n",
+            hdr.entry_arr_lba_);
+        KHeap::Free(entries);
+        return nullptr;
+    }
+    return entries;
+}
@@ -2,9 +2,13 @@
 #define AHCI_DISK_H
 
 #include <sys/kheap.h>
+#include <sys/dma.h>
 #include <ds/dyn_array.h>
 #include <ds/owning_ptr.h>
 #include <ds/cache.h>
+#include <ds/radix_tree.h>
+#include <ds/intrusive_list.h>
+#include <sys/shrinker.h>
 
 constexpr uint64_t GPT_MAGIC = 0x5452415020494645;
 constexpr uint64_t ESP_GUID_LO = 0x11d2f81fc12a7328;
@@ -267,7 +271,18 @@ public:
 
     bool Write(const ds::DynArray<DiskRange> &ranges, void *buff);
 
-    ds::Optional<uint64_t> GetDiskCapacity();
+    /**
+     * Write every dirty cached sector back to the disk, in LBA order, with
+     * runs of consecutive sectors coalesced into a single command each.
+     * @return Did every write succeed? Sectors that failed stay dirty.
+     */
+    bool Sync();
+
+    /**
+     * @return The highest addressable LBA, i.e. one less than the number of
+     *         sectors, or NullOpt if the disk won't say.
+     */
+    ds::Optional<uint64_t> GetMaxLBA();
 
     bool IsBusy() const;
 
@@ -294,12 +309,39 @@ private:
     // NCQ tag must not exceed value in bits 0:4 of word 75 of ID Dev info.
     // Hence, 32-bit bitmap can store all possible vals.
     uint32_t ncq_tag_bitmap_;
+    struct SectorSlab;
     struct CachedSector {
         void *sector_;
         bool dirty_;
         SATAPort *disk_;
+        SectorSlab *slab_;
+        // The next free sector in the same slab, while this one is free.
+        CachedSector *next_free_;
     };
-    ds::LRUCache<uint64_t, CachedSector*> disk_cache_;
+    // The cache may grow to 1/DISK_CACHE_SHARE of RAM, but never less than
+    // DISK_CACHE_MIN sectors. Sectors and their buffers come from slabs that
+    // are allocated as the cache grows, and handed back by the shrinker once
+    // memory runs low and every sector in a slab has been evicted.
+    static constexpr size_t DISK_CACHE_SHARE = 64;
+    static constexpr size_t DISK_CACHE_MIN = 256;
+    // Sectors per slab, making for 32 KiB of buffers.
+    static constexpr size_t SLAB_SECTORS = 64;
+    // 2Q, so that streaming through a large file doesn't flush out the
+    // metadata sectors read over and over.
+    ds::FixedCache<uint64_t, CachedSector*, ds::TwoQPolicy> disk_cache_;
+    // Slabs with a free sector, busiest first, and slabs without one.
+    ds::IntrusiveList<SectorSlab> partial_slabs_, full_slabs_;
+    // Cached sectors awaiting writeback; the rest the shrinker may evict
+    // without touching the disk.
+    size_t num_dirty_;
+    Shrinker shrinker_;
+    // The dirty subset of the cache, by LBA, so writeback can find runs of
+    // consecutive dirty sectors without going through the whole cache.
+    ds::RadixTree<CachedSector> dirty_sectors_;
+    // Longest run Sync() writes with one command.
+    static constexpr size_t MAX_WRITEBACK_SECTORS = 128;
+    // Scatter list of the transfer in flight on each command slot.
+    DMA::Mapping slot_dma_[32];
     int64_t max_lba_;
     size_t padded_cmd_tab_size_;
 
@@ -310,11 +352,20 @@ private:
 
     static constexpr size_t num_prdts_ = 8;
     static constexpr size_t SECTOR_SIZE = 512;
+    static constexpr uint64_t PRIMARY_GPT_LBA = 1;
+    // The size of a GPT header as of revision 1.0; later revisions may
+    // extend it, up to a sector.
+    static constexpr uint32_t GPT_HEADER_SIZE = 92;
+    static constexpr uint32_t GPT_MIN_ENTRY_SIZE = 128;
+    // A bound on the partition entry array, far beyond the 16 KiB usual, so
+    // that a bad header can't have us read the whole disk.
+    static constexpr size_t GPT_MAX_ENTRIES_SIZE = 1024 * 1024;
     static constexpr size_t PRDT_SIZE = 4 * 1024 * 1024;
     static constexpr size_t SECTORS_PER_PRDT = PRDT_SIZE / SECTOR_SIZE;
     static constexpr uint32_t LBA_MODE = 1 << 6;
     static constexpr uint32_t DISK_ERR = (1 << 30);
     static constexpr uint32_t NCQ_CAPABLE = (1 << 30);
+    static constexpr uint32_t ADDR_64BIT_CAPABLE = (1u << 31);
     static constexpr uint8_t STATUS_ERR = 1;
     static constexpr uint8_t DMA_READ = 0x25;
     static constexpr uint8_t DMA_WRITE = 0x35;
@@ -358,16 +409,92 @@ private:
 
     bool NCQCapable() const;
 
-    void SetupReadWrite(uint8_t slot, uint64_t lba, size_t sectors,
+    /**
+     * Map a buffer for DMA and program a command slot to transfer it.
+     *
+     * @param slot The command slot to use. Its DMA mapping stays live until
+     *             the caller unmaps it after the command completes.
+     * @param lba The first sector to transfer.
+     * @param sectors The number of sectors to transfer.
+     * @param buff Any kernel virtual buffer.
+     * @param write Is this a write or a read?
+     * @return Could the buffer be mapped for DMA?
+     */
+    bool SetupReadWrite(uint8_t slot, uint64_t lba, size_t sectors,
                         void *buff, bool write, uint8_t priority=0b00,
                         bool ncq=false);
 
+    /**
+     * @return The limits the HBA imposes on a command's scatter list.
+     */
+    DMA::Constraints DMAConstraints() const;
+
     bool RangeReadWrite(const ds::DynArray<DiskRange> &ranges, void *buff,
                         bool write);
 
     static void HandleEviction(uint64_t sector_no, CachedSector *cache_entry);
 
+    static size_t DiskCacheSectors();
+
+    static size_t CountCleanSectors(void *port);
+
+    /**
+     * Evict sectors from the cache, then free every slab left unused.
+     * @return How many sectors were evicted.
+     */
+    static size_t ShrinkCache(void *port, size_t num_sectors);
+
+    /**
+     * Take a free sector buffer for the cache, from a new slab while the
+     * cache is below capacity, or else by evicting a sector.
+     * @return The sector, or nullptr if the cache is empty and no slab could
+     *         be allocated.
+     */
+    CachedSector *AllocCachedSector();
+
+    /**
+     * Hand an evicted sector back to its slab.
+     */
+    void FreeCachedSector(CachedSector *sector);
+
+    /**
+     * Allocate a slab of free sectors and add it to partial_slabs_.
+     * @return Did allocation succeed?
+     */
+    bool AddSlab();
+
+    /**
+     * Free every slab none of whose sectors are cached.
+     */
+    void ReleaseFreeSlabs();
+
+    /**
+     * Flag a cached sector as modified. If it can't be indexed for
+     * writeback, it's written through straight away instead.
+     */
+    void MarkDirty(uint64_t sector_no, CachedSector *sector);
+
+    /**
+     * Read the partition table, from the primary GPT if it's intact, or else
+     * from the backup at the end of the disk.
+     */
     ds::Optional<GPTHeaderAndEntries> ReadGPT();
+
+    /**
+     * Read a GPT header, checking its signature, size, location and CRC.
+     * @param lba The sector the header should be in.
+     * @return The header, to be freed with KHeap::Free, or nullptr if it's
+     *         missing or corrupt.
+     */
+    GPTHeader *ReadGPTHeader(uint64_t lba);
+
+    /**
+     * Read the partition entry array a GPT header describes, checking it
+     * against the header's CRC.
+     * @return The entries, to be freed with KHeap::Free, or nullptr if
+     *         they're corrupt.
+     */
+    char *ReadGPTEntries(const GPTHeader &hdr);
 };
 
 #endif
@@ -0,0 +1,110 @@
+#include "shrinker.h"
+#include "sys/buddy_allocator.h"
+
+namespace ShrinkerRegistry {
+namespace {
+// Caches are shrunk once free memory drops below 1/LOW_WATERMARK of the
+// total.
+const size_t LOW_WATERMARK = 8;
+// Under pressure, Balance trims 1 / 2^BALANCE_PRIORITY of each cache for
+// every 1/BALANCE_STRIDE of total memory allocated.
+const unsigned BALANCE_PRIORITY = 3;
+const size_t BALANCE_STRIDE = 64;
+// Reclaim starts by asking for 1 / 2^RECLAIM_PRIORITY of each cache, and
+// doubles that until something is freed.
+const unsigned RECLAIM_PRIORITY = 4;
+
+Shrinker *shrinkers_;
+// Memory in use when Balance last shrank, so that it doesn't shrink again
+// until more has been allocated.
+size_t balanced_at_;
+// Shrinkers may allocate, e.g. to write back dirty data, which must not
+// recurse into another round of shrinking.
+bool shrinking_;
+// Depth of SuspendReclaim calls.
+unsigned suspended_;
+}
+}
+
+void ShrinkerRegistry::Register(Shrinker *shrinker)
+{
+    shrinker->next_ = shrinkers_;
+    shrinkers_ = shrinker;
+}
+
+void ShrinkerRegistry::Unregister(Shrinker *shrinker)
+{
+    for(Shrinker **link = &shrinkers_; *link; link = &(*link)->next_) {
+        if(*link == shrinker) {
+            *link = shrinker->next_;
+            shrinker->next_ = nullptr;
+            return;
+        }
+    }
+}
+
+bool ShrinkerRegistry::UnderPressure()
+{
+    return BuddyAllocator::MemFree() <
+           BuddyAllocator::TotalMem() / LOW_WATERMARK;
+}
+
+size_t ShrinkerRegistry::Shrink(unsigned priority)
+{
+    if(shrinking_ || suspended_) {
+        return 0;
+    }
+
+    shrinking_ = true;
+    size_t freed = 0;
+    for(Shrinker *shrinker = shrinkers_; shrinker; shrinker = shrinker->next_)
+    {
+        size_t count = shrinker->count_(shrinker->cache_);
+        if(! count) {
+            continue;
+        }
+
+        size_t num_objs = count >> priority;
+        freed += shrinker->scan_(shrinker->cache_, num_objs ? num_objs : 1);
+    }
+    shrinking_ = false;
+
+    return freed;
+}
+
+void ShrinkerRegistry::Balance()
+{
+    if(shrinking_ || suspended_ || ! UnderPressure()) {
+        return;
+    }
+
+    size_t in_use = BuddyAllocator::MemInUse();
+    size_t stride = BuddyAllocator::TotalMem() / BALANCE_STRIDE;
+    if(in_use < balanced_at_) {
+        // Memory has been freed since; count the next stride from here.
+        balanced_at_ = in_use;
+    } else if(in_use >= balanced_at_ + stride) {
+        balanced_at_ = in_use;
+        Shrink(BALANCE_PRIORITY);
+    }
+}
+
+size_t ShrinkerRegistry::Reclaim()
+{
+    for(unsigned priority = RECLAIM_PRIORITY + 1; priority-- > 0;) {
+        if(size_t freed = Shrink(priority)) {
+            return freed;
+        }
+    }
+    return 0;
+}
+
+void ShrinkerRegistry::SuspendReclaim()
+{
+    ++suspended_;
+}
+
+void ShrinkerRegistry::ResumeReclaim()
+{
+    --suspended_;
+}
@@ -0,0 +1,97 @@
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include <stddef.h>
+
+/**
+ * A cache's hooks for giving memory back under pressure. Caches are free to
+ * grow into whatever memory is spare; once free memory runs low, the
+ * allocators ask every registered cache to shed the same share of its
+ * objects.
+ */
+struct Shrinker {
+    /**
+     * @return How many objects the cache could free.
+     */
+    size_t (*count_)(void *cache);
+
+    /**
+     * Free up to num_objs objects, coldest first.
+     * @return How many objects were actually freed.
+     */
+    size_t (*scan_)(void *cache, size_t num_objs);
+
+    void *cache_;
+    // Registry link; shrinkers are threaded through themselves so that
+    // reclaiming never allocates.
+    Shrinker *next_;
+};
+
+// A namespace rather than a class for the same reason as BuddyAllocator:
+// there's exactly one registry.
+namespace ShrinkerRegistry
+{
+/**
+ * Add a shrinker to the registry. It must stay at the same address until
+ * unregistered.
+ */
+void Register(Shrinker *shrinker);
+
+void Unregister(Shrinker *shrinker);
+
+/**
+ * @return Has free physical memory fallen below the low watermark?
+ */
+bool UnderPressure();
+
+/**
+ * Ask every registered cache to free the same share of its objects.
+ * @param priority Each cache frees 1 / 2^priority of its objects, and at
+ *                 least one, so lower priorities reclaim harder.
+ * @return Number of objects freed.
+ */
+size_t Shrink(unsigned priority);
+
+/**
+ * Called by the allocators on every allocation. While memory is under
+ * pressure, trims a modest share from every cache each time a further slice
+ * of memory has been allocated, so caches shrink in step with demand rather
+ * than all at once.
+ */
+void Balance();
+
+/**
+ * Called by the allocators when an allocation is about to fail. Shrinks at
+ * increasing intensity until something is freed.
+ * @return Number of objects freed; 0 if there was nothing left to free, if
+ *         this was called from within a shrinker, or if reclaim is
+ *         suspended.
+ */
+size_t Reclaim();
+
+/**
+ * Keep Balance, Reclaim and Shrink from running any shrinker until the
+ * matching ResumeReclaim. Shrinkers evict, and eviction may allocate from or
+ * free to the kernel heap, so an allocator must suspend reclaim while it's
+ * part-way through restructuring itself and can't be re-entered. Calls nest.
+ */
+void SuspendReclaim();
+
+void ResumeReclaim();
+
+/**
+ * Build a shrinker for anything with the ds::Cache interface.
+ */
+template <typename cache_t>
+Shrinker ForCache(cache_t *cache)
+{
+    return Shrinker {
+        .count_ = [](void *c) { return ((cache_t*) c)->NumEntries(); },
+        .scan_ = [](void *c, size_t n) { return ((cache_t*) c)->Evict(n); },
+        .cache_ = cache,
+        .next_ = nullptr
+    };
+}
+}
+
+#endif